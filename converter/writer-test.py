@@ -1,7 +1,7 @@
 import sys
 import time
 import torch
-from writer import writeQuantizedQ40Tensor
+from writer import writeQuantizedQ40Tensor, writeQuantizedQ2KTensor, writeQuantizedQ3KTensor, writeQuantizedQ4KTensor, writeQuantizedQ6KTensor
 
 TEMP_FILE_NAME = 'writer-test.temp'
 
@@ -22,6 +22,25 @@ def testWriteQuantizedQ40Tensor():
     assert contentBase64 == EXPECTED_OUTPUT, f'Received: {contentBase64}'
     print('✅ writeQuantizedQ40Tensor')
 
+def testWriteQuantizedKTensors():
+    EXPECTED_Q2K_OUTPUT = 'f1d1b191716141210103040607090f0c40404041818586d6dadaebebefffffff1050506061a1b5b6f6fafafbfbffffffb8b8bdbdbdbebebebebfbfbfbfbfbfbffafafefefefefefefeffffffffffffff9d2a3c3006070806090a0b0b0c0d0e0e0f0b0c0caaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaeaeaeaeaeaeaeaeaeaeaeaeaeaeaeaeeaeaeaeaeaeaeaeaeaeaeaeaeaeaeaeafafafafafafafafafafafafafafafafa3a310000'
+    EXPECTED_Q3K_OUTPUT = '1010000000000000000000000000000000000000000000000000000000000008050505050505454545454545555595950505054545454585859595d5d5d5d5155454575757575656525251515151505056565655555151515151515050505050306498cd3477bafde4e4e4e405a5000000000000000000000000000000000000000000000000000000000000000055555555555555555555555555555555555555555555555555555555555555555555555555555555555555555555555555555555555555555555555555555555a48372504f3e1c0b01010101d32b'
+    EXPECTED_Q4K_OUTPUT = '32180c280f4fcfcf3f2f1f100f0f000f0000111122223333444455556666777788889999aaaabbbbccccddddeeeeffff00101021213232434354546565767687879899a9aababbcbccdcddedeefeffff80818192929393a4a4a5a5b6b6b7b7c8c8c9c9dadadbdbececededfefeffffffcacacacbcbcbcbcbdbdcdcdcdcdcdcddedededededeeeeeefefefefeffffffff6f1e00009adfe5e9000000000f04090fdcdcdcddddddddddddedededededeeeeeeeeeeeeeefefefeffffffffffffffffedededededededededeeeeeeeeeeeeeefefefefefefefefeffffffffffffffffeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeefefefeffffffffffffffffffffffffffeeeeeeeeeeeeeeeeeeeeeeeeeeefefefffffffffffffffffffffffffffffffff'
+    EXPECTED_Q6K_OUTPUT = '1121213232424253536363747474848511213232424253636373848494a5a5b5112132425263738393a4b4c4d5e5f5061131527292b3d3f41434456586a6c6e790a2a4a6b8bacccec0d2d5e7e9ebfdffa0b1b2b3b4c5c6c7d8d9daebecedfeffb5b6b6c7c8c8d9dadadbebecededfeffb7c8c8c9c9dadadbdbececededfefeff0000000000000000000000000000004000000000000000004040404040404040fefefefefefefefeffffffffffffffffffffffffffffffffffffffffffffffff7f6f5f4f403020100f1f2f3f4e5e6e7e2910dcdcdcddddddddeeeeeeeeeeefffffffdcdcdcddddededededeeeeeefefeffffdcddddededededeeeeeeeefefeffffffddddddddedeeeeeeeeeeeeefefffffffedededeeeeeeeeeeeeeefefeffffffffedeeeeeeeeeeeeeeeefeffffffffffffeeeeeeeeeeeeeeeeeeefefffffffffffedeeeeeeeeeeeeeeeefefeffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff2f353a3f454a4f555a5f646a6f747a7f3a16'
+
+    tensor = (torch.arange(512) - 128) / 64
+
+    for (write, expectedOutput) in [
+        (writeQuantizedQ2KTensor, EXPECTED_Q2K_OUTPUT),
+        (writeQuantizedQ3KTensor, EXPECTED_Q3K_OUTPUT),
+        (writeQuantizedQ4KTensor, EXPECTED_Q4K_OUTPUT),
+        (writeQuantizedQ6KTensor, EXPECTED_Q6K_OUTPUT)]:
+        with open(TEMP_FILE_NAME, 'wb') as file:
+            write(file, tensor)
+        contentBase64 = readBase64FromFile(TEMP_FILE_NAME)
+        assert contentBase64 == expectedOutput, f'Received: {contentBase64}'
+        print(f'✅ {write.__name__}')
+
 def runWriteQuantizedQ40TensorBenchmark():
     tensor = torch.randn(8192, 4096)
     t0 = time.time()
@@ -32,4 +51,5 @@ def runWriteQuantizedQ40TensorBenchmark():
 
 if __name__ == '__main__':
     testWriteQuantizedQ40Tensor()
+    testWriteQuantizedKTensors()
     runWriteQuantizedQ40TensorBenchmark()
@@ -8,12 +8,22 @@ class FloatType:
     F16 = 1
     Q40 = 2
     Q80 = 3
+    Q4K = 4
+    Q6K = 5
+    BF16 = 6
+    Q2K = 7
+    Q3K = 8
 
 floatTypeMap = {
     'f32': FloatType.F32,
     'f16': FloatType.F16,
     'q40': FloatType.Q40,
     'q80': FloatType.Q80,
+    'q4k': FloatType.Q4K,
+    'q6k': FloatType.Q6K,
+    'bf16': FloatType.BF16,
+    'q2k': FloatType.Q2K,
+    'q3k': FloatType.Q3K,
 }
 floatTypeNames = list(floatTypeMap.keys())
 
@@ -73,6 +83,203 @@ def writeQuantizedQ80Tensor(file, x):
         nBytes += len(buffer)
     return nBytes
 
+def roundAway(x):
+    # the same rounding as roundf in C
+    return np.sign(x) * np.floor(np.abs(x) + 0.5)
+
+def fitScaleMin(x, nMax):
+    # x: (n, size), returns scales and mins of value = scale * q - min, q in [0, nMax]
+    n = x.shape[0]
+    size = np.float32(x.shape[1])
+    xMin = np.minimum(np.min(x, axis=1), 0)
+    xMax = np.max(x, axis=1)
+    xRange = xMax - xMin
+    safeRange = np.where(xRange > 0, xRange, 1).astype(np.float32)
+    bestScale = (xRange / nMax).astype(np.float32)
+    bestMin = xMin.astype(np.float32)
+    bestError = np.full(n, np.inf, dtype=np.float32)
+    sumX = np.sum(x, axis=1)
+    for step in range(0, 21):
+        iScale = np.float32(nMax - 1.0 + 0.1 * step) / safeRange
+        q = np.clip(roundAway(iScale[:, np.newaxis] * (x - xMin[:, np.newaxis])), 0, nMax).astype(np.float32)
+        sumL = np.sum(q, axis=1)
+        sumL2 = np.sum(q * q, axis=1)
+        sumXL = np.sum(q * x, axis=1)
+        det = size * sumL2 - sumL * sumL
+        safeDet = np.where(det > 0, det, 1)
+        scale = (size * sumXL - sumX * sumL) / safeDet
+        m = (sumL2 * sumX - sumL * sumXL) / safeDet
+        positive = m > 0
+        m = np.where(positive, 0, m)
+        scale = np.where(positive, sumXL / np.where(sumL2 > 0, sumL2, 1), scale)
+        error = np.sum((scale[:, np.newaxis] * q + m[:, np.newaxis] - x) ** 2, axis=1)
+        better = (det > 0) & (error < bestError)
+        bestError = np.where(better, error, bestError)
+        bestScale = np.where(better, scale, bestScale)
+        bestMin = np.where(better, m, bestMin)
+    flat = xRange == 0
+    bestScale = np.where(flat, 0, bestScale)
+    bestMin = np.where(flat, xMin, bestMin)
+    return bestScale.astype(np.float32), (0 - bestMin).astype(np.float32)
+
+def fitScale(x, nMax):
+    # x: (n, size), returns scales of value = scale * q, q in [-nMax, nMax - 1]
+    n = x.shape[0]
+    maxIndex = np.argmax(np.abs(x), axis=1)
+    xMax = x[np.arange(n), maxIndex]
+    safeMax = np.where(xMax != 0, xMax, 1).astype(np.float32)
+    bestScale = (xMax / np.float32(-nMax)).astype(np.float32)
+    bestError = np.full(n, np.inf, dtype=np.float32)
+    for step in range(-9, 10):
+        iScale = -np.float32(nMax + 0.1 * step) / safeMax
+        q = np.clip(roundAway(iScale[:, np.newaxis] * x), -nMax, nMax - 1).astype(np.float32)
+        sumXL = np.sum(x * q, axis=1)
+        sumL2 = np.sum(q * q, axis=1)
+        scale = sumXL / np.where(sumL2 > 0, sumL2, 1)
+        error = np.sum((scale[:, np.newaxis] * q - x) ** 2, axis=1)
+        better = (sumL2 > 0) & (error < bestError)
+        bestError = np.where(better, error, bestError)
+        bestScale = np.where(better, scale, bestScale)
+    return np.where(xMax != 0, bestScale, 0).astype(np.float32)
+
+def packQ2Bits(q):
+    # q: (nBlocks, 256), the bits 2j of the byte l of a 128 value chunk hold the value 32j + l
+    q = q.reshape(q.shape[0], 2, 4, 32)
+    return (q[:, :, 0] | (q[:, :, 1] << 2) | (q[:, :, 2] << 4) | (q[:, :, 3] << 6)).reshape(q.shape[0], 64)
+
+def writeQuantizedQ2KTensor(file, x):
+    # 256 values per block: 16 bytes of 4-bit scales and mins, 64 bytes of 2-bit quants, f16 d, f16 dmin
+    x = x.to(torch.float32).numpy().astype(np.float32)
+    blockSize = 256
+    assert(x.shape[0] % blockSize == 0)
+    nBlocks = x.shape[0] // blockSize
+    groups = x.reshape(nBlocks * 16, 16)
+    scales, mins = fitScaleMin(groups, 3)
+    scales = np.maximum(scales, 0).reshape(nBlocks, 16)
+    mins = mins.reshape(nBlocks, 16)
+    d16 = (np.max(scales, axis=1) / 15).astype(np.float16)
+    dmin16 = (np.max(mins, axis=1) / 15).astype(np.float16)
+    dq = d16.astype(np.float32)[:, np.newaxis]
+    dminq = dmin16.astype(np.float32)[:, np.newaxis]
+    sc = np.where(dq > 0, np.minimum(15, roundAway(scales / np.where(dq > 0, dq, 1))), 0).astype(np.uint8)
+    m = np.where(dminq > 0, np.minimum(15, roundAway(mins / np.where(dminq > 0, dminq, 1))), 0).astype(np.uint8)
+
+    s = (dq * sc)[:, :, np.newaxis]
+    o = (dminq * m)[:, :, np.newaxis]
+    v = np.where(s > 0, roundAway((groups.reshape(nBlocks, 16, 16) + o) / np.where(s > 0, s, 1)), 0)
+    q = np.clip(v, 0, 3).astype(np.uint8).reshape(nBlocks, 256)
+
+    blocks = np.concatenate([
+        sc | (m << 4),
+        packQ2Bits(q),
+        d16.view(np.uint8).reshape(nBlocks, 2),
+        dmin16.view(np.uint8).reshape(nBlocks, 2)], axis=1)
+    buffer = blocks.tobytes()
+    file.write(buffer)
+    return len(buffer)
+
+def writeQuantizedQ3KTensor(file, x):
+    # 256 values per block: 32 bytes of high bits, 64 bytes of low 2 bits, 12 bytes of 6-bit scales, f16 d
+    x = x.to(torch.float32).numpy().astype(np.float32)
+    blockSize = 256
+    assert(x.shape[0] % blockSize == 0)
+    nBlocks = x.shape[0] // blockSize
+    groups = x.reshape(nBlocks * 16, 16)
+    scales = fitScale(groups, 4).reshape(nBlocks, 16)
+    maxScale = scales[np.arange(nBlocks), np.argmax(np.abs(scales), axis=1)]
+    d16 = (maxScale / np.float32(-32)).astype(np.float16)
+    dq = d16.astype(np.float32)[:, np.newaxis]
+    l = np.where(dq != 0, np.clip(roundAway(scales / np.where(dq != 0, dq, 1)), -32, 31), 0).astype(np.float32)
+    sc = (l + 32).astype(np.uint8)
+
+    s = (dq * l)[:, :, np.newaxis]
+    v = np.where(s != 0, roundAway(groups.reshape(nBlocks, 16, 16) / np.where(s != 0, s, 1)), 0)
+    q = (np.clip(v, -4, 3) + 4).astype(np.uint8).reshape(nBlocks, 256)
+
+    packedScales = np.zeros((nBlocks, 12), dtype=np.uint8)
+    packedScales[:, 0:8] = (sc[:, 0:8] & 0xF) | ((sc[:, 8:16] & 0xF) << 4)
+    high = (sc >> 4).reshape(nBlocks, 4, 4)
+    packedScales[:, 8:12] = high[:, 0] | (high[:, 1] << 2) | (high[:, 2] << 4) | (high[:, 3] << 6)
+    hbits = (q >> 2).reshape(nBlocks, 8, 32)
+    hmask = np.zeros((nBlocks, 32), dtype=np.uint8)
+    for j in range(0, 8):
+        hmask |= hbits[:, j] << j
+
+    blocks = np.concatenate([
+        hmask,
+        packQ2Bits(q & 3),
+        packedScales,
+        d16.view(np.uint8).reshape(nBlocks, 2)], axis=1)
+    buffer = blocks.tobytes()
+    file.write(buffer)
+    return len(buffer)
+
+def writeQuantizedQ4KTensor(file, x):
+    # 256 values per block: f16 d, f16 dmin, 12 bytes of 6-bit scales and mins, 128 bytes of nibbles
+    x = x.to(torch.float32).numpy().astype(np.float32)
+    blockSize = 256
+    assert(x.shape[0] % blockSize == 0)
+    nBlocks = x.shape[0] // blockSize
+    groups = x.reshape(nBlocks * 8, 32)
+    scales, mins = fitScaleMin(groups, 15)
+    scales = np.maximum(scales, 0).reshape(nBlocks, 8)
+    mins = mins.reshape(nBlocks, 8)
+    d16 = (np.max(scales, axis=1) / 63).astype(np.float16)
+    dmin16 = (np.max(mins, axis=1) / 63).astype(np.float16)
+    dq = d16.astype(np.float32)[:, np.newaxis]
+    dminq = dmin16.astype(np.float32)[:, np.newaxis]
+    sc = np.where(dq > 0, np.minimum(63, roundAway(scales / np.where(dq > 0, dq, 1))), 0).astype(np.uint8)
+    m = np.where(dminq > 0, np.minimum(63, roundAway(mins / np.where(dminq > 0, dminq, 1))), 0).astype(np.uint8)
+
+    packedScales = np.empty((nBlocks, 12), dtype=np.uint8)
+    packedScales[:, 0:4] = sc[:, 0:4] | ((sc[:, 4:8] >> 4) << 6)
+    packedScales[:, 4:8] = m[:, 0:4] | ((m[:, 4:8] >> 4) << 6)
+    packedScales[:, 8:12] = (sc[:, 4:8] & 0xF) | ((m[:, 4:8] & 0xF) << 4)
+
+    s = (dq * sc)[:, :, np.newaxis]
+    o = (dminq * m)[:, :, np.newaxis]
+    v = np.where(s > 0, roundAway((groups.reshape(nBlocks, 8, 32) + o) / np.where(s > 0, s, 1)), 0)
+    q = np.clip(v, 0, 15).astype(np.uint8).reshape(nBlocks, 4, 2, 32)
+    qs = (q[:, :, 0, :] | (q[:, :, 1, :] << 4)).reshape(nBlocks, 128)
+
+    blocks = np.concatenate([
+        d16.view(np.uint8).reshape(nBlocks, 2),
+        dmin16.view(np.uint8).reshape(nBlocks, 2),
+        packedScales,
+        qs], axis=1)
+    buffer = blocks.tobytes()
+    file.write(buffer)
+    return len(buffer)
+
+def writeQuantizedQ6KTensor(file, x):
+    # 256 values per block: 128 bytes of low 4 bits, 64 bytes of high 2 bits, 16 int8 scales, f16 d
+    x = x.to(torch.float32).numpy().astype(np.float32)
+    blockSize = 256
+    assert(x.shape[0] % blockSize == 0)
+    nBlocks = x.shape[0] // blockSize
+    groups = x.reshape(nBlocks, 16, 16)
+    scales = np.max(np.abs(groups), axis=2) / np.float32(31)
+    d16 = (np.max(scales, axis=1) / 127).astype(np.float16)
+    dq = d16.astype(np.float32)[:, np.newaxis]
+    sc = np.where(dq > 0, np.minimum(127, roundAway(scales / np.where(dq > 0, dq, 1))), 0).astype(np.int8)
+    s = (dq * sc)[:, :, np.newaxis]
+    v = np.where(s > 0, roundAway(groups / np.where(s > 0, s, 1)), 0)
+    q = (np.clip(v, -32, 31) + 32).astype(np.uint8).reshape(nBlocks, 2, 4, 32)
+
+    ql = np.empty((nBlocks, 2, 64), dtype=np.uint8)
+    ql[:, :, 0:32] = (q[:, :, 0] & 0xF) | ((q[:, :, 2] & 0xF) << 4)
+    ql[:, :, 32:64] = (q[:, :, 1] & 0xF) | ((q[:, :, 3] & 0xF) << 4)
+    qh = (q[:, :, 0] >> 4) | ((q[:, :, 1] >> 4) << 2) | ((q[:, :, 2] >> 4) << 4) | ((q[:, :, 3] >> 4) << 6)
+
+    blocks = np.concatenate([
+        ql.reshape(nBlocks, 128),
+        qh.reshape(nBlocks, 64),
+        sc.view(np.uint8),
+        d16.view(np.uint8).reshape(nBlocks, 2)], axis=1)
+    buffer = blocks.tobytes()
+    file.write(buffer)
+    return len(buffer)
+
 def writeF32Tensor(file, d):
     chunkSize = 10000
     nBytes = 0
@@ -89,18 +296,35 @@ def writeF16Tensor(file, d):
     file.write(b)
     return len(b)
 
+def writeBF16Tensor(file, d):
+    # numpy has no bfloat16, the raw 16 bits are written
+    d = d.to(torch.bfloat16).view(torch.int16).numpy()
+    b = d.astype(np.int16).tobytes()
+    file.write(b)
+    return len(b)
+
 def writeTensor(file, tensor, floatType):
     d = tensor.detach().cpu().view(-1)
     t0 = time.time()
     nBytes = 0
     if (floatType == FloatType.F16):
         nBytes = writeF16Tensor(file, d)
+    elif (floatType == FloatType.BF16):
+        nBytes = writeBF16Tensor(file, d)
     elif (floatType == FloatType.F32):
         nBytes = writeF32Tensor(file, d)
     elif (floatType == FloatType.Q40):
         nBytes = writeQuantizedQ40Tensor(file, d)
     elif (floatType == FloatType.Q80):
         nBytes = writeQuantizedQ80Tensor(file, d)
+    elif (floatType == FloatType.Q2K):
+        nBytes = writeQuantizedQ2KTensor(file, d)
+    elif (floatType == FloatType.Q3K):
+        nBytes = writeQuantizedQ3KTensor(file, d)
+    elif (floatType == FloatType.Q4K):
+        nBytes = writeQuantizedQ4KTensor(file, d)
+    elif (floatType == FloatType.Q6K):
+        nBytes = writeQuantizedQ6KTensor(file, d)
     else:
         raise Exception(f'Unknown float type')
     t1 = time.time()
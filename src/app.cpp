@@ -10,8 +10,13 @@
 FloatType parseFloatType(char* val) {
     if (strcmp(val, "f32") == 0) return F32;
     if (strcmp(val, "f16") == 0) return F16;
+    if (strcmp(val, "bf16") == 0) return BF16;
     if (strcmp(val, "q40") == 0) return Q40;
     if (strcmp(val, "q80") == 0) return Q80;
+    if (strcmp(val, "q2k") == 0) return Q2K;
+    if (strcmp(val, "q3k") == 0) return Q3K;
+    if (strcmp(val, "q4k") == 0) return Q4K;
+    if (strcmp(val, "q6k") == 0) return Q6K;
     printf("Invalid float type %s\n", val);
     exit(EXIT_FAILURE);
 }
@@ -35,6 +40,7 @@ AppArgs AppArgs::parse(int argc, char** argv, bool hasMode) {
     args.weightsFloatType = FUNK;
     args.bufferFloatType = F32;
     args.nWorkers = 0;
+    args.nLocalSlices = 0;
     args.port = 9990;
     args.temperature = 0.8f;
     args.topp = 0.9f;
@@ -43,6 +49,15 @@ AppArgs AppArgs::parse(int argc, char** argv, bool hasMode) {
     args.chatTemplateType = TEMPLATE_UNKNOWN;
     args.maxSeqLen = 0;
     args.useDiscForKvCache = false;
+    args.useDynamicMatmul = false;
+    args.repackWeights = true;
+    args.spinBudget = TASK_LOOP_DEFAULT_SPIN_BUDGET;
+    args.cpuList = NULL;
+    args.numa = false;
+    args.profile = false;
+    args.profileTracePath = NULL;
+    args.profileTraceTokens = 1;
+    args.kernelsLevel = KERNELS_AUTO;
 
     int i = 1;
     if (hasMode && argc > 1) {
@@ -86,6 +101,8 @@ AppArgs AppArgs::parse(int argc, char** argv, bool hasMode) {
             }
 
             i += count - 1;
+        } else if (strcmp(name, "--local-slices") == 0) {
+            args.nLocalSlices = (unsigned int)atoi(value);
         } else if (strcmp(name, "--port") == 0) {
             args.port = atoi(value);
         } else if (strcmp(name, "--nthreads") == 0) {
@@ -104,6 +121,25 @@ AppArgs AppArgs::parse(int argc, char** argv, bool hasMode) {
             args.maxSeqLen = (unsigned int)atoi(value);
         } else if (strcmp(name, "--kv-cache-storage") == 0) {
             args.useDiscForKvCache = strcmp(value, "disc") == 0;
+        } else if (strcmp(name, "--matmul-scheduling") == 0) {
+            args.useDynamicMatmul = strcmp(value, "dynamic") == 0;
+        } else if (strcmp(name, "--repack-weights") == 0) {
+            args.repackWeights = strcmp(value, "on") == 0;
+        } else if (strcmp(name, "--spin-budget") == 0) {
+            args.spinBudget = (unsigned int)atoi(value);
+        } else if (strcmp(name, "--cpu-list") == 0) {
+            args.cpuList = value;
+        } else if (strcmp(name, "--numa") == 0) {
+            args.numa = strcmp(value, "on") == 0;
+        } else if (strcmp(name, "--kernels") == 0) {
+            args.kernelsLevel = parseKernelsLevel(value);
+        } else if (strcmp(name, "--profile") == 0) {
+            args.profile = strcmp(value, "on") == 0;
+        } else if (strcmp(name, "--profile-trace") == 0) {
+            args.profile = true;
+            args.profileTracePath = value;
+        } else if (strcmp(name, "--profile-trace-tokens") == 0) {
+            args.profileTraceTokens = (unsigned int)atoi(value);
         } else {
             printf("Unknown option %s\n", name);
             exit(EXIT_FAILURE);
@@ -120,6 +156,135 @@ TransformerArch TransformerArchFactory::create(TransformerSpec* spec) {
     exit(EXIT_FAILURE);
 }
 
+std::vector<unsigned int> App::resolveCpus(AppArgs* args, unsigned int groupIndex) {
+    std::vector<unsigned int> cpus;
+    if (args->cpuList != NULL) {
+        if (!parseCpuList(args->cpuList, &cpus)) {
+            printf("Invalid CPU list %s\n", args->cpuList);
+            exit(EXIT_FAILURE);
+        }
+        // Slices of one process take next nThreads CPUs of the list if the list is long enough
+        size_t start = groupIndex * (size_t)args->nThreads;
+        if (start + args->nThreads <= cpus.size()) {
+            cpus = std::vector<unsigned int>(cpus.begin() + start, cpus.begin() + start + args->nThreads);
+        }
+    } else if (args->numa) {
+        // Threads fill the first node before the next one, slices of one process start on next nodes
+        unsigned int nNodes = getNumaNodeCount();
+        for (unsigned int n = 0; n < nNodes && cpus.size() < (size_t)args->nThreads; n++) {
+            unsigned int node = (groupIndex + n) % nNodes;
+            std::vector<unsigned int> nodeCpus;
+            if (!getNumaNodeCpus(node, &nodeCpus)) continue;
+            for (unsigned int i = 0; i < nodeCpus.size() && cpus.size() < (size_t)args->nThreads; i++) {
+                cpus.push_back(nodeCpus[i]);
+            }
+        }
+    }
+    return cpus;
+}
+
+void App::bindToNumaNodes(AppArgs* args, Transformer* transformer, const std::vector<unsigned int>& cpus) {
+    if (!args->numa || cpus.size() == 0) return;
+    if (getNumaNodeCount() < 2) {
+        printf("📌 Single NUMA node, weights are not moved\n");
+        return;
+    }
+    if (transformer->bindToNumaNodes(args->nThreads, cpus)) {
+        printf("📌 Weights are moved to NUMA nodes of threads\n");
+    } else {
+        printf("🚧 Cannot move all weights to NUMA nodes\n");
+    }
+}
+
+void App::work(AppArgs* args, Socket* socket, unsigned int groupIndex) {
+    TransformerConfig config;
+    config.useDiscForKvCache = args->useDiscForKvCache;
+    config.useDynamicMatmul = args->useDynamicMatmul;
+    config.repackWeights = args->repackWeights;
+
+    std::vector<unsigned int> cpus = resolveCpus(args, groupIndex);
+    if (cpus.size() > 0) {
+        // Weights are allocated by this thread, so they land on its node
+        pinThreadToCpu(NULL, cpus[0]);
+    }
+
+    TransformerSpec spec;
+    Transformer transformer = Transformer::loadSlice(&spec, &config, socket);
+    TransformerArch arch = TransformerArchFactory::create(&spec);
+    arch.compile(&spec, &config);
+
+    Worker worker = Worker(&arch, args->nThreads, &transformer, socket);
+    worker.setSpinBudget(args->spinBudget);
+    if (cpus.size() > 0) {
+        if (!worker.setCpus(cpus)) {
+            printf("🚧 Cannot pin threads to CPUs\n");
+        }
+        bindToNumaNodes(args, &transformer, cpus);
+    }
+    worker.work();
+}
+
+struct AppLocalSlice {
+    AppArgs* args;
+    Socket* socket;
+    unsigned int groupIndex;
+    dl_thread handler;
+};
+
+static void* localSliceHandler(void* arg) {
+    AppLocalSlice* slice = (AppLocalSlice*)arg;
+    try {
+        App::work(slice->args, slice->socket, slice->groupIndex);
+    } catch (ReadSocketException& e) {
+        // The root closed the pipe
+    } catch (WriteSocketException& e) {
+    }
+    delete slice->socket;
+    return 0;
+}
+
+// Owns the socket pool of App::run. Local slices read their pipes until the pool is closed, so the pool is
+// closed and their threads are joined before it's deleted, also when App::run throws
+class AppLocalSlices {
+private:
+    SocketPool* socketPool;
+    std::vector<AppLocalSlice> slices;
+    unsigned int nStarted;
+public:
+    AppLocalSlices(SocketPool* socketPool, unsigned int nSlices) : slices(nSlices) {
+        this->socketPool = socketPool;
+        nStarted = 0;
+    }
+
+    ~AppLocalSlices() {
+        socketPool->closeLocal();
+        for (unsigned int i = 0; i < nStarted; i++) {
+            pthread_join(slices[i].handler, NULL);
+        }
+        delete socketPool;
+    }
+
+    void start(AppArgs* args) {
+        for (unsigned int i = 0; i < slices.size(); i++) {
+            AppLocalSlice* slice = &slices[i];
+            slice->args = args;
+            slice->socket = socketPool->acceptLocal(args->nWorkers + i);
+            slice->groupIndex = i + 1;
+            int result = pthread_create(&slice->handler, NULL, (thread_func_t)localSliceHandler, (void*)slice);
+            if (result != 0) {
+                delete slice->socket;
+                throw std::runtime_error("Cannot create a thread of a local slice");
+            }
+            nStarted++;
+        }
+    }
+};
+
+void App::selectKernels(AppArgs* args) {
+    setKernelsLevel(args->kernelsLevel);
+    printf("💡 kernels: %s\n", getKernelsLevelName(getKernels()->level));
+}
+
 void App::run(AppArgs* args, void (*program)(Inference* inference, SocketPool* socketPool, Tokenizer* tokenizer, Sampler* sampler, AppArgs* args, TransformerSpec* spec)) {
     if (args->modelPath == NULL) {
         throw std::runtime_error("Model is required");
@@ -127,29 +292,48 @@ void App::run(AppArgs* args, void (*program)(Inference* inference, SocketPool* s
     if (args->tokenizerPath == NULL) {
         throw std::runtime_error("Tokenizer is required");
     }
+    selectKernels(args);
+
+    SocketPool* socketPool = SocketPool::connect(args->nWorkers, args->workerHosts, args->workerPorts, args->nLocalSlices);
+    unsigned int nSlices = args->nWorkers + args->nLocalSlices + 1;
 
-    SocketPool* socketPool = SocketPool::connect(args->nWorkers, args->workerHosts, args->workerPorts);
-    unsigned int nSlices = args->nWorkers + 1;
+    // Declared before all objects that may throw, so it's destroyed last
+    AppLocalSlices localSlices(socketPool, args->nLocalSlices);
+    // Local slices read weights while the root loads them, so they start before the root
+    localSlices.start(args);
 
     TransformerSpec spec = Transformer::loadSpecFromFile(args->modelPath, nSlices, args->maxSeqLen, args->weightsFloatType, args->bufferFloatType);
+    TransformerConfig config;
+    config.useDiscForKvCache = args->useDiscForKvCache;
+    config.useDynamicMatmul = args->useDynamicMatmul;
+    config.repackWeights = args->repackWeights;
+
     TransformerArch arch = TransformerArchFactory::create(&spec);
+    arch.compile(&spec, &config);
     Tokenizer tokenizer(args->tokenizerPath, spec.vocabSize);
 
     if (args->steps == 0 || args->steps > spec.seqLen) {
         args->steps = spec.seqLen;
     }
 
-    TransformerConfig config;
-    config.useDiscForKvCache = args->useDiscForKvCache;
-
     Transformer transformer = Transformer::loadRootFromFile(args->modelPath, &spec, &config, socketPool);
     socketPool->setTurbo(true);
 
     Inference inference = Inference(&arch, args->nThreads, &transformer, socketPool);
+    inference.setSpinBudget(args->spinBudget);
+    std::vector<unsigned int> cpus = resolveCpus(args);
+    if (cpus.size() > 0) {
+        if (!inference.setCpus(cpus)) {
+            printf("🚧 Cannot pin threads to CPUs\n");
+        }
+        bindToNumaNodes(args, &transformer, cpus);
+    }
+    if (args->profile) {
+        inference.enableProfiler(args->profileTracePath, args->profileTraceTokens);
+    }
 
     Sampler sampler(spec.vocabSize, args->temperature, args->topp, args->seed);
+    sampler.setNThreads(args->nThreads);
 
     program(&inference, socketPool, &tokenizer, &sampler, args, &spec);
-
-    delete socketPool;
 }
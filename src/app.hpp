@@ -2,6 +2,7 @@
 #define APP_HPP
 
 #include "quants.hpp"
+#include "kernels.hpp"
 #include "transformer.hpp"
 #include "utils.hpp"
 #include "utils.hpp"
@@ -18,6 +19,15 @@ public:
     char* mode;
     int nThreads;
     bool useDiscForKvCache;
+    bool useDynamicMatmul;
+    bool repackWeights;
+    unsigned int spinBudget;
+    char* cpuList;
+    bool numa;
+    bool profile;
+    char* profileTracePath;
+    unsigned int profileTraceTokens;
+    KernelsLevel kernelsLevel;
 
     // inference
     char* modelPath;
@@ -26,6 +36,7 @@ public:
     FloatType weightsFloatType;
     FloatType bufferFloatType;
     int nWorkers;
+    unsigned int nLocalSlices;
     char** workerHosts;
     int* workerPorts;
     float temperature;
@@ -49,6 +60,13 @@ public:
 
 class App {
 public:
+    // Returns CPUs for TaskLoop threads of the slice executed in this process, empty if threads are not pinned
+    static std::vector<unsigned int> resolveCpus(AppArgs* args, unsigned int groupIndex = 0);
+    // Must be called before the transformer is loaded, commands resolve kernels when they are created
+    static void selectKernels(AppArgs* args);
+    static void bindToNumaNodes(AppArgs* args, Transformer* transformer, const std::vector<unsigned int>& cpus);
+    // Loads a slice sent by the root and executes it until the socket is closed
+    static void work(AppArgs* args, Socket* socket, unsigned int groupIndex);
     static void run(AppArgs* args, void (*program)(Inference* inference, SocketPool* socketPool, Tokenizer* tokenizer, Sampler* sampler, AppArgs* args, TransformerSpec* spec));
 };
 
@@ -294,36 +294,37 @@ public:
         int token = promptTokens[0];
         pos_t pos = startPos;
         for (; pos < maxPos; pos++) {
-            float* logits = inference->infer(token, pos);
-
             if (pos < promptEndPos - 1) {
+                inference->inferWithoutLogits(token, pos);
                 token = promptTokens[pos - startPos + 1];
-            } else {
-                int prevToken = token;
-                token = sampler->sample(logits);
+                continue;
+            }
+            float* logits = inference->infer(token, pos);
 
-                char* piece = tokenizer->decode(prevToken, token);
-                bool isSafe = isSafePiece(piece);
+            int prevToken = token;
+            token = sampler->sample(logits);
 
-                EosDetectorType eosType = eosDetector->append(token, isSafe ? piece : "");
+            char* piece = tokenizer->decode(prevToken, token);
+            bool isSafe = isSafePiece(piece);
 
-                if (isSafePiece(piece)) {
-                    printf("%s", piece);
-                    fflush(stdout);
-                }
+            EosDetectorType eosType = eosDetector->append(token, isSafe ? piece : "");
+
+            if (isSafePiece(piece)) {
+                printf("%s", piece);
+                fflush(stdout);
+            }
 
-                if (eosType == NOT_EOS || eosType == EOS) {
-                    char* delta = eosDetector->getDelta();
-                    if (delta != NULL) {
-                        std::string deltaStr(delta);
-                        if (params.stream)
-                            writeChatCompletionChunk(request, deltaStr, false);
-                        buffer += deltaStr;
-                    }
-                    eosDetector->clear();
+            if (eosType == NOT_EOS || eosType == EOS) {
+                char* delta = eosDetector->getDelta();
+                if (delta != NULL) {
+                    std::string deltaStr(delta);
+                    if (params.stream)
+                        writeChatCompletionChunk(request, deltaStr, false);
+                    buffer += deltaStr;
                 }
-                if (eosType == EOS) break;
+                eosDetector->clear();
             }
+            if (eosType == EOS) break;
         }
 
         ChatMessage chatMessage("assistant", buffer);
@@ -344,6 +345,9 @@ public:
             request.writeJson(chatJson);
         }
         printf("🔶\n");
+        if (args->profile) {
+            inference->printProfile();
+        }
         fflush(stdout);
     }
 
@@ -42,15 +42,23 @@ void generate(Inference* inference, SocketPool* socketPool, Tokenizer *tokenizer
     unsigned long totalGenerationTime = 0;
     unsigned long totalInferenceTime = 0;
     unsigned long totalTransferTime = 0;
+    unsigned long totalPromptTime = 0;
     while (pos < args->steps) {
         unsigned long startTime = timeMs();
-        float* logits = inference->infer(token, pos);
+        // Logits of prompt tokens except the last one are not sampled
+        bool isPromptToken = pos < numPromptTokens - 1;
+        float* logits = NULL;
+        if (isPromptToken) {
+            inference->inferWithoutLogits(token, pos);
+        } else {
+            logits = inference->infer(token, pos);
+        }
 
         inference->getStats(&inferenceTime, &transferTime);
         socketPool->getStats(&sentBytes, &recvBytes);
 
         // advance the state machine
-        if (pos < numPromptTokens - 1) {
+        if (isPromptToken) {
             // if we are still processing the input prompt, force the next prompt token
             next = promptTokens[pos + 1];
         } else {
@@ -62,6 +70,9 @@ void generate(Inference* inference, SocketPool* socketPool, Tokenizer *tokenizer
         unsigned long generationTime = timeMs() - startTime;
 
         totalGenerationTime += generationTime;
+        if (isPromptToken) {
+            totalPromptTime += generationTime;
+        }
         totalInferenceTime += inferenceTime;
         totalTransferTime += transferTime;
 
@@ -91,6 +102,13 @@ void generate(Inference* inference, SocketPool* socketPool, Tokenizer *tokenizer
     printf("Avg generation time: %.2f ms\n", avgGenerationTime);
     printf("Avg inference time:  %.2f ms\n", totalInferenceTime / (double)pos);
     printf("Avg transfer time:   %.2f ms\n", totalTransferTime / (double)pos);
+    if (numPromptTokens > 1 && pos >= numPromptTokens) {
+        printf("Avg prompt time:     %.2f ms\n", totalPromptTime / (double)(numPromptTokens - 1));
+    }
+
+    if (args->profile) {
+        inference->printProfile();
+    }
 }
 
 size_t readStdin(const char* guide, char* buffer, size_t bufsize) {
@@ -162,7 +180,7 @@ public:
 
             pos_t userPromptEndPos = (pos_t)std::min<unsigned int>(spec->seqLen, pos + nInputTokens - 1);
             for (pos_t i = 0; pos < userPromptEndPos; pos++, i++) {
-                inference->infer(inputTokens[i], pos);
+                inference->inferWithoutLogits(inputTokens[i], pos);
                 token = inputTokens[i + 1];
             }
 
@@ -187,6 +205,10 @@ public:
             }
 
             inputPrompt.clear();
+            if (args->profile) {
+                printf("\n");
+                inference->printProfile();
+            }
         } while (pos < spec->seqLen);
 
         printf("(end of context)\n");
@@ -207,17 +229,10 @@ void worker(AppArgs* args) {
         throw std::runtime_error("Invalid port number");
     }
 
-    TransformerConfig config;
-    config.useDiscForKvCache = args->useDiscForKvCache;
-
+    App::selectKernels(args);
     SocketServer server(args->port);
     Socket socket = server.accept();
-    TransformerSpec spec;
-    Transformer transformer = Transformer::loadSlice(&spec, &config, &socket);
-    TransformerArch arch = TransformerArchFactory::create(&spec);
-
-    Worker worker = Worker(&arch, args->nThreads, &transformer, &socket);
-    worker.work();
+    App::work(args, &socket, 0);
 }
 
 int main(int argc, char *argv[]) {
@@ -1,4 +1,5 @@
 #include "commands.hpp"
+#include "utils.hpp"
 #include <cmath>
 #include <cstdio>
 #include <cstring>
@@ -78,7 +79,184 @@ void testRopeSlice(int arch, const int nSliceTests, const int nPosTests, const i
     printf("✅ ropeSlice (arch=%d)\n", arch);
 }
 
+void testMatmulForwardBatch(const FloatType weightsFloatType, const FloatType inputFloatType, const bool isRepacked) {
+    const unsigned int n = 256;
+    const unsigned int d = 22;
+    const unsigned int nTokens = 6;
+    const unsigned int nThreads = 2;
+    unsigned long long state = 800000010L;
+
+    const size_t weightsBytes = getBatchBytes(weightsFloatType, n, d);
+    char* weights = new char[weightsBytes];
+    float* w = new float[n * d];
+    for (unsigned int i = 0; i < n * d; i++) w[i] = randomF32(&state) / 127.0f;
+    if (weightsFloatType == F32) memcpy(weights, w, weightsBytes);
+    if (weightsFloatType == F16) quantizeF16Row(w, (uint16_t*)weights, n * d, 1, 0);
+    if (weightsFloatType == Q40) for (size_t i = 0; i < weightsBytes; i++) weights[i] = randomU32(&state) & 0x3F;
+
+    const size_t inputBytes = getBatchBytes(inputFloatType, n, 1);
+    char* inputs = new char[inputBytes * nTokens];
+    float* x = new float[n * nTokens];
+    for (unsigned int i = 0; i < n * nTokens; i++) x[i] = randomF32(&state) / 127.0f;
+    if (inputFloatType == F32) memcpy(inputs, x, inputBytes * nTokens);
+    if (inputFloatType == Q80) quantizeQ80Row(x, (BlockQ80*)inputs, n * nTokens, 1, 0);
+
+    MatmulCommand mm(n, d, inputFloatType, weightsFloatType);
+    mm.setRepacked(isRepacked);
+    mm.loadWeights(weights);
+
+    float* outputs = new float[d * nTokens];
+    float* expected = new float[d * nTokens];
+    for (unsigned int threadIndex = 0; threadIndex < nThreads; threadIndex++) {
+        for (unsigned int t = 0; t < nTokens; t++)
+            mm.forward(&inputs[t * inputBytes], &expected[t * d], nThreads, threadIndex);
+        mm.forwardBatch(inputs, nTokens, outputs, nThreads, threadIndex);
+    }
+    for (unsigned int i = 0; i < d * nTokens; i++) {
+        if (fabs(outputs[i] - expected[i]) > 0.0001) {
+            printf("❌ matmul forwardBatch %d/%d (repacked=%d) ix=%d %f != %f\n", weightsFloatType, inputFloatType, isRepacked, i, outputs[i], expected[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    printf("✅ matmul forwardBatch %d/%d (repacked=%d)\n", weightsFloatType, inputFloatType, isRepacked);
+
+    delete[] weights;
+    delete[] w;
+    delete[] inputs;
+    delete[] x;
+    delete[] outputs;
+    delete[] expected;
+}
+
+void testMatmulForwardGated(const FloatType weightsFloatType, const FloatType inputFloatType, const FloatType outputFloatType, const bool isRepacked) {
+    const unsigned int n = 256;
+    const unsigned int d = 96;
+    const unsigned int nThreads = 2;
+    unsigned long long state = 800000010L;
+
+    const size_t weightsBytes = getBatchBytes(weightsFloatType, n, d);
+    char* weights[2];
+    for (int m = 0; m < 2; m++) {
+        weights[m] = new char[weightsBytes];
+        if (weightsFloatType == F32) for (unsigned int i = 0; i < n * d; i++) ((float*)weights[m])[i] = randomF32(&state) / 127.0f;
+        if (weightsFloatType == Q40) for (size_t i = 0; i < weightsBytes; i++) weights[m][i] = randomU32(&state) & 0x3F;
+    }
+
+    const size_t inputBytes = getBatchBytes(inputFloatType, n, 1);
+    char* input = new char[inputBytes];
+    float* x = new float[n];
+    for (unsigned int i = 0; i < n; i++) x[i] = randomF32(&state) / 127.0f;
+    if (inputFloatType == F32) memcpy(input, x, inputBytes);
+    if (inputFloatType == Q80) quantizeQ80Row(x, (BlockQ80*)input, n, 1, 0);
+
+    MatmulCommand gate(n, d, inputFloatType, weightsFloatType);
+    MatmulCommand up(n, d, inputFloatType, weightsFloatType);
+    gate.setRepacked(isRepacked);
+    up.setRepacked(isRepacked);
+    gate.loadWeights(weights[0]);
+    up.loadWeights(weights[1]);
+
+    float* g = new float[d];
+    float* u = new float[d];
+    const size_t outputBytes = getBatchBytes(outputFloatType, d, 1);
+    char* output = new char[outputBytes];
+    char* expected = new char[outputBytes];
+    for (unsigned int threadIndex = 0; threadIndex < nThreads; threadIndex++) {
+        gate.forward(input, g, nThreads, threadIndex);
+        up.forward(input, u, nThreads, threadIndex);
+        gate.forwardGated(&up, silu, input, output, outputFloatType, nThreads, threadIndex);
+    }
+    silu(g, d, 1, 0);
+    mul(g, u, d, 1, 0);
+    quantizeRow(outputFloatType, g, expected, 0, d);
+
+    if (memcmp(output, expected, outputBytes) != 0) {
+        printf("❌ matmul forwardGated %d/%d/%d (repacked=%d)\n", weightsFloatType, inputFloatType, outputFloatType, isRepacked);
+        exit(EXIT_FAILURE);
+    }
+    printf("✅ matmul forwardGated %d/%d/%d (repacked=%d)\n", weightsFloatType, inputFloatType, outputFloatType, isRepacked);
+
+    delete[] weights[0];
+    delete[] weights[1];
+    delete[] input;
+    delete[] x;
+    delete[] g;
+    delete[] u;
+    delete[] output;
+    delete[] expected;
+}
+
+void testMatmulSlices(const FloatType weightsFloatType) {
+    // Row slices compute parts of the output, column slices compute parts of the sums
+    const unsigned int n = QKK * 4;
+    const unsigned int d = 16;
+    const unsigned int nSlices = 2;
+    const unsigned int nThreads = 1;
+    unsigned long long state = 800000010L;
+
+    float* w = new float[n * d];
+    float x[n];
+    for (unsigned int i = 0; i < n * d; i++) w[i] = (randomF32(&state) - 0.5f) / 127.0f;
+    for (unsigned int i = 0; i < n; i++) x[i] = randomF32(&state) - 0.5f;
+    char* weights = new char[getBatchBytes(weightsFloatType, n, d)];
+    if (weightsFloatType == Q2K) quantizeQ2KRow(w, (BlockQ2K*)weights, n * d);
+    if (weightsFloatType == Q3K) quantizeQ3KRow(w, (BlockQ3K*)weights, n * d);
+    if (weightsFloatType == Q4K) quantizeQ4KRow(w, (BlockQ4K*)weights, n * d);
+    if (weightsFloatType == Q80) quantizeQ80Row(w, (BlockQ80*)weights, n * d, 1, 0);
+    BlockQ80 xQ80[n / QK80];
+    quantizeQ80Row(x, xQ80, n, 1, 0);
+
+    float expected[d];
+    MatmulCommand mm(n, d, Q80, weightsFloatType);
+    mm.loadWeights(weights);
+    mm.forward(xQ80, expected, nThreads, 0);
+
+    float rowOutput[d];
+    float colOutput[d];
+    for (unsigned int i = 0; i < d; i++) colOutput[i] = 0.0f;
+    for (slice_index_t sliceIndex = 0; sliceIndex < nSlices; sliceIndex++) {
+        RowMatmulSlice rowSlice(weightsFloatType, nSlices, n, d);
+        char* rowWeights = new char[rowSlice.sliceBytes];
+        rowSlice.splitWeights(sliceIndex, weights, rowWeights);
+        MatmulCommand rowMm(n, rowSlice.d0, Q80, weightsFloatType);
+        rowMm.loadWeights(rowWeights);
+        rowMm.forward(xQ80, &rowOutput[rowSlice.dOffset(sliceIndex)], nThreads, 0);
+        delete[] rowWeights;
+
+        ColMatmulSlice colSlice(weightsFloatType, nSlices, n, d);
+        char* colWeights = new char[colSlice.sliceBytes];
+        colSlice.splitWeights(sliceIndex, weights, colWeights);
+        MatmulCommand colMm(colSlice.n0, d, Q80, weightsFloatType);
+        colMm.loadWeights(colWeights);
+        float output[d];
+        colMm.forward(&xQ80[sliceIndex * colSlice.n0 / QK80], output, nThreads, 0);
+        for (unsigned int i = 0; i < d; i++) colOutput[i] += output[i];
+        delete[] colWeights;
+    }
+    for (unsigned int i = 0; i < d; i++) {
+        if (rowOutput[i] != expected[i] || fabs(colOutput[i] - expected[i]) > 0.0001) {
+            printf("❌ matmul slices %d ix=%d %f, %f != %f\n", weightsFloatType, i, rowOutput[i], colOutput[i], expected[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    printf("✅ matmul slices %d\n", weightsFloatType);
+
+    delete[] w;
+    delete[] weights;
+}
+
 int main() {
+    testMatmulForwardBatch(F32, F32, false);
+    testMatmulForwardBatch(F16, F32, false);
+    testMatmulForwardBatch(Q40, Q80, false);
+    testMatmulForwardBatch(Q40, Q80, true);
+    testMatmulForwardGated(F32, F32, F32, false);
+    testMatmulForwardGated(Q40, Q80, Q80, false);
+    testMatmulForwardGated(Q40, Q80, Q80, true);
+    testMatmulSlices(Q80);
+    testMatmulSlices(Q2K);
+    testMatmulSlices(Q3K);
+    testMatmulSlices(Q4K);
     testRopeSlice(2, 4, 6, 3);
     testRopeSlice(1, 6, 4, 3);
     return 0;
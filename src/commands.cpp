@@ -112,7 +112,13 @@ MatmulCommand::MatmulCommand(const unsigned int n, const unsigned int d, const F
     this->d = d;
     this->inputFloatType = inputFloatType;
     this->weightsFloatType = weightsFloatType;
+    this->kernel = getMatmulKernel(weightsFloatType, inputFloatType, true);
+    this->batchKernel = getMatmulBatchKernel(weightsFloatType, inputFloatType);
     this->cpuSize = getBatchBytes(weightsFloatType, n, d);
+    this->isDynamic = false;
+    this->isTiled = true;
+    this->isRepacked = false;
+    this->cursor.value.exchange(0);
 #if ALLOC_MEMORY
     this->cpuWeights = newBuffer(this->cpuSize);
 #endif
@@ -126,15 +132,111 @@ MatmulCommand::~MatmulCommand() {
 
 size_t MatmulCommand::loadWeights(const void* source) {
 #if ALLOC_MEMORY
-    memcpy(cpuWeights, source, cpuSize);
+    if (isRepacked) {
+        packQ40((const BlockQ40*)source, (BlockQ40x4*)cpuWeights, n, d);
+    } else {
+        memcpy(cpuWeights, source, cpuSize);
+    }
 #else
     cpuWeights = (void*)source;
 #endif
     return cpuSize;
 }
 
+bool MatmulCommand::bindToNumaNodes(const unsigned int nThreads, const int* threadNodes) {
+    bool ok = true;
+    for (unsigned int threadIndex = 0; threadIndex < nThreads; threadIndex++) {
+        if (threadNodes[threadIndex] < 0) continue;
+        // The same split as in matmul()
+        SPLIT_RANGE_TO_THREADS(ds, de, 0, d, nThreads, threadIndex);
+        if (isRepacked) {
+            // A tile shared by two threads stays on the node of the second one
+            const size_t tileBytes = getPackedQ40Bytes(n, Q40_PACKED_ROWS);
+            const unsigned int ts = ds / Q40_PACKED_ROWS;
+            const unsigned int te = (de + Q40_PACKED_ROWS - 1) / Q40_PACKED_ROWS;
+            ok &= bindBufferToNumaNode((char*)cpuWeights + ts * tileBytes, (te - ts) * tileBytes, (unsigned int)threadNodes[threadIndex]);
+            continue;
+        }
+        const size_t rowBytes = getBatchBytes(weightsFloatType, n, 1);
+        ok &= bindBufferToNumaNode((char*)cpuWeights + ds * rowBytes, (de - ds) * rowBytes, (unsigned int)threadNodes[threadIndex]);
+    }
+    return ok;
+}
+
+void MatmulCommand::setDynamic(bool isDynamic) {
+    this->isDynamic = isDynamic;
+}
+
+void MatmulCommand::setTiled(bool isTiled) {
+    this->isTiled = isTiled;
+    if (!isRepacked) {
+        this->kernel = getMatmulKernel(weightsFloatType, inputFloatType, isTiled);
+    }
+}
+
+void MatmulCommand::setRepacked(bool isRepacked) {
+#if ALLOC_MEMORY
+    // Only the x86 kernels have the packed layout, elsewhere the weights stay as they are
+    const MatmulKernel packedKernel = getKernels()->matmulQ40x4vQ80;
+    isRepacked = isRepacked && weightsFloatType == Q40 && inputFloatType == Q80 && packedKernel != NULL;
+    if (isRepacked == this->isRepacked) return;
+    freeBuffer(cpuWeights);
+    cpuWeights = newBuffer(isRepacked ? getPackedQ40Bytes(n, d) : cpuSize);
+    this->isRepacked = isRepacked;
+    this->kernel = isRepacked ? packedKernel : getMatmulKernel(weightsFloatType, inputFloatType, isTiled);
+    this->batchKernel = isRepacked ? NULL : getMatmulBatchKernel(weightsFloatType, inputFloatType);
+#else
+    // Weights are used directly from the source buffer
+    (void)isRepacked;
+#endif
+}
+
 void MatmulCommand::forward(const void* input, float* output, const unsigned int nThreads, const unsigned int threadIndex) {
-    matmul(weightsFloatType, inputFloatType, output, input, cpuWeights, n, d, nThreads, threadIndex);
+    if (isDynamic) {
+        unsigned int chunkSize = getMatmulChunkSize(weightsFloatType, n, d, nThreads);
+        matmulDynamic(kernel, output, input, cpuWeights, n, d, chunkSize, &cursor.value, nThreads);
+        return;
+    }
+    matmul(kernel, output, input, cpuWeights, n, d, nThreads, threadIndex);
+}
+
+void MatmulCommand::forwardBatch(const void* inputs, const unsigned int nTokens, float* outputs, const unsigned int nThreads, const unsigned int threadIndex) {
+    matmulBatch(kernel, batchKernel, outputs, inputs, getBatchBytes(inputFloatType, n, 1), cpuWeights, n, d, nTokens,
+        getMatmulBatchChunkSize(weightsFloatType, n), nThreads, threadIndex);
+}
+
+#define MATMUL_GATED_CHUNK_ROWS 64
+
+void MatmulCommand::forwardGated(MatmulCommand* up, ActivationFunc* activation, const void* input, void* output, const FloatType outputFloatType, const unsigned int nThreads, const unsigned int threadIndex) {
+    assert(up->n == n && up->d == d);
+    assert(outputFloatType != Q80 || d % QK80 == 0);
+    SPLIT_RANGE_TO_THREADS(bs, be, 0, (d + QK80 - 1) / QK80, nThreads, threadIndex);
+    const unsigned int de = be * QK80 < d ? be * QK80 : d;
+
+    float gateRows[MATMUL_GATED_CHUNK_ROWS];
+    float upRows[MATMUL_GATED_CHUNK_ROWS];
+    for (unsigned int r = bs * QK80; r < de; r += MATMUL_GATED_CHUNK_ROWS) {
+        const unsigned int nRows = de - r < MATMUL_GATED_CHUNK_ROWS ? de - r : MATMUL_GATED_CHUNK_ROWS;
+        forwardRows(input, gateRows, r, r + nRows);
+        up->forwardRows(input, upRows, r, r + nRows);
+        activation(gateRows, nRows, 1, 0);
+        mul(gateRows, upRows, nRows, 1, 0);
+        quantizeRow(outputFloatType, gateRows, output, r, nRows);
+    }
+}
+
+void MatmulCommand::forwardRows(const void* input, float* output, const unsigned int ds, const unsigned int de) {
+    MatmulThreadInfo s;
+    s.output = output;
+    s.input = input;
+    // Kernels index rows from the weights pointer, so it points to the row ds
+    s.weights = isRepacked
+        ? (const char*)cpuWeights + (ds / Q40_PACKED_ROWS) * getPackedQ40Bytes(n, Q40_PACKED_ROWS)
+        : (const char*)cpuWeights + ds * getBatchBytes(weightsFloatType, n, 1);
+    s.n = n;
+    s.ds = 0;
+    s.de = de - ds;
+    kernel(&s);
 }
 
 LlamaRopeCommand::LlamaRopeCommand(RopeSlice *slice) {
@@ -3,6 +3,9 @@
 
 #include <cstdio>
 #include "quants.hpp"
+#include "kernels.hpp"
+#include "funcs.hpp"
+#include "utils.hpp"
 
 // RESPONSIBILITIES
 //
@@ -79,15 +82,45 @@ class MatmulCommand {
 private:
     FloatType inputFloatType;
     FloatType weightsFloatType;
+    // Resolved once, so kernels selected by setKernelsLevel() must be set before the command is created
+    MatmulKernel kernel;
+    // NULL if the weights are repacked or the kernels have no batched kernel for the float types
+    MatmulBatchKernel batchKernel;
     unsigned int n;
     unsigned int d;
     size_t cpuSize;
     void* cpuWeights;
+    bool isDynamic;
+    bool isTiled;
+    bool isRepacked;
+    // The cursor of claimed row chunks doesn't share a cache line with fields read by all threads
+    char padding[TASK_LOOP_CACHE_LINE_SIZE];
+    TaskLoopCounter cursor;
 public:
     MatmulCommand(const unsigned int n, const unsigned int d, const FloatType inputFloatType, const FloatType weightsFloatType);
     ~MatmulCommand();
     size_t loadWeights(const void* source);
+    // Threads claim chunks of rows instead of the static split, a task calling forward() can't be followed
+    // by a task without a barrier then
+    void setDynamic(bool isDynamic);
+    // Tiled kernels compute several rows per pass sharing the input loads, enabled by default
+    void setTiled(bool isTiled);
+    // Packs Q40 weights into tiles of interleaved rows in loadWeights(), must be called before loadWeights().
+    // Ignored if the weights aren't Q40, the input isn't Q80 or the kernels have no packed kernel
+    void setRepacked(bool isRepacked);
+    // Moves rows computed by each thread to the NUMA node of the thread, a node < 0 leaves the rows as they are
+    bool bindToNumaNodes(const unsigned int nThreads, const int* threadNodes);
     void forward(const void* input, float* output, const unsigned int nThreads, const unsigned int threadIndex);
+    // Multiplies nTokens input vectors stored one after another, the output of the token t starts at outputs + t * d.
+    // Rows are always split statically, so the dynamic setting doesn't apply
+    void forwardBatch(const void* inputs, const unsigned int nTokens, float* outputs, const unsigned int nThreads, const unsigned int threadIndex);
+    // Gated FFN (SwiGLU, GeGLU): output = activation(this * input) * (up * input) in the output float type. Both
+    // matmuls compute the same chunk of rows and the product is converted while it's in the cache, so F32 rows are
+    // never stored. Rows are split statically in QK80 blocks, so the dynamic setting doesn't apply
+    void forwardGated(MatmulCommand* up, ActivationFunc* activation, const void* input, void* output, const FloatType outputFloatType, const unsigned int nThreads, const unsigned int threadIndex);
+private:
+    // Computes the rows [ds, de), the row ds is stored at output[0]
+    void forwardRows(const void* input, float* output, const unsigned int ds, const unsigned int de);
 };
 
 class RopeCommand {
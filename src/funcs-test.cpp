@@ -4,6 +4,12 @@
 #include <cstdlib>
 #include <cmath>
 #include <cassert>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 void testRms() {
     float x[] = {0.1f, 0.2f, 0.3f, 0.4f, 0.5f, 0.6f, 0.7f, 0.8f};
@@ -59,6 +65,914 @@ void testMatmulQ80() {
     delete[] wQ;
 }
 
+const KernelsLevel kernelsLevels[] = { KERNELS_SCALAR, KERNELS_NEON, KERNELS_NEON_DOTPROD, KERNELS_AVX2, KERNELS_AVX512, KERNELS_AVX512_BF16 };
+const unsigned int nKernelsLevels = sizeof(kernelsLevels) / sizeof(KernelsLevel);
+
+void testKernelsLevels() {
+    // Each kernels level compiled into the binary and supported by the CPU must agree with the scalar one
+    const unsigned int n = 256;
+    const unsigned int d = 24;
+    const FloatType types[][2] = { { F32, F32 }, { F16, F32 }, { F16, F16 }, { Q40, F32 }, { Q80, F32 }, { Q40, Q80 }, { Q80, Q80 },
+        { Q2K, F32 }, { Q3K, F32 }, { Q4K, F32 }, { Q6K, F32 }, { Q2K, Q80 }, { Q3K, Q80 }, { Q4K, Q80 }, { Q6K, Q80 },
+        { BF16, F32 }, { BF16, BF16 } };
+    const unsigned int nTypes = sizeof(types) / sizeof(types[0]);
+    unsigned long long state = 24242424L;
+    float x[n];
+    float w[n * d];
+    for (unsigned int i = 0; i < n; i++) x[i] = randomF32(&state) / 127.0f;
+    for (unsigned int i = 0; i < n * d; i++) w[i] = randomF32(&state) / 127.0f;
+
+    // Q40 weights are random nibbles, they don't need a quantizer
+    BlockQ40* wQ40 = new BlockQ40[n * d / QK40];
+    for (unsigned int i = 0; i < n * d / QK40; i++) {
+        wQ40[i].d = convertF32ToF16(0.01f);
+        for (unsigned int j = 0; j < QK40 / 2; j++) wQ40[i].qs[j] = randomU32(&state) & 0xFF;
+    }
+    uint16_t* wF16 = new uint16_t[n * d];
+    uint16_t xF16[n];
+    BlockQ80* wQ80 = new BlockQ80[n * d / QK80];
+    BlockQ80 xQ80[n / QK80];
+    setKernelsLevel(KERNELS_SCALAR);
+    quantizeF16Row(w, wF16, n * d, 1, 0);
+    quantizeF16Row(x, xF16, n, 1, 0);
+    quantizeQ80Row(w, wQ80, n * d, 1, 0);
+    quantizeQ80Row(x, xQ80, n, 1, 0);
+    uint16_t* wBF16 = new uint16_t[n * d];
+    uint16_t xBF16[n];
+    quantizeBF16Row(w, wBF16, n * d, 1, 0);
+    quantizeBF16Row(x, xBF16, n, 1, 0);
+    // K-quants get signed values, so mins of sub-blocks are used
+    float* wSigned = new float[n * d];
+    for (unsigned int i = 0; i < n * d; i++) wSigned[i] = w[i] - 0.5f / 127.0f;
+    BlockQ2K* wQ2K = new BlockQ2K[n * d / QKK];
+    BlockQ3K* wQ3K = new BlockQ3K[n * d / QKK];
+    BlockQ4K* wQ4K = new BlockQ4K[n * d / QKK];
+    BlockQ6K* wQ6K = new BlockQ6K[n * d / QKK];
+    quantizeQ2KRow(wSigned, wQ2K, n * d);
+    quantizeQ3KRow(wSigned, wQ3K, n * d);
+    quantizeQ4KRow(wSigned, wQ4K, n * d);
+    quantizeQ6KRow(wSigned, wQ6K, n * d);
+
+    float expected[nTypes][d];
+    float y[d];
+    for (unsigned int l = 0; l < nKernelsLevels; l++) {
+        if (!isKernelsLevelSupported(kernelsLevels[l])) continue;
+        setKernelsLevel(kernelsLevels[l]);
+
+        for (unsigned int t = 0; t < nTypes; t++) {
+            const FloatType weightsType = types[t][0];
+            const FloatType inputType = types[t][1];
+            const void* weights = weightsType == F32 ? (void*)w : weightsType == F16 ? (void*)wF16 : weightsType == Q40 ? (void*)wQ40
+                : weightsType == Q80 ? (void*)wQ80 : weightsType == Q2K ? (void*)wQ2K : weightsType == Q3K ? (void*)wQ3K
+                : weightsType == Q4K ? (void*)wQ4K : weightsType == Q6K ? (void*)wQ6K : (void*)wBF16;
+            const void* input = inputType == F32 ? (void*)x : inputType == F16 ? (void*)xF16 : inputType == BF16 ? (void*)xBF16 : (void*)xQ80;
+            matmul(weightsType, inputType, l == 0 ? expected[t] : y, input, weights, n, d, 1, 0);
+            if (l == 0) continue;
+            for (unsigned int i = 0; i < d; i++) {
+                if (fabs(expected[t][i] - y[i]) > 0.0001) {
+                    printf("❌ kernels %s, matmul %d/%d ix=%d %f != %f\n",
+                        getKernelsLevelName(kernelsLevels[l]), weightsType, inputType, i, expected[t][i], y[i]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+
+        BlockQ80 q[n / QK80];
+        uint16_t h[n];
+        uint16_t b[n];
+        quantizeQ80Row(x, q, n, 1, 0);
+        quantizeF16Row(x, h, n, 1, 0);
+        quantizeBF16Row(x, b, n, 1, 0);
+        for (unsigned int i = 0; i < n; i++) {
+            if (q[i / QK80].qs[i % QK80] != xQ80[i / QK80].qs[i % QK80] || q[i / QK80].d != xQ80[i / QK80].d || h[i] != xF16[i] || b[i] != xBF16[i]) {
+                printf("❌ kernels %s, quantization ix=%d\n", getKernelsLevelName(kernelsLevels[l]), i);
+                exit(EXIT_FAILURE);
+            }
+        }
+        printf("✅ kernels %s\n", getKernelsLevelName(kernelsLevels[l]));
+    }
+    setKernelsLevel(KERNELS_AUTO);
+
+    delete[] wQ40;
+    delete[] wF16;
+    delete[] wQ80;
+    delete[] wSigned;
+    delete[] wQ2K;
+    delete[] wQ3K;
+    delete[] wQ4K;
+    delete[] wQ6K;
+    delete[] wBF16;
+}
+
+void testMatmulKQuants() {
+    // K-quants against the dequantized weights multiplied by the dequantized input
+    const unsigned int n = QKK * 3;
+    const unsigned int d = 11;
+    unsigned long long state = 12121212L;
+    float* x = new float[n];
+    float* w = new float[n * d];
+    float* wq = new float[n * d];
+    float* xq = new float[n];
+    for (unsigned int i = 0; i < n; i++) x[i] = randomF32(&state) - 0.5f;
+    for (unsigned int i = 0; i < n * d; i++) w[i] = (randomF32(&state) - 0.4f) * 0.05f;
+    BlockQ80* xQ80 = new BlockQ80[n / QK80];
+    quantizeQ80Row(x, xQ80, n, 1, 0);
+    dequantizeQ80Row(xQ80, xq, n, 1, 0);
+    BlockQ2K* wQ2K = new BlockQ2K[n * d / QKK];
+    BlockQ3K* wQ3K = new BlockQ3K[n * d / QKK];
+    BlockQ4K* wQ4K = new BlockQ4K[n * d / QKK];
+    BlockQ6K* wQ6K = new BlockQ6K[n * d / QKK];
+    quantizeQ2KRow(w, wQ2K, n * d);
+    quantizeQ3KRow(w, wQ3K, n * d);
+    quantizeQ4KRow(w, wQ4K, n * d);
+    quantizeQ6KRow(w, wQ6K, n * d);
+    float y[d];
+
+    const FloatType types[] = { Q2K, Q3K, Q4K, Q6K };
+    for (int t = 0; t < 4; t++) {
+        const FloatType type = types[t];
+        const void* weights = type == Q2K ? (void*)wQ2K : type == Q3K ? (void*)wQ3K : type == Q4K ? (void*)wQ4K : (void*)wQ6K;
+        if (type == Q2K) dequantizeQ2KRow(wQ2K, wq, n * d);
+        else if (type == Q3K) dequantizeQ3KRow(wQ3K, wq, n * d);
+        else if (type == Q4K) dequantizeQ4KRow(wQ4K, wq, n * d);
+        else dequantizeQ6KRow(wQ6K, wq, n * d);
+        for (int inputIndex = 0; inputIndex < 2; inputIndex++) {
+            const FloatType inputType = inputIndex == 0 ? F32 : Q80;
+            for (unsigned int threadIndex = 0; threadIndex < 2; threadIndex++)
+                matmul(type, inputType, y, inputIndex == 0 ? (void*)x : (void*)xQ80, weights, n, d, 2, threadIndex);
+            for (unsigned int i = 0; i < d; i++) {
+                const float expected = dotProduct(&wq[i * n], inputIndex == 0 ? x : xq, n);
+                if (fabs(expected - y[i]) > 0.0001) {
+                    printf("❌ matmul %d/%d ix=%d %f != %f\n", type, inputType, i, expected, y[i]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+    }
+    printf("✅ matmul K-quants\n");
+
+    delete[] x;
+    delete[] w;
+    delete[] wq;
+    delete[] xq;
+    delete[] xQ80;
+    delete[] wQ2K;
+    delete[] wQ3K;
+    delete[] wQ4K;
+    delete[] wQ6K;
+}
+
+void benchmarkActivations() {
+    // The hidden dimension of Llama 3 70B
+    const unsigned int n = 28672;
+    const unsigned int nRuns = 200;
+    unsigned long long state = 6789L;
+    float* x = new float[n];
+    float* y = new float[n];
+    for (unsigned int i = 0; i < n; i++) x[i] = (randomF32(&state) - 0.5f) * 8.0f;
+    for (unsigned int l = 0; l < nKernelsLevels; l++) {
+        if (!isKernelsLevelSupported(kernelsLevels[l])) continue;
+        setKernelsLevel(kernelsLevels[l]);
+        double us[3];
+        for (int k = 0; k < 3; k++) {
+            unsigned long long ns = 0;
+            for (unsigned int r = 0; r < nRuns; r++) {
+                // Repeated calls on the same values would end up in denormals
+                memcpy(y, x, n * sizeof(float));
+                unsigned long long t0 = timeNs();
+                if (k == 0) silu(y, n, 1, 0);
+                else if (k == 1) gelu(y, n, 1, 0);
+                else softmax(y, n);
+                ns += timeNs() - t0;
+            }
+            us[k] = (double)ns / nRuns / 1000.0;
+        }
+        printf("🕒 n=%u, kernels %s: silu %.2f us, gelu %.2f us, softmax %.2f us\n",
+            n, getKernelsLevelName(kernelsLevels[l]), us[0], us[1], us[2]);
+    }
+    setKernelsLevel(KERNELS_AUTO);
+    delete[] x;
+    delete[] y;
+}
+
+void benchmarkMatmulKQuants() {
+    // 2, 3, 4 and 6-bit formats against Q40 and Q80 with the Q80 input, a Llama 3 8B layer (wq)
+    const unsigned int n = 4096;
+    const unsigned int d = 4096;
+    const FloatType weightsTypes[] = { Q2K, Q3K, Q40, Q4K, Q6K, Q80 };
+    const unsigned int nRuns = 4;
+    unsigned long long state = 6789L;
+    float* x = new float[n];
+    for (unsigned int i = 0; i < n; i++) x[i] = randomF32(&state) / 127.0f;
+    BlockQ80* xQ80 = new BlockQ80[n / QK80];
+    quantizeQ80Row(x, xQ80, n, 1, 0);
+    float* y = new float[d];
+    for (unsigned int t = 0; t < sizeof(weightsTypes) / sizeof(weightsTypes[0]); t++) {
+        const size_t weightsBytes = getBatchBytes(weightsTypes[t], n, d);
+        char* weights = (char*)newBuffer(weightsBytes);
+        for (size_t i = 0; i < weightsBytes; i++) weights[i] = randomU32(&state) & 0x3F;
+        MatmulKernel kernel = getMatmulKernel(weightsTypes[t], Q80);
+        matmul(kernel, y, xQ80, weights, n, d, 1, 0);
+        unsigned long long t0 = timeNs();
+        for (unsigned int r = 0; r < nRuns; r++) matmul(kernel, y, xQ80, weights, n, d, 1, 0);
+        const double ns = (double)(timeNs() - t0);
+        printf("🕒 matmul %d/%d %ux%u: %.2f GB/s, %.2f GOP/s\n", weightsTypes[t], Q80, n, d,
+            (double)(weightsBytes * nRuns) / ns, 2.0 * n * d * nRuns / ns);
+        freeBuffer(weights);
+    }
+    delete[] x;
+    delete[] xQ80;
+    delete[] y;
+}
+
+void testMatmulTiled() {
+    // Row counts of threads are not multiples of the tile, so the row remainder path is covered as well
+    const unsigned int n = 128;
+    const unsigned int d = 37;
+    const FloatType types[][2] = { { F32, F32 }, { Q40, Q80 }, { Q80, Q80 } };
+    unsigned long long state = 14141414L;
+    float x[n];
+    float w[n * d];
+    float y[d];
+    float yTiled[d];
+    for (unsigned int i = 0; i < n; i++) x[i] = randomF32(&state) / 127.0f;
+    for (unsigned int i = 0; i < n * d; i++) w[i] = randomF32(&state) / 127.0f;
+    BlockQ40* wQ40 = new BlockQ40[n * d / QK40];
+    for (unsigned int i = 0; i < n * d / QK40; i++) {
+        wQ40[i].d = convertF32ToF16(0.01f);
+        for (unsigned int j = 0; j < QK40 / 2; j++) wQ40[i].qs[j] = randomU32(&state) & 0xFF;
+    }
+    BlockQ80* wQ80 = new BlockQ80[n * d / QK80];
+    BlockQ80 xQ80[n / QK80];
+    quantizeQ80Row(w, wQ80, n * d, 1, 0);
+    quantizeQ80Row(x, xQ80, n, 1, 0);
+
+    for (unsigned int t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+        const void* weights = types[t][0] == F32 ? (void*)w : types[t][0] == Q40 ? (void*)wQ40 : (void*)wQ80;
+        const void* input = types[t][1] == F32 ? (void*)x : (void*)xQ80;
+        MatmulKernel kernel = getMatmulKernel(types[t][0], types[t][1], false);
+        MatmulKernel tiledKernel = getMatmulKernel(types[t][0], types[t][1], true);
+        for (unsigned int nThreads = 1; nThreads <= 3; nThreads++) {
+            for (unsigned int threadIndex = 0; threadIndex < nThreads; threadIndex++) {
+                matmul(kernel, y, input, weights, n, d, nThreads, threadIndex);
+                matmul(tiledKernel, yTiled, input, weights, n, d, nThreads, threadIndex);
+            }
+            for (unsigned int i = 0; i < d; i++) {
+                if (fabs(y[i] - yTiled[i]) > 0.0001) {
+                    printf("❌ matmul tiled %d/%d (nThreads=%d) ix=%d %f != %f\n", types[t][0], types[t][1], nThreads, i, y[i], yTiled[i]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+    }
+    printf("✅ matmul tiled\n");
+
+    delete[] wQ40;
+    delete[] wQ80;
+}
+
+void testMatmulPacked() {
+    // Scales differ per block, so a row or block mixed up by the packed layout changes the result
+    const unsigned int n = QK40 * 6;
+    const unsigned int d = 39;
+    unsigned long long state = 15151515L;
+    float x[n];
+    float y[d];
+    float yPacked[d];
+    for (unsigned int i = 0; i < n; i++) x[i] = randomF32(&state) / 127.0f;
+    BlockQ80 xQ80[n / QK80];
+    quantizeQ80Row(x, xQ80, n, 1, 0);
+    BlockQ40* w = new BlockQ40[n * d / QK40];
+    for (unsigned int i = 0; i < n * d / QK40; i++) {
+        w[i].d = convertF32ToF16(randomF32(&state) / 12700.0f);
+        for (unsigned int j = 0; j < QK40 / 2; j++) w[i].qs[j] = randomU32(&state) & 0xFF;
+    }
+    BlockQ40x4* packed = (BlockQ40x4*)newBuffer(getPackedQ40Bytes(n, d));
+    packQ40(w, packed, n, d);
+
+    for (unsigned int l = 0; l < nKernelsLevels; l++) {
+        if (!isKernelsLevelSupported(kernelsLevels[l])) continue;
+        setKernelsLevel(kernelsLevels[l]);
+        const Kernels* kernels = getKernels();
+        if (kernels->matmulQ40x4vQ80 == NULL) continue;
+
+        for (unsigned int nThreads = 1; nThreads <= 5; nThreads++) {
+            for (unsigned int threadIndex = 0; threadIndex < nThreads; threadIndex++) {
+                matmul(kernels->matmulQ40vQ80, y, xQ80, w, n, d, nThreads, threadIndex);
+                matmul(kernels->matmulQ40x4vQ80, yPacked, xQ80, packed, n, d, nThreads, threadIndex);
+            }
+            for (unsigned int i = 0; i < d; i++) {
+                if (fabs(y[i] - yPacked[i]) > 0.0001) {
+                    printf("❌ kernels %s, matmul packed (nThreads=%d) ix=%d %f != %f\n",
+                        getKernelsLevelName(kernelsLevels[l]), nThreads, i, y[i], yPacked[i]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+        printf("✅ kernels %s, matmul packed\n", getKernelsLevelName(kernelsLevels[l]));
+    }
+    setKernelsLevel(KERNELS_AUTO);
+
+    delete[] w;
+    freeBuffer(packed);
+}
+
+void testMatmulBatch() {
+    // Every type pair of each kernels level, with and without a batched kernel, against the single vector kernel.
+    // Token counts cover the remainder of token groups, the chunk size covers chunks and the row remainder.
+    const unsigned int n = 256;
+    const unsigned int d = 21;
+    const unsigned int maxTokens = 9;
+    const unsigned int chunkSize = 8;
+    const FloatType types[][2] = { { F32, F32 }, { F16, F32 }, { F16, F16 }, { Q40, F32 }, { Q80, F32 }, { Q40, Q80 }, { Q80, Q80 } };
+    unsigned long long state = 16161616L;
+    float* x = new float[n * maxTokens];
+    float* w = new float[n * d];
+    for (unsigned int i = 0; i < n * maxTokens; i++) x[i] = randomF32(&state) / 127.0f;
+    for (unsigned int i = 0; i < n * d; i++) w[i] = randomF32(&state) / 127.0f;
+    BlockQ40* wQ40 = new BlockQ40[n * d / QK40];
+    for (unsigned int i = 0; i < n * d / QK40; i++) {
+        wQ40[i].d = convertF32ToF16(0.01f);
+        for (unsigned int j = 0; j < QK40 / 2; j++) wQ40[i].qs[j] = randomU32(&state) & 0xFF;
+    }
+    uint16_t* wF16 = new uint16_t[n * d];
+    uint16_t* xF16 = new uint16_t[n * maxTokens];
+    BlockQ80* wQ80 = new BlockQ80[n * d / QK80];
+    BlockQ80* xQ80 = new BlockQ80[n * maxTokens / QK80];
+    quantizeF16Row(w, wF16, n * d, 1, 0);
+    quantizeF16Row(x, xF16, n * maxTokens, 1, 0);
+    quantizeQ80Row(w, wQ80, n * d, 1, 0);
+    quantizeQ80Row(x, xQ80, n * maxTokens, 1, 0);
+    float y[d * maxTokens];
+    float yBatch[d * maxTokens];
+
+    for (unsigned int l = 0; l < nKernelsLevels; l++) {
+        if (!isKernelsLevelSupported(kernelsLevels[l])) continue;
+        setKernelsLevel(kernelsLevels[l]);
+
+        for (unsigned int t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+            const FloatType weightsType = types[t][0];
+            const FloatType inputType = types[t][1];
+            const void* weights = weightsType == F32 ? (void*)w : weightsType == F16 ? (void*)wF16 : weightsType == Q40 ? (void*)wQ40 : (void*)wQ80;
+            const char* input = inputType == F32 ? (char*)x : inputType == F16 ? (char*)xF16 : (char*)xQ80;
+            const size_t inputBytes = getBatchBytes(inputType, n, 1);
+            MatmulKernel kernel = getMatmulKernel(weightsType, inputType);
+            MatmulBatchKernel batchKernel = getMatmulBatchKernel(weightsType, inputType);
+
+            for (unsigned int nTokens = 1; nTokens <= maxTokens; nTokens += 4) {
+                for (unsigned int nThreads = 1; nThreads <= 3; nThreads++) {
+                    for (unsigned int threadIndex = 0; threadIndex < nThreads; threadIndex++) {
+                        for (unsigned int k = 0; k < nTokens; k++)
+                            matmul(kernel, &y[k * d], input + k * inputBytes, weights, n, d, nThreads, threadIndex);
+                        matmulBatch(kernel, batchKernel, yBatch, input, inputBytes, weights, n, d, nTokens, chunkSize, nThreads, threadIndex);
+                    }
+                    for (unsigned int i = 0; i < d * nTokens; i++) {
+                        if (fabs(y[i] - yBatch[i]) > 0.0001) {
+                            printf("❌ kernels %s, matmul batch %d/%d (nTokens=%d, nThreads=%d) ix=%d %f != %f\n",
+                                getKernelsLevelName(kernelsLevels[l]), weightsType, inputType, nTokens, nThreads, i, y[i], yBatch[i]);
+                            exit(EXIT_FAILURE);
+                        }
+                    }
+                }
+            }
+        }
+        printf("✅ kernels %s, matmul batch\n", getKernelsLevelName(kernelsLevels[l]));
+    }
+    setKernelsLevel(KERNELS_AUTO);
+
+    delete[] x;
+    delete[] w;
+    delete[] wQ40;
+    delete[] wF16;
+    delete[] xF16;
+    delete[] wQ80;
+    delete[] xQ80;
+}
+
+void benchmarkMatmulBatch() {
+    // A Llama 3 8B layer (wq) multiplied by several tokens, as in the prompt processing
+    const unsigned int n = 4096;
+    const unsigned int d = 4096;
+    const unsigned int tokenCounts[] = { 1, 8, 32 };
+    const FloatType types[][2] = { { F32, F32 }, { F16, F32 }, { Q40, Q80 }, { Q80, Q80 } };
+    unsigned long long state = 8765L;
+    const unsigned int maxTokens = 32;
+    float* x = new float[n * maxTokens];
+    for (unsigned int i = 0; i < n * maxTokens; i++) x[i] = randomF32(&state) / 127.0f;
+    BlockQ80* xQ80 = new BlockQ80[n * maxTokens / QK80];
+    quantizeQ80Row(x, xQ80, n * maxTokens, 1, 0);
+    float* y = new float[d * maxTokens];
+
+    for (unsigned int t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+        const size_t weightsBytes = getBatchBytes(types[t][0], n, d);
+        char* weights = (char*)newBuffer(weightsBytes);
+        if (types[t][0] == F32) {
+            // Random bytes would give F32 denormals, these slow down the multiplication a lot
+            for (size_t i = 0; i < (size_t)n * d; i++) ((float*)weights)[i] = randomF32(&state) / 127.0f;
+        } else {
+            for (size_t i = 0; i < weightsBytes; i++) weights[i] = randomU32(&state) & 0x3F;
+        }
+        const char* input = types[t][1] == F32 ? (char*)x : (char*)xQ80;
+        const size_t inputBytes = getBatchBytes(types[t][1], n, 1);
+        MatmulKernel kernel = getMatmulKernel(types[t][0], types[t][1], true);
+        MatmulBatchKernel batchKernel = getMatmulBatchKernel(types[t][0], types[t][1]);
+        const unsigned int chunkSize = getMatmulBatchChunkSize(types[t][0], n);
+
+        for (unsigned int c = 0; c < sizeof(tokenCounts) / sizeof(tokenCounts[0]); c++) {
+            const unsigned int nTokens = tokenCounts[c];
+            const double flops = 2.0 * n * d * nTokens;
+            unsigned long long t0 = timeNs();
+            for (unsigned int k = 0; k < nTokens; k++)
+                matmul(kernel, &y[k * d], input + k * inputBytes, weights, n, d, 1, 0);
+            const double gflops = flops / (timeNs() - t0);
+            t0 = timeNs();
+            matmulBatch(kernel, batchKernel, y, input, inputBytes, weights, n, d, nTokens, chunkSize, 1, 0);
+            const double batchGflops = flops / (timeNs() - t0);
+            printf("🕒 matmul %d/%d %ux%u, %u tokens: %.2f GFLOPS, batch %.2f GFLOPS\n", types[t][0], types[t][1], n, d, nTokens, gflops, batchGflops);
+        }
+        freeBuffer(weights);
+    }
+    delete[] x;
+    delete[] xQ80;
+    delete[] y;
+}
+
+void benchmarkMatmulF32Input() {
+    // Quantized weights with F32 input, as in the classifier of Llama 3 8B (rows are capped) and the MoE router
+    const unsigned int n = 4096;
+    const unsigned int d = 8192;
+    const FloatType weightsTypes[] = { Q40, Q80 };
+    const unsigned int nRuns = 4;
+    unsigned long long state = 5678L;
+    float* x = new float[n];
+    for (unsigned int i = 0; i < n; i++) x[i] = randomF32(&state) / 127.0f;
+    float* y = new float[d];
+    for (unsigned int t = 0; t < sizeof(weightsTypes) / sizeof(weightsTypes[0]); t++) {
+        const size_t weightsBytes = getBatchBytes(weightsTypes[t], n, d);
+        char* weights = (char*)newBuffer(weightsBytes);
+        for (size_t i = 0; i < weightsBytes; i++) weights[i] = randomU32(&state) & 0x3F;
+        for (unsigned int l = 0; l < nKernelsLevels; l++) {
+            if (!isKernelsLevelSupported(kernelsLevels[l])) continue;
+            setKernelsLevel(kernelsLevels[l]);
+            MatmulKernel kernel = getMatmulKernel(weightsTypes[t], F32);
+            matmul(kernel, y, x, weights, n, d, 1, 0);
+            unsigned long long t0 = timeNs();
+            for (unsigned int r = 0; r < nRuns; r++) matmul(kernel, y, x, weights, n, d, 1, 0);
+            printf("🕒 matmul %d/%d %ux%u (%s): %.2f GB/s\n", weightsTypes[t], F32, n, d,
+                getKernelsLevelName(kernelsLevels[l]), (double)(weightsBytes * nRuns) / (timeNs() - t0));
+        }
+        freeBuffer(weights);
+    }
+    setKernelsLevel(KERNELS_AUTO);
+    delete[] x;
+    delete[] y;
+}
+
+void benchmarkMatmulTiled() {
+    // Llama 3 8B and 70B layer shapes (wq, w1, w2), rows are capped to keep the benchmark in memory
+    const unsigned int shapes[][2] = { { 4096, 4096 }, { 4096, 14336 }, { 14336, 4096 }, { 8192, 8192 }, { 8192, 28672 }, { 28672, 8192 } };
+    const FloatType types[][2] = { { F32, F32 }, { Q40, Q80 }, { Q80, Q80 } };
+    const unsigned int maxD = 2048;
+    const unsigned int nRuns = 4;
+    for (unsigned int s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        const unsigned int n = shapes[s][0];
+        const unsigned int d = shapes[s][1] < maxD ? shapes[s][1] : maxD;
+        unsigned long long state = 4321L;
+        float* x = new float[n];
+        for (unsigned int i = 0; i < n; i++) x[i] = randomF32(&state) / 127.0f;
+        BlockQ80* xQ80 = new BlockQ80[n / QK80];
+        quantizeQ80Row(x, xQ80, n, 1, 0);
+        float* y = new float[d];
+
+        for (unsigned int t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+            const size_t weightsBytes = getBatchBytes(types[t][0], n, d);
+            // Random bytes are valid weights of every type, the top bits are cleared to keep F16 scales finite
+            char* weights = (char*)newBuffer(weightsBytes);
+            for (size_t i = 0; i < weightsBytes; i++) weights[i] = randomU32(&state) & 0x3F;
+            const void* input = types[t][1] == F32 ? (void*)x : (void*)xQ80;
+
+            double gbs[2];
+            for (int tiled = 0; tiled < 2; tiled++) {
+                MatmulKernel kernel = getMatmulKernel(types[t][0], types[t][1], tiled == 1);
+                matmul(kernel, y, input, weights, n, d, 1, 0);
+                unsigned long long t0 = timeNs();
+                for (unsigned int r = 0; r < nRuns; r++) matmul(kernel, y, input, weights, n, d, 1, 0);
+                gbs[tiled] = (double)(weightsBytes * nRuns) / (timeNs() - t0);
+            }
+            printf("🕒 matmul %d/%d %ux%u: %.2f GB/s, tiled %.2f GB/s\n", types[t][0], types[t][1], n, shapes[s][1], gbs[0], gbs[1]);
+
+            MatmulKernel packedKernel = getKernels()->matmulQ40x4vQ80;
+            if (types[t][0] == Q40 && packedKernel != NULL) {
+                // Bytes of the original layout, so the rate compares with the lines above
+                BlockQ40x4* packed = (BlockQ40x4*)newBuffer(getPackedQ40Bytes(n, d));
+                packQ40((BlockQ40*)weights, packed, n, d);
+                matmul(packedKernel, y, input, packed, n, d, 1, 0);
+                unsigned long long t0 = timeNs();
+                for (unsigned int r = 0; r < nRuns; r++) matmul(packedKernel, y, input, packed, n, d, 1, 0);
+                printf("🕒 matmul %d/%d %ux%u: packed %.2f GB/s\n", types[t][0], types[t][1], n, shapes[s][1], (double)(weightsBytes * nRuns) / (timeNs() - t0));
+                freeBuffer(packed);
+            }
+            freeBuffer(weights);
+        }
+        delete[] x;
+        delete[] xQ80;
+        delete[] y;
+    }
+}
+
+float matmulQ80RowReference(const BlockQ80* w, const float* x, const BlockQ80* xQ, unsigned int nb) {
+    float sum = 0.0f;
+    for (unsigned int i = 0; i < nb; i++) {
+        float s = 0.0f;
+        for (unsigned int j = 0; j < QK80; j++) {
+            s += (float)w[i].qs[j] * (xQ == NULL ? x[i * QK80 + j] : convertF16ToF32(xQ[i].d) * (float)xQ[i].qs[j]);
+        }
+        sum += s * convertF16ToF32(w[i].d);
+    }
+    return sum;
+}
+
+void testMatmulQ80Reference() {
+    // Compares kernels with the scalar reference, an odd number of blocks and threads checks row and block tails
+    const unsigned int n = QK80 * 5;
+    const unsigned int d = 37;
+    const unsigned int nb = n / QK80;
+    unsigned long long state = 7777777L;
+    float x[n];
+    float w[n * d];
+    float y[d];
+    for (unsigned int i = 0; i < n; i++) x[i] = randomF32(&state) / 127.0f;
+    for (unsigned int i = 0; i < n * d; i++) w[i] = randomF32(&state) / 127.0f;
+
+    BlockQ80* xQ = new BlockQ80[nb];
+    BlockQ80* wQ = new BlockQ80[nb * d];
+    quantizeQ80Row(x, xQ, n, 1, 0);
+    quantizeQ80Row(w, wQ, n * d, 1, 0);
+
+    for (int inputQ80 = 0; inputQ80 < 2; inputQ80++) {
+        for (unsigned int threadIndex = 0; threadIndex < 3; threadIndex++) {
+            if (inputQ80)
+                matmul(Q80, Q80, y, xQ, wQ, n, d, 3, threadIndex);
+            else
+                matmul(Q80, F32, y, x, wQ, n, d, 3, threadIndex);
+        }
+        for (unsigned int i = 0; i < d; i++) {
+            float ref = matmulQ80RowReference(&wQ[i * nb], x, inputQ80 ? xQ : NULL, nb);
+            if (fabs(ref - y[i]) > 0.0001) {
+                printf("❌ %s reference ix=%d %f != %f\n", inputQ80 ? "matmulQ80vQ80" : "matmulQ80", i, ref, y[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    printf("✅ matmulQ80 reference\n");
+
+    delete[] xQ;
+    delete[] wQ;
+}
+
+void benchmarkMatmulQ80() {
+    // Llama 7B layer shapes: wq/wk/wv/wo, w1/w3 and w2; the scalar reference shows the kernel speedup
+    const unsigned int shapes[][2] = { { 4096, 4096 }, { 4096, 11008 }, { 11008, 4096 } };
+    const unsigned int nRuns = 3;
+    for (unsigned int s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        const unsigned int n = shapes[s][0];
+        const unsigned int d = shapes[s][1];
+        const unsigned int nb = n / QK80;
+        unsigned long long state = 1234L;
+        float* x = new float[n];
+        for (unsigned int i = 0; i < n; i++) x[i] = randomF32(&state) / 127.0f;
+        BlockQ80* xQ = new BlockQ80[nb];
+        BlockQ80* wQ = new BlockQ80[nb * d];
+        float* y = new float[d];
+        quantizeQ80Row(x, xQ, n, 1, 0);
+        for (unsigned int i = 0; i < d; i++) {
+            for (unsigned int j = 0; j < nb; j++) {
+                wQ[i * nb + j] = xQ[(j + i) % nb];
+            }
+        }
+
+        unsigned long long t0 = timeNs();
+        for (unsigned int r = 0; r < nRuns; r++) {
+            for (unsigned int i = 0; i < d; i++) y[i] = matmulQ80RowReference(&wQ[i * nb], x, xQ, nb);
+        }
+        unsigned long long t1 = timeNs();
+        double gop = 2.0 * n * d * nRuns;
+        printf("🕒 matmulQ80 %ux%u: reference %.2f GOP/s\n", n, d, gop / (t1 - t0));
+
+        for (unsigned int l = 0; l < nKernelsLevels; l++) {
+            if (!isKernelsLevelSupported(kernelsLevels[l])) continue;
+            setKernelsLevel(kernelsLevels[l]);
+            t1 = timeNs();
+            for (unsigned int r = 0; r < nRuns; r++) matmul(Q80, Q80, y, xQ, wQ, n, d, 1, 0);
+            unsigned long long t2 = timeNs();
+            for (unsigned int r = 0; r < nRuns; r++) matmul(Q80, F32, y, x, wQ, n, d, 1, 0);
+            unsigned long long t3 = timeNs();
+            printf("🕒 matmulQ80 %ux%u (%s): Q80vQ80 %.2f GOP/s, Q80vF32 %.2f GOP/s\n",
+                n, d, getKernelsLevelName(kernelsLevels[l]), gop / (t2 - t1), gop / (t3 - t2));
+        }
+        setKernelsLevel(KERNELS_AUTO);
+
+        delete[] x;
+        delete[] xQ;
+        delete[] wQ;
+        delete[] y;
+    }
+}
+
+void testMatmulF16() {
+    const unsigned int n = 264;
+    const unsigned int d = 19;
+    unsigned long long state = 16161616L;
+    float x[n];
+    uint16_t xF16[n];
+    uint16_t w[n * d];
+    float y[d];
+    float yF16[d];
+    for (unsigned int i = 0; i < n; i++) {
+        xF16[i] = convertF32ToF16(randomF32(&state));
+        x[i] = convertF16ToF32(xF16[i]);
+    }
+    for (unsigned int i = 0; i < n * d; i++) w[i] = convertF32ToF16(randomF32(&state));
+
+    matmul(F16, F32, y, x, w, n, d, 1, 0);
+    matmul(F16, F16, yF16, xF16, w, n, d, 1, 0);
+
+    for (unsigned int i = 0; i < d; i++) {
+        float ref = 0.0f;
+        for (unsigned int j = 0; j < n; j++) ref += convertF16ToF32(w[i * n + j]) * x[j];
+        if (fabs(ref - y[i]) > 0.0001 || fabs(ref - yF16[i]) > 0.0001) {
+            printf("❌ matmulF16() ix=%d %f != %f, %f\n", i, ref, y[i], yF16[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    printf("✅ matmulF16\n");
+}
+
+struct MatmulDynamicState {
+    const float* weights;
+    const float* input;
+    float* output;
+    unsigned int n;
+    unsigned int d;
+    unsigned int chunkSize;
+    std::atomic_uint cursor;
+};
+
+void matmulDynamicTask(unsigned int nThreads, unsigned int threadIndex, void* userData) {
+    MatmulDynamicState* state = (MatmulDynamicState*)userData;
+    matmulDynamic(F32, F32, state->output, state->input, state->weights, state->n, state->d, state->chunkSize, &state->cursor, nThreads);
+}
+
+void testMatmulDynamic(unsigned int nThreads) {
+    const unsigned int n = 64;
+    const unsigned int d = 1000;
+    unsigned long long state = 12345L;
+    float* x = new float[n];
+    float* w = new float[n * d];
+    float* y = new float[d];
+    float* yDynamic = new float[d];
+    for (unsigned int i = 0; i < n; i++) x[i] = randomF32(&state);
+    for (unsigned int i = 0; i < n * d; i++) w[i] = randomF32(&state);
+    matmul(F32, F32, y, x, w, n, d, 1, 0);
+
+    MatmulDynamicState dynamicState;
+    dynamicState.weights = w;
+    dynamicState.input = x;
+    dynamicState.output = yDynamic;
+    dynamicState.n = n;
+    dynamicState.d = d;
+    dynamicState.chunkSize = 7;
+    dynamicState.cursor.exchange(0);
+    TaskLoopTask tasks[] = {
+        { matmulDynamicTask, 0 },
+    };
+    TaskLoop loop(nThreads, 1, 1, tasks, &dynamicState);
+
+    // The cursor must be reset after each run
+    for (unsigned int r = 0; r < 3; r++) {
+        memset(yDynamic, 0, d * sizeof(float));
+        loop.run();
+        if (dynamicState.cursor.load() != 0) {
+            printf("❌ matmulDynamic (nThreads=%d) cursor=%d after run\n", nThreads, dynamicState.cursor.load());
+            exit(EXIT_FAILURE);
+        }
+        for (unsigned int i = 0; i < d; i++) {
+            if (y[i] != yDynamic[i]) {
+                printf("❌ matmulDynamic (nThreads=%d) ix=%d %f != %f\n", nThreads, i, y[i], yDynamic[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    printf("✅ matmulDynamic (nThreads=%d)\n", nThreads);
+
+    delete[] x;
+    delete[] w;
+    delete[] y;
+    delete[] yDynamic;
+}
+
+void testRmsnormQuantize() {
+    // Not a multiple of the chunk, so the last chunk of a thread is shorter
+    const unsigned int n = QK80 * 45;
+    unsigned long long state = 54321L;
+    float* x = new float[n];
+    float* weight = new float[n];
+    float* expected = new float[n];
+    float* f32Output = new float[n];
+    for (unsigned int i = 0; i < n; i++) {
+        x[i] = randomF32(&state) - 0.5f;
+        weight[i] = randomF32(&state) * 2.0f;
+    }
+    const float ms = rms(x, n);
+    rmsnorm(expected, x, ms, weight, n, 1, 0);
+
+    const FloatType types[] = { F32, F16, BF16, Q80 };
+    for (unsigned int t = 0; t < sizeof(types) / sizeof(FloatType); t++) {
+        const size_t bytes = getBatchBytes(types[t], n, 1);
+        char* expectedOutput = new char[bytes];
+        char* output = new char[bytes];
+        if (types[t] == F32) memcpy(expectedOutput, expected, bytes);
+        else if (types[t] == F16) quantizeF16Row(expected, (uint16_t*)expectedOutput, n, 1, 0);
+        else if (types[t] == BF16) quantizeBF16Row(expected, (uint16_t*)expectedOutput, n, 1, 0);
+        else quantizeQ80Row(expected, (BlockQ80*)expectedOutput, n, 1, 0);
+
+        for (unsigned int nThreads = 1; nThreads < 5; nThreads += 3) {
+            memset(f32Output, 0, n * sizeof(float));
+            for (unsigned int threadIndex = 0; threadIndex < nThreads; threadIndex++) {
+                rmsnormQuantize(output, types[t], f32Output, x, ms, weight, n, nThreads, threadIndex);
+            }
+            if (memcmp(output, expectedOutput, bytes) != 0 || memcmp(f32Output, expected, n * sizeof(float)) != 0) {
+                printf("❌ rmsnormQuantize() differs from rmsnorm() (type=%d, nThreads=%d)\n", types[t], nThreads);
+                exit(EXIT_FAILURE);
+            }
+        }
+        delete[] expectedOutput;
+        delete[] output;
+    }
+
+    delete[] x;
+    delete[] weight;
+    delete[] expected;
+    delete[] f32Output;
+    printf("✅ rmsnormQuantize\n");
+}
+
+void testDequantizeRow() {
+    const unsigned int n = QK80 * 24;
+    unsigned long long state = 98765L;
+    float* x = new float[n];
+    float* base = new float[n];
+    float* expected = new float[n];
+    float* output = new float[n];
+    for (unsigned int i = 0; i < n; i++) {
+        x[i] = randomF32(&state) - 0.5f;
+        base[i] = randomF32(&state) - 0.5f;
+    }
+
+    const FloatType types[] = { F32, F16, BF16, Q80 };
+    // Ranges that split Q80 blocks and the chunks of dequantizeAddRow()
+    const unsigned int ranges[][2] = { { 0, n }, { 5, 300 }, { QK80, QK80 * 9 }, { 250, n - 250 }, { 31, 2 } };
+    for (unsigned int t = 0; t < sizeof(types) / sizeof(FloatType); t++) {
+        const size_t bytes = getBatchBytes(types[t], n, 1);
+        char* input = new char[bytes];
+        quantizeRow(types[t], x, input, 0, n);
+        if (types[t] == F32) memcpy(expected, input, bytes);
+        else if (types[t] == F16) dequantizeF16Row((uint16_t*)input, expected, n, 1, 0);
+        else if (types[t] == BF16) dequantizeBF16Row((uint16_t*)input, expected, n, 1, 0);
+        else dequantizeQ80Row((BlockQ80*)input, expected, n, 1, 0);
+
+        for (unsigned int r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++) {
+            const unsigned int offset = ranges[r][0];
+            const unsigned int len = ranges[r][1];
+            dequantizeRow(types[t], input, output, offset, len);
+            if (memcmp(output, &expected[offset], len * sizeof(float)) != 0) {
+                printf("❌ dequantizeRow() (type=%d, offset=%d, n=%d)\n", types[t], offset, len);
+                exit(EXIT_FAILURE);
+            }
+            memcpy(output, base, len * sizeof(float));
+            dequantizeAddRow(types[t], input, output, offset, len);
+            for (unsigned int i = 0; i < len; i++) {
+                if (output[i] != base[i] + expected[offset + i]) {
+                    printf("❌ dequantizeAddRow() (type=%d, offset=%d, n=%d) ix=%d\n", types[t], offset, len, i);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+        delete[] input;
+    }
+
+    delete[] x;
+    delete[] base;
+    delete[] expected;
+    delete[] output;
+    printf("✅ dequantizeRow\n");
+}
+
+void testActivations() {
+    // Odd sizes and thread ranges leave scalar tails next to vectorized parts
+    const unsigned int n = 1003;
+    unsigned long long state = 12345L;
+    float* x = new float[n];
+    float* y = new float[n];
+    float* z = new float[n];
+    for (unsigned int i = 0; i < n; i++) x[i] = (randomF32(&state) - 0.5f) * 40.0f;
+    x[0] = 0.0f;
+    x[1] = -100.0f;
+    x[2] = 100.0f;
+    x[3] = 1e-4f;
+
+    for (unsigned int l = 0; l < nKernelsLevels; l++) {
+        if (!isKernelsLevelSupported(kernelsLevels[l])) continue;
+        setKernelsLevel(kernelsLevels[l]);
+        const char* name = getKernelsLevelName(kernelsLevels[l]);
+
+        for (unsigned int nThreads = 1; nThreads < 4; nThreads++) {
+            float maxSiluError = 0.0f;
+            float maxGeluError = 0.0f;
+            memcpy(y, x, n * sizeof(float));
+            memcpy(z, x, n * sizeof(float));
+            for (unsigned int threadIndex = 0; threadIndex < nThreads; threadIndex++) {
+                silu(y, n, nThreads, threadIndex);
+                gelu(z, n, nThreads, threadIndex);
+            }
+            for (unsigned int i = 0; i < n; i++) {
+                const float v = x[i];
+                const float expectedSilu = v / (1.0f + expf(-v));
+                const float expectedGelu = 0.5f * v * (1.0f + tanhf(0.79788456f * v * (1.0f + 0.044715f * v * v)));
+                maxSiluError = fmaxf(maxSiluError, fabsf(y[i] - expectedSilu) / fmaxf(1.0f, fabsf(expectedSilu)));
+                maxGeluError = fmaxf(maxGeluError, fabsf(z[i] - expectedGelu) / fmaxf(1.0f, fabsf(expectedGelu)));
+            }
+            if (maxSiluError > 1e-6f || maxGeluError > 1e-6f) {
+                printf("❌ kernels %s, silu() error %e, gelu() error %e (nThreads=%d)\n", name, maxSiluError, maxGeluError, nThreads);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        for (unsigned int size = 1; size <= n; size += 167) {
+            memcpy(y, x, size * sizeof(float));
+            softmax(y, size);
+            float maxVal = x[0];
+            for (unsigned int i = 1; i < size; i++) maxVal = fmaxf(maxVal, x[i]);
+            double sum = 0.0;
+            for (unsigned int i = 0; i < size; i++) sum += exp((double)x[i] - maxVal);
+            for (unsigned int i = 0; i < size; i++) {
+                const float expected = (float)(exp((double)x[i] - maxVal) / sum);
+                if (fabsf(y[i] - expected) > 1e-6f * fmaxf(1e-3f, expected)) {
+                    printf("❌ kernels %s, softmax(%u)[%u] = %e != %e\n", name, size, i, y[i], expected);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+
+        for (unsigned int i = 0; i < n; i++) {
+            y[i] = x[i];
+            z[i] = 0.5f + i % 7;
+        }
+        for (unsigned int threadIndex = 0; threadIndex < 3; threadIndex++) {
+            mul(y, z, n, 3, threadIndex);
+            mulScalar(y, 0.25f, n, 3, threadIndex);
+        }
+        for (unsigned int i = 0; i < n; i++) {
+            if (y[i] != x[i] * z[i] * 0.25f) {
+                printf("❌ kernels %s, mul() and mulScalar() = %f != %f\n", name, y[i], x[i] * z[i] * 0.25f);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        // The ranges of threads are not multiples of the vector width, so tails are used
+        double expectedSs = 0.0;
+        double expectedDot = 0.0;
+        double absDot = 0.0;
+        for (unsigned int i = 0; i < n; i++) {
+            expectedSs += (double)x[i] * x[i];
+            expectedDot += (double)x[i] * z[i];
+            absDot += fabs((double)x[i] * z[i]);
+        }
+        float ss = 0.0f;
+        for (unsigned int threadIndex = 0; threadIndex < 3; threadIndex++) {
+            ss += sumOfSquares(x, n, 3, threadIndex);
+            rmsnorm(y, x, 0.5f, z, n, 3, threadIndex);
+        }
+        const float dot = dotProduct(x, z, n);
+        if (fabs(ss - expectedSs) > 1e-5 * expectedSs || fabs(dot - expectedDot) > 1e-5 * absDot) {
+            printf("❌ kernels %s, sumOfSquares() = %f != %f, dotProduct() = %f != %f\n", name, ss, expectedSs, dot, expectedDot);
+            exit(EXIT_FAILURE);
+        }
+        for (unsigned int i = 0; i < n; i++) {
+            if (y[i] != z[i] * (0.5f * x[i])) {
+                printf("❌ kernels %s, rmsnorm()[%u] = %f != %f\n", name, i, y[i], z[i] * (0.5f * x[i]));
+                exit(EXIT_FAILURE);
+            }
+        }
+        printf("✅ silu, gelu, softmax, mul, rmsnorm (kernels %s)\n", name);
+    }
+    setKernelsLevel(KERNELS_AUTO);
+
+    delete[] x;
+    delete[] y;
+    delete[] z;
+}
+
 void testAdd() {
     const int n = 16;
     float a[n];
@@ -135,12 +1049,183 @@ void testSplitRangeToThreads() {
     printf("✅ SPLIT_RANGE_TO_THREADS\n");
 }
 
+struct MatmulBandwidthState {
+    const void* weights;
+    const void* input;
+    float* output;
+    unsigned int n;
+    unsigned int d;
+};
+
+void matmulBandwidthTask(unsigned int nThreads, unsigned int threadIndex, void* userData) {
+    MatmulBandwidthState* state = (MatmulBandwidthState*)userData;
+    matmul(Q80, Q80, state->output, state->input, state->weights, state->n, state->d, nThreads, threadIndex);
+}
+
+void benchmarkMatmulBandwidth() {
+    // Streams a matrix larger than caches, threads are pinned to one NUMA node and weights are bound to one node
+    const unsigned int n = 4096;
+    const unsigned int d = 8192;
+    const unsigned int nRuns = 5;
+    const size_t weightsBytes = getBatchBytes(Q80, n, d);
+    const size_t rowBytes = getBatchBytes(Q80, n, 1);
+
+    unsigned long long state = 12345678L;
+    float* row = new float[n];
+    for (unsigned int i = 0; i < n; i++) row[i] = randomF32(&state) / 127.0f;
+    char* weights = (char*)newBuffer(weightsBytes);
+    char* input = new char[rowBytes];
+    float* output = new float[d];
+    quantizeQ80Row(row, (BlockQ80*)input, n, 1, 0);
+    for (unsigned int i = 0; i < d; i++) memcpy(&weights[i * rowBytes], input, rowBytes);
+
+    MatmulBandwidthState bandwidthState = { weights, input, output, n, d };
+    TaskLoopTask tasks[] = {
+        { matmulBandwidthTask, 0 },
+    };
+
+    unsigned int nNodes = getNumaNodeCount();
+    for (unsigned int cpuNode = 0; cpuNode < nNodes; cpuNode++) {
+        std::vector<unsigned int> nodeCpus;
+        if (!getNumaNodeCpus(cpuNode, &nodeCpus)) continue;
+        std::vector<unsigned int> threadCounts;
+        for (unsigned int nThreads = 1; nThreads < nodeCpus.size(); nThreads *= 2) threadCounts.push_back(nThreads);
+        threadCounts.push_back(nodeCpus.size());
+        for (unsigned int memoryNode = 0; memoryNode < nNodes; memoryNode++) {
+            bool isBound = bindBufferToNumaNode(weights, weightsBytes, memoryNode);
+            // The remote node is measured only with all threads of the node
+            for (unsigned int c = memoryNode == cpuNode ? 0 : threadCounts.size() - 1; c < threadCounts.size(); c++) {
+                unsigned int nThreads = threadCounts[c];
+                TaskLoop loop(nThreads, 1, 1, tasks, &bandwidthState);
+                loop.setCpus(nodeCpus);
+                loop.run();
+                unsigned long long t0 = timeNs();
+                for (unsigned int r = 0; r < nRuns; r++) {
+                    loop.run();
+                }
+                unsigned long long t1 = timeNs();
+                printf("🕒 matmul bandwidth (cpuNode=%d, memoryNode=%d%s, nThreads=%d): %.1f GB/s\n",
+                    cpuNode, memoryNode, isBound ? "" : " unbound", nThreads, (double)(weightsBytes * nRuns) / (t1 - t0));
+            }
+        }
+    }
+
+    freeBuffer(weights);
+    delete[] row;
+    delete[] input;
+    delete[] output;
+}
+
+struct MatmulLatencyState {
+    MatmulBandwidthState matmul;
+    unsigned int chunkSize;
+    std::atomic_uint cursor;
+    bool isDynamic;
+};
+
+void matmulLatencyTask(unsigned int nThreads, unsigned int threadIndex, void* userData) {
+    MatmulLatencyState* state = (MatmulLatencyState*)userData;
+    MatmulBandwidthState* m = &state->matmul;
+    if (state->isDynamic) {
+        matmulDynamic(Q80, Q80, m->output, m->input, m->weights, m->n, m->d, state->chunkSize, &state->cursor, nThreads);
+    } else {
+        matmul(Q80, Q80, m->output, m->input, m->weights, m->n, m->d, nThreads, threadIndex);
+    }
+}
+
+void* matmulLatencyNoise(void* arg) {
+    // Takes a core from time to time, like other processes of a loaded machine
+    std::atomic_bool* stopped = (std::atomic_bool*)arg;
+    unsigned long long state = 1;
+    while (!stopped->load()) {
+        unsigned long long t0 = timeNs();
+        while (timeNs() - t0 < 200000) randomU32(&state);
+        std::this_thread::sleep_for(std::chrono::microseconds(800));
+    }
+    return NULL;
+}
+
+void benchmarkMatmulTailLatency(unsigned int nThreads) {
+    // Compares the static split with dynamic claiming while a noise thread competes for cores
+    const unsigned int n = 4096;
+    const unsigned int d = 1024;
+    const unsigned int nRuns = 200;
+    const size_t rowBytes = getBatchBytes(Q80, n, 1);
+
+    unsigned long long state = 87654321L;
+    float* row = new float[n];
+    for (unsigned int i = 0; i < n; i++) row[i] = randomF32(&state) / 127.0f;
+    char* weights = new char[getBatchBytes(Q80, n, d)];
+    char* input = new char[rowBytes];
+    float* output = new float[d];
+    quantizeQ80Row(row, (BlockQ80*)input, n, 1, 0);
+    for (unsigned int i = 0; i < d; i++) memcpy(&weights[i * rowBytes], input, rowBytes);
+
+    MatmulLatencyState latencyState;
+    latencyState.matmul = { weights, input, output, n, d };
+    latencyState.chunkSize = getMatmulChunkSize(Q80, n, d, nThreads);
+    latencyState.cursor.exchange(0);
+    TaskLoopTask tasks[] = {
+        { matmulLatencyTask, 0 },
+    };
+    std::vector<unsigned long long> times(nRuns);
+
+    std::atomic_bool stopped;
+    stopped.exchange(false);
+    dl_thread noiseThread;
+    pthread_create(&noiseThread, NULL, (thread_func_t)matmulLatencyNoise, (void*)&stopped);
+
+    for (int mode = 0; mode < 2; mode++) {
+        latencyState.isDynamic = mode == 1;
+        TaskLoop loop(nThreads, 1, 1, tasks, &latencyState);
+        loop.setSpinBudget(0);
+        for (unsigned int r = 0; r < nRuns; r++) {
+            unsigned long long t0 = timeNs();
+            loop.run();
+            times[r] = timeNs() - t0;
+        }
+        std::sort(times.begin(), times.end());
+        printf("🕒 matmul latency (%s, nThreads=%d): p50=%.0f us, p99=%.0f us, max=%.0f us\n",
+            latencyState.isDynamic ? "dynamic" : "static", nThreads,
+            times[nRuns / 2] / 1000.0, times[(nRuns * 99) / 100] / 1000.0, times[nRuns - 1] / 1000.0);
+    }
+
+    stopped.exchange(true);
+    pthread_join(noiseThread, NULL);
+    delete[] row;
+    delete[] weights;
+    delete[] input;
+    delete[] output;
+}
+
 int main() {
     initQuants();
 
     testRms();
     testMatmulQ80();
+    testMatmulQ80Reference();
+    testMatmulF16();
+    testKernelsLevels();
+    testMatmulTiled();
+    testMatmulKQuants();
+    testMatmulPacked();
+    testMatmulBatch();
+    testRmsnormQuantize();
+    testDequantizeRow();
+    testActivations();
     testAdd();
     testSplitRangeToThreads();
+    testMatmulDynamic(1);
+    testMatmulDynamic(4);
+
+    benchmarkActivations();
+    benchmarkMatmulQ80();
+    benchmarkMatmulF32Input();
+    benchmarkMatmulKQuants();
+    benchmarkMatmulTiled();
+    benchmarkMatmulBatch();
+    benchmarkMatmulTailLatency(4);
+    // Pins the main thread, so it goes last
+    benchmarkMatmulBandwidth();
     return EXIT_SUCCESS;
 }
\ No newline at end of file
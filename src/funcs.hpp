@@ -1,13 +1,49 @@
 #ifndef FUNCS_HPP
 #define FUNCS_HPP
 
+#include <atomic>
+#include <cstddef>
 #include "quants.hpp"
+#include "kernels.hpp"
+
+#define MATMUL_CHUNK_BYTES 65536
+#define MATMUL_MIN_CHUNKS_PER_THREAD 4
 
 void softmax(float* x, const unsigned int size);
 float rms(const float* x, const unsigned int size);
+// rms() split into a partial sum of the share of the thread and a combine step
+float sumOfSquares(const float* x, const unsigned int size, const unsigned int nThreads, const unsigned int threadIndex);
+float rmsFromSumOfSquares(float ss, const unsigned int size);
 void rmsnorm(float* o, const float* x, const float ms, const float* weight, const unsigned int size, const unsigned int nThreads, const unsigned int threadIndex);
+// Converts n values to the float type and stores them from the value `offset` of the output, an offset of Q80 output
+// must be a multiple of QK80
+void quantizeRow(const FloatType outputFloatType, float* input, void* output, const unsigned int offset, const unsigned int n);
+// Converts n values from the value `offset` of the input to F32, the offset of Q80 input may split a block
+void dequantizeRow(const FloatType inputFloatType, const void* input, float* output, const unsigned int offset, const unsigned int n);
+// dequantizeRow() that adds the values to the output instead of storing them
+void dequantizeAddRow(const FloatType inputFloatType, const void* input, float* output, const unsigned int offset, const unsigned int n);
+// rmsnorm() that converts the output to the float type in the same pass, threads split the range in QK80 blocks.
+// The F32 values are stored to f32Output too, unless it is NULL.
+void rmsnormQuantize(void* output, const FloatType outputFloatType, float* f32Output, const float* x, const float ms, const float* weight, const unsigned int size, const unsigned int nThreads, const unsigned int threadIndex);
+// Resolves the kernel of the selected kernels level, exits if the float types are not supported
+// A tiled kernel computes several rows per pass, types without a tiled kernel get the single row one
+MatmulKernel getMatmulKernel(const FloatType weightsFloatType, const FloatType inputFloatType, const bool tiled = false);
+void matmul(const MatmulKernel kernel, float* output, const void* input, const void* weights, const unsigned int n, const unsigned int d, const unsigned int nThreads, const unsigned int threadIndex);
 void matmul(const FloatType weightsFloatType, const FloatType inputFloatType, float* output, const void* input, const void* weights, const unsigned int n, const unsigned int d, const unsigned int nThreads, const unsigned int threadIndex);
+// Rows of a dynamic matmul are claimed from the cursor in chunks, so a thread that runs faster computes more rows.
+// All nThreads threads must call it, the cursor must be 0 before the call and the last thread resets it to 0.
+unsigned int getMatmulChunkSize(const FloatType weightsFloatType, const unsigned int n, const unsigned int d, const unsigned int nThreads);
+void matmulDynamic(const MatmulKernel kernel, float* output, const void* input, const void* weights, const unsigned int n, const unsigned int d, const unsigned int chunkSize, std::atomic_uint* cursor, const unsigned int nThreads);
+void matmulDynamic(const FloatType weightsFloatType, const FloatType inputFloatType, float* output, const void* input, const void* weights, const unsigned int n, const unsigned int d, const unsigned int chunkSize, std::atomic_uint* cursor, const unsigned int nThreads);
+// Returns NULL if the kernels have no batched kernel for the float types
+MatmulBatchKernel getMatmulBatchKernel(const FloatType weightsFloatType, const FloatType inputFloatType);
+unsigned int getMatmulBatchChunkSize(const FloatType weightsFloatType, const unsigned int n);
+// Multiplies nTokens input vectors of inputBytes each. Rows of the thread are computed in chunks of chunkSize rows,
+// so a chunk of weights stays in the cache for all tokens. Without a batched kernel each token runs the single vector
+// kernel on the chunk, which is the case on ARM where only the x86 kernels have batched variants.
+void matmulBatch(const MatmulKernel kernel, const MatmulBatchKernel batchKernel, float* output, const void* input, const size_t inputBytes, const void* weights, const unsigned int n, const unsigned int d, const unsigned int nTokens, const unsigned int chunkSize, const unsigned int nThreads, const unsigned int threadIndex);
 float dotProduct(const float* a, const float* b, const unsigned int size);
+typedef void (ActivationFunc)(float* t, const unsigned int n, const unsigned int nThreads, const unsigned int threadIndex);
 void gelu(float* t, const unsigned int n, const unsigned int nThreads, const unsigned int threadIndex);
 void silu(float* t, const unsigned int n, const unsigned int nThreads, const unsigned int threadIndex);
 void mul(float* output, const float* input, const unsigned int n, const unsigned int nThreads, const unsigned int threadIndex);
@@ -50,6 +50,8 @@ int main() {
 
     TransformerConfig config;
     config.useDiscForKvCache = false;
+    config.useDynamicMatmul = false;
+    config.repackWeights = false;
 
     size_t beforeBlockBytes = spec.dim * spec.vocabSize * sizeof(float);
     size_t blockBytes = 956596224;
@@ -68,28 +70,45 @@ int main() {
     transformer.pos = 0;
 
     float* x = transformer.x;
-    for (int i = 0; i < spec.dim; i++) x[i] = (randomF32(&state) / 100.0) / 78.38367176906169f;
+    float* x0 = new float[spec.dim];
+    for (int i = 0; i < spec.dim; i++) x0[i] = (randomF32(&state) / 100.0) / 78.38367176906169f;
 
     TransformerArch arch = buildGrok1Arch(&spec);
+    int skipLastNTasks = 3;
+    arch.inference.nTasks -= skipLastNTasks;
 
     int nThreads = 4;
     TransformerContext context;
     context.transformer = &transformer;
-    context.currentBlockIndex = 0;
     context.socket = NULL;
     context.socketPool = &socketPool;
+    TaskLoopReduction reduction(nThreads, TASK_REDUCTION_N_VALUES);
+    context.reduction = &reduction;
 
-    int skipLastNTasks = 4;
-    TaskLoop loop(nThreads, arch.inference.nTasks - skipLastNTasks, TASK_N_TYPES, arch.inference.tasks, &context);
-    long t0 = timeMs();
-    loop.run();
-    long t1 = timeMs();
+    // The first pass executes all tasks, the second one executes compiled tasks, the third one claims matmul rows dynamically
+    for (int pass = 0; pass < 3; pass++) {
+        if (pass == 2) {
+            config.useDynamicMatmul = true;
+            transformer.setDynamicMatmul(true);
+        }
+        if (pass >= 1) {
+            arch.compile(&spec, &config);
+        }
+        memcpy(x, x0, spec.dim * sizeof(float));
+        context.currentBlockIndex = 0;
 
-    freeBuffer(weights);
+        TaskLoop loop(nThreads, arch.inference.nTasks, TASK_N_TYPES, arch.inference.tasks, &context);
+        long t0 = timeMs();
+        loop.run();
+        long t1 = timeMs();
 
-    compare(&x[0], expectedOutput_0_4, 4);
-    compare(&x[256], expectedOutput_256_260, 4);
-    compare(&x[5012], expectedOutput_5012_5016, 4);
+        compare(&x[0], expectedOutput_0_4, 4);
+        compare(&x[256], expectedOutput_256_260, 4);
+        compare(&x[5012], expectedOutput_5012_5016, 4);
 
-    printf("✅ Block forwarded correctly in %ldms\n", t1 - t0);
+        printf("✅ Block forwarded correctly in %ldms (%s)\n", t1 - t0, pass == 0 ? "all tasks" : pass == 1 ? "compiled tasks" : "dynamic matmuls");
+    }
+
+    delete[] x0;
+    freeBuffer(weights);
 }
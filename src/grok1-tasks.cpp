@@ -15,22 +15,20 @@ void grokMulInput(TASK_ARGS) {
 
 void grokRmfFfn(TASK_ARGS) {
     TASK_VARIABLES;
-    if (threadIndex == 0) {
-        float* xb2 = (float*)transformer->buffer->getUnit(TB_SLICED_XB2);
-        memset(xb2, 0, spec->dim * sizeof(float));
-        for (uint8_t s = 0; s < spec->nSlices; s++) {
-            float* xbv = (float*)transformer->buffer->getSliced(TB_SLICED_XBV, s);
-            add(xb2, xbv, spec->dim, 1, 0);
-        }
-        transformer->rms = rms(xb2, spec->dim);
-    }
+    float* xb2 = (float*)transformer->buffer->getUnit(TB_SLICED_XB2);
+    SPLIT_RANGE_TO_THREADS(start, end, 0, spec->dim, nThreads, threadIndex);
+    memset(&xb2[start], 0, (end - start) * sizeof(float));
+    mergeSlicedBuffer(nThreads, threadIndex, ctx, TB_SLICED_XBV, TB_SLICED_XBV_QUANTIZED, xb2);
+    ctx->reduction->get(threadIndex)[TASK_REDUCTION_XB2_RMS] = sumOfSquares(xb2, spec->dim, nThreads, threadIndex);
 }
 
 void grokRmfFfnNorm(TASK_ARGS) {
     TASK_VARIABLES;
     float* xb2 = (float*)transformer->buffer->getUnit(TB_SLICED_XB2);
 
-    rmsnorm(xb2, xb2, transformer->rms, block->rmsFfn, spec->dim, nThreads, threadIndex);
+    float ms = rmsFromSumOfSquares(ctx->reduction->sum(TASK_REDUCTION_XB2_RMS), spec->dim);
+
+    rmsnorm(xb2, xb2, ms, block->rmsFfn, spec->dim, nThreads, threadIndex);
 }
 
 void grokRmfFfnNormJoin(TASK_ARGS) {
@@ -42,15 +40,16 @@ void grokRmfFfnNormJoin(TASK_ARGS) {
 
 void grokMoeRms(TASK_ARGS) {
     TASK_VARIABLES;
-    if (threadIndex == 0) {
-        transformer->rms = rms(transformer->x, spec->dim);
-    }
+    ctx->reduction->get(threadIndex)[TASK_REDUCTION_X_RMS] = sumOfSquares(transformer->x, spec->dim, nThreads, threadIndex);
 }
 
 void grokMoeRmsNorm(TASK_ARGS) {
     TASK_VARIABLES;
+    // The router reads xb in F32, the experts read xbq
     float* xb = (float*)transformer->buffer->getUnit(TB_UNIT_XB);
-    rmsnorm(xb, transformer->x, transformer->rms, block->rmsMoe, spec->dim, nThreads, threadIndex);
+    void* xbq = transformer->buffer->getUnit(TB_UNIT_XB_QUANTIZED);
+    float ms = rmsFromSumOfSquares(ctx->reduction->sum(TASK_REDUCTION_X_RMS), spec->dim);
+    rmsnormQuantize(xbq, spec->bufferFloatType, xb, transformer->x, ms, block->rmsMoe, spec->dim, nThreads, threadIndex);
 }
 
 void grokMoeRouter(TASK_ARGS) {
@@ -113,11 +112,6 @@ void grokMoeNormWeights(TASK_ARGS) {
     }
 }
 
-void grokQuantizeMoeInput(TASK_ARGS) {
-    TASK_VARIABLES;
-    quantizeUnitBuffer(nThreads, threadIndex, ctx, TB_UNIT_XB, TB_UNIT_XB_QUANTIZED);
-}
-
 void grokSyncMoeInput(TASK_ARGS) {
     TASK_VARIABLES;
     syncUnitBuffer(nThreads, threadIndex, ctx, TB_UNIT_XB_QUANTIZED);
@@ -129,44 +123,18 @@ void grokMoeBlock0(TASK_ARGS) {
     TASK_VARIABLES;
 
     uint8_t* indexes = (uint8_t*)transformer->buffer->getUnit(TB_UNIT_MOE_INDEXES);
-    float* xb = (float*)transformer->buffer->getUnit(TB_UNIT_XB_QUANTIZED);
-    float* hb = (float*)transformer->buffer->getSliced(TB_SLICED_HB, transformer->sliceIndex);
+    void* xbq = transformer->buffer->getUnit(TB_UNIT_XB_QUANTIZED);
+    char* hbq = (char*)transformer->buffer->getSliced(TB_SLICED_HB_QUANTIZED, transformer->sliceIndex);
+    const unsigned int d0 = block->moeUpAndGate0Slice->d0;
+    const size_t expertBytes = getBatchBytes(spec->bufferFloatType, d0, 1);
 
     for (int ae = 0; ae < spec->nActiveExperts; ae++) {
         uint8_t e = indexes[ae];
-
-        float* expertUp = &hb[block->moeUpAndGate0Slice->d0 * ae];
-        float* expertGate = &block->expertGate[block->moeUpAndGate0Slice->d0 * ae];
-
-        block->moeUpMm[e]->forward(xb, expertUp, nThreads, threadIndex);
-        block->moeGateMm[e]->forward(xb, expertGate, nThreads, threadIndex);
-    }
-}
-
-void grokMoeBlock1(TASK_ARGS) {
-    TASK_VARIABLES;
-    float* hb = (float*)transformer->buffer->getSliced(TB_SLICED_HB, transformer->sliceIndex);
-
-    for (int ae = 0; ae < spec->nActiveExperts; ae++) {
-        float* expertUp = &hb[block->moeUpAndGate0Slice->d0 * ae];
-        float* expertGate = &block->expertGate[block->moeUpAndGate0Slice->d0 * ae];
-
-        if (spec->hiddenAct == SILU) {
-            silu(expertGate, block->moeUpAndGate0Slice->d0, nThreads, threadIndex);
-        } else if (spec->hiddenAct == GELU) {
-            gelu(expertGate, block->moeUpAndGate0Slice->d0, nThreads, threadIndex);
-        } else {
-            assert(false);
-        }
-        mul(expertUp, expertGate, block->moeUpAndGate0Slice->d0, nThreads, threadIndex);
+        // The gate and up rows of the expert are written only in the buffer float type
+        block->moeGateMm[e]->forwardGated(block->moeUpMm[e], getHiddenActivation(spec), xbq, &hbq[expertBytes * ae], spec->bufferFloatType, nThreads, threadIndex);
     }
 }
 
-void grokQuantizeMoeMul(TASK_ARGS) {
-    TASK_VARIABLES;
-    quantizeSlicedBuffer(nThreads, threadIndex, ctx, true, TB_SLICED_HB, TB_SLICED_HB_QUANTIZED);
-}
-
 void grokSyncMoeMulA(TASK_ARGS) {
     TASK_VARIABLES;
     syncSliceOfSlicedBuffer(nThreads, threadIndex, ctx, TB_SLICED_HB_QUANTIZED);
@@ -209,18 +177,27 @@ void grokMoeBlock2(TASK_ARGS) {
     size_t rowBytes = getBatchBytes(spec->bufferFloatType, spec->hiddenDim, 1);
 
     uint8_t* indexes = (uint8_t*)transformer->buffer->getUnit(TB_UNIT_MOE_INDEXES);
-    float* weights = (float*)transformer->buffer->getUnit(TB_UNIT_MOE_WEIGHTS);
 
     for (int ae = 0; ae < spec->nActiveExperts; ae++) {
         uint8_t e = indexes[ae];
-        float weight = weights[ae];
 
         char* expertUp = &hbq[rowBytes * ae];
         float* expertDown = ae == 0 ? xb2 : &block->expertDown[block->moeDown0Slice->d0 * (ae - 1)];
 
         block->moeDownMm[e]->forward(expertUp, expertDown, nThreads, threadIndex);
+    }
+}
+
+void grokMoeBlock3(TASK_ARGS) {
+    TASK_VARIABLES;
+
+    float* xb2 = (float*)transformer->buffer->getSliced(TB_SLICED_XB2, transformer->sliceIndex);
+    float* weights = (float*)transformer->buffer->getUnit(TB_UNIT_MOE_WEIGHTS);
 
-        mulScalar(expertDown, weight, block->moeDown0Slice->d0, nThreads, threadIndex);
+    for (int ae = 0; ae < spec->nActiveExperts; ae++) {
+        float* expertDown = ae == 0 ? xb2 : &block->expertDown[block->moeDown0Slice->d0 * (ae - 1)];
+
+        mulScalar(expertDown, weights[ae], block->moeDown0Slice->d0, nThreads, threadIndex);
         if (ae > 0) {
             add(xb2, expertDown, block->moeDown0Slice->d0, nThreads, threadIndex);
         }
@@ -237,23 +214,24 @@ void grokSyncMoeOutput(TASK_ARGS) {
     syncSliceOfSlicedBuffer(nThreads, threadIndex, ctx, TB_SLICED_XB2_QUANTIZED);
 }
 
-void grokDequantizeMoeOutput(TASK_ARGS) {
-    TASK_VARIABLES;
-    dequantizeSlicedBuffer(nThreads, threadIndex, ctx, false, TB_SLICED_XB2_QUANTIZED, TB_SLICED_XB2);
-}
-
 void grokMoeRmsFinal(TASK_ARGS) {
     TASK_VARIABLES;
+    // Serial, the same thread dequantizes the slices of workers, so the rms needs no barrier after them
     if (threadIndex == 0) {
         float* xb2 = (float*)transformer->buffer->getUnit(TB_SLICED_XB2);
-        transformer->rms = rms(xb2, spec->dim);
+        joinSlicedBuffer(1, 0, ctx, TB_SLICED_XB2, TB_SLICED_XB2_QUANTIZED, xb2, false);
+        ctx->reduction->get(0)[TASK_REDUCTION_XB2_RMS] = sumOfSquares(xb2, spec->dim, 1, 0);
+        for (unsigned int t = 1; t < ctx->reduction->nThreads; t++) {
+            ctx->reduction->get(t)[TASK_REDUCTION_XB2_RMS] = 0.0f;
+        }
     }
 }
 
 void grokMoeRmsNormFinal(TASK_ARGS) {
     TASK_VARIABLES;
     float* xb2 = (float*)transformer->buffer->getUnit(TB_SLICED_XB2);
-    rmsnorm(xb2, xb2, transformer->rms, block->rmsFfn2, spec->dim, nThreads, threadIndex);
+    float ms = rmsFromSumOfSquares(ctx->reduction->sum(TASK_REDUCTION_XB2_RMS), spec->dim);
+    rmsnorm(xb2, xb2, ms, block->rmsFfn2, spec->dim, nThreads, threadIndex);
 }
 
 void grokMoeAdd(TASK_ARGS) {
@@ -277,77 +255,75 @@ TransformerArch buildGrok1Arch(TransformerSpec* spec) {
 
     // inference
 
-    a.I(sendPos, TASK_TYPE_TRANSFER);
-    a.I(grokMulInput, TASK_TYPE_INFERENCE);
+    a.I(sendPos, "sendPos", TASK_TYPE_TRANSFER, TASK_HINT_SYNC | TASK_HINT_ASYNC);
+    a.I(grokMulInput, "grokMulInput", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN | TASK_HINT_DIM_OUT);
+    a.I(llamaRmsAtt, "llamaRmsAtt", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN);
     for (int i = 0; i < spec->nLayers; i++) {
-        a.I(llamaRmsAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaRmsAttNorm, TASK_TYPE_INFERENCE);
-        a.I(llamaQuantizeRmsAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaSyncRmsAtt, TASK_TYPE_TRANSFER);
-        a.I(llamaQkv, TASK_TYPE_INFERENCE);
-        a.I(llamaRope, TASK_TYPE_INFERENCE);
-        a.I(llamaMultiheadAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaQuantizeMultiheadAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaQuantizeAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaSyncAtt, TASK_TYPE_TRANSFER);
-        a.I(llamaDequantizeAtt, TASK_TYPE_INFERENCE);
-        a.I(grokRmfFfn, TASK_TYPE_INFERENCE);
-        a.I(grokRmfFfnNorm, TASK_TYPE_INFERENCE);
-        a.I(grokRmfFfnNormJoin, TASK_TYPE_INFERENCE);
-
-        a.I(grokMoeRms, TASK_TYPE_INFERENCE);
-        a.I(grokMoeRmsNorm, TASK_TYPE_INFERENCE);
-        a.I(grokMoeRouter, TASK_TYPE_INFERENCE);
-        a.I(grokMoeRouterSoftmax, TASK_TYPE_INFERENCE);
-        a.I(grokMoeTopk, TASK_TYPE_INFERENCE);
-        a.I(grokMoeNormWeights, TASK_TYPE_INFERENCE);
-        a.I(grokQuantizeMoeInput, TASK_TYPE_INFERENCE);
-        a.I(grokSyncMoeInput, TASK_TYPE_TRANSFER);
-        a.I(grokMoeBlock0, TASK_TYPE_INFERENCE);
-        a.I(grokMoeBlock1, TASK_TYPE_INFERENCE);
-        a.I(grokQuantizeMoeMul, TASK_TYPE_INFERENCE);
-        a.I(grokSyncMoeMulA, TASK_TYPE_INFERENCE);
-        a.I(grokSyncMoeMulRearrange, TASK_TYPE_INFERENCE);
-        a.I(grokSyncMoeMulB, TASK_TYPE_INFERENCE);
-        a.I(grokMoeBlock2, TASK_TYPE_INFERENCE);
-        a.I(grokQuantizeMoeOutput, TASK_TYPE_INFERENCE);
-        a.I(grokSyncMoeOutput, TASK_TYPE_TRANSFER);
-        a.I(grokDequantizeMoeOutput, TASK_TYPE_INFERENCE);
-        a.I(grokMoeRmsFinal, TASK_TYPE_INFERENCE);
-        a.I(grokMoeRmsNormFinal, TASK_TYPE_INFERENCE);
-        a.I(grokMoeAdd, TASK_TYPE_INFERENCE);
-        a.I(llamaNextBlock, TASK_TYPE_INFERENCE);
+        a.I(llamaRmsAttNorm, "llamaRmsAttNorm", TASK_TYPE_INFERENCE);
+        a.I(llamaSyncRmsAtt, "llamaSyncRmsAtt", TASK_TYPE_TRANSFER, TASK_HINT_SYNC | TASK_HINT_ASYNC);
+        a.I(llamaQkv, "llamaQkv", TASK_TYPE_INFERENCE, TASK_HINT_MATMUL);
+        a.I(llamaRope, "llamaRope", TASK_TYPE_INFERENCE);
+        a.I(llamaMultiheadAtt, "llamaMultiheadAtt", TASK_TYPE_INFERENCE, TASK_HINT_AWAIT);
+        a.I(llamaSyncAtt, "llamaSyncAtt", TASK_TYPE_TRANSFER, TASK_HINT_SYNC | TASK_HINT_ASYNC);
+        a.I(llamaQuantizeMultiheadAtt, "llamaQuantizeMultiheadAtt", TASK_TYPE_INFERENCE, TASK_HINT_QUANTIZE);
+        a.I(llamaAtt, "llamaAtt", TASK_TYPE_INFERENCE, TASK_HINT_DIM_OUT | TASK_HINT_MATMUL);
+        a.I(llamaQuantizeAtt, "llamaQuantizeAtt", TASK_TYPE_INFERENCE, TASK_HINT_QUANTIZE | TASK_HINT_WORKER_ONLY);
+        a.I(grokRmfFfn, "grokRmfFfn", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN | TASK_HINT_AWAIT);
+        a.I(grokRmfFfnNorm, "grokRmfFfnNorm", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN | TASK_HINT_DIM_OUT);
+        a.I(grokRmfFfnNormJoin, "grokRmfFfnNormJoin", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN | TASK_HINT_DIM_OUT);
+
+        a.I(grokMoeRms, "grokMoeRms", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN);
+        a.I(grokMoeRmsNorm, "grokMoeRmsNorm", TASK_TYPE_INFERENCE);
+        a.I(grokMoeRouter, "grokMoeRouter", TASK_TYPE_INFERENCE, TASK_HINT_MATMUL);
+        a.I(grokMoeRouterSoftmax, "grokMoeRouterSoftmax", TASK_TYPE_INFERENCE, TASK_HINT_SERIAL);
+        a.I(grokMoeTopk, "grokMoeTopk", TASK_TYPE_INFERENCE, TASK_HINT_SERIAL);
+        a.I(grokMoeNormWeights, "grokMoeNormWeights", TASK_TYPE_INFERENCE, TASK_HINT_SERIAL);
+        a.I(grokSyncMoeInput, "grokSyncMoeInput", TASK_TYPE_TRANSFER, TASK_HINT_SYNC | TASK_HINT_ASYNC);
+        a.I(grokSyncMoeMulA, "grokSyncMoeMulA", TASK_TYPE_TRANSFER, TASK_HINT_SYNC | TASK_HINT_ASYNC);
+        a.I(grokMoeBlock0, "grokMoeBlock0", TASK_TYPE_INFERENCE);
+        a.I(grokSyncMoeMulRearrange, "grokSyncMoeMulRearrange", TASK_TYPE_INFERENCE, TASK_HINT_SERIAL | TASK_HINT_SYNC | TASK_HINT_AWAIT);
+        a.I(grokSyncMoeMulB, "grokSyncMoeMulB", TASK_TYPE_TRANSFER, TASK_HINT_SYNC | TASK_HINT_ASYNC);
+        a.I(grokSyncMoeOutput, "grokSyncMoeOutput", TASK_TYPE_TRANSFER, TASK_HINT_SYNC | TASK_HINT_ASYNC);
+        a.I(grokMoeBlock2, "grokMoeBlock2", TASK_TYPE_INFERENCE, TASK_HINT_DIM_OUT | TASK_HINT_MATMUL);
+        a.I(grokMoeBlock3, "grokMoeBlock3", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN);
+        a.I(grokQuantizeMoeOutput, "grokQuantizeMoeOutput", TASK_TYPE_INFERENCE, TASK_HINT_QUANTIZE | TASK_HINT_WORKER_ONLY);
+        a.I(grokMoeRmsFinal, "grokMoeRmsFinal", TASK_TYPE_INFERENCE, TASK_HINT_SERIAL | TASK_HINT_AWAIT);
+        a.I(grokMoeRmsNormFinal, "grokMoeRmsNormFinal", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN | TASK_HINT_DIM_OUT);
+        a.I(grokMoeAdd, "grokMoeAdd", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN | TASK_HINT_DIM_OUT);
+        // The next rms reads x in the same ranges as the merge, so no barrier is needed between them
+        if (i + 1 < spec->nLayers) {
+            a.I(llamaRmsAtt, "llamaRmsAtt", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN);
+        } else {
+            a.I(llamaRmsFinal, "llamaRmsFinal", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN);
+        }
+        a.I(llamaNextBlock, "llamaNextBlock", TASK_TYPE_INFERENCE, TASK_HINT_SERIAL | TASK_HINT_NEXT_BLOCK);
     }
-
-    a.I(llamaRmsFinal, TASK_TYPE_INFERENCE);
-    a.I(llamaRmsFinalNorm, TASK_TYPE_INFERENCE);
-    a.I(grokFinalize, TASK_TYPE_INFERENCE);
-    a.I(grokFinalize2, TASK_TYPE_INFERENCE);
+    a.I(llamaRmsFinalNorm, "llamaRmsFinalNorm", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN | TASK_HINT_DIM_OUT);
+    a.I(grokFinalize, "grokFinalize", TASK_TYPE_INFERENCE, TASK_HINT_VOCAB_OUT | TASK_HINT_MATMUL);
+    a.I(grokFinalize2, "grokFinalize2", TASK_TYPE_INFERENCE, TASK_HINT_VOCAB_IN | TASK_HINT_VOCAB_OUT);
 
     // worker
 
     for (int i = 0; i < spec->nLayers; i++) {
-        a.W(llamaSyncRmsAtt, TASK_TYPE_TRANSFER);
-        a.W(llamaQkv, TASK_TYPE_INFERENCE);
-        a.W(llamaRope, TASK_TYPE_INFERENCE);
-        a.W(llamaMultiheadAtt, TASK_TYPE_INFERENCE);
-        a.W(llamaQuantizeMultiheadAtt, TASK_TYPE_INFERENCE);
-        a.W(llamaAtt, TASK_TYPE_INFERENCE);
-        a.W(llamaQuantizeAtt, TASK_TYPE_INFERENCE);
-        a.W(llamaSyncAtt, TASK_TYPE_TRANSFER);
-
-        a.W(grokSyncMoeInput, TASK_TYPE_TRANSFER);
-        a.W(grokMoeBlock0, TASK_TYPE_INFERENCE);
-        a.W(grokMoeBlock1, TASK_TYPE_INFERENCE);
-        a.W(grokQuantizeMoeMul, TASK_TYPE_INFERENCE);
-        a.W(grokSyncMoeMulA, TASK_TYPE_INFERENCE);
-        a.W(grokSyncMoeMulB, TASK_TYPE_INFERENCE);
-        a.W(grokMoeBlock2, TASK_TYPE_INFERENCE);
-        a.W(grokQuantizeMoeOutput, TASK_TYPE_INFERENCE);
-        a.W(grokSyncMoeOutput, TASK_TYPE_TRANSFER);
-
-        a.W(llamaNextBlock, TASK_TYPE_INFERENCE);
+        a.W(llamaSyncRmsAtt, "llamaSyncRmsAtt", TASK_TYPE_TRANSFER, TASK_HINT_SYNC);
+        a.W(llamaQkv, "llamaQkv", TASK_TYPE_INFERENCE, TASK_HINT_MATMUL);
+        a.W(llamaRope, "llamaRope", TASK_TYPE_INFERENCE);
+        a.W(llamaMultiheadAtt, "llamaMultiheadAtt", TASK_TYPE_INFERENCE);
+        a.W(llamaQuantizeMultiheadAtt, "llamaQuantizeMultiheadAtt", TASK_TYPE_INFERENCE, TASK_HINT_QUANTIZE);
+        a.W(llamaAtt, "llamaAtt", TASK_TYPE_INFERENCE, TASK_HINT_DIM_OUT | TASK_HINT_MATMUL);
+        a.W(llamaQuantizeAtt, "llamaQuantizeAtt", TASK_TYPE_INFERENCE, TASK_HINT_QUANTIZE | TASK_HINT_WORKER_ONLY);
+        a.W(llamaSyncAtt, "llamaSyncAtt", TASK_TYPE_TRANSFER, TASK_HINT_SYNC);
+
+        a.W(grokSyncMoeInput, "grokSyncMoeInput", TASK_TYPE_TRANSFER, TASK_HINT_SYNC);
+        a.W(grokMoeBlock0, "grokMoeBlock0", TASK_TYPE_INFERENCE);
+        a.W(grokSyncMoeMulA, "grokSyncMoeMulA", TASK_TYPE_TRANSFER, TASK_HINT_SYNC);
+        a.W(grokSyncMoeMulB, "grokSyncMoeMulB", TASK_TYPE_TRANSFER, TASK_HINT_SYNC);
+        a.W(grokMoeBlock2, "grokMoeBlock2", TASK_TYPE_INFERENCE, TASK_HINT_DIM_OUT | TASK_HINT_MATMUL);
+        a.W(grokMoeBlock3, "grokMoeBlock3", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN);
+        a.W(grokQuantizeMoeOutput, "grokQuantizeMoeOutput", TASK_TYPE_INFERENCE, TASK_HINT_QUANTIZE | TASK_HINT_WORKER_ONLY);
+        a.W(grokSyncMoeOutput, "grokSyncMoeOutput", TASK_TYPE_TRANSFER, TASK_HINT_SYNC);
+
+        a.W(llamaNextBlock, "llamaNextBlock", TASK_TYPE_INFERENCE, TASK_HINT_SERIAL | TASK_HINT_NEXT_BLOCK);
     }
 
     return a;
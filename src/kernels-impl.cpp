@@ -0,0 +1,1995 @@
+// Kernels of one instruction set. The Makefile compiles this file once per variant with
+// KERNELS_NAME, KERNELS_LEVEL and the instruction set flags, so all functions here are static.
+#include <cmath>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "kernels.hpp"
+
+#if !defined(KERNELS_NAME) || !defined(KERNELS_LEVEL)
+    #error "KERNELS_NAME and KERNELS_LEVEL must be defined"
+#endif
+
+// The scalar variant ignores instruction sets enabled by the compiler, e.g. by -march=native
+#if !defined(KERNELS_NO_SIMD)
+    #if defined(__ARM_NEON)
+        #define USE_NEON
+        #if defined(__ARM_FEATURE_DOTPROD)
+            #define USE_NEON_DOTPROD
+        #endif
+    #elif defined(__AVX2__) && defined(__FMA__) && defined(__F16C__)
+        #define USE_AVX2
+        #if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+            #define USE_AVX512_VNNI
+        #endif
+        #if defined(__AVX512BF16__) && defined(__AVX512VL__)
+            #define USE_AVX512_BF16
+        #endif
+        #if defined(__AVX512F__) && defined(__AVX512BW__) && defined(__AVX512VL__)
+            #define USE_AVX512
+        #endif
+    #endif
+#endif
+
+#if defined(USE_NEON)
+    #include <arm_neon.h>
+#elif defined(USE_AVX2)
+    #include <immintrin.h>
+#endif
+
+#if defined(USE_AVX2)
+    #define MM256_SET_M128I(a, b) _mm256_insertf128_si256(_mm256_castsi128_si256(b), (a), 1)
+
+    static inline __m256i bytes_from_nibbles_32(const uint8_t* rsi) {
+        // Load 16 bytes from memory
+        __m128i tmpl = _mm_loadu_si128((const __m128i *)rsi);
+        __m128i tmph = _mm_srli_epi16(tmpl, 4);
+        const __m128i lowMask = _mm_set1_epi8(0xF);
+        tmpl = _mm_and_si128(lowMask, tmpl);
+        tmph = _mm_and_si128(lowMask, tmph);
+        return MM256_SET_M128I(tmph, tmpl);
+    }
+
+    static inline float hsum_float_8(const __m256 x) {
+        __m128 res = _mm256_extractf128_ps(x, 1);
+        res = _mm_add_ps(res, _mm256_castps256_ps128(x));
+        res = _mm_add_ps(res, _mm_movehl_ps(res, res));
+        res = _mm_add_ss(res, _mm_movehdup_ps(res));
+        return _mm_cvtss_f32(res);
+    }
+
+    // add int16_t pairwise and return as float vector
+    static inline __m256 sum_i16_pairs_float(const __m128i xh, const __m128i xl) {
+        const __m128i ones = _mm_set1_epi16(1);
+        const __m128i summed_pairsl = _mm_madd_epi16(ones, xl);
+        const __m128i summed_pairsh = _mm_madd_epi16(ones, xh);
+        const __m256i summed_pairs = MM256_SET_M128I(summed_pairsh, summed_pairsl);
+        return _mm256_cvtepi32_ps(summed_pairs);
+    }
+
+    // multiply unsigned int8_t by int8_t and add groups of four as int32_t
+    static inline __m256i dot_u8_i8(const __m256i ax, const __m256i sy) {
+#if defined(USE_AVX512_VNNI)
+        return _mm256_dpbusd_epi32(_mm256_setzero_si256(), ax, sy);
+#else
+        return _mm256_madd_epi16(_mm256_maddubs_epi16(ax, sy), _mm256_set1_epi16(1));
+#endif
+    }
+
+#if defined(USE_AVX512_VNNI)
+    // multiply int8_t and add groups of four with a single VNNI instruction
+    static inline __m256 mul_sum_i8_pairs_float(const __m256i x, const __m256i y) {
+        const __m256i ax = _mm256_sign_epi8(x, x);
+        const __m256i sy = _mm256_sign_epi8(y, x);
+        return _mm256_cvtepi32_ps(_mm256_dpbusd_epi32(_mm256_setzero_si256(), ax, sy));
+    }
+#else
+    // multiply int8_t, add results pairwise twice and return as float vector
+    static inline __m256 mul_sum_i8_pairs_float(const __m256i x, const __m256i y) {
+        const __m128i xl = _mm256_castsi256_si128(x);
+        const __m128i xh = _mm256_extractf128_si256(x, 1);
+        const __m128i yl = _mm256_castsi256_si128(y);
+        const __m128i yh = _mm256_extractf128_si256(y, 1);
+        // Get absolute values of x vectors
+        const __m128i axl = _mm_sign_epi8(xl, xl);
+        const __m128i axh = _mm_sign_epi8(xh, xh);
+        // Sign the values of the y vectors
+        const __m128i syl = _mm_sign_epi8(yl, xl);
+        const __m128i syh = _mm_sign_epi8(yh, xh);
+        // Perform multiplication and create 16-bit values
+        const __m128i dotl = _mm_maddubs_epi16(axl, syl);
+        const __m128i doth = _mm_maddubs_epi16(axh, syh);
+        return sum_i16_pairs_float(doth, dotl);
+    }
+#endif
+#endif
+
+static inline float f16ToF32(const uint16_t value) {
+#if defined(USE_AVX2)
+    return _cvtsh_ss(value);
+#else
+    return convertF16ToF32(value);
+#endif
+}
+
+static inline float bf16ToF32(const uint16_t value) {
+    const uint32_t bits = (uint32_t)value << 16;
+    float result;
+    memcpy(&result, &bits, sizeof(float));
+    return result;
+}
+
+#if defined(USE_AVX2)
+// BF16 is the upper half of F32, so 8 values are widened by a shift
+static inline __m256 bf16x8ToF32(const uint16_t* x) {
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)x)), 16));
+}
+#endif
+
+static void dequantizeQ40RowKernel(const BlockQ40* x, float* y, int k) {
+    static const int qk = QK40;
+    assert(k % qk == 0);
+    const int nb = k / qk;
+
+#if defined(USE_NEON)
+    const uint8x16_t m4b = vdupq_n_u8(0x0F);
+    const int8x16_t  s8b = vdupq_n_s8(0x8);
+
+    for (int i = 0; i < nb; i++) {
+        const BlockQ40* b = &x[i];
+        const float d = f16ToF32(b->d);
+
+        const uint8x16_t v0_0 = vld1q_u8(b->qs);
+
+        const int8x16_t v0_0l = vreinterpretq_s8_u8(vandq_u8(v0_0, m4b));
+        const int8x16_t v0_0h = vreinterpretq_s8_u8(vshrq_n_u8(v0_0, 4));
+
+        const int8x16_t v0_0ls = vsubq_s8(v0_0l, s8b);
+        const int8x16_t v0_0hs = vsubq_s8(v0_0h, s8b);
+
+        int8x8_t r1 = vget_low_s8(v0_0ls);
+        int8x8_t r2 = vget_high_s8(v0_0ls);
+        int8x8_t r3 = vget_low_s8(v0_0hs);
+        int8x8_t r4 = vget_high_s8(v0_0hs);
+
+        for (int j = 0; j < 8; j++) {
+            y[i * qk + j + 0] = r1[j] * d;
+            y[i * qk + j + 8] = r2[j] * d;
+            y[i * qk + j + 16] = r3[j] * d;
+            y[i * qk + j + 24] = r4[j] * d;
+        }
+    }
+#elif defined(USE_AVX512)
+    const __m128i m4b = _mm_set1_epi8(0x0F);
+    const __m128i s8b = _mm_set1_epi8(0x8);
+
+    for (int i = 0; i < nb; i++) {
+        const BlockQ40* b = &x[i];
+        const __m512 d = _mm512_set1_ps(f16ToF32(b->d));
+
+        const __m128i qs = _mm_loadu_si128((const __m128i*)b->qs);
+        const __m128i ql = _mm_sub_epi8(_mm_and_si128(qs, m4b), s8b);
+        const __m128i qh = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(qs, 4), m4b), s8b);
+
+        _mm512_storeu_ps(&y[i * qk], _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(ql)), d));
+        _mm512_storeu_ps(&y[i * qk + qk / 2], _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(qh)), d));
+    }
+#elif defined(USE_AVX2)
+    const __m256i s8b = _mm256_set1_epi8(0x8);
+
+    for (int i = 0; i < nb; i++) {
+        const BlockQ40* b = &x[i];
+        const __m256 d = _mm256_set1_ps(f16ToF32(b->d));
+
+        // Low nibbles are the first half of the block, high nibbles the second one
+        const __m256i q = _mm256_sub_epi8(bytes_from_nibbles_32(b->qs), s8b);
+        const __m128i q0 = _mm256_castsi256_si128(q);
+        const __m128i q1 = _mm256_extracti128_si256(q, 1);
+
+        _mm256_storeu_ps(&y[i * qk], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(q0)), d));
+        _mm256_storeu_ps(&y[i * qk + 8], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(q0, 8))), d));
+        _mm256_storeu_ps(&y[i * qk + 16], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(q1)), d));
+        _mm256_storeu_ps(&y[i * qk + 24], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(q1, 8))), d));
+    }
+#else
+    for (int i = 0; i < nb; i++) {
+        const BlockQ40* b = &x[i];
+        const float d = f16ToF32(b->d);
+
+        for (int j = 0; j < qk / 2; ++j) {
+            const int x0 = (b->qs[j] & 0x0F) - 8;
+            const int x1 = (b->qs[j] >>   4) - 8;
+
+            y[i * qk + j] = x0 * d;
+            y[i * qk + j + qk / 2] = x1 * d;
+        }
+    }
+#endif
+}
+
+static void quantizeQ80RowKernel(float* input, BlockQ80* output, int k, unsigned int nThreads, unsigned int threadIndex) {
+    assert(k % QK80 == 0);
+
+    const int nBlocks = k / QK80;
+    const int blocksPerThread = nBlocks / nThreads;
+    const int sk = blocksPerThread * QK80;
+    const int currentThreadBlocks = blocksPerThread + (threadIndex == nThreads - 1 ? nBlocks % nThreads : 0);
+
+    const float* x = &input[sk * threadIndex];
+    BlockQ80* y = &output[blocksPerThread * threadIndex];
+
+#if defined(USE_NEON)
+    float dBuf[4];
+
+    for (int i = 0; i < currentThreadBlocks; i++) {
+        float32x4_t srcv [8];
+        float32x4_t asrcv[8];
+        float32x4_t amaxv[8];
+
+        for (int j = 0; j < 8; j++) srcv[j] = vld1q_f32(x + i*32 + 4*j);
+        for (int j = 0; j < 8; j++) asrcv[j] = vabsq_f32(srcv[j]);
+
+        for (int j = 0; j < 4; j++) amaxv[2*j] = vmaxq_f32(asrcv[2*j], asrcv[2*j+1]);
+        for (int j = 0; j < 2; j++) amaxv[4*j] = vmaxq_f32(amaxv[4*j], amaxv[4*j+2]);
+        for (int j = 0; j < 1; j++) amaxv[8*j] = vmaxq_f32(amaxv[8*j], amaxv[8*j+4]);
+
+        const float amax = vmaxvq_f32(amaxv[0]);
+
+        const float d = amax / ((1 << 7) - 1);
+        const float id = d ? 1.0f/d : 0.0f;
+
+        int dbi = i % 4;
+        dBuf[dbi] = d;
+        if (dbi == 3) {
+            float32x4_t dBuf32 = vld1q_f32(dBuf);
+            int16x4_t dBuf16 = (int16x4_t)vcvt_f16_f32(dBuf32);
+
+            y[i - 3].d = dBuf16[0];
+            y[i - 2].d = dBuf16[1];
+            y[i - 1].d = dBuf16[2];
+            y[i - 0].d = dBuf16[3];
+        }
+
+        for (int j = 0; j < 8; j++) {
+            const float32x4_t v  = vmulq_n_f32(srcv[j], id);
+            const int32x4_t   vi = vcvtaq_s32_f32(v);
+
+            y[i].qs[4*j + 0] = vgetq_lane_s32(vi, 0);
+            y[i].qs[4*j + 1] = vgetq_lane_s32(vi, 1);
+            y[i].qs[4*j + 2] = vgetq_lane_s32(vi, 2);
+            y[i].qs[4*j + 3] = vgetq_lane_s32(vi, 3);
+        }
+    }
+
+    int rest = currentThreadBlocks % 4;
+    if (rest != 0) {
+        float32x4_t dBuf32 = vld1q_f32(dBuf);
+        int16x4_t dBuf16 = (int16x4_t)vcvt_f16_f32(dBuf32);
+        for (int i = 0; i < rest; i++) {
+            y[currentThreadBlocks - rest + i].d = dBuf16[i];
+        }
+    }
+#elif defined(USE_AVX512)
+    // roundf() rounds halves away from zero: truncate after adding 0.5 - ulp with the sign of the value
+    const __m512i signBit = _mm512_set1_epi32(0x80000000);
+    const __m512i half = _mm512_castps_si512(_mm512_set1_ps(0.49999997f));
+
+    for (int i = 0; i < currentThreadBlocks; i++) {
+        const __m512 v0 = _mm512_loadu_ps(x + i*QK80);
+        const __m512 v1 = _mm512_loadu_ps(x + i*QK80 + 16);
+
+        const float amax = _mm512_reduce_max_ps(_mm512_max_ps(_mm512_abs_ps(v0), _mm512_abs_ps(v1)));
+
+        const float d = amax / ((1 << 7) - 1);
+        const float id = d ? 1.0f/d : 0.0f;
+
+        y[i].d = _cvtss_sh(d, _MM_FROUND_TO_NEAREST_INT);
+
+        const __m512 mul = _mm512_set1_ps(id);
+        const __m512 s0 = _mm512_mul_ps(v0, mul);
+        const __m512 s1 = _mm512_mul_ps(v1, mul);
+        const __m512 r0 = _mm512_add_ps(s0, _mm512_castsi512_ps(_mm512_or_si512(_mm512_and_si512(_mm512_castps_si512(s0), signBit), half)));
+        const __m512 r1 = _mm512_add_ps(s1, _mm512_castsi512_ps(_mm512_or_si512(_mm512_and_si512(_mm512_castps_si512(s1), signBit), half)));
+
+        _mm_storeu_si128((__m128i*)y[i].qs, _mm512_cvtepi32_epi8(_mm512_cvttps_epi32(r0)));
+        _mm_storeu_si128((__m128i*)(y[i].qs + 16), _mm512_cvtepi32_epi8(_mm512_cvttps_epi32(r1)));
+    }
+#elif defined(USE_AVX2)
+    // roundf() rounds halves away from zero: truncate after adding 0.5 - ulp with the sign of the value
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+    const __m256 half = _mm256_set1_ps(0.49999997f);
+
+    for (int i = 0; i < currentThreadBlocks; i++) {
+        __m256 v[4];
+        for (int j = 0; j < 4; j++) v[j] = _mm256_loadu_ps(x + i*QK80 + 8*j);
+
+        __m256 maxAbs = _mm256_andnot_ps(signBit, v[0]);
+        for (int j = 1; j < 4; j++) maxAbs = _mm256_max_ps(maxAbs, _mm256_andnot_ps(signBit, v[j]));
+        __m128 max4 = _mm_max_ps(_mm256_extractf128_ps(maxAbs, 1), _mm256_castps256_ps128(maxAbs));
+        max4 = _mm_max_ps(max4, _mm_movehl_ps(max4, max4));
+        max4 = _mm_max_ss(max4, _mm_movehdup_ps(max4));
+        const float amax = _mm_cvtss_f32(max4);
+
+        const float d = amax / ((1 << 7) - 1);
+        const float id = d ? 1.0f/d : 0.0f;
+
+        y[i].d = _cvtss_sh(d, _MM_FROUND_TO_NEAREST_INT);
+
+        const __m256 mul = _mm256_set1_ps(id);
+        __m256i q[4];
+        for (int j = 0; j < 4; j++) {
+            const __m256 s = _mm256_mul_ps(v[j], mul);
+            q[j] = _mm256_cvttps_epi32(_mm256_add_ps(s, _mm256_or_ps(_mm256_and_ps(s, signBit), half)));
+        }
+
+        // Packing works per 128-bit lane, the permutation restores the order of values
+        const __m256i q01 = _mm256_packs_epi32(q[0], q[1]);
+        const __m256i q23 = _mm256_packs_epi32(q[2], q[3]);
+        const __m256i q0123 = _mm256_packs_epi16(q01, q23);
+        _mm256_storeu_si256((__m256i*)y[i].qs, _mm256_permutevar8x32_epi32(q0123, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)));
+    }
+#else
+    for (int i = 0; i < currentThreadBlocks; i++) {
+        float amax = 0.0f;
+
+        for (int j = 0; j < QK80; j++) {
+            const float v = fabsf(x[i*QK80 + j]);
+            amax = amax > v ? amax : v;
+        }
+
+        const float d = amax / ((1 << 7) - 1);
+        const float id = d ? 1.0f/d : 0.0f;
+
+        y[i].d = convertF32ToF16(d);
+
+        for (int j = 0; j < QK80; ++j) {
+            const float x0 = x[i*QK80 + j]*id;
+            y[i].qs[j] = roundf(x0);
+        }
+    }
+#endif
+}
+
+static void dequantizeQ80RowKernel(const BlockQ80* input, float* output, int k, unsigned int nThreads, unsigned int threadIndex) {
+    assert(k % QK80 == 0);
+
+    const int nBlocks = k / QK80;
+    const int blocksPerThread = nBlocks / nThreads;
+    const int sk = blocksPerThread * QK80;
+    const int currentThreadBlocks = blocksPerThread + (threadIndex == nThreads - 1 ? nBlocks % nThreads : 0);
+
+    const BlockQ80* x = &input[blocksPerThread * threadIndex];
+    float* y = &output[sk * threadIndex];
+
+#if defined(USE_AVX512)
+    for (int i = 0; i < currentThreadBlocks; i++) {
+        const __m512 d = _mm512_set1_ps(f16ToF32(x[i].d));
+
+        for (int j = 0; j < QK80; j += 16) {
+            const __m512i q = _mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i*)(x[i].qs + j)));
+            _mm512_storeu_ps(&y[i*QK80 + j], _mm512_mul_ps(_mm512_cvtepi32_ps(q), d));
+        }
+    }
+#elif defined(USE_AVX2)
+    for (int i = 0; i < currentThreadBlocks; i++) {
+        const __m256 d = _mm256_set1_ps(f16ToF32(x[i].d));
+
+        for (int j = 0; j < QK80; j += 8) {
+            const __m256i q = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(x[i].qs + j)));
+            _mm256_storeu_ps(&y[i*QK80 + j], _mm256_mul_ps(_mm256_cvtepi32_ps(q), d));
+        }
+    }
+#else
+    for (int i = 0; i < currentThreadBlocks; i++) {
+        const float d = f16ToF32(x[i].d);
+
+        for (int j = 0; j < QK80; ++j) {
+            y[i*QK80 + j] = x[i].qs[j]*d;
+        }
+    }
+#endif
+}
+
+static void quantizeF16RowKernel(const float* input, uint16_t* output, int k, unsigned int nThreads, unsigned int threadIndex) {
+    // Split into groups of 8 values, so each thread converts whole vectors
+    const int nGroups = k / 8;
+    const int groupsPerThread = nGroups / nThreads;
+    const int start = groupsPerThread * 8 * threadIndex;
+    const int end = threadIndex == nThreads - 1 ? k : start + groupsPerThread * 8;
+    int i = start;
+
+#if defined(USE_NEON)
+    for (; i + 4 <= end; i += 4) {
+        vst1_u16(&output[i], vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(&input[i]))));
+    }
+#elif defined(USE_AVX2)
+    for (; i + 8 <= end; i += 8) {
+        _mm_storeu_si128((__m128i*)&output[i], _mm256_cvtps_ph(_mm256_loadu_ps(&input[i]), _MM_FROUND_TO_NEAREST_INT));
+    }
+#endif
+    for (; i < end; i++) {
+        output[i] = convertF32ToF16(input[i]);
+    }
+}
+
+static void dequantizeF16RowKernel(const uint16_t* input, float* output, int k, unsigned int nThreads, unsigned int threadIndex) {
+    const int nGroups = k / 8;
+    const int groupsPerThread = nGroups / nThreads;
+    const int start = groupsPerThread * 8 * threadIndex;
+    const int end = threadIndex == nThreads - 1 ? k : start + groupsPerThread * 8;
+    int i = start;
+
+#if defined(USE_NEON)
+    for (; i + 4 <= end; i += 4) {
+        vst1q_f32(&output[i], vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(&input[i]))));
+    }
+#elif defined(USE_AVX2)
+    for (; i + 8 <= end; i += 8) {
+        _mm256_storeu_ps(&output[i], _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)&input[i])));
+    }
+#endif
+    for (; i < end; i++) {
+        output[i] = f16ToF32(input[i]);
+    }
+}
+
+static void quantizeBF16RowKernel(const float* input, uint16_t* output, int k, unsigned int nThreads, unsigned int threadIndex) {
+    const int nGroups = k / 8;
+    const int groupsPerThread = nGroups / nThreads;
+    const int start = groupsPerThread * 8 * threadIndex;
+    const int end = threadIndex == nThreads - 1 ? k : start + groupsPerThread * 8;
+    int i = start;
+
+#if defined(USE_NEON)
+    const uint32x4_t one = vdupq_n_u32(1);
+    const uint32x4_t bias = vdupq_n_u32(0x7FFF);
+    for (; i + 4 <= end; i += 4) {
+        const float32x4_t x = vld1q_f32(&input[i]);
+        const uint32x4_t u = vreinterpretq_u32_f32(x);
+        const uint32x4_t r = vaddq_u32(u, vaddq_u32(bias, vandq_u32(vshrq_n_u32(u, 16), one)));
+        const uint32x4_t nan = vorrq_u32(u, vdupq_n_u32(0x400000));
+        vst1_u16(&output[i], vshrn_n_u32(vbslq_u32(vceqq_f32(x, x), r, nan), 16));
+    }
+#elif defined(USE_AVX512_BF16)
+    for (; i + 8 <= end; i += 8) {
+        const __m128bh r = _mm256_cvtneps_pbh(_mm256_loadu_ps(&input[i]));
+        _mm_storeu_si128((__m128i*)&output[i], (__m128i)r);
+    }
+#elif defined(USE_AVX2)
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i bias = _mm256_set1_epi32(0x7FFF);
+    const __m256i quiet = _mm256_set1_epi32(0x40);
+    for (; i + 8 <= end; i += 8) {
+        const __m256 x = _mm256_loadu_ps(&input[i]);
+        const __m256i u = _mm256_castps_si256(x);
+        const __m256i high = _mm256_srli_epi32(u, 16);
+        __m256i r = _mm256_srli_epi32(_mm256_add_epi32(u, _mm256_add_epi32(bias, _mm256_and_si256(high, one))), 16);
+        r = _mm256_blendv_epi8(r, _mm256_or_si256(high, quiet), _mm256_castps_si256(_mm256_cmp_ps(x, x, _CMP_UNORD_Q)));
+        _mm_storeu_si128((__m128i*)&output[i], _mm_packus_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1)));
+    }
+#endif
+    for (; i < end; i++) {
+        output[i] = convertF32ToBF16(input[i]);
+    }
+}
+
+static void dequantizeBF16RowKernel(const uint16_t* input, float* output, int k, unsigned int nThreads, unsigned int threadIndex) {
+    const int nGroups = k / 8;
+    const int groupsPerThread = nGroups / nThreads;
+    const int start = groupsPerThread * 8 * threadIndex;
+    const int end = threadIndex == nThreads - 1 ? k : start + groupsPerThread * 8;
+    int i = start;
+
+#if defined(USE_NEON)
+    for (; i + 4 <= end; i += 4) {
+        vst1q_f32(&output[i], vreinterpretq_f32_u32(vshll_n_u16(vld1_u16(&input[i]), 16)));
+    }
+#elif defined(USE_AVX2)
+    for (; i + 8 <= end; i += 8) {
+        _mm256_storeu_ps(&output[i], bf16x8ToF32(&input[i]));
+    }
+#endif
+    for (; i < end; i++) {
+        output[i] = bf16ToF32(input[i]);
+    }
+}
+
+static void dequantizeQ2KRowKernel(const BlockQ2K* x, float* y, int k) {
+    assert(k % QKK == 0);
+    const int nb = k / QKK;
+    for (int i = 0; i < nb; i++) {
+        const float d = f16ToF32(x[i].d);
+        const float dmin = f16ToF32(x[i].dmin);
+        for (int j = 0; j < QKK; j++) {
+            const uint8_t sc = x[i].scales[j / 16];
+            const int q = (x[i].qs[(j / 128) * 32 + j % 32] >> (2 * ((j / 32) % 4))) & 3;
+            y[i * QKK + j] = d * (sc & 0xF) * q - dmin * (sc >> 4);
+        }
+    }
+}
+
+// Unpacks 16 scales of Q3K with the offset of 32 removed
+static inline void getScalesQ3K(const uint8_t* q, int8_t* scales) {
+    for (int j = 0; j < QKK / 16; j++) {
+        const uint8_t low = j < 8 ? q[j] & 0xF : q[j - 8] >> 4;
+        const uint8_t high = (q[j % 4 + 8] >> (2 * (j / 4))) & 3;
+        scales[j] = (int8_t)(low | (high << 4)) - 32;
+    }
+}
+
+static void dequantizeQ3KRowKernel(const BlockQ3K* x, float* y, int k) {
+    assert(k % QKK == 0);
+    const int nb = k / QKK;
+    for (int i = 0; i < nb; i++) {
+        const float d = f16ToF32(x[i].d);
+        int8_t scales[QKK / 16];
+        getScalesQ3K(x[i].scales, scales);
+        for (int j = 0; j < QKK; j++) {
+            const int low = (x[i].qs[(j / 128) * 32 + j % 32] >> (2 * ((j / 32) % 4))) & 3;
+            const int high = (x[i].hmask[j % 32] >> (j / 32)) & 1;
+            y[i * QKK + j] = d * scales[j / 16] * ((low | (high << 2)) - 4);
+        }
+    }
+}
+
+static inline void getScaleMinQ4K(const int j, const uint8_t* q, uint8_t* sc, uint8_t* m) {
+    if (j < 4) {
+        *sc = q[j] & 63;
+        *m = q[j + 4] & 63;
+    } else {
+        *sc = (q[j + 4] & 0xF) | ((q[j - 4] >> 6) << 4);
+        *m = (q[j + 4] >> 4) | ((q[j] >> 6) << 4);
+    }
+}
+
+static void dequantizeQ4KRowKernel(const BlockQ4K* x, float* y, int k) {
+    assert(k % QKK == 0);
+    const int nb = k / QKK;
+    for (int i = 0; i < nb; i++) {
+        const float d = f16ToF32(x[i].d);
+        const float dmin = f16ToF32(x[i].dmin);
+        for (int j = 0; j < QKK; j += 64) {
+            uint8_t sc0, m0, sc1, m1;
+            getScaleMinQ4K(j / 32, x[i].scales, &sc0, &m0);
+            getScaleMinQ4K(j / 32 + 1, x[i].scales, &sc1, &m1);
+            const uint8_t* qs = &x[i].qs[j / 2];
+            for (int l = 0; l < 32; l++) {
+                y[i * QKK + j + l] = d * sc0 * (qs[l] & 0xF) - dmin * m0;
+                y[i * QKK + j + l + 32] = d * sc1 * (qs[l] >> 4) - dmin * m1;
+            }
+        }
+    }
+}
+
+static void dequantizeQ6KRowKernel(const BlockQ6K* x, float* y, int k) {
+    assert(k % QKK == 0);
+    const int nb = k / QKK;
+    for (int i = 0; i < nb; i++) {
+        const float d = f16ToF32(x[i].d);
+        // A chunk of 128 values: the byte l of ql keeps the low bits of values l and l + 64, the byte l + 32 of
+        // values l + 32 and l + 96, the byte l of qh keeps the high bits of values l, l + 32, l + 64 and l + 96
+        for (int j = 0; j < QKK; j += 128) {
+            const uint8_t* ql = &x[i].ql[j / 2];
+            const uint8_t* qh = &x[i].qh[j / 4];
+            const int8_t* sc = &x[i].scales[j / 16];
+            float* o = &y[i * QKK + j];
+            for (int l = 0; l < 32; l++) {
+                const int is = l / 16;
+                o[l] = d * sc[is] * (((ql[l] & 0xF) | (((qh[l] >> 0) & 3) << 4)) - 32);
+                o[l + 32] = d * sc[is + 2] * (((ql[l + 32] & 0xF) | (((qh[l] >> 2) & 3) << 4)) - 32);
+                o[l + 64] = d * sc[is + 4] * (((ql[l] >> 4) | (((qh[l] >> 4) & 3) << 4)) - 32);
+                o[l + 96] = d * sc[is + 6] * (((ql[l + 32] >> 4) | (((qh[l] >> 6) & 3) << 4)) - 32);
+            }
+        }
+    }
+}
+
+// exp(x) = 2^n * exp(r), where r = x - n * ln(2) is reduced to [-ln(2)/2, ln(2)/2] and exp(r) is a polynomial
+// (Cephes expf). The relative error is below 2e-7 for the clamped range, x is clamped to keep 2^n normal.
+#define EXP_MIN -87.3f
+#define EXP_MAX 88.3f
+#define EXP_LOG2E 1.44269504088896341f
+#define EXP_C1 0.693359375f
+#define EXP_C2 -2.12194440e-4f
+#define EXP_P0 1.9875691500e-4f
+#define EXP_P1 1.3981999507e-3f
+#define EXP_P2 8.3334519073e-3f
+#define EXP_P3 4.1665795894e-2f
+#define EXP_P4 1.6666665459e-1f
+#define EXP_P5 5.0000001201e-1f
+
+#if defined(USE_NEON)
+    static inline float32x4_t exp_float_4(float32x4_t x) {
+        x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(EXP_MIN)), vdupq_n_f32(EXP_MAX));
+        const float32x4_t n = vrndmq_f32(vfmaq_f32(vdupq_n_f32(0.5f), x, vdupq_n_f32(EXP_LOG2E)));
+        float32x4_t r = vfmsq_f32(x, n, vdupq_n_f32(EXP_C1));
+        r = vfmsq_f32(r, n, vdupq_n_f32(EXP_C2));
+
+        float32x4_t p = vfmaq_f32(vdupq_n_f32(EXP_P1), vdupq_n_f32(EXP_P0), r);
+        p = vfmaq_f32(vdupq_n_f32(EXP_P2), p, r);
+        p = vfmaq_f32(vdupq_n_f32(EXP_P3), p, r);
+        p = vfmaq_f32(vdupq_n_f32(EXP_P4), p, r);
+        p = vfmaq_f32(vdupq_n_f32(EXP_P5), p, r);
+        p = vfmaq_f32(vaddq_f32(r, vdupq_n_f32(1.0f)), p, vmulq_f32(r, r));
+
+        const int32x4_t e = vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(n), vdupq_n_s32(127)), 23);
+        return vmulq_f32(p, vreinterpretq_f32_s32(e));
+    }
+#elif defined(USE_AVX2)
+    static inline float hmax_float_8(const __m256 x) {
+        __m128 res = _mm256_extractf128_ps(x, 1);
+        res = _mm_max_ps(res, _mm256_castps256_ps128(x));
+        res = _mm_max_ps(res, _mm_movehl_ps(res, res));
+        res = _mm_max_ss(res, _mm_movehdup_ps(res));
+        return _mm_cvtss_f32(res);
+    }
+
+    static inline __m256 exp_float_8(__m256 x) {
+        x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(EXP_MIN)), _mm256_set1_ps(EXP_MAX));
+        const __m256 n = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(EXP_LOG2E), _mm256_set1_ps(0.5f)));
+        __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(EXP_C1), x);
+        r = _mm256_fnmadd_ps(n, _mm256_set1_ps(EXP_C2), r);
+
+        __m256 p = _mm256_fmadd_ps(_mm256_set1_ps(EXP_P0), r, _mm256_set1_ps(EXP_P1));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P2));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P3));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P4));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P5));
+        p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+        const __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+        return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+    }
+#endif
+
+// Element-wise kernels of funcs.cpp, they get the range of one thread. Vectorized parts are followed by scalar
+// tails, so any size is accepted.
+static void mulScalarKernel(float* output, const float c, const unsigned int n) {
+    unsigned int i = 0;
+#if defined(USE_NEON)
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(&output[i], vmulq_n_f32(vld1q_f32(&output[i]), c));
+    }
+#elif defined(USE_AVX2)
+    const __m256 fc = _mm256_set1_ps(c);
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(&output[i], _mm256_mul_ps(_mm256_loadu_ps(&output[i]), fc));
+    }
+#endif
+    for (; i < n; i++) {
+        output[i] *= c;
+    }
+}
+
+static void mulKernel(float* output, const float* input, const unsigned int n) {
+    unsigned int i = 0;
+#if defined(USE_NEON)
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(&output[i], vmulq_f32(vld1q_f32(&output[i]), vld1q_f32(&input[i])));
+    }
+#elif defined(USE_AVX2)
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(&output[i], _mm256_mul_ps(_mm256_loadu_ps(&output[i]), _mm256_loadu_ps(&input[i])));
+    }
+#endif
+    for (; i < n; i++) {
+        output[i] *= input[i];
+    }
+}
+
+static void addKernel(float* output, const float* input, const unsigned int n) {
+    unsigned int i = 0;
+#if defined(USE_NEON)
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(&output[i], vaddq_f32(vld1q_f32(&output[i]), vld1q_f32(&input[i])));
+    }
+#elif defined(USE_AVX2)
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(&output[i], _mm256_add_ps(_mm256_loadu_ps(&output[i]), _mm256_loadu_ps(&input[i])));
+    }
+#endif
+    for (; i < n; i++) {
+        output[i] += input[i];
+    }
+}
+
+static void softmaxKernel(float* x, const unsigned int size) {
+    unsigned int i = 0;
+    // find max value (for numerical stability)
+    float maxVal = x[0];
+#if defined(USE_NEON)
+    if (size >= 4) {
+        float32x4_t fmaxv = vld1q_f32(&x[0]);
+        for (i = 4; i + 4 <= size; i += 4) fmaxv = vmaxq_f32(fmaxv, vld1q_f32(&x[i]));
+        maxVal = vmaxvq_f32(fmaxv);
+    }
+#elif defined(USE_AVX2)
+    if (size >= 8) {
+        __m256 fmaxv = _mm256_loadu_ps(&x[0]);
+        for (i = 8; i + 8 <= size; i += 8) fmaxv = _mm256_max_ps(fmaxv, _mm256_loadu_ps(&x[i]));
+        maxVal = hmax_float_8(fmaxv);
+    }
+#endif
+    for (; i < size; i++) {
+        if (x[i] > maxVal) {
+            maxVal = x[i];
+        }
+    }
+
+    // exp and sum
+    i = 0;
+    float sum = 0.0f;
+#if defined(USE_NEON)
+    const float32x4_t fmax = vdupq_n_f32(maxVal);
+    float32x4_t fsum = vdupq_n_f32(0.0f);
+    for (; i + 4 <= size; i += 4) {
+        const float32x4_t fe = exp_float_4(vsubq_f32(vld1q_f32(&x[i]), fmax));
+        vst1q_f32(&x[i], fe);
+        fsum = vaddq_f32(fsum, fe);
+    }
+    sum = vaddvq_f32(fsum);
+#elif defined(USE_AVX2)
+    const __m256 fmax = _mm256_set1_ps(maxVal);
+    __m256 fsum = _mm256_setzero_ps();
+    for (; i + 8 <= size; i += 8) {
+        const __m256 fe = exp_float_8(_mm256_sub_ps(_mm256_loadu_ps(&x[i]), fmax));
+        _mm256_storeu_ps(&x[i], fe);
+        fsum = _mm256_add_ps(fsum, fe);
+    }
+    sum = hsum_float_8(fsum);
+#endif
+    for (; i < size; i++) {
+        x[i] = expf(x[i] - maxVal);
+        sum += x[i];
+    }
+
+    // normalize
+    mulScalarKernel(x, 1.0f / sum, size);
+}
+
+static float sumOfSquaresKernel(const float* x, const unsigned int size) {
+    unsigned int j = 0;
+    float ss;
+#if defined(USE_NEON)
+    float32x4_t fsq;
+    float32x4_t fs = vmovq_n_f32(0);
+    for (; j + 4 <= size; j += 4) {
+        fsq = vld1q_f32(&x[j]);
+        fs = vmlaq_f32(fs, fsq, fsq);
+    }
+    ss = vaddvq_f32(fs);
+#elif defined(USE_AVX2)
+    __m256 a;
+    __m256 u = _mm256_set1_ps(0.0f);
+    for (; j + 8 <= size; j += 8) {
+        a = _mm256_loadu_ps(&x[j]);
+        u = _mm256_fmadd_ps(a, a, u);
+    }
+    ss = hsum_float_8(u);
+#else
+    ss = 0;
+#endif
+    for (; j < size; j++) {
+        ss += x[j] * x[j];
+    }
+    return ss;
+}
+
+static void rmsnormKernel(float* o, const float* x, const float ms, const float* weight, const unsigned int size) {
+    unsigned int j = 0;
+#if defined(USE_NEON)
+    const float32x4_t fss = vmovq_n_f32(ms);
+    for (; j + 4 <= size; j += 4) {
+        const float32x4_t fx = vmulq_f32(vld1q_f32(&x[j]), fss);
+        vst1q_f32(&o[j], vmulq_f32(vld1q_f32(&weight[j]), fx));
+    }
+#elif defined(USE_AVX2)
+    const __m256 fss = _mm256_set1_ps(ms);
+    for (; j + 8 <= size; j += 8) {
+        const __m256 fx = _mm256_mul_ps(_mm256_loadu_ps(&x[j]), fss);
+        _mm256_storeu_ps(&o[j], _mm256_mul_ps(_mm256_loadu_ps(&weight[j]), fx));
+    }
+#endif
+    for (; j < size; j++) {
+        o[j] = weight[j] * (ms * x[j]);
+    }
+}
+
+static float dotProductKernel(const float* a, const float* b, const unsigned int size) {
+    unsigned int i = 0;
+    float sum;
+#if defined(USE_NEON)
+    float32x4_t fs = vmovq_n_f32(0);
+    for (; i + 4 <= size; i += 4) {
+        fs = vmlaq_f32(fs, vld1q_f32(&a[i]), vld1q_f32(&b[i]));
+    }
+    sum = vaddvq_f32(fs);
+#elif defined(USE_AVX2)
+    __m256 u = _mm256_set1_ps(0.0f);
+    for (; i + 8 <= size; i += 8) {
+        u = _mm256_fmadd_ps(_mm256_loadu_ps(&a[i]), _mm256_loadu_ps(&b[i]), u);
+    }
+    sum = hsum_float_8(u);
+#else
+    sum = 0.0f;
+#endif
+    for (; i < size; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+#define SQRT_2_OVER_PI 0.79788456080286535587989211986876f
+#define GELU_COEF_A 0.044715f
+
+// gelu(x) = 0.5 * x * (1 + tanh(u)) = x / (1 + exp(-2 * u)), so the vectorized path needs only exp()
+static void geluKernel(float* t, const unsigned int n) {
+    unsigned int i = 0;
+#if defined(USE_NEON)
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    for (; i + 4 <= n; i += 4) {
+        const float32x4_t x = vld1q_f32(&t[i]);
+        const float32x4_t z = vmulq_f32(vmulq_n_f32(x, -2.0f * SQRT_2_OVER_PI), vfmaq_f32(one, vmulq_n_f32(x, GELU_COEF_A), x));
+        vst1q_f32(&t[i], vdivq_f32(x, vaddq_f32(one, exp_float_4(z))));
+    }
+#elif defined(USE_AVX2)
+    const __m256 one = _mm256_set1_ps(1.0f);
+    for (; i + 8 <= n; i += 8) {
+        const __m256 x = _mm256_loadu_ps(&t[i]);
+        const __m256 z = _mm256_mul_ps(_mm256_mul_ps(x, _mm256_set1_ps(-2.0f * SQRT_2_OVER_PI)),
+            _mm256_fmadd_ps(_mm256_mul_ps(x, _mm256_set1_ps(GELU_COEF_A)), x, one));
+        _mm256_storeu_ps(&t[i], _mm256_div_ps(x, _mm256_add_ps(one, exp_float_8(z))));
+    }
+#endif
+    for (; i < n; i++) {
+        float x = t[i];
+        t[i] = 0.5f * x * (1.0f + tanhf(SQRT_2_OVER_PI * x * (1.0f + GELU_COEF_A * x * x)));
+    }
+}
+
+static void siluKernel(float* t, const unsigned int n) {
+    unsigned int i = 0;
+#if defined(USE_NEON)
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    for (; i + 4 <= n; i += 4) {
+        const float32x4_t x = vld1q_f32(&t[i]);
+        vst1q_f32(&t[i], vdivq_f32(x, vaddq_f32(one, exp_float_4(vnegq_f32(x)))));
+    }
+#elif defined(USE_AVX2)
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+    for (; i + 8 <= n; i += 8) {
+        const __m256 x = _mm256_loadu_ps(&t[i]);
+        _mm256_storeu_ps(&t[i], _mm256_div_ps(x, _mm256_add_ps(one, exp_float_8(_mm256_xor_ps(x, signBit)))));
+    }
+#endif
+    for (; i < n; i++) {
+        float x = t[i];
+        t[i] = x / (1.0f + expf(-x));
+    }
+}
+
+static void matmulF32(const MatmulThreadInfo* a) {
+    const float* input = (float*)a->input;
+    float* w = (float*)a->weights;
+    unsigned int d, j;
+
+#if defined(USE_NEON)
+    assert(a->n % 4 == 0);
+    float32x4_t q;
+    float32x4_t p;
+    float32x4_t z;
+    for (d = a->ds; d < a->de; d++) {
+        z = vmovq_n_f32(0);
+        for (j = 0; j < a->n; j += 4) {
+            q = vld1q_f32(&input[j]);
+            p = vld1q_f32(&w[d * a->n + j]);
+            z = vfmaq_f32(z, q, p);
+        }
+        a->output[d] = vaddvq_f32(z);
+    }
+#elif defined(USE_AVX2)
+    assert(a->n % 8 == 0);
+    __m256 a0, b0, u;
+    for (d = a->ds; d < a->de; d++) {
+        u = _mm256_set1_ps(0.0f);
+        for (j = 0; j < a->n; j += 8) {
+            a0 = _mm256_loadu_ps(&input[j]);
+            b0 = _mm256_loadu_ps(&w[d * a->n + j]);
+            u = _mm256_fmadd_ps(a0, b0, u);
+        }
+        a->output[d] = hsum_float_8(u);
+    }
+#else
+    for (d = a->ds; d < a->de; d++) {
+        float val = 0.0f;
+        for (j = 0; j < a->n; j++) {
+            val += w[d * a->n + j] * input[j];
+        }
+        a->output[d] = val;
+    }
+#endif
+}
+
+static void matmulF16(const MatmulThreadInfo* a) {
+    const float* input = (float*)a->input;
+    const uint16_t* w = (uint16_t*)a->weights;
+    unsigned int d, j;
+
+#if defined(USE_NEON)
+    assert(a->n % 4 == 0);
+    float32x4_t z;
+    for (d = a->ds; d < a->de; d++) {
+        z = vmovq_n_f32(0);
+        for (j = 0; j < a->n; j += 4) {
+            const float32x4_t p = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(&w[d * a->n + j])));
+            z = vfmaq_f32(z, vld1q_f32(&input[j]), p);
+        }
+        a->output[d] = vaddvq_f32(z);
+    }
+#elif defined(USE_AVX2)
+    assert(a->n % 8 == 0);
+    __m256 a0, b0, u;
+    for (d = a->ds; d < a->de; d++) {
+        u = _mm256_set1_ps(0.0f);
+        for (j = 0; j < a->n; j += 8) {
+            a0 = _mm256_loadu_ps(&input[j]);
+            b0 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)&w[d * a->n + j]));
+            u = _mm256_fmadd_ps(a0, b0, u);
+        }
+        a->output[d] = hsum_float_8(u);
+    }
+#else
+    for (d = a->ds; d < a->de; d++) {
+        float val = 0.0f;
+        for (j = 0; j < a->n; j++) {
+            float ww = f16ToF32(w[d * a->n + j]);
+            val += ww * input[j];
+        }
+        a->output[d] = val;
+    }
+#endif
+}
+
+static void matmulF16vF16(const MatmulThreadInfo* a) {
+    const uint16_t* input = (uint16_t*)a->input;
+    const uint16_t* w = (uint16_t*)a->weights;
+    unsigned int d, j;
+
+#if defined(USE_NEON)
+    assert(a->n % 4 == 0);
+    float32x4_t z;
+    for (d = a->ds; d < a->de; d++) {
+        z = vmovq_n_f32(0);
+        for (j = 0; j < a->n; j += 4) {
+            const float32x4_t q = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(&input[j])));
+            const float32x4_t p = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(&w[d * a->n + j])));
+            z = vfmaq_f32(z, q, p);
+        }
+        a->output[d] = vaddvq_f32(z);
+    }
+#elif defined(USE_AVX2)
+    assert(a->n % 8 == 0);
+    __m256 a0, b0, u;
+    for (d = a->ds; d < a->de; d++) {
+        u = _mm256_set1_ps(0.0f);
+        for (j = 0; j < a->n; j += 8) {
+            a0 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)&input[j]));
+            b0 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)&w[d * a->n + j]));
+            u = _mm256_fmadd_ps(a0, b0, u);
+        }
+        a->output[d] = hsum_float_8(u);
+    }
+#else
+    for (d = a->ds; d < a->de; d++) {
+        float val = 0.0f;
+        for (j = 0; j < a->n; j++) {
+            val += f16ToF32(w[d * a->n + j]) * f16ToF32(input[j]);
+        }
+        a->output[d] = val;
+    }
+#endif
+}
+
+static void matmulBF16(const MatmulThreadInfo* a) {
+    const float* input = (float*)a->input;
+    const uint16_t* w = (uint16_t*)a->weights;
+    unsigned int d, j;
+
+#if defined(USE_NEON)
+    assert(a->n % 4 == 0);
+    float32x4_t z;
+    for (d = a->ds; d < a->de; d++) {
+        z = vmovq_n_f32(0);
+        for (j = 0; j < a->n; j += 4) {
+            const float32x4_t p = vreinterpretq_f32_u32(vshll_n_u16(vld1_u16(&w[d * a->n + j]), 16));
+            z = vfmaq_f32(z, vld1q_f32(&input[j]), p);
+        }
+        a->output[d] = vaddvq_f32(z);
+    }
+#elif defined(USE_AVX2)
+    assert(a->n % 8 == 0);
+    __m256 u;
+    for (d = a->ds; d < a->de; d++) {
+        u = _mm256_set1_ps(0.0f);
+        for (j = 0; j < a->n; j += 8) {
+            u = _mm256_fmadd_ps(_mm256_loadu_ps(&input[j]), bf16x8ToF32(&w[d * a->n + j]), u);
+        }
+        a->output[d] = hsum_float_8(u);
+    }
+#else
+    for (d = a->ds; d < a->de; d++) {
+        float val = 0.0f;
+        for (j = 0; j < a->n; j++) {
+            val += bf16ToF32(w[d * a->n + j]) * input[j];
+        }
+        a->output[d] = val;
+    }
+#endif
+}
+
+static void matmulBF16vBF16(const MatmulThreadInfo* a) {
+    const uint16_t* input = (uint16_t*)a->input;
+    const uint16_t* w = (uint16_t*)a->weights;
+    unsigned int d, j;
+
+#if defined(USE_NEON)
+    assert(a->n % 4 == 0);
+    float32x4_t z;
+    for (d = a->ds; d < a->de; d++) {
+        z = vmovq_n_f32(0);
+        for (j = 0; j < a->n; j += 4) {
+            const float32x4_t q = vreinterpretq_f32_u32(vshll_n_u16(vld1_u16(&input[j]), 16));
+            const float32x4_t p = vreinterpretq_f32_u32(vshll_n_u16(vld1_u16(&w[d * a->n + j]), 16));
+            z = vfmaq_f32(z, q, p);
+        }
+        a->output[d] = vaddvq_f32(z);
+    }
+#elif defined(USE_AVX2)
+    assert(a->n % 8 == 0);
+    __m256 u;
+    for (d = a->ds; d < a->de; d++) {
+        const uint16_t* row = &w[d * a->n];
+        u = _mm256_set1_ps(0.0f);
+        j = 0;
+#if defined(USE_AVX512_BF16)
+        // 16 pairs of BF16 values are multiplied and added to 8 F32 sums by one instruction
+        for (; j + 16 <= a->n; j += 16) {
+            const __m256i x = _mm256_loadu_si256((const __m256i*)&input[j]);
+            const __m256i y = _mm256_loadu_si256((const __m256i*)&row[j]);
+            u = _mm256_dpbf16_ps(u, (__m256bh)x, (__m256bh)y);
+        }
+#endif
+        for (; j < a->n; j += 8) {
+            u = _mm256_fmadd_ps(bf16x8ToF32(&input[j]), bf16x8ToF32(&row[j]), u);
+        }
+        a->output[d] = hsum_float_8(u);
+    }
+#else
+    for (d = a->ds; d < a->de; d++) {
+        float val = 0.0f;
+        for (j = 0; j < a->n; j++) {
+            val += bf16ToF32(w[d * a->n + j]) * bf16ToF32(input[j]);
+        }
+        a->output[d] = val;
+    }
+#endif
+}
+
+static void matmulQ40(const MatmulThreadInfo* a) {
+    BlockQ40* w = (BlockQ40*)a->weights;
+    assert(a->n % QK40 == 0);
+    const float* input = (float*)a->input;
+    const unsigned int nb = a->n / QK40;
+
+    // Nibbles are unpacked straight into the registers of the multiplication, the low nibble of the byte j
+    // is the value j of the block and the high one is the value j + QK40 / 2
+#if defined(USE_NEON)
+    const uint8x16_t lowMask = vdupq_n_u8(0x0F);
+    const int8x16_t off = vdupq_n_s8(8);
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        float32x4_t acc = vmovq_n_f32(0);
+        for (unsigned int i = 0; i < nb; i++) {
+            const BlockQ40* b = &w[d * nb + i];
+            const float* x = &input[i * QK40];
+            const uint8x16_t q = vld1q_u8(b->qs);
+            const int8x16_t ql = vsubq_s8(vreinterpretq_s8_u8(vandq_u8(q, lowMask)), off);
+            const int8x16_t qh = vsubq_s8(vreinterpretq_s8_u8(vshrq_n_u8(q, 4)), off);
+            const int16x8_t ql0 = vmovl_s8(vget_low_s8(ql));
+            const int16x8_t ql1 = vmovl_s8(vget_high_s8(ql));
+            const int16x8_t qh0 = vmovl_s8(vget_low_s8(qh));
+            const int16x8_t qh1 = vmovl_s8(vget_high_s8(qh));
+            float32x4_t s0 = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(ql0))), vld1q_f32(&x[0]));
+            float32x4_t s1 = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(ql0))), vld1q_f32(&x[4]));
+            s0 = vfmaq_f32(s0, vcvtq_f32_s32(vmovl_s16(vget_low_s16(ql1))), vld1q_f32(&x[8]));
+            s1 = vfmaq_f32(s1, vcvtq_f32_s32(vmovl_s16(vget_high_s16(ql1))), vld1q_f32(&x[12]));
+            s0 = vfmaq_f32(s0, vcvtq_f32_s32(vmovl_s16(vget_low_s16(qh0))), vld1q_f32(&x[16]));
+            s1 = vfmaq_f32(s1, vcvtq_f32_s32(vmovl_s16(vget_high_s16(qh0))), vld1q_f32(&x[20]));
+            s0 = vfmaq_f32(s0, vcvtq_f32_s32(vmovl_s16(vget_low_s16(qh1))), vld1q_f32(&x[24]));
+            s1 = vfmaq_f32(s1, vcvtq_f32_s32(vmovl_s16(vget_high_s16(qh1))), vld1q_f32(&x[28]));
+            acc = vmlaq_n_f32(acc, vaddq_f32(s0, s1), f16ToF32(b->d));
+        }
+        a->output[d] = vaddvq_f32(acc);
+    }
+#elif defined(USE_AVX2)
+    const __m128i lowMask = _mm_set1_epi8(0x0F);
+    const __m128i off = _mm_set1_epi8(8);
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        __m256 acc = _mm256_setzero_ps();
+        for (unsigned int i = 0; i < nb; i++) {
+            const BlockQ40* b = &w[d * nb + i];
+            const float* x = &input[i * QK40];
+            const __m128i q = _mm_loadu_si128((const __m128i*)b->qs);
+            const __m128i ql = _mm_sub_epi8(_mm_and_si128(q, lowMask), off);
+            const __m128i qh = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(q, 4), lowMask), off);
+            // int8 -> int32 -> float, two sums hide the latency of the multiplication
+            __m256 s0 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(ql)), _mm256_loadu_ps(&x[0]));
+            __m256 s1 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(ql, 8))), _mm256_loadu_ps(&x[8]));
+            s0 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(qh)), _mm256_loadu_ps(&x[16]), s0);
+            s1 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(qh, 8))), _mm256_loadu_ps(&x[24]), s1);
+            acc = _mm256_fmadd_ps(_mm256_set1_ps(f16ToF32(b->d)), _mm256_add_ps(s0, s1), acc);
+        }
+        a->output[d] = hsum_float_8(acc);
+    }
+#else
+    float group[QK40];
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        float val = 0.0f;
+        for (unsigned int i = 0; i < nb; i++) {
+            dequantizeQ40RowKernel(&w[d * nb + i], group, QK40);
+            for (unsigned int z = 0; z < QK40; z++) {
+                val += group[z] * input[i * QK40 + z];
+            }
+        }
+        a->output[d] = val;
+    }
+#endif
+}
+
+static void matmulQ80(const MatmulThreadInfo* a) {
+    float* input = (float*)a->input;
+    const BlockQ80* weights = (BlockQ80*)a->weights;
+    assert(a->n % QK80 == 0);
+    const unsigned int nb = a->n / QK80;
+
+#if defined(USE_NEON)
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        float32x4_t acc = vmovq_n_f32(0);
+        for (unsigned int i = 0; i < nb; i++) {
+            const BlockQ80* w = &weights[d * nb + i];
+            const float* x = &input[i * QK80];
+            float32x4_t s = vmovq_n_f32(0);
+            for (unsigned int j = 0; j < QK80; j += 16) {
+                // int8 -> int16 -> int32 -> float
+                const int8x16_t q = vld1q_s8(&w->qs[j]);
+                const int16x8_t ql = vmovl_s8(vget_low_s8(q));
+                const int16x8_t qh = vmovl_s8(vget_high_s8(q));
+                s = vfmaq_f32(s, vcvtq_f32_s32(vmovl_s16(vget_low_s16(ql))), vld1q_f32(&x[j]));
+                s = vfmaq_f32(s, vcvtq_f32_s32(vmovl_s16(vget_high_s16(ql))), vld1q_f32(&x[j + 4]));
+                s = vfmaq_f32(s, vcvtq_f32_s32(vmovl_s16(vget_low_s16(qh))), vld1q_f32(&x[j + 8]));
+                s = vfmaq_f32(s, vcvtq_f32_s32(vmovl_s16(vget_high_s16(qh))), vld1q_f32(&x[j + 12]));
+            }
+            acc = vmlaq_n_f32(acc, s, f16ToF32(w->d));
+        }
+        a->output[d] = vaddvq_f32(acc);
+    }
+#elif defined(USE_AVX2)
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        __m256 acc = _mm256_setzero_ps();
+        for (unsigned int i = 0; i < nb; i++) {
+            const BlockQ80* w = &weights[d * nb + i];
+            const float* x = &input[i * QK80];
+            __m256 s = _mm256_setzero_ps();
+            for (unsigned int j = 0; j < QK80; j += 8) {
+                // int8 -> int32 -> float
+                const __m256 q = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)&w->qs[j])));
+                s = _mm256_fmadd_ps(q, _mm256_loadu_ps(&x[j]), s);
+            }
+            acc = _mm256_fmadd_ps(_mm256_set1_ps(f16ToF32(w->d)), s, acc);
+        }
+        a->output[d] = hsum_float_8(acc);
+    }
+#else
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        float sum = 0.0;
+        for (unsigned int i = 0; i < nb; i++) {
+            float s = 0.0;
+            for (unsigned int j = 0; j < QK80; j++) {
+                s += input[i * QK80 + j] * (float)weights[d * nb + i].qs[j];
+            }
+            sum += s * f16ToF32(weights[d * nb + i].d);
+        }
+        a->output[d] = sum;
+    }
+#endif
+}
+
+static void matmulQ40vQ80(const MatmulThreadInfo* a) {
+    const BlockQ40* w = (BlockQ40*)a->weights;
+    const BlockQ80* input = (BlockQ80*)a->input;
+    assert(a->n % QK40 == 0);
+    const unsigned int n = a->n / QK40;
+
+#if defined(USE_NEON)
+    float32x4_t sumv0;
+    float32x4_t sumv1;
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        sumv0 = vmovq_n_f32(0);
+        sumv1 = vmovq_n_f32(0);
+        for (unsigned int j = 0; j < n; j += 2) {
+            const BlockQ40* x0 = &w[d * n + j];
+            const BlockQ40* x1 = &w[d * n + j + 1];
+            const BlockQ80* y0 = &input[j];
+            const BlockQ80* y1 = &input[j + 1];
+
+            const uint8x16_t m4b = vdupq_n_u8(0x0F);
+            const int8x16_t  s8b = vdupq_n_s8(0x8);
+
+            const uint8x16_t v0_0 = vld1q_u8(x0->qs);
+            const uint8x16_t v0_1 = vld1q_u8(x1->qs);
+
+            // 4-bit -> 8-bit
+            const int8x16_t v0_0l = vreinterpretq_s8_u8(vandq_u8  (v0_0, m4b));
+            const int8x16_t v0_0h = vreinterpretq_s8_u8(vshrq_n_u8(v0_0, 4));
+            const int8x16_t v0_1l = vreinterpretq_s8_u8(vandq_u8  (v0_1, m4b));
+            const int8x16_t v0_1h = vreinterpretq_s8_u8(vshrq_n_u8(v0_1, 4));
+
+            // sub 8
+            const int8x16_t v0_0ls = vsubq_s8(v0_0l, s8b);
+            const int8x16_t v0_0hs = vsubq_s8(v0_0h, s8b);
+            const int8x16_t v0_1ls = vsubq_s8(v0_1l, s8b);
+            const int8x16_t v0_1hs = vsubq_s8(v0_1h, s8b);
+
+            // load y
+            const int8x16_t v1_0l = vld1q_s8(y0->qs);
+            const int8x16_t v1_0h = vld1q_s8(y0->qs + 16);
+            const int8x16_t v1_1l = vld1q_s8(y1->qs);
+            const int8x16_t v1_1h = vld1q_s8(y1->qs + 16);
+
+
+#if defined(USE_NEON_DOTPROD)
+            const int32x4_t p_0 = vdotq_s32(vdotq_s32(vdupq_n_s32(0), v0_0ls, v1_0l), v0_0hs, v1_0h);
+            const int32x4_t p_1 = vdotq_s32(vdotq_s32(vdupq_n_s32(0), v0_1ls, v1_1l), v0_1hs, v1_1h);
+
+            sumv0 = vmlaq_n_f32(sumv0, vcvtq_f32_s32(p_0), f16ToF32(x0->d)*f16ToF32(y0->d));
+            sumv1 = vmlaq_n_f32(sumv1, vcvtq_f32_s32(p_1), f16ToF32(x1->d)*f16ToF32(y1->d));
+#else
+            const int16x8_t pl0l = vmull_s8(vget_low_s8 (v0_0ls), vget_low_s8 (v1_0l));
+            const int16x8_t pl0h = vmull_s8(vget_high_s8(v0_0ls), vget_high_s8(v1_0l));
+            const int16x8_t ph0l = vmull_s8(vget_low_s8 (v0_0hs), vget_low_s8 (v1_0h));
+            const int16x8_t ph0h = vmull_s8(vget_high_s8(v0_0hs), vget_high_s8(v1_0h));
+
+            const int16x8_t pl1l = vmull_s8(vget_low_s8 (v0_1ls), vget_low_s8 (v1_1l));
+            const int16x8_t pl1h = vmull_s8(vget_high_s8(v0_1ls), vget_high_s8(v1_1l));
+            const int16x8_t ph1l = vmull_s8(vget_low_s8 (v0_1hs), vget_low_s8 (v1_1h));
+            const int16x8_t ph1h = vmull_s8(vget_high_s8(v0_1hs), vget_high_s8(v1_1h));
+
+            const int32x4_t pl0 = vaddq_s32(vpaddlq_s16(pl0l), vpaddlq_s16(pl0h));
+            const int32x4_t ph0 = vaddq_s32(vpaddlq_s16(ph0l), vpaddlq_s16(ph0h));
+            const int32x4_t pl1 = vaddq_s32(vpaddlq_s16(pl1l), vpaddlq_s16(pl1h));
+            const int32x4_t ph1 = vaddq_s32(vpaddlq_s16(ph1l), vpaddlq_s16(ph1h));
+
+            sumv0 = vmlaq_n_f32(sumv0, vcvtq_f32_s32(vaddq_s32(pl0, ph0)), f16ToF32(x0->d) * f16ToF32(y0->d));
+            sumv1 = vmlaq_n_f32(sumv1, vcvtq_f32_s32(vaddq_s32(pl1, ph1)), f16ToF32(x1->d) * f16ToF32(y1->d));
+#endif
+        }
+        a->output[d] = vaddvq_f32(sumv0) + vaddvq_f32(sumv1);
+    }
+#elif defined(USE_AVX2)
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        __m256 acc = _mm256_setzero_ps();
+
+        for (unsigned int j = 0; j < n; j++) {
+            /* Compute combined scale for the block */
+            const __m256 cd = _mm256_set1_ps( f16ToF32(w[d * n + j].d) * f16ToF32(input[j].d) );
+
+            __m256i bx = bytes_from_nibbles_32(w[d * n + j].qs);
+
+            // Now we have a vector with bytes in [ 0 .. 15 ] interval. Offset them into [ -8 .. +7 ] interval.
+            const __m256i off = _mm256_set1_epi8( 8 );
+            bx = _mm256_sub_epi8(bx, off);
+
+            __m256i by = _mm256_loadu_si256((const __m256i *)input[j].qs);
+
+            const __m256 q = mul_sum_i8_pairs_float(bx, by);
+
+            /* Multiply q with scale and accumulate */
+            acc = _mm256_fmadd_ps( cd, q, acc );
+        }
+
+        a->output[d] = hsum_float_8(acc);
+    }
+#else
+    float group[QK40];
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        float sum = 0.0;
+        for (unsigned int j = 0; j < n; j++) {
+            dequantizeQ40RowKernel(&w[d * n + j], group, QK40);
+            float iD = f16ToF32(input[j].d);
+            for (unsigned int z = 0; z < QK40; z++) {
+                sum += group[z] * iD * (float)input[j].qs[z];
+            }
+        }
+        a->output[d] = sum;
+    }
+#endif
+}
+
+static void matmulQ80vQ80(const MatmulThreadInfo* a) {
+    const BlockQ80* input = (BlockQ80*)a->input;
+    BlockQ80* weights = (BlockQ80*)a->weights;
+    assert(a->n % QK80 == 0);
+    const unsigned int nb = a->n / QK80;
+
+#if defined(USE_NEON)
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        float32x4_t sumv = vmovq_n_f32(0);
+        for (unsigned int i = 0; i < nb; i++) {
+            const BlockQ80* x = &weights[d * nb + i];
+            const BlockQ80* y = &input[i];
+
+            const int8x16_t x0 = vld1q_s8(x->qs);
+            const int8x16_t x1 = vld1q_s8(x->qs + 16);
+            const int8x16_t y0 = vld1q_s8(y->qs);
+            const int8x16_t y1 = vld1q_s8(y->qs + 16);
+
+#if defined(USE_NEON_DOTPROD)
+            const int32x4_t p = vdotq_s32(vdotq_s32(vdupq_n_s32(0), x0, y0), x1, y1);
+#else
+            const int16x8_t p0l = vmull_s8(vget_low_s8 (x0), vget_low_s8 (y0));
+            const int16x8_t p0h = vmull_s8(vget_high_s8(x0), vget_high_s8(y0));
+            const int16x8_t p1l = vmull_s8(vget_low_s8 (x1), vget_low_s8 (y1));
+            const int16x8_t p1h = vmull_s8(vget_high_s8(x1), vget_high_s8(y1));
+
+            const int32x4_t p0 = vaddq_s32(vpaddlq_s16(p0l), vpaddlq_s16(p0h));
+            const int32x4_t p1 = vaddq_s32(vpaddlq_s16(p1l), vpaddlq_s16(p1h));
+            const int32x4_t p = vaddq_s32(p0, p1);
+#endif
+            sumv = vmlaq_n_f32(sumv, vcvtq_f32_s32(p), f16ToF32(x->d) * f16ToF32(y->d));
+        }
+        a->output[d] = vaddvq_f32(sumv);
+    }
+#elif defined(USE_AVX2)
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        __m256 acc = _mm256_setzero_ps();
+
+        for (unsigned int i = 0; i < nb; i++) {
+            /* Compute combined scale for the block */
+            const __m256 cd = _mm256_set1_ps( f16ToF32(weights[d * nb + i].d) * f16ToF32(input[i].d) );
+
+            __m256i bx = _mm256_loadu_si256((const __m256i *)weights[d * nb + i].qs);
+            __m256i by = _mm256_loadu_si256((const __m256i *)input[i].qs);
+
+            const __m256 q = mul_sum_i8_pairs_float(bx, by);
+
+            /* Multiply q with scale and accumulate */
+            acc = _mm256_fmadd_ps( cd, q, acc );
+        }
+
+        a->output[d] = hsum_float_8(acc);
+    }
+#else
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        float sum = 0.0;
+        for (unsigned int i = 0; i < nb; i++) {
+            int s = 0;
+            for (unsigned int j = 0; j < QK80; j++) {
+                s += input[i].qs[j] * (int)weights[d * nb + i].qs[j];
+            }
+            sum += s * (f16ToF32(input[i].d) * f16ToF32(weights[d * nb + i].d));
+        }
+        a->output[d] = sum;
+    }
+#endif
+}
+
+static inline float dotF32(const float* a, const float* b, const unsigned int n) {
+#if defined(USE_NEON)
+    float32x4_t u = vmovq_n_f32(0);
+    for (unsigned int j = 0; j < n; j += 4)
+        u = vfmaq_f32(u, vld1q_f32(&a[j]), vld1q_f32(&b[j]));
+    return vaddvq_f32(u);
+#elif defined(USE_AVX2)
+    __m256 u = _mm256_setzero_ps();
+    for (unsigned int j = 0; j < n; j += 8)
+        u = _mm256_fmadd_ps(_mm256_loadu_ps(&a[j]), _mm256_loadu_ps(&b[j]), u);
+    return hsum_float_8(u);
+#else
+    float sum = 0.0f;
+    for (unsigned int j = 0; j < n; j++)
+        sum += a[j] * b[j];
+    return sum;
+#endif
+}
+
+// K-quants with F32 input are used by the classifier and the MoE router only, so a superblock is dequantized
+// into a buffer that stays in L1
+static void matmulQ2K(const MatmulThreadInfo* a) {
+    const BlockQ2K* w = (BlockQ2K*)a->weights;
+    const float* input = (float*)a->input;
+    assert(a->n % QKK == 0);
+    const unsigned int nb = a->n / QKK;
+    float group[QKK];
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        float sum = 0.0f;
+        for (unsigned int i = 0; i < nb; i++) {
+            dequantizeQ2KRowKernel(&w[d * nb + i], group, QKK);
+            sum += dotF32(group, &input[i * QKK], QKK);
+        }
+        a->output[d] = sum;
+    }
+}
+
+static void matmulQ3K(const MatmulThreadInfo* a) {
+    const BlockQ3K* w = (BlockQ3K*)a->weights;
+    const float* input = (float*)a->input;
+    assert(a->n % QKK == 0);
+    const unsigned int nb = a->n / QKK;
+    float group[QKK];
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        float sum = 0.0f;
+        for (unsigned int i = 0; i < nb; i++) {
+            dequantizeQ3KRowKernel(&w[d * nb + i], group, QKK);
+            sum += dotF32(group, &input[i * QKK], QKK);
+        }
+        a->output[d] = sum;
+    }
+}
+
+static void matmulQ4K(const MatmulThreadInfo* a) {
+    const BlockQ4K* w = (BlockQ4K*)a->weights;
+    const float* input = (float*)a->input;
+    assert(a->n % QKK == 0);
+    const unsigned int nb = a->n / QKK;
+    float group[QKK];
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        float sum = 0.0f;
+        for (unsigned int i = 0; i < nb; i++) {
+            dequantizeQ4KRowKernel(&w[d * nb + i], group, QKK);
+            sum += dotF32(group, &input[i * QKK], QKK);
+        }
+        a->output[d] = sum;
+    }
+}
+
+static void matmulQ6K(const MatmulThreadInfo* a) {
+    const BlockQ6K* w = (BlockQ6K*)a->weights;
+    const float* input = (float*)a->input;
+    assert(a->n % QKK == 0);
+    const unsigned int nb = a->n / QKK;
+    float group[QKK];
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        float sum = 0.0f;
+        for (unsigned int i = 0; i < nb; i++) {
+            dequantizeQ6KRowKernel(&w[d * nb + i], group, QKK);
+            sum += dotF32(group, &input[i * QKK], QKK);
+        }
+        a->output[d] = sum;
+    }
+}
+
+// A chunk of 32 values of K-quants is multiplied by one Q80 block of the input. Q2K and Q3K have SIMD code
+// for AVX2 only, NEON builds use the scalar code of the #else branch
+static void matmulQ2KvQ80(const MatmulThreadInfo* a) {
+    const BlockQ2K* w = (BlockQ2K*)a->weights;
+    const BlockQ80* input = (BlockQ80*)a->input;
+    assert(a->n % QKK == 0);
+    const unsigned int nb = a->n / QKK;
+
+#if defined(USE_AVX2)
+    // 16-bit sums of pairs of values are multiplied by the scale of their 16 values, the mins are multiplied by
+    // sums of the input the same way
+    const __m256i m2 = _mm256_set1_epi8(3);
+    const __m256i ones = _mm256_set1_epi8(1);
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        __m256 acc = _mm256_setzero_ps();
+        for (unsigned int i = 0; i < nb; i++) {
+            const BlockQ2K* x = &w[d * nb + i];
+            const float xd = f16ToF32(x->d);
+            const float xdmin = f16ToF32(x->dmin);
+            for (unsigned int j = 0; j < QKK / 128; j++) {
+                const __m256i q = _mm256_loadu_si256((const __m256i *)&x->qs[j * 32]);
+                for (unsigned int k = 0; k < 4; k++) {
+                    const BlockQ80* y = &input[i * (QKK / QK80) + j * 4 + k];
+                    const uint8_t sc0 = x->scales[j * 8 + 2 * k];
+                    const uint8_t sc1 = x->scales[j * 8 + 2 * k + 1];
+                    const __m256i by = _mm256_loadu_si256((const __m256i *)y->qs);
+                    const __m256i p = _mm256_maddubs_epi16(_mm256_and_si256(_mm256_srli_epi16(q, 2 * k), m2), by);
+                    const __m256i sums = _mm256_maddubs_epi16(ones, by);
+                    const __m256i scales = MM256_SET_M128I(_mm_set1_epi16(sc1 & 0xF), _mm_set1_epi16(sc0 & 0xF));
+                    const __m256i mins = MM256_SET_M128I(_mm_set1_epi16(sc1 >> 4), _mm_set1_epi16(sc0 >> 4));
+                    const float yd = f16ToF32(y->d);
+                    acc = _mm256_fmadd_ps(_mm256_set1_ps(xd * yd), _mm256_cvtepi32_ps(_mm256_madd_epi16(p, scales)), acc);
+                    acc = _mm256_fmadd_ps(_mm256_set1_ps(-xdmin * yd), _mm256_cvtepi32_ps(_mm256_madd_epi16(sums, mins)), acc);
+                }
+            }
+        }
+        a->output[d] = hsum_float_8(acc);
+    }
+#else
+    float group[QKK];
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        float sum = 0.0f;
+        for (unsigned int i = 0; i < nb; i++) {
+            dequantizeQ2KRowKernel(&w[d * nb + i], group, QKK);
+            for (unsigned int j = 0; j < QKK / QK80; j++) {
+                const BlockQ80* y = &input[i * (QKK / QK80) + j];
+                float s = 0.0f;
+                for (unsigned int l = 0; l < QK80; l++) s += group[j * QK80 + l] * (float)y->qs[l];
+                sum += s * f16ToF32(y->d);
+            }
+        }
+        a->output[d] = sum;
+    }
+#endif
+}
+
+static void matmulQ3KvQ80(const MatmulThreadInfo* a) {
+    const BlockQ3K* w = (BlockQ3K*)a->weights;
+    const BlockQ80* input = (BlockQ80*)a->input;
+    assert(a->n % QKK == 0);
+    const unsigned int nb = a->n / QKK;
+
+#if defined(USE_AVX2)
+    // The high bit makes quants unsigned from 0 to 7, the offset of 4 is subtracted as 4 * the input sum
+    const __m256i m2 = _mm256_set1_epi8(3);
+    const __m256i off = _mm256_set1_epi8(4);
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        __m256 acc = _mm256_setzero_ps();
+        for (unsigned int i = 0; i < nb; i++) {
+            const BlockQ3K* x = &w[d * nb + i];
+            const float xd = f16ToF32(x->d);
+            int8_t sc[QKK / 16];
+            getScalesQ3K(x->scales, sc);
+            const __m256i hmask = _mm256_loadu_si256((const __m256i *)x->hmask);
+            for (unsigned int j = 0; j < QKK / 128; j++) {
+                const __m256i q = _mm256_loadu_si256((const __m256i *)&x->qs[j * 32]);
+                for (unsigned int k = 0; k < 4; k++) {
+                    const BlockQ80* y = &input[i * (QKK / QK80) + j * 4 + k];
+                    const __m256i bit = _mm256_set1_epi8((char)(1 << (j * 4 + k)));
+                    const __m256i high = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(hmask, bit), bit), off);
+                    const __m256i qk = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(q, 2 * k), m2), high);
+                    const __m256i by = _mm256_loadu_si256((const __m256i *)y->qs);
+                    const __m256i p = _mm256_sub_epi16(_mm256_maddubs_epi16(qk, by), _mm256_maddubs_epi16(off, by));
+                    const __m256i scales = MM256_SET_M128I(_mm_set1_epi16(sc[j * 8 + 2 * k + 1]), _mm_set1_epi16(sc[j * 8 + 2 * k]));
+                    acc = _mm256_fmadd_ps(_mm256_set1_ps(xd * f16ToF32(y->d)), _mm256_cvtepi32_ps(_mm256_madd_epi16(p, scales)), acc);
+                }
+            }
+        }
+        a->output[d] = hsum_float_8(acc);
+    }
+#else
+    float group[QKK];
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        float sum = 0.0f;
+        for (unsigned int i = 0; i < nb; i++) {
+            dequantizeQ3KRowKernel(&w[d * nb + i], group, QKK);
+            for (unsigned int j = 0; j < QKK / QK80; j++) {
+                const BlockQ80* y = &input[i * (QKK / QK80) + j];
+                float s = 0.0f;
+                for (unsigned int l = 0; l < QK80; l++) s += group[j * QK80 + l] * (float)y->qs[l];
+                sum += s * f16ToF32(y->d);
+            }
+        }
+        a->output[d] = sum;
+    }
+#endif
+}
+
+// Q4K and Q6K have SIMD code for AVX2 only, NEON builds use the scalar code of the #else branch
+static void matmulQ4KvQ80(const MatmulThreadInfo* a) {
+    const BlockQ4K* w = (BlockQ4K*)a->weights;
+    const BlockQ80* input = (BlockQ80*)a->input;
+    assert(a->n % QKK == 0);
+    const unsigned int nb = a->n / QKK;
+
+#if defined(USE_AVX2)
+    // Quants are unsigned, so they are multiplied by the input directly and the min is applied to the input sum
+    const __m256i lowMask = _mm256_set1_epi8(0xF);
+    const __m256i ones = _mm256_set1_epi8(1);
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        __m256 acc = _mm256_setzero_ps();
+        for (unsigned int i = 0; i < nb; i++) {
+            const BlockQ4K* x = &w[d * nb + i];
+            const BlockQ80* y = &input[i * (QKK / QK80)];
+            const float xd = f16ToF32(x->d);
+            const float xdmin = f16ToF32(x->dmin);
+            for (unsigned int j = 0; j < QKK / 64; j++) {
+                uint8_t sc0, m0, sc1, m1;
+                getScaleMinQ4K(2 * j, x->scales, &sc0, &m0);
+                getScaleMinQ4K(2 * j + 1, x->scales, &sc1, &m1);
+                const __m256i q = _mm256_loadu_si256((const __m256i *)&x->qs[j * 32]);
+                const __m256i y0 = _mm256_loadu_si256((const __m256i *)y[2 * j].qs);
+                const __m256i y1 = _mm256_loadu_si256((const __m256i *)y[2 * j + 1].qs);
+                const float yd0 = f16ToF32(y[2 * j].d);
+                const float yd1 = f16ToF32(y[2 * j + 1].d);
+                const __m256i p0 = dot_u8_i8(_mm256_and_si256(q, lowMask), y0);
+                const __m256i p1 = dot_u8_i8(_mm256_and_si256(_mm256_srli_epi16(q, 4), lowMask), y1);
+                acc = _mm256_fmadd_ps(_mm256_set1_ps(xd * sc0 * yd0), _mm256_cvtepi32_ps(p0), acc);
+                acc = _mm256_fmadd_ps(_mm256_set1_ps(xd * sc1 * yd1), _mm256_cvtepi32_ps(p1), acc);
+                acc = _mm256_fmadd_ps(_mm256_set1_ps(-xdmin * m0 * yd0), _mm256_cvtepi32_ps(dot_u8_i8(ones, y0)), acc);
+                acc = _mm256_fmadd_ps(_mm256_set1_ps(-xdmin * m1 * yd1), _mm256_cvtepi32_ps(dot_u8_i8(ones, y1)), acc);
+            }
+        }
+        a->output[d] = hsum_float_8(acc);
+    }
+#else
+    float group[QKK];
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        float sum = 0.0f;
+        for (unsigned int i = 0; i < nb; i++) {
+            dequantizeQ4KRowKernel(&w[d * nb + i], group, QKK);
+            for (unsigned int j = 0; j < QKK / QK80; j++) {
+                const BlockQ80* y = &input[i * (QKK / QK80) + j];
+                float s = 0.0f;
+                for (unsigned int l = 0; l < QK80; l++) s += group[j * QK80 + l] * (float)y->qs[l];
+                sum += s * f16ToF32(y->d);
+            }
+        }
+        a->output[d] = sum;
+    }
+#endif
+}
+
+static void matmulQ6KvQ80(const MatmulThreadInfo* a) {
+    const BlockQ6K* w = (BlockQ6K*)a->weights;
+    const BlockQ80* input = (BlockQ80*)a->input;
+    assert(a->n % QKK == 0);
+    const unsigned int nb = a->n / QKK;
+
+#if defined(USE_AVX2)
+    // Quants are multiplied unsigned and the offset of 32 is subtracted as 32 * the input sum, then pairs of
+    // 16-bit sums are multiplied by the scales of their 16 values
+    const __m256i m4 = _mm256_set1_epi8(0xF);
+    const __m256i m2 = _mm256_set1_epi8(3);
+    const __m256i off = _mm256_set1_epi8(32);
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        __m256 acc = _mm256_setzero_ps();
+        for (unsigned int i = 0; i < nb; i++) {
+            const BlockQ6K* x = &w[d * nb + i];
+            const float xd = f16ToF32(x->d);
+            for (unsigned int j = 0; j < QKK / 128; j++) {
+                const __m256i qlA = _mm256_loadu_si256((const __m256i *)&x->ql[j * 64]);
+                const __m256i qlB = _mm256_loadu_si256((const __m256i *)&x->ql[j * 64 + 32]);
+                const __m256i qh = _mm256_loadu_si256((const __m256i *)&x->qh[j * 32]);
+                __m256i q[4];
+                q[0] = _mm256_or_si256(_mm256_and_si256(qlA, m4), _mm256_slli_epi16(_mm256_and_si256(qh, m2), 4));
+                q[1] = _mm256_or_si256(_mm256_and_si256(qlB, m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh, 2), m2), 4));
+                q[2] = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(qlA, 4), m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh, 4), m2), 4));
+                q[3] = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(qlB, 4), m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh, 6), m2), 4));
+                const int8_t* sc = &x->scales[j * 8];
+                for (unsigned int k = 0; k < 4; k++) {
+                    const BlockQ80* y = &input[i * (QKK / QK80) + j * 4 + k];
+                    const __m256i by = _mm256_loadu_si256((const __m256i *)y->qs);
+                    const __m256i p = _mm256_sub_epi16(_mm256_maddubs_epi16(q[k], by), _mm256_maddubs_epi16(off, by));
+                    const __m256i scales = MM256_SET_M128I(_mm_set1_epi16(sc[2 * k + 1]), _mm_set1_epi16(sc[2 * k]));
+                    acc = _mm256_fmadd_ps(_mm256_set1_ps(xd * f16ToF32(y->d)), _mm256_cvtepi32_ps(_mm256_madd_epi16(p, scales)), acc);
+                }
+            }
+        }
+        a->output[d] = hsum_float_8(acc);
+    }
+#else
+    float group[QKK];
+    for (unsigned int d = a->ds; d < a->de; d++) {
+        float sum = 0.0f;
+        for (unsigned int i = 0; i < nb; i++) {
+            dequantizeQ6KRowKernel(&w[d * nb + i], group, QKK);
+            for (unsigned int j = 0; j < QKK / QK80; j++) {
+                const BlockQ80* y = &input[i * (QKK / QK80) + j];
+                float s = 0.0f;
+                for (unsigned int l = 0; l < QK80; l++) s += group[j * QK80 + l] * (float)y->qs[l];
+                sum += s * f16ToF32(y->d);
+            }
+        }
+        a->output[d] = sum;
+    }
+#endif
+}
+
+// Tiled kernels compute MATMUL_TILE_ROWS rows per pass, so each input block is loaded and prepared once
+// for all rows of the tile. Rows left after the last tile are computed by the single row kernel.
+#define MATMUL_TILE_ROWS 4
+
+#if defined(USE_AVX2)
+static void matmulTail(MatmulKernel kernel, const MatmulThreadInfo* a, const unsigned int ds) {
+    if (ds < a->de) {
+        MatmulThreadInfo tail = *a;
+        tail.ds = ds;
+        kernel(&tail);
+    }
+}
+
+static void matmulF32Tiled(const MatmulThreadInfo* a) {
+    const float* input = (float*)a->input;
+    const float* w = (float*)a->weights;
+    const unsigned int n = a->n;
+    assert(n % 8 == 0);
+    unsigned int d = a->ds;
+    for (; d + MATMUL_TILE_ROWS <= a->de; d += MATMUL_TILE_ROWS) {
+        __m256 u[MATMUL_TILE_ROWS];
+        for (unsigned int r = 0; r < MATMUL_TILE_ROWS; r++) u[r] = _mm256_setzero_ps();
+        for (unsigned int j = 0; j < n; j += 8) {
+            const __m256 x = _mm256_loadu_ps(&input[j]);
+            for (unsigned int r = 0; r < MATMUL_TILE_ROWS; r++)
+                u[r] = _mm256_fmadd_ps(x, _mm256_loadu_ps(&w[(d + r) * n + j]), u[r]);
+        }
+        for (unsigned int r = 0; r < MATMUL_TILE_ROWS; r++) a->output[d + r] = hsum_float_8(u[r]);
+    }
+    matmulTail(matmulF32, a, d);
+}
+
+static void matmulQ40vQ80Tiled(const MatmulThreadInfo* a) {
+    const BlockQ40* w = (BlockQ40*)a->weights;
+    const BlockQ80* input = (BlockQ80*)a->input;
+    assert(a->n % QK40 == 0);
+    const unsigned int n = a->n / QK40;
+    const __m256i off = _mm256_set1_epi8(8);
+    unsigned int d = a->ds;
+    for (; d + MATMUL_TILE_ROWS <= a->de; d += MATMUL_TILE_ROWS) {
+        __m256 acc[MATMUL_TILE_ROWS];
+        for (unsigned int r = 0; r < MATMUL_TILE_ROWS; r++) acc[r] = _mm256_setzero_ps();
+        for (unsigned int j = 0; j < n; j++) {
+            // The dot product is symmetric, so the absolute input is computed once and weights take its signs
+            const __m256i by = _mm256_loadu_si256((const __m256i *)input[j].qs);
+            const __m256i ay = _mm256_sign_epi8(by, by);
+            const float yd = f16ToF32(input[j].d);
+            for (unsigned int r = 0; r < MATMUL_TILE_ROWS; r++) {
+                const BlockQ40* x = &w[(d + r) * n + j];
+                const __m256i bx = _mm256_sub_epi8(bytes_from_nibbles_32(x->qs), off);
+                const __m256 q = _mm256_cvtepi32_ps(dot_u8_i8(ay, _mm256_sign_epi8(bx, by)));
+                acc[r] = _mm256_fmadd_ps(_mm256_set1_ps(f16ToF32(x->d) * yd), q, acc[r]);
+            }
+        }
+        for (unsigned int r = 0; r < MATMUL_TILE_ROWS; r++) a->output[d + r] = hsum_float_8(acc[r]);
+    }
+    matmulTail(matmulQ40vQ80, a, d);
+}
+
+static void matmulQ80vQ80Tiled(const MatmulThreadInfo* a) {
+    const BlockQ80* input = (BlockQ80*)a->input;
+    const BlockQ80* weights = (BlockQ80*)a->weights;
+    assert(a->n % QK80 == 0);
+    const unsigned int nb = a->n / QK80;
+    unsigned int d = a->ds;
+    for (; d + MATMUL_TILE_ROWS <= a->de; d += MATMUL_TILE_ROWS) {
+        __m256 acc[MATMUL_TILE_ROWS];
+        for (unsigned int r = 0; r < MATMUL_TILE_ROWS; r++) acc[r] = _mm256_setzero_ps();
+        for (unsigned int i = 0; i < nb; i++) {
+            const __m256i by = _mm256_loadu_si256((const __m256i *)input[i].qs);
+            const __m256i ay = _mm256_sign_epi8(by, by);
+            const float yd = f16ToF32(input[i].d);
+            for (unsigned int r = 0; r < MATMUL_TILE_ROWS; r++) {
+                const BlockQ80* x = &weights[(d + r) * nb + i];
+                const __m256i bx = _mm256_loadu_si256((const __m256i *)x->qs);
+                const __m256 q = _mm256_cvtepi32_ps(dot_u8_i8(ay, _mm256_sign_epi8(bx, by)));
+                acc[r] = _mm256_fmadd_ps(_mm256_set1_ps(f16ToF32(x->d) * yd), q, acc[r]);
+            }
+        }
+        for (unsigned int r = 0; r < MATMUL_TILE_ROWS; r++) a->output[d + r] = hsum_float_8(acc[r]);
+    }
+    matmulTail(matmulQ80vQ80, a, d);
+}
+
+static inline float hsum_float_4(const __m128 x) {
+    __m128 res = _mm_add_ps(x, _mm_movehl_ps(x, x));
+    res = _mm_add_ss(res, _mm_movehdup_ps(res));
+    return _mm_cvtss_f32(res);
+}
+
+static float matmulQ40x4vQ80Row(const BlockQ40x4* w, const BlockQ80* input, const unsigned int n, const unsigned int r) {
+    const __m256i off = _mm256_set1_epi8(8);
+    __m256 acc = _mm256_setzero_ps();
+    for (unsigned int j = 0; j < n; j++) {
+        const __m256i bx = _mm256_sub_epi8(bytes_from_nibbles_32(w[j].qs[r]), off);
+        const __m256i by = _mm256_loadu_si256((const __m256i *)input[j].qs);
+        acc = _mm256_fmadd_ps(_mm256_set1_ps(w[j].d[r] * f16ToF32(input[j].d)), mul_sum_i8_pairs_float(bx, by), acc);
+    }
+    return hsum_float_8(acc);
+}
+
+// Weights packed by packQ40. One 256-bit load holds the nibbles of two rows, the low nibbles
+// are multiplied by the first half of the input block and the high nibbles by the second half.
+// Nibbles are used unsigned and the offset of 8 is subtracted once per block as 8 * sum(input).
+static void matmulQ40x4vQ80(const MatmulThreadInfo* a) {
+    const BlockQ40x4* w = (BlockQ40x4*)a->weights;
+    const BlockQ80* input = (BlockQ80*)a->input;
+    assert(a->n % QK40 == 0);
+    const unsigned int n = a->n / QK40;
+    const __m256i lowMask = _mm256_set1_epi8(0xF);
+    const __m256i ones = _mm256_set1_epi8(1);
+    const __m256i idx01 = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+    const __m256i idx23 = _mm256_setr_epi32(2, 2, 2, 2, 3, 3, 3, 3);
+
+    unsigned int d = a->ds;
+    for (; d < a->de && (d % Q40_PACKED_ROWS != 0 || d + Q40_PACKED_ROWS > a->de); d++)
+        a->output[d] = matmulQ40x4vQ80Row(&w[(d / Q40_PACKED_ROWS) * n], input, n, d % Q40_PACKED_ROWS);
+
+    for (; d + Q40_PACKED_ROWS <= a->de; d += Q40_PACKED_ROWS) {
+        const BlockQ40x4* x = &w[(d / Q40_PACKED_ROWS) * n];
+        __m256 acc01 = _mm256_setzero_ps();
+        __m256 acc23 = _mm256_setzero_ps();
+        for (unsigned int j = 0; j < n; j++) {
+            const __m256i y = _mm256_loadu_si256((const __m256i *)input[j].qs);
+            const __m256i yLo = _mm256_permute2x128_si256(y, y, 0x00);
+            const __m256i yHi = _mm256_permute2x128_si256(y, y, 0x11);
+            const __m256i sumY = _mm256_slli_epi32(_mm256_add_epi32(dot_u8_i8(ones, yLo), dot_u8_i8(ones, yHi)), 3);
+
+            const __m256i q01 = _mm256_loadu_si256((const __m256i *)x[j].qs[0]);
+            const __m256i q23 = _mm256_loadu_si256((const __m256i *)x[j].qs[2]);
+            const __m256i p01 = _mm256_add_epi32(
+                dot_u8_i8(_mm256_and_si256(q01, lowMask), yLo),
+                dot_u8_i8(_mm256_and_si256(_mm256_srli_epi16(q01, 4), lowMask), yHi));
+            const __m256i p23 = _mm256_add_epi32(
+                dot_u8_i8(_mm256_and_si256(q23, lowMask), yLo),
+                dot_u8_i8(_mm256_and_si256(_mm256_srli_epi16(q23, 4), lowMask), yHi));
+
+            const __m256 xd = _mm256_castps128_ps256(_mm_loadu_ps(x[j].d));
+            const __m256 yd = _mm256_set1_ps(f16ToF32(input[j].d));
+            acc01 = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_permutevar8x32_ps(xd, idx01), yd),
+                _mm256_cvtepi32_ps(_mm256_sub_epi32(p01, sumY)), acc01);
+            acc23 = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_permutevar8x32_ps(xd, idx23), yd),
+                _mm256_cvtepi32_ps(_mm256_sub_epi32(p23, sumY)), acc23);
+        }
+        a->output[d] = hsum_float_4(_mm256_castps256_ps128(acc01));
+        a->output[d + 1] = hsum_float_4(_mm256_extractf128_ps(acc01, 1));
+        a->output[d + 2] = hsum_float_4(_mm256_castps256_ps128(acc23));
+        a->output[d + 3] = hsum_float_4(_mm256_extractf128_ps(acc23, 1));
+    }
+
+    for (; d < a->de; d++)
+        a->output[d] = matmulQ40x4vQ80Row(&w[(d / Q40_PACKED_ROWS) * n], input, n, d % Q40_PACKED_ROWS);
+}
+
+// Batched kernels load each weight block once for MATMUL_BATCH_TOKENS tokens
+static void matmulF32Batch(const MatmulBatchThreadInfo* a) {
+    const float* input = (float*)a->input;
+    const float* w = (float*)a->weights;
+    const unsigned int n = a->n;
+    assert(n % 8 == 0);
+    assert(a->nTokens % MATMUL_BATCH_TOKENS == 0);
+    // Each F32 multiplication needs an input load, so two rows share the loads of the input
+    for (unsigned int t = 0; t < a->nTokens; t += MATMUL_BATCH_TOKENS) {
+        const float* x = &input[t * n];
+        unsigned int d = a->ds;
+        for (; d < a->de; d += 2) {
+            const float* w0 = &w[d * n];
+            const float* w1 = d + 1 < a->de ? &w[(d + 1) * n] : w0;
+            __m256 u0[MATMUL_BATCH_TOKENS];
+            __m256 u1[MATMUL_BATCH_TOKENS];
+            for (unsigned int k = 0; k < MATMUL_BATCH_TOKENS; k++) {
+                u0[k] = _mm256_setzero_ps();
+                u1[k] = _mm256_setzero_ps();
+            }
+            for (unsigned int j = 0; j < n; j += 8) {
+                const __m256 wx0 = _mm256_loadu_ps(&w0[j]);
+                const __m256 wx1 = _mm256_loadu_ps(&w1[j]);
+                for (unsigned int k = 0; k < MATMUL_BATCH_TOKENS; k++) {
+                    const __m256 xk = _mm256_loadu_ps(&x[k * n + j]);
+                    u0[k] = _mm256_fmadd_ps(wx0, xk, u0[k]);
+                    u1[k] = _mm256_fmadd_ps(wx1, xk, u1[k]);
+                }
+            }
+            for (unsigned int k = 0; k < MATMUL_BATCH_TOKENS; k++) {
+                a->output[(t + k) * a->d + d] = hsum_float_8(u0[k]);
+                if (d + 1 < a->de) a->output[(t + k) * a->d + d + 1] = hsum_float_8(u1[k]);
+            }
+        }
+    }
+}
+
+static void matmulQ40vQ80Batch(const MatmulBatchThreadInfo* a) {
+    const BlockQ40* w = (BlockQ40*)a->weights;
+    const BlockQ80* input = (BlockQ80*)a->input;
+    assert(a->n % QK40 == 0);
+    const unsigned int n = a->n / QK40;
+    const __m256i off = _mm256_set1_epi8(8);
+    assert(a->nTokens % MATMUL_BATCH_TOKENS == 0);
+    for (unsigned int t = 0; t < a->nTokens; t += MATMUL_BATCH_TOKENS) {
+        const BlockQ80* y = &input[t * n];
+        for (unsigned int d = a->ds; d < a->de; d++) {
+            __m256 acc[MATMUL_BATCH_TOKENS];
+            for (unsigned int k = 0; k < MATMUL_BATCH_TOKENS; k++) acc[k] = _mm256_setzero_ps();
+            for (unsigned int j = 0; j < n; j++) {
+                // The weights are unpacked once and give their signs to the input of each token
+                const BlockQ40* x = &w[d * n + j];
+                const __m256i bx = _mm256_sub_epi8(bytes_from_nibbles_32(x->qs), off);
+                const __m256i ax = _mm256_sign_epi8(bx, bx);
+                const float xd = f16ToF32(x->d);
+                for (unsigned int k = 0; k < MATMUL_BATCH_TOKENS; k++) {
+                    const __m256i by = _mm256_loadu_si256((const __m256i *)y[k * n + j].qs);
+                    const __m256 q = _mm256_cvtepi32_ps(dot_u8_i8(ax, _mm256_sign_epi8(by, bx)));
+                    acc[k] = _mm256_fmadd_ps(_mm256_set1_ps(xd * f16ToF32(y[k * n + j].d)), q, acc[k]);
+                }
+            }
+            for (unsigned int k = 0; k < MATMUL_BATCH_TOKENS; k++) a->output[(t + k) * a->d + d] = hsum_float_8(acc[k]);
+        }
+    }
+}
+
+static void matmulQ80vQ80Batch(const MatmulBatchThreadInfo* a) {
+    const BlockQ80* w = (BlockQ80*)a->weights;
+    const BlockQ80* input = (BlockQ80*)a->input;
+    assert(a->n % QK80 == 0);
+    const unsigned int nb = a->n / QK80;
+    assert(a->nTokens % MATMUL_BATCH_TOKENS == 0);
+    for (unsigned int t = 0; t < a->nTokens; t += MATMUL_BATCH_TOKENS) {
+        const BlockQ80* y = &input[t * nb];
+        for (unsigned int d = a->ds; d < a->de; d++) {
+            __m256 acc[MATMUL_BATCH_TOKENS];
+            for (unsigned int k = 0; k < MATMUL_BATCH_TOKENS; k++) acc[k] = _mm256_setzero_ps();
+            for (unsigned int i = 0; i < nb; i++) {
+                const BlockQ80* x = &w[d * nb + i];
+                const __m256i bx = _mm256_loadu_si256((const __m256i *)x->qs);
+                const __m256i ax = _mm256_sign_epi8(bx, bx);
+                const float xd = f16ToF32(x->d);
+                for (unsigned int k = 0; k < MATMUL_BATCH_TOKENS; k++) {
+                    const __m256i by = _mm256_loadu_si256((const __m256i *)y[k * nb + i].qs);
+                    const __m256 q = _mm256_cvtepi32_ps(dot_u8_i8(ax, _mm256_sign_epi8(by, bx)));
+                    acc[k] = _mm256_fmadd_ps(_mm256_set1_ps(xd * f16ToF32(y[k * nb + i].d)), q, acc[k]);
+                }
+            }
+            for (unsigned int k = 0; k < MATMUL_BATCH_TOKENS; k++) a->output[(t + k) * a->d + d] = hsum_float_8(acc[k]);
+        }
+    }
+}
+#else
+// Only the x86 variants (AVX2, AVX-512) have tiled, packed and batched kernels. NEON and scalar kernels
+// compute one row per pass and one token per row, the packed layout is not used there.
+#define matmulF32Tiled matmulF32
+#define matmulQ40vQ80Tiled matmulQ40vQ80
+#define matmulQ80vQ80Tiled matmulQ80vQ80
+#define matmulQ40x4vQ80 NULL
+#define matmulF32Batch NULL
+#define matmulQ40vQ80Batch NULL
+#define matmulQ80vQ80Batch NULL
+#endif
+
+extern const Kernels KERNELS_NAME = {
+    KERNELS_LEVEL,
+    matmulF32,
+    matmulF16,
+    matmulF16vF16,
+    matmulQ40,
+    matmulQ80,
+    matmulQ40vQ80,
+    matmulQ80vQ80,
+    matmulQ2K,
+    matmulQ3K,
+    matmulQ4K,
+    matmulQ6K,
+    matmulQ2KvQ80,
+    matmulQ3KvQ80,
+    matmulQ4KvQ80,
+    matmulQ6KvQ80,
+    matmulBF16,
+    matmulBF16vBF16,
+    matmulF32Tiled,
+    matmulQ40vQ80Tiled,
+    matmulQ80vQ80Tiled,
+    matmulQ40x4vQ80,
+    matmulF32Batch,
+    matmulQ40vQ80Batch,
+    matmulQ80vQ80Batch,
+    dequantizeQ40RowKernel,
+    quantizeQ80RowKernel,
+    dequantizeQ80RowKernel,
+    quantizeF16RowKernel,
+    dequantizeF16RowKernel,
+    dequantizeQ2KRowKernel,
+    dequantizeQ3KRowKernel,
+    dequantizeQ4KRowKernel,
+    dequantizeQ6KRowKernel,
+    quantizeBF16RowKernel,
+    dequantizeBF16RowKernel,
+    softmaxKernel,
+    sumOfSquaresKernel,
+    rmsnormKernel,
+    dotProductKernel,
+    geluKernel,
+    siluKernel,
+    mulKernel,
+    mulScalarKernel,
+    addKernel,
+};
@@ -0,0 +1,118 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "kernels.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #define KERNELS_X86
+    extern const Kernels kernelsScalar;
+    extern const Kernels kernelsAvx2;
+    extern const Kernels kernelsAvx512;
+    extern const Kernels kernelsAvx512Bf16;
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    #define KERNELS_ARM
+    #if defined(__linux__)
+        #include <sys/auxv.h>
+        #include <asm/hwcap.h>
+    #endif
+    extern const Kernels kernelsScalar;
+    extern const Kernels kernelsNeon;
+    extern const Kernels kernelsNeonDotprod;
+#else
+    extern const Kernels kernelsScalar;
+#endif
+
+static const Kernels* currentKernels = NULL;
+
+KernelsLevel parseKernelsLevel(const char* name) {
+    if (strcmp(name, "auto") == 0) return KERNELS_AUTO;
+    if (strcmp(name, "scalar") == 0) return KERNELS_SCALAR;
+    if (strcmp(name, "neon") == 0) return KERNELS_NEON;
+    if (strcmp(name, "neon-dotprod") == 0) return KERNELS_NEON_DOTPROD;
+    if (strcmp(name, "avx2") == 0) return KERNELS_AVX2;
+    if (strcmp(name, "avx512") == 0) return KERNELS_AVX512;
+    if (strcmp(name, "avx512-bf16") == 0) return KERNELS_AVX512_BF16;
+    printf("Invalid kernels level %s\n", name);
+    exit(EXIT_FAILURE);
+}
+
+const char* getKernelsLevelName(KernelsLevel level) {
+    switch (level) {
+        case KERNELS_AUTO: return "auto";
+        case KERNELS_SCALAR: return "scalar";
+        case KERNELS_NEON: return "neon";
+        case KERNELS_NEON_DOTPROD: return "neon-dotprod";
+        case KERNELS_AVX2: return "avx2";
+        case KERNELS_AVX512: return "avx512";
+        case KERNELS_AVX512_BF16: return "avx512-bf16";
+    }
+    return "unknown";
+}
+
+static const Kernels* getKernelsOfLevel(KernelsLevel level) {
+    switch (level) {
+        case KERNELS_SCALAR: return &kernelsScalar;
+#if defined(KERNELS_X86)
+        case KERNELS_AVX2: return &kernelsAvx2;
+        case KERNELS_AVX512: return &kernelsAvx512;
+        case KERNELS_AVX512_BF16: return &kernelsAvx512Bf16;
+#elif defined(KERNELS_ARM)
+        case KERNELS_NEON: return &kernelsNeon;
+        case KERNELS_NEON_DOTPROD: return &kernelsNeonDotprod;
+#endif
+        default: return NULL;
+    }
+}
+
+bool isKernelsLevelSupported(KernelsLevel level) {
+    if (getKernelsOfLevel(level) == NULL) return false;
+#if defined(KERNELS_X86)
+    // __builtin_cpu_supports checks the OS saves the vector registers as well
+    __builtin_cpu_init();
+    // Each check tests all instruction sets enabled by the compiler flags of the variant in the Makefile
+    if (level == KERNELS_AVX2)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+    if (level == KERNELS_AVX512)
+        return isKernelsLevelSupported(KERNELS_AVX2) &&
+            __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") &&
+            __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni");
+    if (level == KERNELS_AVX512_BF16)
+        return isKernelsLevelSupported(KERNELS_AVX512) && __builtin_cpu_supports("avx512bf16");
+#elif defined(KERNELS_ARM)
+    if (level == KERNELS_NEON_DOTPROD) {
+    #if defined(__linux__) && defined(HWCAP_ASIMDDP)
+        return (getauxval(AT_HWCAP) & HWCAP_ASIMDDP) != 0;
+    #elif defined(__APPLE__)
+        return true;
+    #else
+        return false;
+    #endif
+    }
+#endif
+    return true;
+}
+
+KernelsLevel detectKernelsLevel() {
+    const KernelsLevel levels[] = { KERNELS_AVX512_BF16, KERNELS_AVX512, KERNELS_AVX2, KERNELS_NEON_DOTPROD, KERNELS_NEON };
+    for (unsigned int i = 0; i < sizeof(levels) / sizeof(KernelsLevel); i++) {
+        if (isKernelsLevelSupported(levels[i])) return levels[i];
+    }
+    return KERNELS_SCALAR;
+}
+
+void setKernelsLevel(KernelsLevel level) {
+    if (level == KERNELS_AUTO) {
+        level = detectKernelsLevel();
+    } else if (!isKernelsLevelSupported(level)) {
+        printf("Kernels %s are not supported by this CPU or build\n", getKernelsLevelName(level));
+        exit(EXIT_FAILURE);
+    }
+    currentKernels = getKernelsOfLevel(level);
+}
+
+const Kernels* getKernels() {
+    if (currentKernels == NULL) {
+        setKernelsLevel(KERNELS_AUTO);
+    }
+    return currentKernels;
+}
@@ -0,0 +1,106 @@
+#ifndef KERNELS_HPP
+#define KERNELS_HPP
+
+#include "quants.hpp"
+
+enum KernelsLevel {
+    KERNELS_AUTO = -1,
+    KERNELS_SCALAR = 0,
+    KERNELS_NEON = 1,
+    KERNELS_NEON_DOTPROD = 2,
+    KERNELS_AVX2 = 3,
+    KERNELS_AVX512 = 4,
+    KERNELS_AVX512_BF16 = 5
+};
+
+struct MatmulThreadInfo {
+    float* output;
+    const void* input;
+    const void* weights;
+    unsigned int n;
+    unsigned int ds;
+    unsigned int de;
+};
+
+typedef void (*MatmulKernel)(const MatmulThreadInfo* a);
+
+// Batched kernels compute this many tokens per pass over a row, nTokens must be a multiple of it
+#define MATMUL_BATCH_TOKENS 4
+
+// nTokens input vectors follow each other in the input, the output of the token t starts at output + t * d
+struct MatmulBatchThreadInfo {
+    float* output;
+    const void* input;
+    const void* weights;
+    unsigned int n;
+    unsigned int d;
+    unsigned int nTokens;
+    unsigned int ds;
+    unsigned int de;
+};
+
+typedef void (*MatmulBatchKernel)(const MatmulBatchThreadInfo* a);
+
+// Kernels compiled for one instruction set, see kernels-impl.cpp
+struct Kernels {
+    KernelsLevel level;
+    MatmulKernel matmulF32;
+    MatmulKernel matmulF16;
+    MatmulKernel matmulF16vF16;
+    MatmulKernel matmulQ40;
+    MatmulKernel matmulQ80;
+    MatmulKernel matmulQ40vQ80;
+    MatmulKernel matmulQ80vQ80;
+    MatmulKernel matmulQ2K;
+    MatmulKernel matmulQ3K;
+    MatmulKernel matmulQ4K;
+    MatmulKernel matmulQ6K;
+    MatmulKernel matmulQ2KvQ80;
+    MatmulKernel matmulQ3KvQ80;
+    MatmulKernel matmulQ4KvQ80;
+    MatmulKernel matmulQ6KvQ80;
+    MatmulKernel matmulBF16;
+    MatmulKernel matmulBF16vBF16;
+    // Compute several rows per pass, equal to single row kernels if the instruction set has no tiled kernel (only x86 has them)
+    MatmulKernel matmulF32Tiled;
+    MatmulKernel matmulQ40vQ80Tiled;
+    MatmulKernel matmulQ80vQ80Tiled;
+    // Q40 weights packed by packQ40, NULL if the instruction set has no kernel for the packed layout (only x86 has it)
+    MatmulKernel matmulQ40x4vQ80;
+    // Each weight block is loaded once for several tokens, NULL if the instruction set has no batched kernel (only x86 has them)
+    MatmulBatchKernel matmulF32Batch;
+    MatmulBatchKernel matmulQ40vQ80Batch;
+    MatmulBatchKernel matmulQ80vQ80Batch;
+    void (*dequantizeQ40Row)(const BlockQ40* x, float* y, int k);
+    void (*quantizeQ80Row)(float* input, BlockQ80* output, int k, unsigned int nThreads, unsigned int threadIndex);
+    void (*dequantizeQ80Row)(const BlockQ80* input, float* output, int k, unsigned int nThreads, unsigned int threadIndex);
+    void (*quantizeF16Row)(const float* input, uint16_t* output, int k, unsigned int nThreads, unsigned int threadIndex);
+    void (*dequantizeF16Row)(const uint16_t* input, float* output, int k, unsigned int nThreads, unsigned int threadIndex);
+    void (*dequantizeQ2KRow)(const BlockQ2K* x, float* y, int k);
+    void (*dequantizeQ3KRow)(const BlockQ3K* x, float* y, int k);
+    void (*dequantizeQ4KRow)(const BlockQ4K* x, float* y, int k);
+    void (*dequantizeQ6KRow)(const BlockQ6K* x, float* y, int k);
+    void (*quantizeBF16Row)(const float* input, uint16_t* output, int k, unsigned int nThreads, unsigned int threadIndex);
+    void (*dequantizeBF16Row)(const uint16_t* input, float* output, int k, unsigned int nThreads, unsigned int threadIndex);
+    // Element-wise functions of funcs.cpp, they get the range of one thread
+    void (*softmax)(float* x, const unsigned int size);
+    float (*sumOfSquares)(const float* x, const unsigned int size);
+    void (*rmsnorm)(float* o, const float* x, const float ms, const float* weight, const unsigned int size);
+    float (*dotProduct)(const float* a, const float* b, const unsigned int size);
+    void (*gelu)(float* t, const unsigned int n);
+    void (*silu)(float* t, const unsigned int n);
+    void (*mul)(float* output, const float* input, const unsigned int n);
+    void (*mulScalar)(float* output, const float c, const unsigned int n);
+    void (*add)(float* output, const float* input, const unsigned int n);
+};
+
+KernelsLevel parseKernelsLevel(const char* name);
+const char* getKernelsLevelName(KernelsLevel level);
+// The best level supported by the CPU and compiled into the binary
+KernelsLevel detectKernelsLevel();
+bool isKernelsLevelSupported(KernelsLevel level);
+// Selects kernels used by later calls of getKernels(), must be called before commands are created
+void setKernelsLevel(KernelsLevel level);
+const Kernels* getKernels();
+
+#endif
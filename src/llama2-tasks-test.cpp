@@ -548,6 +548,8 @@ int main() {
 
     TransformerConfig config;
     config.useDiscForKvCache = false;
+    config.useDynamicMatmul = false;
+    config.repackWeights = false;
 
     size_t beforeBlockBytes = /* embedding */ 524288000;
     size_t blockBytes       = 809533440;
@@ -570,40 +572,57 @@ int main() {
     transformer.pos = 0;
 
     float* x = transformer.x;
-    for (int i = 0; i < spec.dim; i++) x[i] = randomF32(&state) / 120.0;
+    float* x0 = new float[spec.dim];
+    for (int i = 0; i < spec.dim; i++) x0[i] = randomF32(&state) / 120.0;
 
     TransformerArch arch = buildLlamaArch(&spec);
+    int skipLastNTasks = 2;
+    arch.inference.nTasks -= skipLastNTasks;
 
     int nThreads = 4;
     TransformerContext context;
     context.transformer = &transformer;
-    context.currentBlockIndex = 0;
     context.socket = NULL;
     context.socketPool = &socketPool;
+    TaskLoopReduction reduction(nThreads, TASK_REDUCTION_N_VALUES);
+    context.reduction = &reduction;
 
-    int skipLastNTasks = 3;
-    TaskLoop loop(nThreads, arch.inference.nTasks - skipLastNTasks, TASK_N_TYPES, arch.inference.tasks, &context);
-    long t0 = timeMs();
-    loop.run();
-    long t1 = timeMs();
+    // The first pass executes all tasks, the second one executes compiled tasks, the third one claims matmul rows dynamically
+    for (int pass = 0; pass < 3; pass++) {
+        if (pass == 2) {
+            config.useDynamicMatmul = true;
+            transformer.setDynamicMatmul(true);
+        }
+        if (pass >= 1) {
+            arch.compile(&spec, &config);
+        }
+        memcpy(x, x0, spec.dim * sizeof(float));
+        context.currentBlockIndex = 0;
 
-    freeBuffer(data);
+        TaskLoop loop(nThreads, arch.inference.nTasks, TASK_N_TYPES, arch.inference.tasks, &context);
+        long t0 = timeMs();
+        loop.run();
+        long t1 = timeMs();
 
-    int ix = -1;
-    for (int i = 0; i < spec.dim; i++) {
-        if (std::isnan(x[i]) || fabs(x[i] - expectedOutput[i]) > 0.00001) { // Optimization may cause some differences
-            ix = i;
-            break;
+        int ix = -1;
+        for (int i = 0; i < spec.dim; i++) {
+            if (std::isnan(x[i]) || fabs(x[i] - expectedOutput[i]) > 0.00001) { // Optimization may cause some differences
+                ix = i;
+                break;
+            }
+        }
+        if (ix < 0) {
+            printf("✅ Block forwarded correctly in %ldms (%s)\n", t1 - t0, pass == 0 ? "all tasks" : pass == 1 ? "compiled tasks" : "dynamic matmuls");
+        } else {
+            printf("❌ ix=%d\n", ix);
+            printf("%.9g != %.9g\n", x[ix], expectedOutput[ix]); ix++;
+            printf("%.9g != %.9g\n", x[ix], expectedOutput[ix]); ix++;
+            printf("%.9g != %.9g\n", x[ix], expectedOutput[ix]); ix++;
+            printf("%.9g != %.9g\n", x[ix], expectedOutput[ix]); ix++;
+            exit(EXIT_FAILURE);
         }
     }
-    if (ix < 0) {
-        printf("✅ Block forwarded correctly in %ldms\n", t1 - t0);
-    } else {
-        printf("❌ ix=%d\n", ix);
-        printf("%.9g != %.9g\n", x[ix], expectedOutput[ix]); ix++;
-        printf("%.9g != %.9g\n", x[ix], expectedOutput[ix]); ix++;
-        printf("%.9g != %.9g\n", x[ix], expectedOutput[ix]); ix++;
-        printf("%.9g != %.9g\n", x[ix], expectedOutput[ix]); ix++;
-        exit(EXIT_FAILURE);
-    }
+
+    delete[] x0;
+    freeBuffer(data);
 }
@@ -9,20 +9,15 @@
 
 void llamaRmsAtt(TASK_ARGS) {
     TASK_VARIABLES;
-    if (threadIndex == 0) {
-        transformer->rms = rms(transformer->x, spec->dim);
-    }
+    ctx->reduction->get(threadIndex)[TASK_REDUCTION_X_RMS] = sumOfSquares(transformer->x, spec->dim, nThreads, threadIndex);
 }
 
 void llamaRmsAttNorm(TASK_ARGS) {
     TASK_VARIABLES;
-    float* xb = (float*)transformer->buffer->getUnit(TB_UNIT_XB);
-    rmsnorm(xb, transformer->x, transformer->rms, block->rmsAtt, spec->dim, nThreads, threadIndex);
-}
-
-void llamaQuantizeRmsAtt(TASK_ARGS) {
-    TASK_VARIABLES;
-    quantizeUnitBuffer(nThreads, threadIndex, ctx, TB_UNIT_XB, TB_UNIT_XB_QUANTIZED);
+    // Next tasks read only xbq, so xb in F32 is not written
+    void* xbq = transformer->buffer->getUnit(TB_UNIT_XB_QUANTIZED);
+    float ms = rmsFromSumOfSquares(ctx->reduction->sum(TASK_REDUCTION_X_RMS), spec->dim);
+    rmsnormQuantize(xbq, spec->bufferFloatType, NULL, transformer->x, ms, block->rmsAtt, spec->dim, nThreads, threadIndex);
 }
 
 void llamaSyncRmsAtt(TASK_ARGS) {
@@ -117,37 +112,21 @@ void llamaSyncAtt(TASK_ARGS) {
     syncSliceOfSlicedBuffer(nThreads, threadIndex, ctx, TB_SLICED_XBV_QUANTIZED);
 }
 
-void llamaDequantizeAtt(TASK_ARGS) {
-    TASK_VARIABLES;
-    dequantizeSlicedBuffer(nThreads, threadIndex, ctx, false, TB_SLICED_XBV_QUANTIZED, TB_SLICED_XBV);    
-}
-
 void llamaMergeAtt(TASK_ARGS) {
     TASK_VARIABLES;
-    for (slice_index_t sliceIndex = 0; sliceIndex < spec->nSlices; sliceIndex++) {
-        float* xbv = (float*)transformer->buffer->getSliced(TB_SLICED_XBV, sliceIndex);
-        add(transformer->x, xbv, spec->dim, nThreads, threadIndex);
-    }
+    mergeSlicedBuffer(nThreads, threadIndex, ctx, TB_SLICED_XBV, TB_SLICED_XBV_QUANTIZED, transformer->x);
 }
 
 void llamaRmfFfn(TASK_ARGS) {
     TASK_VARIABLES;
-    if (threadIndex == 0) {
-        transformer->rms = rms(transformer->x, spec->dim);
-    }
+    ctx->reduction->get(threadIndex)[TASK_REDUCTION_X_RMS] = sumOfSquares(transformer->x, spec->dim, nThreads, threadIndex);
 }
 
 void llamaRmfFfnNorm(TASK_ARGS) {
     TASK_VARIABLES;
-    float* xb = (float*)transformer->buffer->getUnit(TB_UNIT_XB);
-    float* x = (float*)transformer->x;
-
-    rmsnorm(xb, x, transformer->rms, block->rmsFfn, spec->dim, nThreads, threadIndex);
-}
-
-void llamaQuantizeRmfFfn(TASK_ARGS) {
-    TASK_VARIABLES;
-    quantizeUnitBuffer(nThreads, threadIndex, ctx, TB_UNIT_XB, TB_UNIT_XB_QUANTIZED);
+    void* xbq = transformer->buffer->getUnit(TB_UNIT_XB_QUANTIZED);
+    float ms = rmsFromSumOfSquares(ctx->reduction->sum(TASK_REDUCTION_X_RMS), spec->dim);
+    rmsnormQuantize(xbq, spec->bufferFloatType, NULL, transformer->x, ms, block->rmsFfn, spec->dim, nThreads, threadIndex);
 }
 
 void llamaSyncFfn(TASK_ARGS) {
@@ -158,25 +137,11 @@ void llamaSyncFfn(TASK_ARGS) {
 void llamaFfn0(TASK_ARGS) {
     TASK_VARIABLES;
 
-    float* xb = (float*)transformer->buffer->getUnit(TB_UNIT_XB_QUANTIZED);
-    float* hb0 = (float*)transformer->buffer->getSliced(TB_SLICED_HB, transformer->sliceIndex);
-
-    block->w10mm->forward(xb, hb0, nThreads, threadIndex);
-    block->w30mm->forward(xb, block->hb20, nThreads, threadIndex);
+    void* xbq = transformer->buffer->getUnit(TB_UNIT_XB_QUANTIZED);
+    void* hbq0 = transformer->buffer->getSliced(TB_SLICED_HB_QUANTIZED, transformer->sliceIndex);
 
-    if (spec->hiddenAct == SILU) {
-        silu(hb0, block->w10Slice->d0, nThreads, threadIndex);
-    } else if (spec->hiddenDim == GELU) {
-        gelu(hb0, block->w10Slice->d0, nThreads, threadIndex);
-    } else {
-        assert(false);
-    }
-    mul(hb0, block->hb20, block->w10Slice->d0, nThreads, threadIndex);
-}
-
-void llamaFfn1(TASK_ARGS) {
-    TASK_VARIABLES;
-    quantizeSlicedBuffer(nThreads, threadIndex, ctx, true, TB_SLICED_HB, TB_SLICED_HB_QUANTIZED);
+    // w1 and w3 compute the same rows, so hb is written only in the buffer float type
+    block->w10mm->forwardGated(block->w30mm, getHiddenActivation(spec), xbq, hbq0, spec->bufferFloatType, nThreads, threadIndex);
 }
 
 void llamaFfn2(TASK_ARGS) {
@@ -198,17 +163,9 @@ void llamaSyncFfn2(TASK_ARGS) {
     syncSliceOfSlicedBuffer(nThreads, threadIndex, ctx, TB_SLICED_XBV_QUANTIZED);
 }
 
-void llamaDequantizeFfn2(TASK_ARGS) {
-    TASK_VARIABLES;
-    dequantizeSlicedBuffer(nThreads, threadIndex, ctx, false, TB_SLICED_XBV_QUANTIZED, TB_SLICED_XBV);
-}
-
 void llamaMergeFfn2(TASK_ARGS) {
     TASK_VARIABLES;
-    for (slice_index_t sliceIndex = 0; sliceIndex < spec->nSlices; sliceIndex++) {
-        float* xbv = (float*)transformer->buffer->getSliced(TB_SLICED_XBV, sliceIndex);
-        add(transformer->x, xbv, spec->dim, nThreads, threadIndex);
-    }
+    mergeSlicedBuffer(nThreads, threadIndex, ctx, TB_SLICED_XBV, TB_SLICED_XBV_QUANTIZED, transformer->x);
 }
 
 void llamaNextBlock(TASK_ARGS) {
@@ -221,16 +178,14 @@ void llamaNextBlock(TASK_ARGS) {
 
 void llamaRmsFinal(TASK_ARGS) {
     TASK_VARIABLES;
-    if (threadIndex == 0) {
-        float* x = transformer->x;
-        transformer->rms = rms(x, spec->dim);
-    }
+    ctx->reduction->get(threadIndex)[TASK_REDUCTION_X_RMS] = sumOfSquares(transformer->x, spec->dim, nThreads, threadIndex);
 }
 
 void llamaRmsFinalNorm(TASK_ARGS) {
     TASK_VARIABLES;
     float* x = transformer->x;
-    rmsnorm(x, x, transformer->rms, (float*)transformer->rmsFinal, spec->dim, nThreads, threadIndex);
+    float ms = rmsFromSumOfSquares(ctx->reduction->sum(TASK_REDUCTION_X_RMS), spec->dim);
+    rmsnorm(x, x, ms, (float*)transformer->rmsFinal, spec->dim, nThreads, threadIndex);
 }
 
 void llamaFinalize(TASK_ARGS) {
@@ -243,56 +198,57 @@ TransformerArch buildLlamaArch(TransformerSpec* spec) {
 
     // inference
 
-    a.I(sendPos, TASK_TYPE_TRANSFER);
+    // Transfers are queued to the I/O thread before the compute that doesn't depend on them
+    a.I(sendPos, "sendPos", TASK_TYPE_TRANSFER, TASK_HINT_SYNC | TASK_HINT_ASYNC);
+    a.I(llamaRmsAtt, "llamaRmsAtt", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN);
     for (int i = 0; i < spec->nLayers; i++) {
-        a.I(llamaRmsAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaRmsAttNorm, TASK_TYPE_INFERENCE);
-        a.I(llamaQuantizeRmsAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaSyncRmsAtt, TASK_TYPE_TRANSFER);
-        a.I(llamaQkv, TASK_TYPE_INFERENCE);
-        a.I(llamaRope, TASK_TYPE_INFERENCE);
-        a.I(llamaMultiheadAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaQuantizeMultiheadAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaQuantizeAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaSyncAtt, TASK_TYPE_TRANSFER);
-        a.I(llamaDequantizeAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaMergeAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaRmfFfn, TASK_TYPE_INFERENCE);
-        a.I(llamaRmfFfnNorm, TASK_TYPE_INFERENCE);
-        a.I(llamaQuantizeRmfFfn, TASK_TYPE_INFERENCE);
-        a.I(llamaSyncFfn, TASK_TYPE_TRANSFER);
-        a.I(llamaFfn0, TASK_TYPE_INFERENCE);
-        a.I(llamaFfn1, TASK_TYPE_INFERENCE);
-        a.I(llamaFfn2, TASK_TYPE_INFERENCE);
-        a.I(llamaQuantizeFfn2, TASK_TYPE_INFERENCE);
-        a.I(llamaSyncFfn2, TASK_TYPE_TRANSFER);
-        a.I(llamaDequantizeFfn2, TASK_TYPE_INFERENCE);
-        a.I(llamaMergeFfn2, TASK_TYPE_INFERENCE);
-        a.I(llamaNextBlock, TASK_TYPE_INFERENCE);
+        a.I(llamaRmsAttNorm, "llamaRmsAttNorm", TASK_TYPE_INFERENCE);
+        a.I(llamaSyncRmsAtt, "llamaSyncRmsAtt", TASK_TYPE_TRANSFER, TASK_HINT_SYNC | TASK_HINT_ASYNC);
+        a.I(llamaQkv, "llamaQkv", TASK_TYPE_INFERENCE, TASK_HINT_MATMUL);
+        a.I(llamaRope, "llamaRope", TASK_TYPE_INFERENCE);
+        // Overwrites xb (and xbq for F32 buffers) sent by llamaSyncRmsAtt
+        a.I(llamaMultiheadAtt, "llamaMultiheadAtt", TASK_TYPE_INFERENCE, TASK_HINT_AWAIT);
+        a.I(llamaSyncAtt, "llamaSyncAtt", TASK_TYPE_TRANSFER, TASK_HINT_SYNC | TASK_HINT_ASYNC);
+        a.I(llamaQuantizeMultiheadAtt, "llamaQuantizeMultiheadAtt", TASK_TYPE_INFERENCE, TASK_HINT_QUANTIZE);
+        a.I(llamaAtt, "llamaAtt", TASK_TYPE_INFERENCE, TASK_HINT_DIM_OUT | TASK_HINT_MATMUL);
+        a.I(llamaQuantizeAtt, "llamaQuantizeAtt", TASK_TYPE_INFERENCE, TASK_HINT_QUANTIZE | TASK_HINT_WORKER_ONLY);
+        a.I(llamaMergeAtt, "llamaMergeAtt", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN | TASK_HINT_DIM_OUT | TASK_HINT_AWAIT);
+        a.I(llamaRmfFfn, "llamaRmfFfn", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN);
+        a.I(llamaRmfFfnNorm, "llamaRmfFfnNorm", TASK_TYPE_INFERENCE);
+        a.I(llamaSyncFfn, "llamaSyncFfn", TASK_TYPE_TRANSFER, TASK_HINT_SYNC | TASK_HINT_ASYNC);
+        a.I(llamaSyncFfn2, "llamaSyncFfn2", TASK_TYPE_TRANSFER, TASK_HINT_SYNC | TASK_HINT_ASYNC);
+        a.I(llamaFfn0, "llamaFfn0", TASK_TYPE_INFERENCE);
+        a.I(llamaFfn2, "llamaFfn2", TASK_TYPE_INFERENCE, TASK_HINT_DIM_OUT | TASK_HINT_MATMUL);
+        a.I(llamaQuantizeFfn2, "llamaQuantizeFfn2", TASK_TYPE_INFERENCE, TASK_HINT_QUANTIZE | TASK_HINT_WORKER_ONLY);
+        a.I(llamaMergeFfn2, "llamaMergeFfn2", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN | TASK_HINT_DIM_OUT | TASK_HINT_AWAIT);
+        // The next rms reads x in the same ranges as the merge, so no barrier is needed between them
+        if (i + 1 < spec->nLayers) {
+            a.I(llamaRmsAtt, "llamaRmsAtt", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN);
+        } else {
+            a.I(llamaRmsFinal, "llamaRmsFinal", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN);
+        }
+        a.I(llamaNextBlock, "llamaNextBlock", TASK_TYPE_INFERENCE, TASK_HINT_SERIAL | TASK_HINT_NEXT_BLOCK);
     }
-    a.I(llamaRmsFinal, TASK_TYPE_INFERENCE);
-    a.I(llamaRmsFinalNorm, TASK_TYPE_INFERENCE);
-    a.I(llamaFinalize, TASK_TYPE_INFERENCE);
+    a.I(llamaRmsFinalNorm, "llamaRmsFinalNorm", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN | TASK_HINT_DIM_OUT);
+    a.I(llamaFinalize, "llamaFinalize", TASK_TYPE_INFERENCE, TASK_HINT_VOCAB_OUT | TASK_HINT_MATMUL);
 
     // worker
 
     for (int i = 0; i < spec->nLayers; i++) {
-        a.W(llamaSyncRmsAtt, TASK_TYPE_TRANSFER);
-        a.W(llamaQkv, TASK_TYPE_INFERENCE);
-        a.W(llamaRope, TASK_TYPE_INFERENCE);
-        a.W(llamaMultiheadAtt, TASK_TYPE_INFERENCE);
-        a.W(llamaQuantizeMultiheadAtt, TASK_TYPE_INFERENCE);
-        a.W(llamaAtt, TASK_TYPE_INFERENCE);
-        a.W(llamaQuantizeAtt, TASK_TYPE_INFERENCE);
-        a.W(llamaSyncAtt, TASK_TYPE_TRANSFER);
-        a.W(llamaSyncFfn, TASK_TYPE_TRANSFER);
-        a.W(llamaFfn0, TASK_TYPE_INFERENCE);
-        a.W(llamaFfn1, TASK_TYPE_INFERENCE);
-        a.W(llamaFfn2, TASK_TYPE_INFERENCE);
-        a.W(llamaQuantizeFfn2, TASK_TYPE_INFERENCE);
-        a.W(llamaSyncFfn2, TASK_TYPE_TRANSFER);
-        a.W(llamaNextBlock, TASK_TYPE_INFERENCE);
+        a.W(llamaSyncRmsAtt, "llamaSyncRmsAtt", TASK_TYPE_TRANSFER, TASK_HINT_SYNC);
+        a.W(llamaQkv, "llamaQkv", TASK_TYPE_INFERENCE, TASK_HINT_MATMUL);
+        a.W(llamaRope, "llamaRope", TASK_TYPE_INFERENCE);
+        a.W(llamaMultiheadAtt, "llamaMultiheadAtt", TASK_TYPE_INFERENCE);
+        a.W(llamaQuantizeMultiheadAtt, "llamaQuantizeMultiheadAtt", TASK_TYPE_INFERENCE, TASK_HINT_QUANTIZE);
+        a.W(llamaAtt, "llamaAtt", TASK_TYPE_INFERENCE, TASK_HINT_DIM_OUT | TASK_HINT_MATMUL);
+        a.W(llamaQuantizeAtt, "llamaQuantizeAtt", TASK_TYPE_INFERENCE, TASK_HINT_QUANTIZE | TASK_HINT_WORKER_ONLY);
+        a.W(llamaSyncAtt, "llamaSyncAtt", TASK_TYPE_TRANSFER, TASK_HINT_SYNC);
+        a.W(llamaSyncFfn, "llamaSyncFfn", TASK_TYPE_TRANSFER, TASK_HINT_SYNC);
+        a.W(llamaFfn0, "llamaFfn0", TASK_TYPE_INFERENCE);
+        a.W(llamaFfn2, "llamaFfn2", TASK_TYPE_INFERENCE, TASK_HINT_DIM_OUT | TASK_HINT_MATMUL);
+        a.W(llamaQuantizeFfn2, "llamaQuantizeFfn2", TASK_TYPE_INFERENCE, TASK_HINT_QUANTIZE | TASK_HINT_WORKER_ONLY);
+        a.W(llamaSyncFfn2, "llamaSyncFfn2", TASK_TYPE_TRANSFER, TASK_HINT_SYNC);
+        a.W(llamaNextBlock, "llamaNextBlock", TASK_TYPE_INFERENCE, TASK_HINT_SERIAL | TASK_HINT_NEXT_BLOCK);
     }
     return a;
 }
@@ -5,7 +5,6 @@
 
 void llamaRmsAtt(TASK_ARGS);
 void llamaRmsAttNorm(TASK_ARGS);
-void llamaQuantizeRmsAtt(TASK_ARGS);
 void llamaSyncRmsAtt(TASK_ARGS);
 void llamaQkv(TASK_ARGS);
 void llamaRope(TASK_ARGS);
@@ -14,7 +13,6 @@ void llamaQuantizeMultiheadAtt(TASK_ARGS);
 void llamaAtt(TASK_ARGS);
 void llamaQuantizeAtt(TASK_ARGS);
 void llamaSyncAtt(TASK_ARGS);
-void llamaDequantizeAtt(TASK_ARGS);
 void llamaMergeAtt(TASK_ARGS);
 void llamaRmfFfn(TASK_ARGS);
 void llamaRmfFfnNorm(TASK_ARGS);
@@ -1,77 +1,91 @@
 #include "llama2-tasks.hpp"
 #include "grok1-tasks.hpp"
 #include "mixtral-tasks.hpp"
+#include "funcs.hpp"
+
+void mixtralRmfFfnNorm(TASK_ARGS) {
+    TASK_VARIABLES;
+    // The router reads xb in F32, the experts read xbq
+    float* xb = (float*)transformer->buffer->getUnit(TB_UNIT_XB);
+    void* xbq = transformer->buffer->getUnit(TB_UNIT_XB_QUANTIZED);
+    float ms = rmsFromSumOfSquares(ctx->reduction->sum(TASK_REDUCTION_X_RMS), spec->dim);
+    rmsnormQuantize(xbq, spec->bufferFloatType, xb, transformer->x, ms, block->rmsFfn, spec->dim, nThreads, threadIndex);
+}
+
+void mixtralMoeAdd(TASK_ARGS) {
+    TASK_VARIABLES;
+    // Slices from workers are added to x straight from the quantized buffer
+    joinSlicedBuffer(nThreads, threadIndex, ctx, TB_SLICED_XB2, TB_SLICED_XB2_QUANTIZED, transformer->x, true);
+}
 
 TransformerArch buildMixtralArch(TransformerSpec* spec) {
     TransformerArch a;
 
     // inference
 
-    a.I(sendPos, TASK_TYPE_TRANSFER);
+    a.I(sendPos, "sendPos", TASK_TYPE_TRANSFER, TASK_HINT_SYNC | TASK_HINT_ASYNC);
+    a.I(llamaRmsAtt, "llamaRmsAtt", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN);
     for (int i = 0; i < spec->nLayers; i++) {
-        a.I(llamaRmsAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaRmsAttNorm, TASK_TYPE_INFERENCE);
-        a.I(llamaQuantizeRmsAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaSyncRmsAtt, TASK_TYPE_TRANSFER);
-        a.I(llamaQkv, TASK_TYPE_INFERENCE);
-        a.I(llamaRope, TASK_TYPE_INFERENCE);
-        a.I(llamaMultiheadAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaQuantizeMultiheadAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaQuantizeAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaSyncAtt, TASK_TYPE_TRANSFER);
-        a.I(llamaDequantizeAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaMergeAtt, TASK_TYPE_INFERENCE);
-        a.I(llamaRmfFfn, TASK_TYPE_INFERENCE);
-        a.I(llamaRmfFfnNorm, TASK_TYPE_INFERENCE);
-
-        a.I(grokMoeRouter, TASK_TYPE_INFERENCE);
-        a.I(grokMoeRouterSoftmax, TASK_TYPE_INFERENCE);
-        a.I(grokMoeTopk, TASK_TYPE_INFERENCE);
-        a.I(grokMoeNormWeights, TASK_TYPE_INFERENCE);
-        a.I(grokQuantizeMoeInput, TASK_TYPE_INFERENCE);
-        a.I(grokSyncMoeInput, TASK_TYPE_TRANSFER);
-        a.I(grokMoeBlock0, TASK_TYPE_INFERENCE);
-        a.I(grokMoeBlock1, TASK_TYPE_INFERENCE);
-        a.I(grokQuantizeMoeMul, TASK_TYPE_INFERENCE);
-        a.I(grokSyncMoeMulA, TASK_TYPE_INFERENCE);
-        a.I(grokSyncMoeMulRearrange, TASK_TYPE_INFERENCE);
-        a.I(grokSyncMoeMulB, TASK_TYPE_INFERENCE);
-        a.I(grokMoeBlock2, TASK_TYPE_INFERENCE);
-        a.I(grokQuantizeMoeOutput, TASK_TYPE_INFERENCE);
-        a.I(grokSyncMoeOutput, TASK_TYPE_TRANSFER);
-        a.I(grokDequantizeMoeOutput, TASK_TYPE_INFERENCE);
-        a.I(grokMoeAdd, TASK_TYPE_INFERENCE);
+        a.I(llamaRmsAttNorm, "llamaRmsAttNorm", TASK_TYPE_INFERENCE);
+        a.I(llamaSyncRmsAtt, "llamaSyncRmsAtt", TASK_TYPE_TRANSFER, TASK_HINT_SYNC | TASK_HINT_ASYNC);
+        a.I(llamaQkv, "llamaQkv", TASK_TYPE_INFERENCE, TASK_HINT_MATMUL);
+        a.I(llamaRope, "llamaRope", TASK_TYPE_INFERENCE);
+        a.I(llamaMultiheadAtt, "llamaMultiheadAtt", TASK_TYPE_INFERENCE, TASK_HINT_AWAIT);
+        a.I(llamaSyncAtt, "llamaSyncAtt", TASK_TYPE_TRANSFER, TASK_HINT_SYNC | TASK_HINT_ASYNC);
+        a.I(llamaQuantizeMultiheadAtt, "llamaQuantizeMultiheadAtt", TASK_TYPE_INFERENCE, TASK_HINT_QUANTIZE);
+        a.I(llamaAtt, "llamaAtt", TASK_TYPE_INFERENCE, TASK_HINT_DIM_OUT | TASK_HINT_MATMUL);
+        a.I(llamaQuantizeAtt, "llamaQuantizeAtt", TASK_TYPE_INFERENCE, TASK_HINT_QUANTIZE | TASK_HINT_WORKER_ONLY);
+        a.I(llamaMergeAtt, "llamaMergeAtt", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN | TASK_HINT_DIM_OUT | TASK_HINT_AWAIT);
+        a.I(llamaRmfFfn, "llamaRmfFfn", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN);
+        a.I(mixtralRmfFfnNorm, "mixtralRmfFfnNorm", TASK_TYPE_INFERENCE);
 
-        a.I(llamaNextBlock, TASK_TYPE_INFERENCE);
+        a.I(grokMoeRouter, "grokMoeRouter", TASK_TYPE_INFERENCE, TASK_HINT_MATMUL);
+        a.I(grokMoeRouterSoftmax, "grokMoeRouterSoftmax", TASK_TYPE_INFERENCE, TASK_HINT_SERIAL);
+        a.I(grokMoeTopk, "grokMoeTopk", TASK_TYPE_INFERENCE, TASK_HINT_SERIAL);
+        a.I(grokMoeNormWeights, "grokMoeNormWeights", TASK_TYPE_INFERENCE, TASK_HINT_SERIAL);
+        a.I(grokSyncMoeInput, "grokSyncMoeInput", TASK_TYPE_TRANSFER, TASK_HINT_SYNC | TASK_HINT_ASYNC);
+        a.I(grokSyncMoeMulA, "grokSyncMoeMulA", TASK_TYPE_TRANSFER, TASK_HINT_SYNC | TASK_HINT_ASYNC);
+        a.I(grokMoeBlock0, "grokMoeBlock0", TASK_TYPE_INFERENCE);
+        a.I(grokSyncMoeMulRearrange, "grokSyncMoeMulRearrange", TASK_TYPE_INFERENCE, TASK_HINT_SERIAL | TASK_HINT_SYNC | TASK_HINT_AWAIT);
+        a.I(grokSyncMoeMulB, "grokSyncMoeMulB", TASK_TYPE_TRANSFER, TASK_HINT_SYNC | TASK_HINT_ASYNC);
+        a.I(grokSyncMoeOutput, "grokSyncMoeOutput", TASK_TYPE_TRANSFER, TASK_HINT_SYNC | TASK_HINT_ASYNC);
+        a.I(grokMoeBlock2, "grokMoeBlock2", TASK_TYPE_INFERENCE, TASK_HINT_DIM_OUT | TASK_HINT_MATMUL);
+        a.I(grokMoeBlock3, "grokMoeBlock3", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN);
+        a.I(grokQuantizeMoeOutput, "grokQuantizeMoeOutput", TASK_TYPE_INFERENCE, TASK_HINT_QUANTIZE | TASK_HINT_WORKER_ONLY);
+        a.I(mixtralMoeAdd, "mixtralMoeAdd", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN | TASK_HINT_DIM_OUT | TASK_HINT_AWAIT);
+        // The next rms reads x in the same ranges as the merge, so no barrier is needed between them
+        if (i + 1 < spec->nLayers) {
+            a.I(llamaRmsAtt, "llamaRmsAtt", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN);
+        } else {
+            a.I(llamaRmsFinal, "llamaRmsFinal", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN);
+        }
+        a.I(llamaNextBlock, "llamaNextBlock", TASK_TYPE_INFERENCE, TASK_HINT_SERIAL | TASK_HINT_NEXT_BLOCK);
     }
-    a.I(llamaRmsFinal, TASK_TYPE_INFERENCE);
-    a.I(llamaRmsFinalNorm, TASK_TYPE_INFERENCE);
-    a.I(llamaFinalize, TASK_TYPE_INFERENCE);
+    a.I(llamaRmsFinalNorm, "llamaRmsFinalNorm", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN | TASK_HINT_DIM_OUT);
+    a.I(llamaFinalize, "llamaFinalize", TASK_TYPE_INFERENCE, TASK_HINT_VOCAB_OUT | TASK_HINT_MATMUL);
 
     // worker
 
     for (int i = 0; i < spec->nLayers; i++) {
-        a.W(llamaSyncRmsAtt, TASK_TYPE_TRANSFER);
-        a.W(llamaQkv, TASK_TYPE_INFERENCE);
-        a.W(llamaRope, TASK_TYPE_INFERENCE);
-        a.W(llamaMultiheadAtt, TASK_TYPE_INFERENCE);
-        a.W(llamaQuantizeMultiheadAtt, TASK_TYPE_INFERENCE);
-        a.W(llamaAtt, TASK_TYPE_INFERENCE);
-        a.W(llamaQuantizeAtt, TASK_TYPE_INFERENCE);
-        a.W(llamaSyncAtt, TASK_TYPE_TRANSFER);
+        a.W(llamaSyncRmsAtt, "llamaSyncRmsAtt", TASK_TYPE_TRANSFER, TASK_HINT_SYNC);
+        a.W(llamaQkv, "llamaQkv", TASK_TYPE_INFERENCE, TASK_HINT_MATMUL);
+        a.W(llamaRope, "llamaRope", TASK_TYPE_INFERENCE);
+        a.W(llamaMultiheadAtt, "llamaMultiheadAtt", TASK_TYPE_INFERENCE);
+        a.W(llamaQuantizeMultiheadAtt, "llamaQuantizeMultiheadAtt", TASK_TYPE_INFERENCE, TASK_HINT_QUANTIZE);
+        a.W(llamaAtt, "llamaAtt", TASK_TYPE_INFERENCE, TASK_HINT_DIM_OUT | TASK_HINT_MATMUL);
+        a.W(llamaQuantizeAtt, "llamaQuantizeAtt", TASK_TYPE_INFERENCE, TASK_HINT_QUANTIZE | TASK_HINT_WORKER_ONLY);
+        a.W(llamaSyncAtt, "llamaSyncAtt", TASK_TYPE_TRANSFER, TASK_HINT_SYNC);
 
-        a.W(grokSyncMoeInput, TASK_TYPE_TRANSFER);
-        a.W(grokMoeBlock0, TASK_TYPE_INFERENCE);
-        a.W(grokMoeBlock1, TASK_TYPE_INFERENCE);
-        a.W(grokQuantizeMoeMul, TASK_TYPE_INFERENCE);
-        a.W(grokSyncMoeMulA, TASK_TYPE_INFERENCE);
-        a.W(grokSyncMoeMulB, TASK_TYPE_INFERENCE);
-        a.W(grokMoeBlock2, TASK_TYPE_INFERENCE);
-        a.W(grokQuantizeMoeOutput, TASK_TYPE_INFERENCE);
-        a.W(grokSyncMoeOutput, TASK_TYPE_TRANSFER);
+        a.W(grokSyncMoeInput, "grokSyncMoeInput", TASK_TYPE_TRANSFER, TASK_HINT_SYNC);
+        a.W(grokMoeBlock0, "grokMoeBlock0", TASK_TYPE_INFERENCE);
+        a.W(grokSyncMoeMulA, "grokSyncMoeMulA", TASK_TYPE_TRANSFER, TASK_HINT_SYNC);
+        a.W(grokSyncMoeMulB, "grokSyncMoeMulB", TASK_TYPE_TRANSFER, TASK_HINT_SYNC);
+        a.W(grokMoeBlock2, "grokMoeBlock2", TASK_TYPE_INFERENCE, TASK_HINT_DIM_OUT | TASK_HINT_MATMUL);
+        a.W(grokMoeBlock3, "grokMoeBlock3", TASK_TYPE_INFERENCE, TASK_HINT_DIM_IN);
+        a.W(grokQuantizeMoeOutput, "grokQuantizeMoeOutput", TASK_TYPE_INFERENCE, TASK_HINT_QUANTIZE | TASK_HINT_WORKER_ONLY);
+        a.W(grokSyncMoeOutput, "grokSyncMoeOutput", TASK_TYPE_TRANSFER, TASK_HINT_SYNC);
 
-        a.W(llamaNextBlock, TASK_TYPE_INFERENCE);
+        a.W(llamaNextBlock, "llamaNextBlock", TASK_TYPE_INFERENCE, TASK_HINT_SERIAL | TASK_HINT_NEXT_BLOCK);
     }
 
     return a;
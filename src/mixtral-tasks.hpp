@@ -3,6 +3,8 @@
 
 #include "tasks.hpp"
 
+void mixtralRmfFfnNorm(TASK_ARGS);
+void mixtralMoeAdd(TASK_ARGS);
 TransformerArch buildMixtralArch(TransformerSpec* spec);
 
 #endif
\ No newline at end of file
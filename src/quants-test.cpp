@@ -1,8 +1,10 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cmath>
+#include <cstring>
 #include "utils.hpp"
 #include "quants.hpp"
+#include "kernels.hpp"
 
 void testQ80(const int len, int nThreads) {
     unsigned long long state = 800000010L;
@@ -34,6 +36,272 @@ void testQ80(const int len, int nThreads) {
     delete[] q80s;
 }
 
+void testF16(const int len, int nThreads) {
+    unsigned long long state = 800000010L;
+    float input[len];
+    float* output = new float[len];
+    uint16_t* f16s = new uint16_t[len];
+
+    for (int i = 0; i < len; i++) {
+        input[i] = randomF32(&state);
+        output[i] = 0;
+    }
+
+    for (int threadIndex = 0; threadIndex < nThreads; threadIndex++) {
+        quantizeF16Row(input, f16s, len, nThreads, threadIndex);
+    }
+    for (int threadIndex = 0; threadIndex < nThreads; threadIndex++) {
+        dequantizeF16Row(f16s, output, len, nThreads, threadIndex);
+    }
+
+    for (int i = 0; i < len; i++) {
+        if (f16s[i] != convertF32ToF16(input[i])) {
+            printf("❌ (%d, %d) ix=%d %d != %d nThreads=%d\n", len, nThreads, i, f16s[i], convertF32ToF16(input[i]), nThreads);
+            exit(EXIT_FAILURE);
+        }
+        if (output[i] != convertF16ToF32(f16s[i])) {
+            printf("❌ (%d, %d) ix=%d %f != %f nThreads=%d\n", len, nThreads, i, output[i], convertF16ToF32(f16s[i]), nThreads);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    delete[] output;
+    delete[] f16s;
+}
+
+void testBF16(const int len, int nThreads) {
+    unsigned long long state = 800000010L;
+    float input[len];
+    float* output = new float[len];
+    uint16_t* bf16s = new uint16_t[len];
+
+    for (int i = 0; i < len; i++) {
+        input[i] = (randomF32(&state) - 0.5f) * 1000.0f;
+        output[i] = 0;
+    }
+    // Values with a known result, placed where vectorized loops convert them
+    const uint32_t specials[][2] = {
+        { 0x3F800000, 0x3F80 }, // 1.0
+        { 0x3F808000, 0x3F80 }, // a tie rounds to the even value
+        { 0x3F818000, 0x3F82 },
+        { 0x3F80C000, 0x3F81 },
+        { 0xC0490FDB, 0xC049 }, // -pi
+        { 0x7F7FFFFF, 0x7F80 }, // the max F32 rounds to the infinity
+        { 0xFF800000, 0xFF80 }, // -inf
+        { 0x7FC00000, 0x7FC0 }, // NaN
+    };
+    const int nSpecials = sizeof(specials) / sizeof(specials[0]);
+    for (int i = 0; i < nSpecials && i < len; i++) memcpy(&input[i], &specials[i][0], sizeof(float));
+
+    for (int threadIndex = 0; threadIndex < nThreads; threadIndex++) {
+        quantizeBF16Row(input, bf16s, len, nThreads, threadIndex);
+    }
+    for (int threadIndex = 0; threadIndex < nThreads; threadIndex++) {
+        dequantizeBF16Row(bf16s, output, len, nThreads, threadIndex);
+    }
+
+    for (int i = 0; i < len; i++) {
+        const uint16_t expected = i < nSpecials ? specials[i][1] : convertF32ToBF16(input[i]);
+        if (bf16s[i] != expected) {
+            printf("❌ (%d, %d) ix=%d %04x != %04x nThreads=%d\n", len, nThreads, i, bf16s[i], expected, nThreads);
+            exit(EXIT_FAILURE);
+        }
+        const float value = convertBF16ToF32(bf16s[i]);
+        if (memcmp(&output[i], &value, sizeof(float)) != 0) {
+            printf("❌ (%d, %d) ix=%d %f != %f nThreads=%d\n", len, nThreads, i, output[i], value, nThreads);
+            exit(EXIT_FAILURE);
+        }
+        if (i >= nSpecials && fabs(output[i] - input[i]) > fabs(input[i]) / 256.0f) {
+            printf("❌ (%d, %d) ix=%d %f != %f nThreads=%d\n", len, nThreads, i, output[i], input[i], nThreads);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    delete[] output;
+    delete[] bf16s;
+}
+
+// The same levels as the vectorized conversions, AVX512_BF16 shares the code of AVX512
+const KernelsLevel quantsLevels[] = { KERNELS_SCALAR, KERNELS_NEON, KERNELS_AVX2, KERNELS_AVX512 };
+const unsigned int nQuantsLevels = sizeof(quantsLevels) / sizeof(KernelsLevel);
+
+void testQ80Kernels(const int len, int nThreads) {
+    unsigned long long state = 800000020L;
+    float* input = new float[len];
+    for (int i = 0; i < len; i++) input[i] = (randomF32(&state) - 0.5f) * 4.0f;
+    // The first block has the scale 1, so halves must be rounded away from zero like roundf() does
+    const float halves[] = { 127.0f, 2.5f, -3.5f, 0.5f, -0.5f, 0.49999997f, -126.5f, 1.5f };
+    for (unsigned int i = 0; i < sizeof(halves) / sizeof(float); i++) input[i] = halves[i];
+    BlockQ40* q40s = new BlockQ40[len / QK40];
+    for (int i = 0; i < len / QK40; i++) {
+        q40s[i].d = convertF32ToF16(randomF32(&state) / 8.0f);
+        for (int j = 0; j < QK40 / 2; j++) q40s[i].qs[j] = randomU32(&state) & 0xFF;
+    }
+
+    setKernelsLevel(KERNELS_SCALAR);
+    BlockQ80* expectedQ80s = new BlockQ80[len / QK80];
+    float* expectedQ80Output = new float[len];
+    float* expectedQ40Output = new float[len];
+    for (int threadIndex = 0; threadIndex < nThreads; threadIndex++) {
+        quantizeQ80Row(input, expectedQ80s, len, nThreads, threadIndex);
+    }
+    for (int threadIndex = 0; threadIndex < nThreads; threadIndex++) {
+        dequantizeQ80Row(expectedQ80s, expectedQ80Output, len, nThreads, threadIndex);
+    }
+    dequantizeQ40Row(q40s, expectedQ40Output, len);
+
+    BlockQ80* q80s = new BlockQ80[len / QK80];
+    float* output = new float[len];
+    for (unsigned int l = 1; l < nQuantsLevels; l++) {
+        if (!isKernelsLevelSupported(quantsLevels[l])) continue;
+        setKernelsLevel(quantsLevels[l]);
+        const char* name = getKernelsLevelName(quantsLevels[l]);
+
+        for (int threadIndex = 0; threadIndex < nThreads; threadIndex++) {
+            quantizeQ80Row(input, q80s, len, nThreads, threadIndex);
+        }
+        if (memcmp(q80s, expectedQ80s, (len / QK80) * sizeof(BlockQ80)) != 0) {
+            printf("❌ (%d, %d) quantizeQ80Row (%s) differs from the scalar kernel\n", len, nThreads, name);
+            exit(EXIT_FAILURE);
+        }
+        for (int threadIndex = 0; threadIndex < nThreads; threadIndex++) {
+            dequantizeQ80Row(q80s, output, len, nThreads, threadIndex);
+        }
+        if (memcmp(output, expectedQ80Output, len * sizeof(float)) != 0) {
+            printf("❌ (%d, %d) dequantizeQ80Row (%s) differs from the scalar kernel\n", len, nThreads, name);
+            exit(EXIT_FAILURE);
+        }
+        dequantizeQ40Row(q40s, output, len);
+        if (memcmp(output, expectedQ40Output, len * sizeof(float)) != 0) {
+            printf("❌ (%d) dequantizeQ40Row (%s) differs from the scalar kernel\n", len, name);
+            exit(EXIT_FAILURE);
+        }
+    }
+    setKernelsLevel(KERNELS_AUTO);
+
+    delete[] input;
+    delete[] q40s;
+    delete[] expectedQ80s;
+    delete[] expectedQ80Output;
+    delete[] expectedQ40Output;
+    delete[] q80s;
+    delete[] output;
+}
+
+void benchmarkQ80Kernels() {
+    // The conversions run on every sync point of a layer, so the time of a single call matters
+    const int dim = 8192;
+    const int nRuns = 2000;
+    unsigned long long state = 800000030L;
+    float* x = new float[dim];
+    float* y = new float[dim];
+    for (int i = 0; i < dim; i++) x[i] = randomF32(&state) - 0.5f;
+    BlockQ80* q80s = new BlockQ80[dim / QK80];
+    BlockQ40* q40s = new BlockQ40[dim / QK40];
+    for (int i = 0; i < dim / QK40; i++) {
+        q40s[i].d = convertF32ToF16(0.01f);
+        for (int j = 0; j < QK40 / 2; j++) q40s[i].qs[j] = randomU32(&state) & 0xFF;
+    }
+
+    for (unsigned int l = 0; l < nQuantsLevels; l++) {
+        if (!isKernelsLevelSupported(quantsLevels[l])) continue;
+        setKernelsLevel(quantsLevels[l]);
+        double us[3];
+        for (int k = 0; k < 3; k++) {
+            unsigned long long t0 = timeNs();
+            for (int r = 0; r < nRuns; r++) {
+                if (k == 0) quantizeQ80Row(x, q80s, dim, 1, 0);
+                else if (k == 1) dequantizeQ80Row(q80s, y, dim, 1, 0);
+                else dequantizeQ40Row(q40s, y, dim);
+            }
+            us[k] = (double)(timeNs() - t0) / nRuns / 1000.0;
+        }
+        printf("🕒 dim=%d (%s): quantizeQ80Row %.2f us, dequantizeQ80Row %.2f us, dequantizeQ40Row %.2f us\n",
+            dim, getKernelsLevelName(quantsLevels[l]), us[0], us[1], us[2]);
+    }
+    setKernelsLevel(KERNELS_AUTO);
+
+    delete[] x;
+    delete[] y;
+    delete[] q80s;
+    delete[] q40s;
+}
+
+float rmse(const float* a, const float* b, const int len) {
+    double sum = 0.0;
+    for (int i = 0; i < len; i++) sum += (a[i] - b[i]) * (a[i] - b[i]);
+    return (float)sqrt(sum / len);
+}
+
+void testKQuants(const int len) {
+    // Weights like values: a sum of uniform values is close to the normal distribution
+    unsigned long long state = 800000010L;
+    float* input = new float[len];
+    float* output = new float[len];
+    for (int i = 0; i < len; i++) {
+        input[i] = (randomF32(&state) + randomF32(&state) + randomF32(&state) + randomF32(&state) - 2.0f) * 0.02f;
+    }
+
+    // Q40 as written by the converter
+    BlockQ40* q40s = new BlockQ40[len / QK40];
+    for (int i = 0; i < len / QK40; i++) {
+        float absMax = 0.0f;
+        for (int j = 0; j < QK40; j++) {
+            if (fabs(input[i * QK40 + j]) > fabs(absMax)) absMax = input[i * QK40 + j];
+        }
+        const float d = absMax / -8.0f;
+        q40s[i].d = convertF32ToF16(d);
+        for (int j = 0; j < QK40 / 2; j++) {
+            int q0 = (int)fmin(15.0f, fmax(0.0f, input[i * QK40 + j] / d + 8.5f));
+            int q1 = (int)fmin(15.0f, fmax(0.0f, input[i * QK40 + j + QK40 / 2] / d + 8.5f));
+            q40s[i].qs[j] = q0 | (q1 << 4);
+        }
+    }
+    dequantizeQ40Row(q40s, output, len);
+    const float errorQ40 = rmse(input, output, len);
+
+    BlockQ80* q80s = new BlockQ80[len / QK80];
+    quantizeQ80Row(input, q80s, len, 1, 0);
+    dequantizeQ80Row(q80s, output, len, 1, 0);
+    const float errorQ80 = rmse(input, output, len);
+
+    BlockQ2K* q2ks = new BlockQ2K[len / QKK];
+    quantizeQ2KRow(input, q2ks, len);
+    dequantizeQ2KRow(q2ks, output, len);
+    const float errorQ2K = rmse(input, output, len);
+
+    BlockQ3K* q3ks = new BlockQ3K[len / QKK];
+    quantizeQ3KRow(input, q3ks, len);
+    dequantizeQ3KRow(q3ks, output, len);
+    const float errorQ3K = rmse(input, output, len);
+
+    BlockQ4K* q4ks = new BlockQ4K[len / QKK];
+    quantizeQ4KRow(input, q4ks, len);
+    dequantizeQ4KRow(q4ks, output, len);
+    const float errorQ4K = rmse(input, output, len);
+
+    BlockQ6K* q6ks = new BlockQ6K[len / QKK];
+    quantizeQ6KRow(input, q6ks, len);
+    dequantizeQ6KRow(q6ks, output, len);
+    const float errorQ6K = rmse(input, output, len);
+
+    printf("🕒 rmse: Q2K %.6f, Q3K %.6f, Q40 %.6f, Q4K %.6f, Q6K %.6f, Q80 %.6f\n",
+        errorQ2K, errorQ3K, errorQ40, errorQ4K, errorQ6K, errorQ80);
+    if (!(errorQ3K < errorQ2K && errorQ40 < errorQ3K && errorQ4K < errorQ40 && errorQ6K < errorQ4K / 3.0f && errorQ80 < errorQ6K)) {
+        printf("❌ K-quants have an unexpected error\n");
+        exit(EXIT_FAILURE);
+    }
+
+    delete[] input;
+    delete[] output;
+    delete[] q40s;
+    delete[] q80s;
+    delete[] q2ks;
+    delete[] q3ks;
+    delete[] q4ks;
+    delete[] q6ks;
+}
+
 int main() {
     initQuants();
 
@@ -51,5 +319,38 @@ int main() {
     testQ80(2752, 4);
 
     printf("✅ Q80 quantized correctly\n");
+
+    testQ80Kernels(1024, 1);
+    testQ80Kernels(2752, 3);
+    testQ80Kernels(8192, 4);
+
+    printf("✅ Q80 and Q40 kernels match the scalar ones\n");
+
+    testF16(1024, 1);
+    testF16(1024, 3);
+    testF16(1000, 1);
+    testF16(1000, 4);
+    testF16(13, 2);
+
+    printf("✅ F16 converted correctly\n");
+
+    // The conversion is vectorized differently by each instruction set
+    const KernelsLevel levels[] = { KERNELS_SCALAR, KERNELS_NEON, KERNELS_AVX2, KERNELS_AVX512_BF16 };
+    for (unsigned int l = 0; l < sizeof(levels) / sizeof(KernelsLevel); l++) {
+        if (!isKernelsLevelSupported(levels[l])) continue;
+        setKernelsLevel(levels[l]);
+        testBF16(1024, 1);
+        testBF16(1024, 3);
+        testBF16(1000, 4);
+        testBF16(13, 2);
+        printf("✅ BF16 converted correctly (%s)\n", getKernelsLevelName(levels[l]));
+    }
+    setKernelsLevel(KERNELS_AUTO);
+
+    testKQuants(QKK * 64);
+
+    printf("✅ K-quants quantized correctly\n");
+
+    benchmarkQ80Kernels();
     return EXIT_SUCCESS;
 }
@@ -2,22 +2,26 @@
 #include <cstdint>
 #include <cmath>
 #include <cassert>
+#include <cstring>
 #include "quants.hpp"
-
-#if defined(__ARM_NEON)
-    #include <arm_neon.h>
-#endif
+#include "kernels.hpp"
 
 int getNumbersPerBatch(FloatType type) {
     switch (type) {
         case F32:
             return 1;
         case F16:
+        case BF16:
             return 1;
         case Q40:
             return QK40;
         case Q80:
             return QK80;
+        case Q2K:
+        case Q3K:
+        case Q4K:
+        case Q6K:
+            return QKK;
         case FUNK:
             break;
     }
@@ -30,6 +34,7 @@ long getBatchBytes(FloatType type, int n, int d) {
         case F32:
             return n * d * sizeof(float);
         case F16:
+        case BF16:
             return n * d * sizeof(uint16_t);
         case Q40:
             {
@@ -43,6 +48,30 @@ long getBatchBytes(FloatType type, int n, int d) {
                 int blocks = n / QK80 * d;
                 return blocks * sizeof(BlockQ80);
             }
+        case Q2K:
+            {
+                assert(n % QKK == 0);
+                long blocks = (long)(n / QKK) * d;
+                return blocks * sizeof(BlockQ2K);
+            }
+        case Q3K:
+            {
+                assert(n % QKK == 0);
+                long blocks = (long)(n / QKK) * d;
+                return blocks * sizeof(BlockQ3K);
+            }
+        case Q4K:
+            {
+                assert(n % QKK == 0);
+                long blocks = (long)(n / QKK) * d;
+                return blocks * sizeof(BlockQ4K);
+            }
+        case Q6K:
+            {
+                assert(n % QKK == 0);
+                long blocks = (long)(n / QKK) * d;
+                return blocks * sizeof(BlockQ6K);
+            }
         case FUNK:
             break;
     }
@@ -85,6 +114,22 @@ uint16_t _convertF32ToF16(float value) {
     return fltInt16;
 }
 
+float convertBF16ToF32(uint16_t value) {
+    const uint32_t bits = (uint32_t)value << 16;
+    float result;
+    memcpy(&result, &bits, sizeof(float));
+    return result;
+}
+
+uint16_t convertF32ToBF16(const float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(float));
+    if ((bits & 0x7FFFFFFF) > 0x7F800000) {
+        return (bits >> 16) | 0x40; // quiet NaN
+    }
+    return (bits + 0x7FFF + ((bits >> 16) & 1)) >> 16;
+}
+
 void initF16ToF32() {
     for (int i = 0; i < 65536; i++) {
         F16ToF32[i] = _convertF16ToF32(i);
@@ -134,157 +179,356 @@ uint16_t convertF32ToF16(const float x) {
     }
 }
 
-void dequantizeQ40Row(const BlockQ40* x, float* y, int k) {
-    static const int qk = QK40;
-    assert(k % qk == 0);
-    const int nb = k / qk;
-
-#if defined(__ARM_NEON)
-    const uint8x16_t m4b = vdupq_n_u8(0x0F);
-    const int8x16_t  s8b = vdupq_n_s8(0x8);
-
-    for (int i = 0; i < nb; i++) {
-        const BlockQ40* b = &x[i];
-        const float d = convertF16ToF32(b->d);
+long getPackedQ40Bytes(int n, int d) {
+    assert(n % QK40 == 0);
+    long nTiles = (d + Q40_PACKED_ROWS - 1) / Q40_PACKED_ROWS;
+    return nTiles * (n / QK40) * sizeof(BlockQ40x4);
+}
 
-        const uint8x16_t v0_0 = vld1q_u8(b->qs);
+void packQ40(const BlockQ40* input, BlockQ40x4* output, int n, int d) {
+    assert(n % QK40 == 0);
+    const int nb = n / QK40;
+    const int nTiles = (d + Q40_PACKED_ROWS - 1) / Q40_PACKED_ROWS;
+    for (int t = 0; t < nTiles; t++) {
+        for (int j = 0; j < nb; j++) {
+            BlockQ40x4* b = &output[t * nb + j];
+            for (int r = 0; r < Q40_PACKED_ROWS; r++) {
+                int row = t * Q40_PACKED_ROWS + r;
+                if (row < d) {
+                    const BlockQ40* x = &input[row * nb + j];
+                    b->d[r] = convertF16ToF32(x->d);
+                    memcpy(b->qs[r], x->qs, QK40 / 2);
+                } else {
+                    b->d[r] = 0.0f;
+                    memset(b->qs[r], 0, QK40 / 2);
+                }
+            }
+        }
+    }
+}
 
-        const int8x16_t v0_0l = vreinterpretq_s8_u8(vandq_u8(v0_0, m4b));
-        const int8x16_t v0_0h = vreinterpretq_s8_u8(vshrq_n_u8(v0_0, 4));
+void dequantizeQ40Row(const BlockQ40* x, float* y, int k) {
+    getKernels()->dequantizeQ40Row(x, y, k);
+}
 
-        const int8x16_t v0_0ls = vsubq_s8(v0_0l, s8b);
-        const int8x16_t v0_0hs = vsubq_s8(v0_0h, s8b);
+void quantizeQ80Row(float* input, BlockQ80* output, int k, unsigned int nThreads, unsigned int threadIndex) {
+    getKernels()->quantizeQ80Row(input, output, k, nThreads, threadIndex);
+}
 
-        int8x8_t r1 = vget_low_s8(v0_0ls);
-        int8x8_t r2 = vget_high_s8(v0_0ls);
-        int8x8_t r3 = vget_low_s8(v0_0hs);
-        int8x8_t r4 = vget_high_s8(v0_0hs);
+void dequantizeQ80Row(const BlockQ80* input, float* output, int k, unsigned int nThreads, unsigned int threadIndex) {
+    getKernels()->dequantizeQ80Row(input, output, k, nThreads, threadIndex);
+}
 
-        for (int j = 0; j < 8; j++) {
-            y[i * qk + j + 0] = r1[j] * d;
-            y[i * qk + j + 8] = r2[j] * d;
-            y[i * qk + j + 16] = r3[j] * d;
-            y[i * qk + j + 24] = r4[j] * d;
+// Finds the scale and the min of n values (at most 32) for nMax + 1 levels, a few rounding scales are tried and
+// for each one the least squares fit of the scale and the min is taken
+static float fitScaleMin(const float* x, const int n, const int nMax, float* min) {
+    assert(n <= 32);
+    float xMin = x[0];
+    float xMax = x[0];
+    for (int l = 1; l < n; l++) {
+        if (x[l] < xMin) xMin = x[l];
+        if (x[l] > xMax) xMax = x[l];
+    }
+    if (xMin > 0.0f) xMin = 0.0f;
+    if (xMax == xMin) {
+        *min = -xMin;
+        return 0.0f;
+    }
+    float bestScale = (xMax - xMin) / nMax;
+    float bestMin = xMin;
+    float bestError = INFINITY;
+    for (int step = 0; step <= 20; step++) {
+        const float iScale = (nMax - 1.0f + 0.1f * step) / (xMax - xMin);
+        float sumL = 0.0f, sumL2 = 0.0f, sumXL = 0.0f, sumX = 0.0f;
+        float q[32];
+        for (int l = 0; l < n; l++) {
+            q[l] = fmaxf(0.0f, fminf((float)nMax, roundf(iScale * (x[l] - xMin))));
+            sumL += q[l];
+            sumL2 += q[l] * q[l];
+            sumXL += q[l] * x[l];
+            sumX += x[l];
+        }
+        const float det = n * sumL2 - sumL * sumL;
+        if (det <= 0.0f) continue;
+        float scale = (n * sumXL - sumX * sumL) / det;
+        float m = (sumL2 * sumX - sumL * sumXL) / det;
+        if (m > 0.0f) {
+            m = 0.0f;
+            scale = sumXL / sumL2;
+        }
+        float error = 0.0f;
+        for (int l = 0; l < n; l++) {
+            const float diff = scale * q[l] + m - x[l];
+            error += diff * diff;
+        }
+        if (error < bestError) {
+            bestError = error;
+            bestScale = scale;
+            bestMin = m;
         }
     }
-#else
-    for (int i = 0; i < nb; i++) {
-        const BlockQ40* b = &x[i];
-        const float d = convertF16ToF32(b->d);
-
-        for (int j = 0; j < qk / 2; ++j) {
-            const int x0 = (b->qs[j] & 0x0F) - 8;
-            const int x1 = (b->qs[j] >>   4) - 8;
+    *min = -bestMin;
+    return bestScale;
+}
 
-            y[i * qk + j] = x0 * d;
-            y[i * qk + j + qk / 2] = x1 * d;
+// Finds the scale of n values (at most 16) for levels from -nMax to nMax - 1, a few rounding scales are tried
+// and for each one the least squares fit of the scale is taken
+static float fitScale(const float* x, const int n, const int nMax) {
+    assert(n <= 16);
+    float amax = 0.0f;
+    float max = 0.0f;
+    for (int l = 0; l < n; l++) {
+        if (fabsf(x[l]) > amax) {
+            amax = fabsf(x[l]);
+            max = x[l];
+        }
+    }
+    if (amax == 0.0f) return 0.0f;
+    // The value with the largest magnitude is mapped to -nMax, the level without a positive counterpart
+    float bestScale = max / -nMax;
+    float bestError = INFINITY;
+    for (int step = -9; step <= 9; step++) {
+        const float iScale = -(nMax + 0.1f * step) / max;
+        float sumXL = 0.0f, sumL2 = 0.0f;
+        float q[16];
+        for (int l = 0; l < n; l++) {
+            q[l] = fmaxf((float)-nMax, fminf((float)(nMax - 1), roundf(iScale * x[l])));
+            sumXL += x[l] * q[l];
+            sumL2 += q[l] * q[l];
+        }
+        if (sumL2 <= 0.0f) continue;
+        const float scale = sumXL / sumL2;
+        float error = 0.0f;
+        for (int l = 0; l < n; l++) {
+            const float diff = scale * q[l] - x[l];
+            error += diff * diff;
+        }
+        if (error < bestError) {
+            bestError = error;
+            bestScale = scale;
         }
     }
-#endif
+    return bestScale;
 }
 
-void quantizeQ80Row(float* input, BlockQ80* output, int k, unsigned int nThreads, unsigned int threadIndex) {
-    assert(k % QK80 == 0);
-
-    const int nBlocks = k / QK80;
-    const int blocksPerThread = nBlocks / nThreads;
-    const int sk = blocksPerThread * QK80;
-    const int currentThreadBlocks = blocksPerThread + (threadIndex == nThreads - 1 ? nBlocks % nThreads : 0);
-
-    const float* x = &input[sk * threadIndex];
-    BlockQ80* y = &output[blocksPerThread * threadIndex];
-
-#if defined(__ARM_NEON)
-    float dBuf[4];
-
-    for (int i = 0; i < currentThreadBlocks; i++) {
-        float32x4_t srcv [8];
-        float32x4_t asrcv[8];
-        float32x4_t amaxv[8];
-
-        for (int j = 0; j < 8; j++) srcv[j] = vld1q_f32(x + i*32 + 4*j);
-        for (int j = 0; j < 8; j++) asrcv[j] = vabsq_f32(srcv[j]);
+// Packs 2-bit values of a superblock, the bits 2j of the byte l of a 128 value chunk hold the value 32j + l
+static void packQ2Bits(const uint8_t* q, uint8_t* qs) {
+    for (int j = 0; j < QKK; j += 128) {
+        for (int l = 0; l < 32; l++) {
+            qs[j / 4 + l] = (q[j + l] & 3) | ((q[j + 32 + l] & 3) << 2) | ((q[j + 64 + l] & 3) << 4) | ((q[j + 96 + l] & 3) << 6);
+        }
+    }
+}
 
-        for (int j = 0; j < 4; j++) amaxv[2*j] = vmaxq_f32(asrcv[2*j], asrcv[2*j+1]);
-        for (int j = 0; j < 2; j++) amaxv[4*j] = vmaxq_f32(amaxv[4*j], amaxv[4*j+2]);
-        for (int j = 0; j < 1; j++) amaxv[8*j] = vmaxq_f32(amaxv[8*j], amaxv[8*j+4]);
+void quantizeQ2KRow(const float* input, BlockQ2K* output, int k) {
+    assert(k % QKK == 0);
+    const int nb = k / QKK;
+    for (int i = 0; i < nb; i++) {
+        const float* x = &input[i * QKK];
+        BlockQ2K* y = &output[i];
+        float scales[QKK / 16];
+        float mins[QKK / 16];
+        float maxScale = 0.0f;
+        float maxMin = 0.0f;
+        for (int j = 0; j < QKK / 16; j++) {
+            scales[j] = fitScaleMin(&x[j * 16], 16, 3, &mins[j]);
+            if (scales[j] > maxScale) maxScale = scales[j];
+            if (mins[j] > maxMin) maxMin = mins[j];
+        }
+        y->d = convertF32ToF16(maxScale / 15.0f);
+        y->dmin = convertF32ToF16(maxMin / 15.0f);
+        const float dq = convertF16ToF32(y->d);
+        const float dminq = convertF16ToF32(y->dmin);
+
+        uint8_t q[QKK];
+        for (int j = 0; j < QKK / 16; j++) {
+            const uint8_t sc = dq > 0.0f ? (uint8_t)fmaxf(0.0f, fminf(15.0f, roundf(scales[j] / dq))) : 0;
+            const uint8_t m = dminq > 0.0f ? (uint8_t)fminf(15.0f, roundf(mins[j] / dminq)) : 0;
+            y->scales[j] = sc | (m << 4);
+            const float s = dq * sc;
+            const float o = dminq * m;
+            for (int l = 0; l < 16; l++) {
+                const float v = s > 0.0f ? roundf((x[j * 16 + l] + o) / s) : 0.0f;
+                q[j * 16 + l] = (uint8_t)fmaxf(0.0f, fminf(3.0f, v));
+            }
+        }
+        packQ2Bits(q, y->qs);
+    }
+}
 
-        const float amax = vmaxvq_f32(amaxv[0]);
+void dequantizeQ2KRow(const BlockQ2K* x, float* y, int k) {
+    getKernels()->dequantizeQ2KRow(x, y, k);
+}
 
-        const float d = amax / ((1 << 7) - 1);
-        const float id = d ? 1.0f/d : 0.0f;
+void quantizeQ3KRow(const float* input, BlockQ3K* output, int k) {
+    assert(k % QKK == 0);
+    const int nb = k / QKK;
+    for (int i = 0; i < nb; i++) {
+        const float* x = &input[i * QKK];
+        BlockQ3K* y = &output[i];
+        float scales[QKK / 16];
+        float amax = 0.0f;
+        float max = 0.0f;
+        for (int j = 0; j < QKK / 16; j++) {
+            scales[j] = fitScale(&x[j * 16], 16, 4);
+            if (fabsf(scales[j]) > amax) {
+                amax = fabsf(scales[j]);
+                max = scales[j];
+            }
+        }
+        // Scales are signed 6-bit values stored with the offset of 32
+        y->d = convertF32ToF16(max / -32.0f);
+        const float dq = convertF16ToF32(y->d);
+
+        uint8_t sc[QKK / 16];
+        uint8_t q[QKK];
+        for (int j = 0; j < QKK / 16; j++) {
+            const float l = dq != 0.0f ? fmaxf(-32.0f, fminf(31.0f, roundf(scales[j] / dq))) : 0.0f;
+            sc[j] = (uint8_t)(l + 32.0f);
+            const float s = dq * l;
+            for (int m = 0; m < 16; m++) {
+                const float v = s != 0.0f ? roundf(x[j * 16 + m] / s) : 0.0f;
+                q[j * 16 + m] = (uint8_t)(fmaxf(-4.0f, fminf(3.0f, v)) + 4.0f);
+            }
+        }
+        memset(y->scales, 0, sizeof(y->scales));
+        for (int j = 0; j < QKK / 16; j++) {
+            if (j < 8) y->scales[j] = sc[j] & 0xF;
+            else y->scales[j - 8] |= (sc[j] & 0xF) << 4;
+            y->scales[j % 4 + 8] |= (sc[j] >> 4) << (2 * (j / 4));
+        }
+        memset(y->hmask, 0, sizeof(y->hmask));
+        for (int j = 0; j < QKK; j++) {
+            if (q[j] > 3) y->hmask[j % 32] |= 1 << (j / 32);
+        }
+        packQ2Bits(q, y->qs);
+    }
+}
 
-        int dbi = i % 4;
-        dBuf[dbi] = d;
-        if (dbi == 3) {
-            float32x4_t dBuf32 = vld1q_f32(dBuf);
-            int16x4_t dBuf16 = (int16x4_t)vcvt_f16_f32(dBuf32);
+void dequantizeQ3KRow(const BlockQ3K* x, float* y, int k) {
+    getKernels()->dequantizeQ3KRow(x, y, k);
+}
 
-            y[i - 3].d = dBuf16[0];
-            y[i - 2].d = dBuf16[1];
-            y[i - 1].d = dBuf16[2];
-            y[i - 0].d = dBuf16[3];
+void quantizeQ4KRow(const float* input, BlockQ4K* output, int k) {
+    assert(k % QKK == 0);
+    const int nb = k / QKK;
+    for (int i = 0; i < nb; i++) {
+        const float* x = &input[i * QKK];
+        BlockQ4K* y = &output[i];
+        // The min of a sub-block is stored as a positive offset
+        float scales[8];
+        float mins[8];
+        float maxScale = 0.0f;
+        float maxMin = 0.0f;
+        for (int j = 0; j < 8; j++) {
+            scales[j] = fitScaleMin(&x[j * 32], 32, 15, &mins[j]);
+            if (scales[j] > maxScale) maxScale = scales[j];
+            if (mins[j] > maxMin) maxMin = mins[j];
         }
-
+        const float d = maxScale / 63.0f;
+        const float dmin = maxMin / 63.0f;
+        y->d = convertF32ToF16(d);
+        y->dmin = convertF32ToF16(dmin);
+        const float dq = convertF16ToF32(y->d);
+        const float dminq = convertF16ToF32(y->dmin);
+
+        uint8_t sc[8];
+        uint8_t m[8];
         for (int j = 0; j < 8; j++) {
-            const float32x4_t v  = vmulq_n_f32(srcv[j], id);
-            const int32x4_t   vi = vcvtnq_s32_f32(v);
-
-            y[i].qs[4*j + 0] = vgetq_lane_s32(vi, 0);
-            y[i].qs[4*j + 1] = vgetq_lane_s32(vi, 1);
-            y[i].qs[4*j + 2] = vgetq_lane_s32(vi, 2);
-            y[i].qs[4*j + 3] = vgetq_lane_s32(vi, 3);
+            sc[j] = dq > 0.0f ? (uint8_t)fmaxf(0.0f, fminf(63.0f, roundf(scales[j] / dq))) : 0;
+            m[j] = dminq > 0.0f ? (uint8_t)fminf(63.0f, roundf(mins[j] / dminq)) : 0;
         }
-    }
-
-    int rest = currentThreadBlocks % 4;
-    if (rest != 0) {
-        float32x4_t dBuf32 = vld1q_f32(dBuf);
-        int16x4_t dBuf16 = (int16x4_t)vcvt_f16_f32(dBuf32);
-        for (int i = 0; i < rest; i++) {
-            y[currentThreadBlocks - rest + i].d = dBuf16[i];
+        for (int j = 0; j < 4; j++) {
+            y->scales[j] = sc[j] | ((sc[j + 4] >> 4) << 6);
+            y->scales[j + 4] = m[j] | ((m[j + 4] >> 4) << 6);
+            y->scales[j + 8] = (sc[j + 4] & 0xF) | ((m[j + 4] & 0xF) << 4);
         }
-    }
-#else
-    for (int i = 0; i < currentThreadBlocks; i++) {
-        float amax = 0.0f;
 
-        for (int j = 0; j < QK80; j++) {
-            const float v = fabsf(x[i*QK80 + j]);
-            amax = amax > v ? amax : v;
+        uint8_t q[QKK];
+        for (int j = 0; j < 8; j++) {
+            const float s = dq * sc[j];
+            const float o = dminq * m[j];
+            for (int l = 0; l < 32; l++) {
+                const float v = s > 0.0f ? roundf((x[j * 32 + l] + o) / s) : 0.0f;
+                q[j * 32 + l] = (uint8_t)fmaxf(0.0f, fminf(15.0f, v));
+            }
         }
+        for (int j = 0; j < QKK; j += 64) {
+            for (int l = 0; l < 32; l++) {
+                y->qs[j / 2 + l] = q[j + l] | (q[j + 32 + l] << 4);
+            }
+        }
+    }
+}
 
-        const float d = amax / ((1 << 7) - 1);
-        const float id = d ? 1.0f/d : 0.0f;
-
-        y[i].d = convertF32ToF16(d);
+void dequantizeQ4KRow(const BlockQ4K* x, float* y, int k) {
+    getKernels()->dequantizeQ4KRow(x, y, k);
+}
 
-        for (int j = 0; j < QK80; ++j) {
-            const float x0 = x[i*QK80 + j]*id;
-            y[i].qs[j] = roundf(x0);
+void quantizeQ6KRow(const float* input, BlockQ6K* output, int k) {
+    assert(k % QKK == 0);
+    const int nb = k / QKK;
+    for (int i = 0; i < nb; i++) {
+        const float* x = &input[i * QKK];
+        BlockQ6K* y = &output[i];
+        float scales[QKK / 16];
+        float maxScale = 0.0f;
+        for (int j = 0; j < QKK / 16; j++) {
+            float amax = 0.0f;
+            for (int l = 0; l < 16; l++) {
+                const float v = fabsf(x[j * 16 + l]);
+                if (v > amax) amax = v;
+            }
+            scales[j] = amax / 31.0f;
+            if (scales[j] > maxScale) maxScale = scales[j];
+        }
+        const float d = maxScale / 127.0f;
+        y->d = convertF32ToF16(d);
+        const float dq = convertF16ToF32(y->d);
+
+        uint8_t q[QKK];
+        for (int j = 0; j < QKK / 16; j++) {
+            y->scales[j] = dq > 0.0f ? (int8_t)fminf(127.0f, roundf(scales[j] / dq)) : 0;
+            const float s = dq * y->scales[j];
+            for (int l = 0; l < 16; l++) {
+                const float v = s > 0.0f ? roundf(x[j * 16 + l] / s) : 0.0f;
+                q[j * 16 + l] = (uint8_t)(fmaxf(-32.0f, fminf(31.0f, v)) + 32.0f);
+            }
+        }
+        for (int j = 0; j < QKK; j += 128) {
+            uint8_t* ql = &y->ql[j / 2];
+            uint8_t* qh = &y->qh[j / 4];
+            for (int l = 0; l < 32; l++) {
+                const uint8_t q1 = q[j + l];
+                const uint8_t q2 = q[j + l + 32];
+                const uint8_t q3 = q[j + l + 64];
+                const uint8_t q4 = q[j + l + 96];
+                ql[l] = (q1 & 0xF) | ((q3 & 0xF) << 4);
+                ql[l + 32] = (q2 & 0xF) | ((q4 & 0xF) << 4);
+                qh[l] = (q1 >> 4) | ((q2 >> 4) << 2) | ((q3 >> 4) << 4) | ((q4 >> 4) << 6);
+            }
         }
     }
-#endif
 }
 
-void dequantizeQ80Row(const BlockQ80* input, float* output, int k, unsigned int nThreads, unsigned int threadIndex) {
-    assert(k % QK80 == 0);
+void dequantizeQ6KRow(const BlockQ6K* x, float* y, int k) {
+    getKernels()->dequantizeQ6KRow(x, y, k);
+}
 
-    const int nBlocks = k / QK80;
-    const int blocksPerThread = nBlocks / nThreads;
-    const int sk = blocksPerThread * QK80;
-    const int currentThreadBlocks = blocksPerThread + (threadIndex == nThreads - 1 ? nBlocks % nThreads : 0);
+void quantizeF16Row(const float* input, uint16_t* output, int k, unsigned int nThreads, unsigned int threadIndex) {
+    getKernels()->quantizeF16Row(input, output, k, nThreads, threadIndex);
+}
 
-    const BlockQ80* x = &input[blocksPerThread * threadIndex];
-    float* y = &output[sk * threadIndex];
+void dequantizeF16Row(const uint16_t* input, float* output, int k, unsigned int nThreads, unsigned int threadIndex) {
+    getKernels()->dequantizeF16Row(input, output, k, nThreads, threadIndex);
+}
 
-    for (int i = 0; i < currentThreadBlocks; i++) {
-        const float d = convertF16ToF32(x[i].d);
+void quantizeBF16Row(const float* input, uint16_t* output, int k, unsigned int nThreads, unsigned int threadIndex) {
+    getKernels()->quantizeBF16Row(input, output, k, nThreads, threadIndex);
+}
 
-        for (int j = 0; j < QK80; ++j) {
-            y[i*QK80 + j] = x[i].qs[j]*d;
-        }
-    }
+void dequantizeBF16Row(const uint16_t* input, float* output, int k, unsigned int nThreads, unsigned int threadIndex) {
+    getKernels()->dequantizeBF16Row(input, output, k, nThreads, threadIndex);
 }
 
 void initQuants() {
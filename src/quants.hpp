@@ -8,11 +8,18 @@ enum FloatType {
     F32 = 0,
     F16 = 1,
     Q40 = 2,
-    Q80 = 3
+    Q80 = 3,
+    Q4K = 4,
+    Q6K = 5,
+    BF16 = 6,
+    Q2K = 7,
+    Q3K = 8
 };
 
 #define QK40 32
 #define QK80 32
+// Values in a superblock of K-quants
+#define QKK 256
 
 typedef struct {
     uint16_t d; // delta
@@ -24,14 +31,79 @@ typedef struct {
     int8_t  qs[QK80]; // quants
 } BlockQ80;
 
+// 2.625 bits per value: 16 sub-blocks of 16 values, value = d * scale * q - dmin * min, with 4-bit scales and mins.
+// A chunk of 128 values is kept in 32 bytes, the bits 2j of the byte l hold the value 32j + l of the chunk.
+typedef struct {
+    uint8_t scales[QKK / 16]; // the scale in the low nibble, the min in the high nibble
+    uint8_t qs[QKK / 4]; // 2-bit quants
+    uint16_t d; // delta of scales
+    uint16_t dmin; // delta of mins
+} BlockQ2K;
+
+// 3.4375 bits per value: 16 sub-blocks of 16 values, value = d * (scale - 32) * (q - 4), with 6-bit scales.
+// The low 2 bits of quants are kept like in Q2K, the bit j of hmask[l] is the high bit of the value 32j + l.
+typedef struct {
+    uint8_t hmask[QKK / 8]; // high bits of quants
+    uint8_t qs[QKK / 4]; // low 2 bits of quants
+    uint8_t scales[12]; // 6-bit scales
+    uint16_t d; // delta of scales
+} BlockQ3K;
+
+// 4.5 bits per value: 8 sub-blocks of 32 values, value = d * scale * q - dmin * min, with 6-bit scales and mins.
+// The byte j of a 64 value chunk holds the value j of the chunk in the low nibble and the value j + 32 in the high one.
+typedef struct {
+    uint16_t d; // delta of scales
+    uint16_t dmin; // delta of mins
+    uint8_t scales[12]; // 6-bit scales and mins
+    uint8_t qs[QKK / 2]; // nibbles / quants
+} BlockQ4K;
+
+// 6.5625 bits per value: 16 sub-blocks of 16 values, value = d * scale * (q - 32), with 8-bit scales.
+// The low 4 bits and the high 2 bits of quants are stored separately, see dequantizeQ6KRow.
+typedef struct {
+    uint8_t ql[QKK / 2]; // low 4 bits of quants
+    uint8_t qh[QKK / 4]; // high 2 bits of quants
+    int8_t scales[QKK / 16];
+    uint16_t d; // delta of scales
+} BlockQ6K;
+
+// Q40 weights repacked at load time: Q40_PACKED_ROWS rows are interleaved per block, so a tile
+// of rows streams contiguous memory. Scales are stored as F32 to skip the conversion in the kernel.
+#define Q40_PACKED_ROWS 4
+
+typedef struct {
+    float d[Q40_PACKED_ROWS];
+    uint8_t qs[Q40_PACKED_ROWS][QK40 / 2];
+} BlockQ40x4;
+
 void initQuants();
 
 int getNumbersPerBatch(FloatType type);
 long getBatchBytes(FloatType type, int n, int d);
 float convertF16ToF32(uint16_t value);
+uint16_t convertF32ToF16(const float x);
+// BF16 is the upper half of F32, the conversion rounds to the nearest even value
+float convertBF16ToF32(uint16_t value);
+uint16_t convertF32ToBF16(const float x);
 
 void dequantizeQ40Row(const BlockQ40* x, float* y, int k);
 void quantizeQ80Row(float* input, BlockQ80* output, int k, unsigned int nThreads, unsigned int threadIndex);
 void dequantizeQ80Row(const BlockQ80* input, float* output, int k, unsigned int nThreads, unsigned int threadIndex);
+long getPackedQ40Bytes(int n, int d);
+// Rows after the last full tile are padded with zero blocks
+void packQ40(const BlockQ40* input, BlockQ40x4* output, int n, int d);
+// K-quants are quantized by the converter, these quantizers use the same method and serve tests
+void quantizeQ2KRow(const float* input, BlockQ2K* output, int k);
+void dequantizeQ2KRow(const BlockQ2K* x, float* y, int k);
+void quantizeQ3KRow(const float* input, BlockQ3K* output, int k);
+void dequantizeQ3KRow(const BlockQ3K* x, float* y, int k);
+void quantizeQ4KRow(const float* input, BlockQ4K* output, int k);
+void dequantizeQ4KRow(const BlockQ4K* x, float* y, int k);
+void quantizeQ6KRow(const float* input, BlockQ6K* output, int k);
+void dequantizeQ6KRow(const BlockQ6K* x, float* y, int k);
+void quantizeF16Row(const float* input, uint16_t* output, int k, unsigned int nThreads, unsigned int threadIndex);
+void dequantizeF16Row(const uint16_t* input, float* output, int k, unsigned int nThreads, unsigned int threadIndex);
+void quantizeBF16Row(const float* input, uint16_t* output, int k, unsigned int nThreads, unsigned int threadIndex);
+void dequantizeBF16Row(const uint16_t* input, float* output, int k, unsigned int nThreads, unsigned int threadIndex);
 
 #endif
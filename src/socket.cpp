@@ -9,6 +9,8 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <thread>
+#include <chrono>
 #include "socket.hpp"
 
 #ifdef _WIN32
@@ -157,8 +159,99 @@ WriteSocketException::WriteSocketException(int code, const char* message) {
     this->message = message;
 }
 
-SocketPool* SocketPool::connect(unsigned int nSockets, char** hosts, int* ports) {
-    int* sockets = new int[nSockets];
+LocalPipe::LocalPipe(size_t capacity) {
+    this->capacity = capacity;
+    buffer = new char[capacity];
+    head.exchange(0);
+    tail.exchange(0);
+    closed.exchange(false);
+}
+
+LocalPipe::~LocalPipe() {
+    delete[] buffer;
+}
+
+void LocalPipe::close() {
+    closed.store(true);
+}
+
+size_t LocalPipe::writeSome(const void* data, size_t size) {
+    if (closed.load(std::memory_order_relaxed)) {
+        throw WriteSocketException(0, "Pipe closed");
+    }
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t space = capacity - (h - tail.load(std::memory_order_acquire));
+    size_t n = size < space ? size : space;
+    if (n == 0) return 0;
+    size_t offset = h % capacity;
+    size_t n0 = capacity - offset < n ? capacity - offset : n;
+    memcpy(&buffer[offset], data, n0);
+    memcpy(buffer, (const char*)data + n0, n - n0);
+    head.store(h + n, std::memory_order_release);
+    return n;
+}
+
+size_t LocalPipe::readSome(void* data, size_t size) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t used = head.load(std::memory_order_acquire) - t;
+    size_t n = size < used ? size : used;
+    if (n == 0) {
+        if (closed.load(std::memory_order_relaxed)) {
+            throw ReadSocketException(0, "Pipe closed");
+        }
+        return 0;
+    }
+    size_t offset = t % capacity;
+    size_t n0 = capacity - offset < n ? capacity - offset : n;
+    memcpy(data, &buffer[offset], n0);
+    memcpy((char*)data + n0, buffer, n - n0);
+    tail.store(t + n, std::memory_order_release);
+    return n;
+}
+
+void LocalPipe::write(const void* data, size_t size, bool turbo) {
+    while (size > 0) {
+        size_t n = writeSome(data, size);
+        if (n == 0) {
+            wait(turbo);
+            continue;
+        }
+        size -= n;
+        data = (const char*)data + n;
+    }
+}
+
+bool LocalPipe::tryRead(void* data, size_t size, unsigned long maxAttempts, bool turbo) {
+    // maxAttempts = 0 means infinite attempts, like in tryReadSocket
+    size_t s = size;
+    while (s > 0) {
+        size_t n = readSome(data, s);
+        if (n == 0) {
+            if (s == size && maxAttempts > 0) {
+                maxAttempts--;
+                if (maxAttempts == 0) {
+                    return false;
+                }
+            }
+            wait(turbo);
+            continue;
+        }
+        data = (char*)data + n;
+        s -= n;
+    }
+    return true;
+}
+
+void LocalPipe::wait(bool turbo) {
+    if (turbo) {
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+SocketPool* SocketPool::connect(unsigned int nSockets, char** hosts, int* ports, unsigned int nLocalSockets) {
+    int* sockets = new int[nSockets + nLocalSockets];
     struct sockaddr_in addr;
 
     for (unsigned int i = 0; i < nSockets; i++) {
@@ -181,26 +274,66 @@ SocketPool* SocketPool::connect(unsigned int nSockets, char** hosts, int* ports)
         setQuickAck(clientSocket);
         sockets[i] = clientSocket;
     }
-    return new SocketPool(nSockets, sockets);
+    SocketPool* pool = new SocketPool(nSockets + nLocalSockets, sockets);
+    if (nLocalSockets > 0) {
+        pool->pipes = new LocalPipe*[pool->nSockets * 2];
+        for (unsigned int i = 0; i < pool->nSockets; i++) {
+            bool isLocal = i >= nSockets;
+            if (isLocal) {
+                sockets[i] = -1;
+            }
+            pool->pipes[i * 2] = isLocal ? new LocalPipe(LOCAL_PIPE_CAPACITY) : NULL;
+            pool->pipes[i * 2 + 1] = isLocal ? new LocalPipe(LOCAL_PIPE_CAPACITY) : NULL;
+        }
+    }
+    return pool;
 }
 
 SocketPool::SocketPool(unsigned int nSockets, int* sockets) {
     this->nSockets = nSockets;
     this->sockets = sockets;
+    this->pipes = NULL;
+    this->turbo = false;
     this->sentBytes.exchange(0);
     this->recvBytes.exchange(0);
 }
 
 SocketPool::~SocketPool() {
     for (unsigned int i = 0; i < nSockets; i++) {
+        if (pipes != NULL && pipes[i * 2] != NULL) {
+            delete pipes[i * 2];
+            delete pipes[i * 2 + 1];
+            continue;
+        }
         shutdown(sockets[i], 2);
         close(sockets[i]);
     }
+    if (pipes != NULL) {
+        delete[] pipes;
+    }
     delete[] sockets;
 }
 
+Socket* SocketPool::acceptLocal(unsigned int socketIndex) {
+    assert(socketIndex < nSockets && pipes != NULL && pipes[socketIndex * 2] != NULL);
+    return new Socket(pipes[socketIndex * 2], pipes[socketIndex * 2 + 1]);
+}
+
+void SocketPool::closeLocal() {
+    if (pipes == NULL) return;
+    for (unsigned int i = 0; i < nSockets * 2; i++) {
+        if (pipes[i] != NULL) {
+            pipes[i]->close();
+        }
+    }
+}
+
 void SocketPool::setTurbo(bool enabled) {
+    turbo = enabled;
     for (unsigned int i = 0; i < nSockets; i++) {
+        if (pipes != NULL && pipes[i * 2] != NULL) {
+            continue;
+        }
         ::setNonBlocking(sockets[i], enabled);
     }
 }
@@ -208,12 +341,20 @@ void SocketPool::setTurbo(bool enabled) {
 void SocketPool::write(unsigned int socketIndex, const void* data, size_t size) {
     assert(socketIndex >= 0 && socketIndex < nSockets);
     sentBytes += size;
+    if (pipes != NULL && pipes[socketIndex * 2] != NULL) {
+        pipes[socketIndex * 2]->write(data, size, turbo);
+        return;
+    }
     writeSocket(sockets[socketIndex], data, size);
 }
 
 void SocketPool::read(unsigned int socketIndex, void* data, size_t size) {
     assert(socketIndex >= 0 && socketIndex < nSockets);
     recvBytes += size;
+    if (pipes != NULL && pipes[socketIndex * 2 + 1] != NULL) {
+        pipes[socketIndex * 2 + 1]->tryRead(data, size, 0, turbo);
+        return;
+    }
     readSocket(sockets[socketIndex], data, size);
 }
 
@@ -226,10 +367,19 @@ void SocketPool::writeMany(unsigned int n, SocketIo* ios) {
     }
     do {
         isWriting = false;
+        // A slice in this process needs CPU time to move forward
+        bool isPipeWaiting = false;
         for (unsigned int i = 0; i < n; i++) {
             SocketIo* io = &ios[i];
             if (io->size > 0) {
                 isWriting = true;
+                if (pipes != NULL && pipes[io->socketIndex * 2] != NULL) {
+                    size_t s = pipes[io->socketIndex * 2]->writeSome(io->data, io->size);
+                    if (s == 0) isPipeWaiting = true;
+                    io->size -= s;
+                    io->data = (char*)io->data + s;
+                    continue;
+                }
                 int socket = sockets[io->socketIndex];
                 ssize_t s = send(socket, (const char*)io->data, io->size, 0);
                 if (s < 0) {
@@ -244,6 +394,9 @@ void SocketPool::writeMany(unsigned int n, SocketIo* ios) {
                 io->data = (char*)io->data + s;
             }
         }
+        if (isPipeWaiting) {
+            LocalPipe::wait(turbo);
+        }
     } while (isWriting);
 }
 
@@ -256,10 +409,19 @@ void SocketPool::readMany(unsigned int n, SocketIo* ios) {
     }
     do {
         isReading = false;
+        // A slice in this process needs CPU time to move forward
+        bool isPipeWaiting = false;
         for (unsigned int i = 0; i < n; i++) {
             SocketIo* io = &ios[i];
             if (io->size > 0) {
                 isReading = true;
+                if (pipes != NULL && pipes[io->socketIndex * 2 + 1] != NULL) {
+                    size_t r = pipes[io->socketIndex * 2 + 1]->readSome((void*)io->data, io->size);
+                    if (r == 0) isPipeWaiting = true;
+                    io->size -= r;
+                    io->data = (char*)io->data + r;
+                    continue;
+                }
                 int socket = sockets[io->socketIndex];
                 ssize_t r = recv(socket, (char*)io->data, io->size, 0);
                 if (r < 0) {
@@ -274,6 +436,9 @@ void SocketPool::readMany(unsigned int n, SocketIo* ios) {
                 io->data = (char*)io->data + r;
             }
         }
+        if (isPipeWaiting) {
+            LocalPipe::wait(turbo);
+        }
     } while (isReading);
 }
 
@@ -297,26 +462,56 @@ Socket SocketServer::accept() {
 
 Socket::Socket(int socket) {
     this->socket = socket;
+    this->readPipe = NULL;
+    this->writePipe = NULL;
+    this->turbo = false;
+}
+
+Socket::Socket(LocalPipe* readPipe, LocalPipe* writePipe) {
+    this->socket = -1;
+    this->readPipe = readPipe;
+    this->writePipe = writePipe;
+    this->turbo = false;
 }
 
 Socket::~Socket() {
+    if (readPipe != NULL) {
+        readPipe->close();
+        writePipe->close();
+        return;
+    }
     shutdown(socket, 2);
     close(socket);
 }
 
 void Socket::setTurbo(bool enabled) {
+    if (readPipe != NULL) {
+        turbo = enabled;
+        return;
+    }
     ::setNonBlocking(socket, enabled);
 }
 
 void Socket::write(const void* data, size_t size) {
+    if (writePipe != NULL) {
+        writePipe->write(data, size, turbo);
+        return;
+    }
     writeSocket(socket, data, size);
 }
 
 void Socket::read(void* data, size_t size) {
+    if (readPipe != NULL) {
+        readPipe->tryRead(data, size, 0, turbo);
+        return;
+    }
     readSocket(socket, data, size);
 }
 
 bool Socket::tryRead(void* data, size_t size, unsigned long maxAttempts) {
+    if (readPipe != NULL) {
+        return readPipe->tryRead(data, size, maxAttempts, turbo);
+    }
     return tryReadSocket(socket, data, size, maxAttempts);
 }
 
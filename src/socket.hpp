@@ -23,26 +23,70 @@ public:
     WriteSocketException(int code, const char* message);
 };
 
+#define LOCAL_PIPE_CAPACITY (4 * 1024 * 1024)
+
+// A byte stream between two threads of one process, it replaces a TCP connection to a slice executed
+// in the same process. One thread writes and one thread reads. Data is copied into the ring buffer and out of it,
+// so a transfer costs two memcpy calls instead of syscalls, slices don't share their buffers. Only the root hosts
+// local slices
+class LocalPipe {
+private:
+    char* buffer;
+    size_t capacity;
+    // Total numbers of written and read bytes, each on own cache line
+    std::atomic<size_t> head;
+    char headPadding[64];
+    std::atomic<size_t> tail;
+    char tailPadding[64];
+    std::atomic_bool closed;
+
+public:
+    LocalPipe(size_t capacity);
+    ~LocalPipe();
+    // Wakes the other side, next reads and writes throw an exception
+    void close();
+    // Returns the number of bytes copied, 0 if the pipe is full or empty
+    size_t writeSome(const void* data, size_t size);
+    size_t readSome(void* data, size_t size);
+    // `turbo` is the mode of the calling endpoint, see wait()
+    void write(const void* data, size_t size, bool turbo);
+    bool tryRead(void* data, size_t size, unsigned long maxAttempts, bool turbo);
+    // Yields in turbo mode, otherwise sleeps. The mode belongs to the endpoint, not to the pipe, so an idle
+    // side switching to non-turbo doesn't slow down waits of the other side
+    static void wait(bool turbo);
+};
+
 struct SocketIo {
     unsigned int socketIndex;
     const void* data;
     size_t size;
 };
 
+class Socket;
+
 class SocketPool {
 private:
     int* sockets;
+    // Two pipes per socket (to the slice, from the slice), NULL items for TCP sockets
+    LocalPipe** pipes;
+    bool turbo;
     std::atomic_uint sentBytes;
     std::atomic_uint recvBytes;
 
 public:
-    static SocketPool* connect(unsigned int nSockets, char** hosts, int* ports);
+    // Sockets 0..nSockets-1 are TCP connections, next nLocalSockets sockets are pipes to slices in this process
+    static SocketPool* connect(unsigned int nSockets, char** hosts, int* ports, unsigned int nLocalSockets = 0);
 
     unsigned int nSockets;
 
     SocketPool(unsigned int nSockets, int* sockets);
     ~SocketPool();
 
+    // The other end of a local socket, it must be deleted before the pool
+    Socket* acceptLocal(unsigned int socketIndex);
+    // Wakes threads that use local sockets, their next reads and writes throw an exception
+    void closeLocal();
+
     void setTurbo(bool enabled);
     void write(unsigned int socketIndex, const void* data, size_t size);
     void read(unsigned int socketIndex, void* data, size_t size);
@@ -54,9 +98,13 @@ public:
 class Socket {
 private:
     int socket;
+    LocalPipe* readPipe;
+    LocalPipe* writePipe;
+    bool turbo;
 
 public:
     Socket(int socket);
+    Socket(LocalPipe* readPipe, LocalPipe* writePipe);
     ~Socket();
 
     void setTurbo(bool enabled);
@@ -2,23 +2,27 @@
 #include <cstring>
 #include <cstdio>
 #include <ctime>
+#include <algorithm>
+#include <stdexcept>
 #include "tasks.hpp"
 
 TransformerArch::TransformerArch() {
     inference.nTasks = 0;
+    inference.tasks = NULL;
     worker.nTasks = 0;
+    worker.tasks = NULL;
 }
 
 TransformerArch::~TransformerArch() {
-    if (inference.nTasks > 0) {
+    if (inference.tasks != NULL) {
         delete[] inference.tasks;
     }
-    if (worker.nTasks > 0) {
+    if (worker.tasks != NULL) {
         delete[] worker.tasks;
     }
 }
 
-void addTask(TaskLoopHandler* handler, unsigned int taskType, TransformerTasks* tasks) {
+void addTask(TaskLoopHandler* handler, const char* name, unsigned int taskType, unsigned int hints, TransformerTasks* tasks) {
     const int alloc = 32;
     if (tasks->nTasks % alloc == 0) {
         TaskLoopTask* newTasks = new TaskLoopTask[tasks->nTasks + alloc];
@@ -30,15 +34,254 @@ void addTask(TaskLoopHandler* handler, unsigned int taskType, TransformerTasks*
     }
     tasks->tasks[tasks->nTasks].handler = handler;
     tasks->tasks[tasks->nTasks].taskType = taskType;
+    tasks->tasks[tasks->nTasks].flags = hints;
+    tasks->tasks[tasks->nTasks].name = name;
     tasks->nTasks++;
 }
 
-void TransformerArch::I(TaskLoopHandler* handler, unsigned int taskType) {
-    addTask(handler, taskType, &inference);
+void TransformerArch::I(TaskLoopHandler* handler, const char* name, unsigned int taskType, unsigned int hints) {
+    addTask(handler, name, taskType, hints, &inference);
 }
 
-void TransformerArch::W(TaskLoopHandler* handler, unsigned int taskType) {
-    addTask(handler, taskType, &worker);
+void TransformerArch::W(TaskLoopHandler* handler, const char* name, unsigned int taskType, unsigned int hints) {
+    addTask(handler, name, taskType, hints, &worker);
+}
+
+void TransformerArch::compile(TransformerSpec* spec, TransformerConfig* config) {
+    unsigned int inferenceBarriers = countBarriersPerLayer(&inference);
+    unsigned int workerBarriers = countBarriersPerLayer(&worker);
+    compileTasks(&inference, spec, config, true);
+    compileTasks(&worker, spec, config, false);
+
+    printf("⏩ Barriers per layer: root %d -> %d", inferenceBarriers, countBarriersPerLayer(&inference));
+    if (spec->nSlices > 1) {
+        printf(", worker %d -> %d", workerBarriers, countBarriersPerLayer(&worker));
+    }
+    printf("\n");
+}
+
+static bool isNoopTask(const TaskLoopTask* task, TransformerSpec* spec, bool isRoot) {
+    if ((task->flags & TASK_HINT_QUANTIZE) && spec->bufferFloatType == F32) return true;
+    if ((task->flags & TASK_HINT_SYNC) && spec->nSlices == 1) return true;
+    if ((task->flags & TASK_HINT_WORKER_ONLY) && isRoot) return true;
+    return false;
+}
+
+static bool canSkipBarrier(const TaskLoopTask* task, const TaskLoopTask* nextTask, TransformerConfig* config) {
+    if (task->taskType != TASK_TYPE_INFERENCE || nextTask->taskType != TASK_TYPE_INFERENCE) return false;
+    if ((task->flags & (TASK_LOOP_SERIAL | TASK_LOOP_ASYNC)) || (nextTask->flags & (TASK_LOOP_SERIAL | TASK_LOOP_ASYNC))) return false;
+    if ((task->flags & TASK_HINT_MATMUL) && config->useDynamicMatmul) return false;
+    return ((task->flags & TASK_HINT_DIM_OUT) && (nextTask->flags & TASK_HINT_DIM_IN)) ||
+        ((task->flags & TASK_HINT_HIDDEN_OUT) && (nextTask->flags & TASK_HINT_HIDDEN_IN)) ||
+        ((task->flags & TASK_HINT_VOCAB_OUT) && (nextTask->flags & TASK_HINT_VOCAB_IN));
+}
+
+void compileTasks(TransformerTasks* tasks, TransformerSpec* spec, TransformerConfig* config, bool isRoot) {
+    unsigned int nTasks = 0;
+    for (unsigned int i = 0; i < tasks->nTasks; i++) {
+        TaskLoopTask task = tasks->tasks[i];
+        if (isNoopTask(&task, spec, isRoot)) {
+            continue;
+        }
+        if (task.flags & TASK_HINT_SERIAL) {
+            task.flags |= TASK_LOOP_SERIAL;
+        }
+        if (task.flags & TASK_HINT_ASYNC) {
+            task.flags |= TASK_LOOP_ASYNC;
+        }
+        if (task.flags & TASK_HINT_AWAIT) {
+            task.flags |= TASK_LOOP_AWAIT;
+        }
+        // Barriers are decided again, so the list may be compiled again with another config
+        task.flags &= ~TASK_LOOP_NO_BARRIER;
+        tasks->tasks[nTasks++] = task;
+    }
+    for (unsigned int i = 0; i + 1 < nTasks; i++) {
+        if (canSkipBarrier(&tasks->tasks[i], &tasks->tasks[i + 1], config)) {
+            tasks->tasks[i].flags |= TASK_LOOP_NO_BARRIER;
+        }
+    }
+    tasks->nTasks = nTasks;
+}
+
+unsigned int countBarriersPerLayer(TransformerTasks* tasks) {
+    // Layers end with a TASK_HINT_NEXT_BLOCK task, the second layer is counted because
+    // the first one contains tasks executed once per token. A single layer is counted with these tasks.
+    unsigned int nLayerEnds = 0;
+    unsigned int start = 0;
+    unsigned int end = 0;
+    for (unsigned int i = 0; i < tasks->nTasks && nLayerEnds < 2; i++) {
+        if (tasks->tasks[i].flags & TASK_HINT_NEXT_BLOCK) {
+            nLayerEnds++;
+            start = end;
+            end = i + 1;
+        }
+    }
+    unsigned int nBarriers = 0;
+    for (unsigned int i = start; i < end; i++) {
+        if (!(tasks->tasks[i].flags & (TASK_LOOP_NO_BARRIER | TASK_LOOP_SERIAL | TASK_LOOP_ASYNC))) {
+            nBarriers++;
+        }
+    }
+    return nBarriers;
+}
+
+TaskProfiler::TaskProfiler(TransformerTasks* tasks, unsigned int nThreads)
+    : loopProfiler(nThreads, tasks->nTasks) {
+    this->tasks = tasks;
+    nTokens = 0;
+    traceFile = NULL;
+    nTraceTokens = 0;
+    traceStartTime = 0;
+    hasTraceEvents = false;
+    taskLayers = new unsigned int[tasks->nTasks];
+    taskEntries = new unsigned int[tasks->nTasks];
+
+    unsigned int layer = 0;
+    for (unsigned int i = 0; i < tasks->nTasks; i++) {
+        const TaskLoopTask* task = &tasks->tasks[i];
+        taskLayers[i] = layer;
+        if (task->flags & TASK_HINT_NEXT_BLOCK) {
+            layer++;
+        }
+
+        // Tasks of the same name share the entry, the names may come from different literals
+        const char* name = task->name == NULL ? "?" : task->name;
+        unsigned int e = 0;
+        while (e < entries.size() && (strcmp(entries[e].name, name) != 0 || entries[e].taskType != task->taskType)) {
+            e++;
+        }
+        if (e == entries.size()) {
+            TaskProfilerEntry entry;
+            entry.name = name;
+            entry.taskType = task->taskType;
+            entry.totalTime = 0;
+            entries.push_back(entry);
+        }
+        taskEntries[i] = e;
+    }
+}
+
+TaskProfiler::~TaskProfiler() {
+    finishTrace();
+    delete[] taskLayers;
+    delete[] taskEntries;
+}
+
+TaskLoopProfiler* TaskProfiler::getLoopProfiler() {
+    return &loopProfiler;
+}
+
+void TaskProfiler::startTrace(const char* path, unsigned int nTokens) {
+    finishTrace();
+    traceFile = fopen(path, "w");
+    if (traceFile == NULL) {
+        printf("Cannot open trace file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    nTraceTokens = nTokens;
+    traceStartTime = 0;
+    hasTraceEvents = false;
+    fprintf(traceFile, "{\"traceEvents\":[\n");
+    fprintf(traceFile, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"I/O\"}}", loopProfiler.nThreads);
+    hasTraceEvents = true;
+}
+
+void TaskProfiler::collect() {
+    const unsigned int nSlots = loopProfiler.nSlots;
+    for (unsigned int i = 0; i < tasks->nTasks; i++) {
+        unsigned long long beginTime = 0;
+        unsigned long long endTime = 0;
+        for (unsigned int t = 0; t < nSlots; t++) {
+            unsigned int slot = i * nSlots + t;
+            if (loopProfiler.beginTimes[slot] == 0) continue;
+            if (beginTime == 0 || loopProfiler.beginTimes[slot] < beginTime) beginTime = loopProfiler.beginTimes[slot];
+            if (loopProfiler.endTimes[slot] > endTime) endTime = loopProfiler.endTimes[slot];
+        }
+        if (beginTime == 0) continue;
+
+        TaskProfilerEntry* entry = &entries[taskEntries[i]];
+        entry->totalTime += endTime - beginTime;
+        entry->times.push_back((unsigned int)(endTime - beginTime));
+    }
+
+    if (traceFile != NULL) {
+        writeTraceEvents();
+    }
+    nTokens++;
+}
+
+void TaskProfiler::writeTraceEvents() {
+    const unsigned int nSlots = loopProfiler.nSlots;
+    for (unsigned int i = 0; i < tasks->nTasks; i++) {
+        for (unsigned int t = 0; t < nSlots; t++) {
+            unsigned int slot = i * nSlots + t;
+            unsigned long long beginTime = loopProfiler.beginTimes[slot];
+            if (beginTime == 0) continue;
+            if (traceStartTime == 0) {
+                traceStartTime = beginTime;
+            }
+            fprintf(traceFile,
+                "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"token\":%u,\"layer\":%u}}",
+                hasTraceEvents ? ",\n" : "",
+                entries[taskEntries[i]].name,
+                tasks->tasks[i].taskType == TASK_TYPE_TRANSFER ? "transfer" : "inference",
+                t,
+                (beginTime - traceStartTime) / 1000.0,
+                (loopProfiler.endTimes[slot] - beginTime) / 1000.0,
+                nTokens,
+                taskLayers[i]);
+            hasTraceEvents = true;
+        }
+    }
+    nTraceTokens--;
+    if (nTraceTokens == 0) {
+        finishTrace();
+    }
+}
+
+void TaskProfiler::finishTrace() {
+    if (traceFile == NULL) return;
+    fprintf(traceFile, "\n]}\n");
+    fclose(traceFile);
+    traceFile = NULL;
+}
+
+static bool compareProfilerEntries(const TaskProfilerEntry* a, const TaskProfilerEntry* b) {
+    return a->totalTime > b->totalTime;
+}
+
+void TaskProfiler::print() {
+    unsigned long long totalTime = 0;
+    std::vector<TaskProfilerEntry*> sorted;
+    for (unsigned int e = 0; e < entries.size(); e++) {
+        totalTime += entries[e].totalTime;
+        if (entries[e].times.size() > 0) {
+            sorted.push_back(&entries[e]);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end(), compareProfilerEntries);
+
+    printf("🔶 Profile of %u tokens\n", nTokens);
+    printf("%-28s %10s %12s %7s %10s %10s\n", "Task", "Calls", "Total ms", "Share", "p50 us", "p99 us");
+    for (unsigned int e = 0; e < sorted.size(); e++) {
+        TaskProfilerEntry* entry = sorted[e];
+        std::vector<unsigned int> times = entry->times;
+        size_t p50 = (times.size() - 1) * 50 / 100;
+        size_t p99 = (times.size() - 1) * 99 / 100;
+        std::nth_element(times.begin(), times.begin() + p50, times.end());
+        unsigned int p50Time = times[p50];
+        std::nth_element(times.begin(), times.begin() + p99, times.end());
+        unsigned int p99Time = times[p99];
+
+        printf("%-28s %10zu %12.3f %6.1f%% %10.1f %10.1f\n",
+            entry->name,
+            entry->times.size(),
+            entry->totalTime / 1000000.0,
+            totalTime > 0 ? (entry->totalTime * 100.0) / totalTime : 0.0,
+            p50Time / 1000.0,
+            p99Time / 1000.0);
+    }
 }
 
 void syncUnitBuffer(unsigned int nThreads, unsigned int threadIndex, TransformerContext* ctx, uint8_t bufferIndex) {
@@ -93,13 +336,24 @@ void syncSliceOfSlicedBuffer(unsigned int nThreads, unsigned int threadIndex, Tr
     }
 }
 
+static void quantizeBuffer(FloatType bufferFloatType, float* input, void* output, unsigned int k, unsigned int nThreads, unsigned int threadIndex) {
+    if (bufferFloatType == Q80) {
+        quantizeQ80Row(input, (BlockQ80*)output, k, nThreads, threadIndex);
+    } else if (bufferFloatType == BF16) {
+        quantizeBF16Row(input, (uint16_t*)output, k, nThreads, threadIndex);
+    } else {
+        assert(bufferFloatType == F16);
+        quantizeF16Row(input, (uint16_t*)output, k, nThreads, threadIndex);
+    }
+}
+
 void quantizeUnitBuffer(unsigned int nThreads, unsigned int threadIndex, TransformerContext* ctx, uint8_t sourceBufferIndex, uint8_t targetBufferIndex) {
     if (ctx->transformer->spec->bufferFloatType == F32) return;
-    assert(ctx->transformer->spec->bufferFloatType == Q80);
 
-    quantizeQ80Row(
+    quantizeBuffer(
+        ctx->transformer->spec->bufferFloatType,
         (float*)ctx->transformer->buffer->getUnit(sourceBufferIndex),
-        (BlockQ80*)ctx->transformer->buffer->getUnit(targetBufferIndex),
+        ctx->transformer->buffer->getUnit(targetBufferIndex),
         ctx->transformer->buffer->getUnitBytes(sourceBufferIndex) / sizeof(float),
         nThreads,
         threadIndex);
@@ -108,32 +362,58 @@ void quantizeUnitBuffer(unsigned int nThreads, unsigned int threadIndex, Transfo
 void quantizeSlicedBuffer(unsigned int nThreads, unsigned int threadIndex, TransformerContext* ctx, bool quantizeRootSlice, uint8_t sourceBufferIndex, uint8_t targetBufferIndex) {
     if (ctx->transformer->spec->bufferFloatType == F32) return;
     if (ctx->transformer->sliceIndex == 0 && !quantizeRootSlice) return;
-    assert(ctx->transformer->spec->bufferFloatType == Q80);
 
-    quantizeQ80Row(
+    quantizeBuffer(
+        ctx->transformer->spec->bufferFloatType,
         (float*)ctx->transformer->buffer->getSliced(sourceBufferIndex, ctx->transformer->sliceIndex),
-        (BlockQ80*)ctx->transformer->buffer->getSliced(targetBufferIndex, ctx->transformer->sliceIndex),
+        ctx->transformer->buffer->getSliced(targetBufferIndex, ctx->transformer->sliceIndex),
         ctx->transformer->buffer->getSlicedBytes(sourceBufferIndex) / sizeof(float),
         nThreads,
         threadIndex);
 }
 
-void dequantizeSlicedBuffer(unsigned int nThreads, unsigned int threadIndex, TransformerContext* ctx, bool dequantizeRootSlice, uint8_t sourceBufferIndex, uint8_t targetBufferIndex) {
-    if (ctx->transformer->spec->bufferFloatType == F32) return;
-    assert(ctx->transformer->spec->bufferFloatType == Q80);
-    assert(ctx->socketPool != NULL); // This function may be called only by root.
+void mergeSlicedBuffer(unsigned int nThreads, unsigned int threadIndex, TransformerContext* ctx, uint8_t bufferIndex, uint8_t quantizedBufferIndex, float* output) {
+    TransformerBuffer* buffer = ctx->transformer->buffer;
+    FloatType bufferFloatType = ctx->transformer->spec->bufferFloatType;
+    unsigned int size = buffer->getSlicedBytes(bufferIndex) / sizeof(float);
 
-    unsigned int sliceIndex = dequantizeRootSlice ? 0 : 1;
-    for (; sliceIndex < ctx->transformer->spec->nSlices; sliceIndex++) {
-        dequantizeQ80Row(
-            (BlockQ80*)ctx->transformer->buffer->getSliced(sourceBufferIndex, sliceIndex),
-            (float*)ctx->transformer->buffer->getSliced(targetBufferIndex, sliceIndex),
-            (ctx->transformer->buffer->getSlicedBytes(sourceBufferIndex) / sizeof(BlockQ80)) * QK80,
-            nThreads,
-            threadIndex);
+    add(output, (float*)buffer->getSliced(bufferIndex, 0), size, nThreads, threadIndex);
+
+    SPLIT_RANGE_TO_THREADS(start, end, 0, size, nThreads, threadIndex);
+    for (slice_index_t sliceIndex = 1; sliceIndex < ctx->transformer->spec->nSlices; sliceIndex++) {
+        void* source = buffer->getSliced(quantizedBufferIndex, sliceIndex);
+        dequantizeAddRow(bufferFloatType, source, &output[start], start, end - start);
+    }
+}
+
+void joinSlicedBuffer(unsigned int nThreads, unsigned int threadIndex, TransformerContext* ctx, uint8_t bufferIndex, uint8_t quantizedBufferIndex, float* output, bool add) {
+    TransformerBuffer* buffer = ctx->transformer->buffer;
+    FloatType bufferFloatType = ctx->transformer->spec->bufferFloatType;
+    unsigned int sliceSize = buffer->getSlicedBytes(bufferIndex) / sizeof(float);
+
+    SPLIT_RANGE_TO_THREADS(start, end, 0, sliceSize * ctx->transformer->spec->nSlices, nThreads, threadIndex);
+    unsigned int i = start;
+    while (i < end) {
+        slice_index_t sliceIndex = i / sliceSize;
+        unsigned int offset = i % sliceSize;
+        unsigned int n = std::min(end - i, sliceSize - offset);
+        FloatType sourceFloatType = sliceIndex == 0 ? F32 : bufferFloatType;
+        void* source = buffer->getSliced(sliceIndex == 0 ? bufferIndex : quantizedBufferIndex, sliceIndex);
+        if (add) {
+            dequantizeAddRow(sourceFloatType, source, &output[i], offset, n);
+        } else {
+            dequantizeRow(sourceFloatType, source, &output[i], offset, n);
+        }
+        i += n;
     }
 }
 
+ActivationFunc* getHiddenActivation(TransformerSpec* spec) {
+    if (spec->hiddenAct == SILU) return silu;
+    if (spec->hiddenAct == GELU) return gelu;
+    throw std::runtime_error("Unsupported hidden activation");
+}
+
 void sendPos(TASK_ARGS) {
     TASK_VARIABLES;
 
@@ -162,12 +442,24 @@ Inference::Inference(TransformerArch* arch, unsigned int nThreads, Transformer*
     context.transformer = transformer;
     context.socket = NULL;
     context.socketPool = socketPool;
-    assert(arch->inference.tasks[0].handler == sendPos);
+    context.reduction = new TaskLoopReduction(nThreads, TASK_REDUCTION_N_VALUES);
+    assert(arch->inference.tasks[0].handler == sendPos || transformer->spec->nSlices == 1);
     taskLoop = new TaskLoop(nThreads, arch->inference.nTasks, TASK_N_TYPES, arch->inference.tasks, (void*)&context);
+    profiler = NULL;
+    nLayerTasks = arch->inference.nTasks;
+    for (unsigned int i = 0; i < arch->inference.nTasks; i++) {
+        if (arch->inference.tasks[i].flags & TASK_HINT_NEXT_BLOCK) {
+            nLayerTasks = i + 1;
+        }
+    }
 }
 
 Inference::~Inference() {
     delete taskLoop;
+    delete context.reduction;
+    if (profiler != NULL) {
+        delete profiler;
+    }
 }
 
 float* Inference::infer(int token, pos_t pos) {
@@ -180,25 +472,76 @@ float* Inference::infer(int token, pos_t pos) {
 
     taskLoop->run();
 
+    if (profiler != NULL) {
+        profiler->collect();
+    }
     return transformer->logits;
 }
 
+void Inference::inferWithoutLogits(int token, pos_t pos) {
+    transformer->pos = pos;
+
+    float* contentRow = ((float*)transformer->tokenEmbeddingTable) + token * transformer->spec->dim;
+    memcpy(transformer->x, contentRow, transformer->spec->dim * sizeof(float));
+
+    context.currentBlockIndex = 0;
+
+    // Workers don't execute the final tasks, so they don't notice the difference
+    taskLoop->run(nLayerTasks);
+
+    if (profiler != NULL) {
+        profiler->collect();
+    }
+}
+
 void Inference::getStats(unsigned long* inferenceTime, unsigned long* transferTime) {
     *inferenceTime = taskLoop->executionTime[TASK_TYPE_INFERENCE];
     *transferTime = taskLoop->executionTime[TASK_TYPE_TRANSFER];
 }
 
+void Inference::setSpinBudget(unsigned int spinBudget) {
+    taskLoop->setSpinBudget(spinBudget);
+}
+
+bool Inference::setCpus(const std::vector<unsigned int>& cpus) {
+    return taskLoop->setCpus(cpus);
+}
+
+void Inference::enableProfiler(const char* tracePath, unsigned int nTraceTokens) {
+    profiler = new TaskProfiler(&arch->inference, taskLoop->nThreads);
+    if (tracePath != NULL && nTraceTokens > 0) {
+        profiler->startTrace(tracePath, nTraceTokens);
+    }
+    taskLoop->setProfiler(profiler->getLoopProfiler());
+}
+
+void Inference::printProfile() {
+    if (profiler != NULL) {
+        profiler->print();
+    }
+}
+
 Worker::Worker(TransformerArch* arch, unsigned int nThreads, Transformer* transformer, Socket* socket) {
     this->transformer = transformer;
     this->socket = socket;
     context.transformer = transformer;
     context.socket = socket;
     context.socketPool = NULL;
+    context.reduction = new TaskLoopReduction(nThreads, TASK_REDUCTION_N_VALUES);
     taskLoop = new TaskLoop(nThreads, arch->worker.nTasks, TASK_N_TYPES, arch->worker.tasks, (void*)&context);
 }
 
 Worker::~Worker() {
     delete taskLoop;
+    delete context.reduction;
+}
+
+void Worker::setSpinBudget(unsigned int spinBudget) {
+    taskLoop->setSpinBudget(spinBudget);
+}
+
+bool Worker::setCpus(const std::vector<unsigned int>& cpus) {
+    return taskLoop->setCpus(cpus);
 }
 
 void Worker::work() {
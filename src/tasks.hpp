@@ -1,6 +1,7 @@
 #ifndef TASKS_HPP
 #define TASKS_HPP
 
+#include <vector>
 #include "transformer.hpp"
 #include "utils.hpp"
 
@@ -10,15 +11,51 @@
 #define TASK_TYPE_INFERENCE 0
 #define TASK_TYPE_TRANSFER 1
 
+// Values of TransformerContext::reduction. A norm may still read its value while a next rms fused without
+// a barrier writes partials, so the rms of x and the rms of xb2 never share a value
+#define TASK_REDUCTION_N_VALUES 2
+#define TASK_REDUCTION_X_RMS 0
+#define TASK_REDUCTION_XB2_RMS 1
+
 struct TransformerContext {
     Transformer* transformer;
     Socket* socket;
     SocketPool* socketPool;
     unsigned int currentBlockIndex;
+    // Partials of reductions split across threads, e.g. sums of squares of rms
+    TaskLoopReduction* reduction;
 };
 
 typedef void (InferenceInitializer)(TransformerContext* context);
 
+// Hints describe a task to TransformerArch::compile, they are stored above TASK_LOOP_FLAGS_MASK
+// The task is executed only by thread 0
+#define TASK_HINT_SERIAL 0x100
+// The task does nothing if the buffer float type is F32
+#define TASK_HINT_QUANTIZE 0x200
+// The task does nothing if there is only one slice
+#define TASK_HINT_SYNC 0x400
+// The task does nothing on the root node
+#define TASK_HINT_WORKER_ONLY 0x800
+// The task moves the context to the next block
+#define TASK_HINT_NEXT_BLOCK 0x1000
+// *_OUT: the task writes only the share of the range assigned to the thread by SPLIT_RANGE_TO_THREADS.
+// *_IN: the task touches data written by the previous task only in the share assigned to the thread.
+// An *_OUT task followed by an *_IN task of the same range doesn't need a barrier between them.
+#define TASK_HINT_DIM_OUT 0x2000
+#define TASK_HINT_DIM_IN 0x4000
+#define TASK_HINT_HIDDEN_OUT 0x8000
+#define TASK_HINT_HIDDEN_IN 0x10000
+#define TASK_HINT_VOCAB_OUT 0x20000
+#define TASK_HINT_VOCAB_IN 0x40000
+// The task only moves data over the network and is executed by the I/O thread, next tasks may not touch
+// buffers it reads or writes until a task with TASK_HINT_AWAIT
+#define TASK_HINT_ASYNC 0x80000
+// The task waits for all previous async tasks
+#define TASK_HINT_AWAIT 0x100000
+// The task calls MatmulCommand::forward, its *_OUT hint is ignored if matmuls claim rows dynamically
+#define TASK_HINT_MATMUL 0x200000
+
 struct TransformerTasks {
     unsigned int nTasks;
     TaskLoopTask* tasks;
@@ -32,8 +69,46 @@ public:
     TransformerArch();
     ~TransformerArch();
 
-    void I(TaskLoopHandler* handler, unsigned int taskType);
-    void W(TaskLoopHandler* handler, unsigned int taskType);
+    void I(TaskLoopHandler* handler, const char* name, unsigned int taskType, unsigned int hints = 0);
+    void W(TaskLoopHandler* handler, const char* name, unsigned int taskType, unsigned int hints = 0);
+    // Removes tasks that do nothing for the spec and removes barriers not needed between tasks
+    void compile(TransformerSpec* spec, TransformerConfig* config);
+};
+
+void compileTasks(TransformerTasks* tasks, TransformerSpec* spec, TransformerConfig* config, bool isRoot);
+unsigned int countBarriersPerLayer(TransformerTasks* tasks);
+
+struct TaskProfilerEntry {
+    const char* name;
+    unsigned int taskType;
+    unsigned long long totalTime;
+    // Wall time (ns) of each call, from the first thread entering the task to the last thread leaving it
+    std::vector<unsigned int> times;
+};
+
+class TaskProfiler {
+private:
+    TransformerTasks* tasks;
+    TaskLoopProfiler loopProfiler;
+    unsigned int* taskLayers;
+    unsigned int* taskEntries;
+    std::vector<TaskProfilerEntry> entries;
+    unsigned int nTokens;
+    FILE* traceFile;
+    unsigned int nTraceTokens;
+    unsigned long long traceStartTime;
+    bool hasTraceEvents;
+public:
+    TaskProfiler(TransformerTasks* tasks, unsigned int nThreads);
+    ~TaskProfiler();
+    TaskLoopProfiler* getLoopProfiler();
+    // Writes Chrome trace events (chrome://tracing, Perfetto) of the next `nTokens` tokens to the file
+    void startTrace(const char* path, unsigned int nTokens);
+    void collect();
+    void print();
+private:
+    void writeTraceEvents();
+    void finishTrace();
 };
 
 #define TASK_VARIABLES \
@@ -46,7 +121,15 @@ void syncUnitBuffer(unsigned int nThreads, unsigned int threadIndex, Transformer
 void syncSliceOfSlicedBuffer(unsigned int nThreads, unsigned int threadIndex, TransformerContext* ctx, uint8_t bufferIndex);
 void quantizeUnitBuffer(unsigned int nThreads, unsigned int threadIndex, TransformerContext* ctx, uint8_t sourceBufferIndex, uint8_t targetBufferIndex);
 void quantizeSlicedBuffer(unsigned int nThreads, unsigned int threadIndex, TransformerContext* ctx, bool quantizeRootSlice, uint8_t sourceBufferIndex, uint8_t targetBufferIndex);
-void dequantizeSlicedBuffer(unsigned int nThreads, unsigned int threadIndex, TransformerContext* ctx, bool dequantizeRootSlice, uint8_t sourceBufferIndex, uint8_t targetBufferIndex);
+// Adds all slices of the sliced buffer to the output, each slice is a partial sum of the whole output. The root
+// slice is read from the F32 buffer, other slices are dequantized from the quantized buffer in the same pass.
+// Threads split the output like add(). May be called only by root.
+void mergeSlicedBuffer(unsigned int nThreads, unsigned int threadIndex, TransformerContext* ctx, uint8_t bufferIndex, uint8_t quantizedBufferIndex, float* output);
+// Stores (or adds if `add` is true) the sliced buffer to the output, each slice is a part of the output. The slices
+// are read like in mergeSlicedBuffer(). Threads split the output like add(). May be called only by root.
+void joinSlicedBuffer(unsigned int nThreads, unsigned int threadIndex, TransformerContext* ctx, uint8_t bufferIndex, uint8_t quantizedBufferIndex, float* output, bool add);
+// The activation of the gated FFN
+ActivationFunc* getHiddenActivation(TransformerSpec* spec);
 void sendPos(TASK_ARGS);
 
 class Inference {
@@ -56,11 +139,20 @@ private:
     TransformerContext context;
     TaskLoop *taskLoop;
     TransformerArch *arch;
+    TaskProfiler* profiler;
+    // Tasks up to the end of the last layer, next tasks only compute logits
+    unsigned int nLayerTasks;
 public:
     Inference(TransformerArch* arch, unsigned int nThreads, Transformer* transformer, SocketPool* socketPool);
     ~Inference();
     float* infer(int token, pos_t pos);
+    // Fills the KV cache for the token without computing logits, for prompt tokens whose logits are not sampled
+    void inferWithoutLogits(int token, pos_t pos);
     void getStats(unsigned long* inferenceTime, unsigned long* transferTime);
+    void setSpinBudget(unsigned int spinBudget);
+    bool setCpus(const std::vector<unsigned int>& cpus);
+    void enableProfiler(const char* tracePath, unsigned int nTraceTokens);
+    void printProfile();
 };
 
 class Worker {
@@ -73,6 +165,8 @@ public:
     Worker(TransformerArch* arch, unsigned int nThreads, Transformer* transformer, Socket* socket);
     ~Worker();
     void work();
+    void setSpinBudget(unsigned int spinBudget);
+    bool setCpus(const std::vector<unsigned int>& cpus);
 };
 
 #endif
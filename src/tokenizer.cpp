@@ -2,6 +2,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <cstdint>
+#include <cmath>
 #include <fcntl.h>
 #include <ctype.h>
 #include <ctime>
@@ -375,10 +376,74 @@ Sampler::Sampler(int vocab_size, float temperature, float topp, unsigned long lo
     this->rngState = rngSeed;
     // buffer only used with nucleus sampling; may not need but it's ~small
     probindex = new ProbIndex[vocab_size];
+    softmaxLoop = NULL;
+    softmaxReduction = NULL;
+    softmaxLogits = NULL;
 }
 
 Sampler::~Sampler() {
     free(probindex);
+    if (softmaxLoop != NULL) {
+        delete softmaxLoop;
+        delete softmaxReduction;
+    }
+}
+
+static TaskLoopTask softmaxTasks[] = {
+    { Sampler::softmaxScale, 0, 0, "softmaxScale" },
+    { Sampler::softmaxExp, 0, 0, "softmaxExp" },
+    { Sampler::softmaxNormalize, 0, 0, "softmaxNormalize" },
+};
+
+void Sampler::setNThreads(unsigned int nThreads) {
+    if (softmaxLoop != NULL) {
+        delete softmaxLoop;
+        delete softmaxReduction;
+        softmaxLoop = NULL;
+        softmaxReduction = NULL;
+    }
+    if (nThreads > 1) {
+        // 0: max of logits, 1: sum of exps
+        softmaxReduction = new TaskLoopReduction(nThreads, 2);
+        softmaxLoop = new TaskLoop(nThreads, sizeof(softmaxTasks) / sizeof(TaskLoopTask), 1, softmaxTasks, this);
+        // The loop runs once per token, its threads shouldn't take CPU from the inference loop
+        softmaxLoop->setSpinBudget(0);
+    }
+}
+
+void Sampler::softmaxScale(unsigned int nThreads, unsigned int threadIndex, void* userData) {
+    Sampler* sampler = (Sampler*)userData;
+    float* x = sampler->softmaxLogits;
+    SPLIT_RANGE_TO_THREADS(start, end, 0, sampler->vocab_size, nThreads, threadIndex);
+    float maxVal = -INFINITY;
+    for (unsigned int i = start; i < end; i++) {
+        x[i] /= sampler->temperature;
+        if (x[i] > maxVal) maxVal = x[i];
+    }
+    sampler->softmaxReduction->get(threadIndex)[0] = maxVal;
+}
+
+void Sampler::softmaxExp(unsigned int nThreads, unsigned int threadIndex, void* userData) {
+    Sampler* sampler = (Sampler*)userData;
+    float* x = sampler->softmaxLogits;
+    SPLIT_RANGE_TO_THREADS(start, end, 0, sampler->vocab_size, nThreads, threadIndex);
+    float maxVal = sampler->softmaxReduction->max(0);
+    float sum = 0.0f;
+    for (unsigned int i = start; i < end; i++) {
+        x[i] = expf(x[i] - maxVal);
+        sum += x[i];
+    }
+    sampler->softmaxReduction->get(threadIndex)[1] = sum;
+}
+
+void Sampler::softmaxNormalize(unsigned int nThreads, unsigned int threadIndex, void* userData) {
+    Sampler* sampler = (Sampler*)userData;
+    float* x = sampler->softmaxLogits;
+    SPLIT_RANGE_TO_THREADS(start, end, 0, sampler->vocab_size, nThreads, threadIndex);
+    float sum = sampler->softmaxReduction->sum(1);
+    for (unsigned int i = start; i < end; i++) {
+        x[i] /= sum;
+    }
 }
 
 int Sampler::sample(float* logits) {
@@ -388,10 +453,16 @@ int Sampler::sample(float* logits) {
         // greedy argmax sampling: take the token with the highest probability
         next = sample_argmax(logits, vocab_size);
     } else {
-        // apply the temperature to the logits
-        for (int q=0; q < vocab_size; q++) { logits[q] /= temperature; }
-        // apply softmax to the logits to get the probabilities for next token
-        softmax(logits, vocab_size);
+        if (softmaxLoop != NULL) {
+            // apply the temperature and softmax, the vocab is split across threads
+            softmaxLogits = logits;
+            softmaxLoop->run();
+        } else {
+            // apply the temperature to the logits
+            for (int q=0; q < vocab_size; q++) { logits[q] /= temperature; }
+            // apply softmax to the logits to get the probabilities for next token
+            softmax(logits, vocab_size);
+        }
         // flip a (float) coin (this is our source of entropy for sampling)
         float coin = randomF32(&rngState);
         // we sample from this distribution to get the next token
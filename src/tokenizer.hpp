@@ -70,6 +70,10 @@ private:
     float temperature;
     float topp;
     unsigned long long rngState;
+    // Softmax split across threads, NULL if the sampler is single-threaded
+    TaskLoop* softmaxLoop;
+    TaskLoopReduction* softmaxReduction;
+    float* softmaxLogits;
 
 public:
     Sampler(int vocab_size, float temperature, float topp, unsigned long long rngSeed);
@@ -77,6 +81,11 @@ public:
     int sample(float* logits);
     void setTemp(float temp);
     void setSeed(unsigned long long rngSeed);
+    void setNThreads(unsigned int nThreads);
+
+    static void softmaxScale(unsigned int nThreads, unsigned int threadIndex, void* userData);
+    static void softmaxExp(unsigned int nThreads, unsigned int threadIndex, void* userData);
+    static void softmaxNormalize(unsigned int nThreads, unsigned int threadIndex, void* userData);
 };
 
 class TokenizerChatStops {
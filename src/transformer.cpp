@@ -1,5 +1,6 @@
 #include <cstdio>
 #include <cassert>
+#include <algorithm>
 #include <stdexcept>
 #include <string.h>
 #include "utils.hpp"
@@ -109,6 +110,11 @@ TransformerSpec Transformer::loadSpecFromFile(const char* path, const unsigned i
         // TODO: https://github.com/b4rtaz/distributed-llama/issues/70
         throw std::runtime_error("This version does not support more nodes than the number of KV heads in the model.");
     }
+    // Column slices split rows of weights, so a slice must keep whole blocks of the weights float type
+    const int numbersPerBatch = getNumbersPerBatch(weightsFloatType);
+    if ((spec.dim / spec.nSlices) % numbersPerBatch != 0 || (spec.hiddenDim / spec.nSlices) % numbersPerBatch != 0) {
+        throw std::runtime_error("Dimensions of the model split into slices are not multiples of the weights block size");
+    }
     if (spec.archType == LLAMA) {
         printf("💡 arch: llama\n");
     } else if (spec.archType == GROK1) {
@@ -257,6 +263,9 @@ Transformer::Transformer(TransformerSpec* spec, TransformerConfig* config, slice
         throw std::runtime_error("Unsupported rope type");
     }
 
+    setDynamicMatmul(config->useDynamicMatmul);
+    setRepackedWeights(config->repackWeights);
+
     TransformerBlock* b = blocks[0];
     assert(b->q0Slice->d0 == ropeSlice->qDim0);
     assert(b->q0Slice->dOffset(sliceIndex) == ropeSlice->qDimStart);
@@ -287,6 +296,44 @@ Transformer::~Transformer() {
     delete rope;
 }
 
+bool Transformer::bindToNumaNodes(const unsigned int nThreads, const std::vector<unsigned int>& cpus) {
+    int* threadNodes = new int[nThreads];
+    std::vector<unsigned int> nodes;
+    for (unsigned int i = 0; i < nThreads; i++) {
+        threadNodes[i] = getCpuNumaNode(cpus[i % cpus.size()]);
+        if (threadNodes[i] >= 0 && std::find(nodes.begin(), nodes.end(), (unsigned int)threadNodes[i]) == nodes.end()) {
+            nodes.push_back((unsigned int)threadNodes[i]);
+        }
+    }
+    bool ok = nodes.size() > 0;
+    for (int i = 0; i < spec->nLayers; i++) {
+        ok &= blocks[i]->bindToNumaNodes(nThreads, threadNodes, nodes);
+    }
+    if (IS_ROOT_SLICE(sliceIndex)) {
+        ok &= wclsMm->bindToNumaNodes(nThreads, threadNodes);
+    }
+    delete[] threadNodes;
+    return ok;
+}
+
+void Transformer::setDynamicMatmul(bool isDynamic) {
+    for (int i = 0; i < spec->nLayers; i++) {
+        blocks[i]->setDynamicMatmul(isDynamic);
+    }
+    if (IS_ROOT_SLICE(sliceIndex)) {
+        wclsMm->setDynamic(isDynamic);
+    }
+}
+
+void Transformer::setRepackedWeights(bool isRepacked) {
+    for (int i = 0; i < spec->nLayers; i++) {
+        blocks[i]->setRepackedWeights(isRepacked);
+    }
+    if (IS_ROOT_SLICE(sliceIndex)) {
+        wclsMm->setRepacked(isRepacked);
+    }
+}
+
 TransformerBlock::TransformerBlock(TransformerSpec* spec, TransformerConfig* config, slice_index_t sliceIndex) {
     this->sliceIndex = sliceIndex;
     this->spec = spec;
@@ -349,7 +396,6 @@ TransformerBlock::TransformerBlock(TransformerSpec* spec, TransformerConfig* con
             moeDownMm[e] = new MatmulCommand(moeDown0Slice->n, moeDown0Slice->d0, spec->bufferFloatType, spec->weightsFloatType);
         }
 
-        expertGate = (float*)newBuffer(moeUpAndGate0Slice->d0 * spec->nExperts * sizeof(float));
         expertDown = (float*)newBuffer(moeDown0Slice->d0 * (spec->nExperts - 1) * sizeof(float));
     } else {
         w10Slice = new RowMatmulSlice(spec->weightsFloatType, spec->nSlices, spec->dim, spec->hiddenDim);
@@ -359,9 +405,71 @@ TransformerBlock::TransformerBlock(TransformerSpec* spec, TransformerConfig* con
         w10mm = new MatmulCommand(w10Slice->n, w10Slice->d0, spec->bufferFloatType, spec->weightsFloatType);
         w20mm = new MatmulCommand(w20Slice->n0, w20Slice->d, spec->bufferFloatType, spec->weightsFloatType);
         w30mm = new MatmulCommand(w30Slice->n, w30Slice->d0, spec->bufferFloatType, spec->weightsFloatType);
+    }
+}
+
+bool TransformerBlock::bindToNumaNodes(const unsigned int nThreads, const int* threadNodes, const std::vector<unsigned int>& nodes) {
+    bool ok = true;
+    if (spec->nExperts > 0) {
+        ok &= moeRouterMm->bindToNumaNodes(nThreads, threadNodes);
+        for (int e = 0; e < spec->nExperts; e++) {
+            ok &= moeUpMm[e]->bindToNumaNodes(nThreads, threadNodes);
+            ok &= moeGateMm[e]->bindToNumaNodes(nThreads, threadNodes);
+            ok &= moeDownMm[e]->bindToNumaNodes(nThreads, threadNodes);
+        }
+    } else {
+        ok &= w10mm->bindToNumaNodes(nThreads, threadNodes);
+        ok &= w20mm->bindToNumaNodes(nThreads, threadNodes);
+        ok &= w30mm->bindToNumaNodes(nThreads, threadNodes);
+    }
+    ok &= q0mm->bindToNumaNodes(nThreads, threadNodes);
+    ok &= k0mm->bindToNumaNodes(nThreads, threadNodes);
+    ok &= v0mm->bindToNumaNodes(nThreads, threadNodes);
+    ok &= wo0mm->bindToNumaNodes(nThreads, threadNodes);
+    if (!config->useDiscForKvCache) {
+        // A cache row keeps all heads of one position, threads split heads, so rows can't follow threads
+        ok &= interleaveBufferOnNumaNodes(keyCache, kvCacheSlice->keyCacheSize, nodes);
+        ok &= interleaveBufferOnNumaNodes(valueCache, kvCacheSlice->valueCacheSize, nodes);
+    }
+    return ok;
+}
+
+void TransformerBlock::setDynamicMatmul(bool isDynamic) {
+    if (spec->nExperts > 0) {
+        moeRouterMm->setDynamic(isDynamic);
+        for (int e = 0; e < spec->nExperts; e++) {
+            moeUpMm[e]->setDynamic(isDynamic);
+            moeGateMm[e]->setDynamic(isDynamic);
+            moeDownMm[e]->setDynamic(isDynamic);
+        }
+    } else {
+        w10mm->setDynamic(isDynamic);
+        w20mm->setDynamic(isDynamic);
+        w30mm->setDynamic(isDynamic);
+    }
+    q0mm->setDynamic(isDynamic);
+    k0mm->setDynamic(isDynamic);
+    v0mm->setDynamic(isDynamic);
+    wo0mm->setDynamic(isDynamic);
+}
 
-        hb20 = (float*)newBuffer(w30Slice->d0 * sizeof(float));
+void TransformerBlock::setRepackedWeights(bool isRepacked) {
+    if (spec->nExperts > 0) {
+        moeRouterMm->setRepacked(isRepacked);
+        for (int e = 0; e < spec->nExperts; e++) {
+            moeUpMm[e]->setRepacked(isRepacked);
+            moeGateMm[e]->setRepacked(isRepacked);
+            moeDownMm[e]->setRepacked(isRepacked);
+        }
+    } else {
+        w10mm->setRepacked(isRepacked);
+        w20mm->setRepacked(isRepacked);
+        w30mm->setRepacked(isRepacked);
     }
+    q0mm->setRepacked(isRepacked);
+    k0mm->setRepacked(isRepacked);
+    v0mm->setRepacked(isRepacked);
+    wo0mm->setRepacked(isRepacked);
 }
 
 TransformerBlock::~TransformerBlock() {
@@ -414,7 +522,6 @@ TransformerBlock::~TransformerBlock() {
         delete[] moeDownMm;
         freeBuffer(moeRouterProbs);
 
-        freeBuffer(expertGate);
         freeBuffer(expertDown);
     } else {
         delete w10Slice;
@@ -424,8 +531,6 @@ TransformerBlock::~TransformerBlock() {
         delete w10mm;
         delete w20mm;
         delete w30mm;
-
-        freeBuffer(hb20);
     }
 }
 
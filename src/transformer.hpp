@@ -3,6 +3,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <vector>
 #include "quants.hpp"
 #include "commands.hpp"
 #include "socket.hpp"
@@ -91,6 +92,10 @@ struct TransformerSpec {
 
 struct TransformerConfig {
     bool useDiscForKvCache;
+    // Threads claim chunks of matmul rows instead of the static split
+    bool useDynamicMatmul;
+    // Q40 weights are packed at load time into the layout of the packed matmul kernel
+    bool repackWeights;
 };
 
 class TransformerBlock {
@@ -132,9 +137,7 @@ public:
     MatmulCommand** moeDownMm;
 
     float* moeRouterProbs;
-    float* expertGate;
     float* expertDown;
-    float* hb20;
 
     KvCacheSlice* kvCacheSlice;
     float* keyCache;
@@ -145,6 +148,9 @@ public:
 
     TransformerBlock(TransformerSpec* spec, TransformerConfig* config, slice_index_t sliceIndex);
     ~TransformerBlock();
+    bool bindToNumaNodes(const unsigned int nThreads, const int* threadNodes, const std::vector<unsigned int>& nodes);
+    void setDynamicMatmul(bool isDynamic);
+    void setRepackedWeights(bool isRepacked);
 };
 
 #define TB_LENGTH 10
@@ -190,13 +196,18 @@ public:
     MatmulCommand* wclsMm;
 
     pos_t pos;
-    float rms;
     float* x;
     float* logits;
     RopeSlice* ropeSlice;
     RopeCommand* rope;
 
     ~Transformer();
+    // Moves matmul rows to NUMA nodes of threads pinned to the CPUs and interleaves the KV cache across these nodes
+    bool bindToNumaNodes(const unsigned int nThreads, const std::vector<unsigned int>& cpus);
+    // Switches all matmuls to dynamic row claiming, tasks must be compiled with the same setting
+    void setDynamicMatmul(bool isDynamic);
+    // Must be called before weights are loaded
+    void setRepackedWeights(bool isRepacked);
 
     static TransformerSpec loadSpecFromFile(const char* path, const unsigned int nSlices, const unsigned int maxSeqLen, FloatType weightsFloatType, FloatType bufferFloatType);
     static Transformer loadRootFromFile(const char* path, TransformerSpec* spec, TransformerConfig* config, SocketPool* socketPool);
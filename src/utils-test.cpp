@@ -0,0 +1,371 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <atomic>
+#include "utils.hpp"
+
+struct TestTaskLoopState {
+    std::atomic_uint counter;
+    unsigned int values[64];
+    unsigned int nThreads;
+    unsigned int sum;
+};
+
+void testTaskLoopStep0(unsigned int nThreads, unsigned int threadIndex, void* userData) {
+    TestTaskLoopState* state = (TestTaskLoopState*)userData;
+    state->values[threadIndex] = threadIndex + 1;
+    state->counter++;
+}
+
+void testTaskLoopStep1(unsigned int nThreads, unsigned int threadIndex, void* userData) {
+    TestTaskLoopState* state = (TestTaskLoopState*)userData;
+    // The previous task must be finished by all threads
+    unsigned int next = (threadIndex + 1) % nThreads;
+    if (state->values[next] != next + 1) {
+        printf("❌ taskLoop: value of thread %d is not visible for thread %d\n", next, threadIndex);
+        exit(EXIT_FAILURE);
+    }
+    state->counter++;
+}
+
+void testTaskLoopStep2(unsigned int nThreads, unsigned int threadIndex, void* userData) {
+    TestTaskLoopState* state = (TestTaskLoopState*)userData;
+    state->values[threadIndex] = 0;
+    state->counter++;
+}
+
+void testTaskLoopSerialReset(unsigned int nThreads, unsigned int threadIndex, void* userData) {
+    TestTaskLoopState* state = (TestTaskLoopState*)userData;
+    if (nThreads != 1 || threadIndex != 0) {
+        printf("❌ taskLoop: serial task is called with nThreads=%d, threadIndex=%d\n", nThreads, threadIndex);
+        exit(EXIT_FAILURE);
+    }
+    state->sum = 0;
+    state->counter++;
+}
+
+void testTaskLoopStep1Own(unsigned int nThreads, unsigned int threadIndex, void* userData) {
+    TestTaskLoopState* state = (TestTaskLoopState*)userData;
+    // Executed without a barrier after Step0, so only the own value may be read
+    if (state->values[threadIndex] != threadIndex + 1) {
+        printf("❌ taskLoop: own value of thread %d is not visible\n", threadIndex);
+        exit(EXIT_FAILURE);
+    }
+    state->counter++;
+}
+
+void testTaskLoopSerialSum(unsigned int nThreads, unsigned int threadIndex, void* userData) {
+    TestTaskLoopState* state = (TestTaskLoopState*)userData;
+    for (unsigned int i = 0; i < state->nThreads; i++) {
+        state->sum += state->values[i];
+    }
+    state->counter++;
+}
+
+void testTaskLoopCheckSum(unsigned int nThreads, unsigned int threadIndex, void* userData) {
+    TestTaskLoopState* state = (TestTaskLoopState*)userData;
+    // Two serial tasks summed values of all threads before any thread was released
+    unsigned int expected = nThreads * (nThreads + 1);
+    if (state->sum != expected) {
+        printf("❌ taskLoop: sum=%d expected=%d\n", state->sum, expected);
+        exit(EXIT_FAILURE);
+    }
+    state->counter++;
+}
+
+void testTaskLoopAsyncWrite(unsigned int nThreads, unsigned int threadIndex, void* userData) {
+    TestTaskLoopState* state = (TestTaskLoopState*)userData;
+    if (nThreads != 1 || threadIndex != 0) {
+        printf("❌ taskLoop: async task is called with nThreads=%d, threadIndex=%d\n", nThreads, threadIndex);
+        exit(EXIT_FAILURE);
+    }
+    state->values[63] = 0xFFFF;
+    state->counter++;
+}
+
+void testTaskLoopAsyncCheck(unsigned int nThreads, unsigned int threadIndex, void* userData) {
+    TestTaskLoopState* state = (TestTaskLoopState*)userData;
+    if (state->values[63] != 0xFFFF) {
+        printf("❌ taskLoop: async task is not finished before the await task\n");
+        exit(EXIT_FAILURE);
+    }
+    state->counter++;
+}
+
+void testTaskLoopAsyncReset(unsigned int nThreads, unsigned int threadIndex, void* userData) {
+    TestTaskLoopState* state = (TestTaskLoopState*)userData;
+    state->values[63] = 0;
+    state->counter++;
+}
+
+void testTaskLoopNop(unsigned int nThreads, unsigned int threadIndex, void* userData) {}
+
+void testTaskLoop(unsigned int nThreads, unsigned int spinBudget) {
+    TaskLoopTask tasks[] = {
+        { testTaskLoopStep0, 0 },
+        { testTaskLoopStep1, 1 },
+        { testTaskLoopStep2, 0 },
+    };
+    const unsigned int nTasks = sizeof(tasks) / sizeof(TaskLoopTask);
+    const unsigned int nRuns = 20;
+
+    TestTaskLoopState state;
+    state.counter.exchange(0);
+    TaskLoop loop(nThreads, nTasks, 2, tasks, &state);
+    loop.setSpinBudget(spinBudget);
+    for (unsigned int r = 0; r < nRuns; r++) {
+        loop.run();
+    }
+
+    unsigned int expected = nRuns * nTasks * nThreads;
+    if (state.counter != expected) {
+        printf("❌ taskLoop(nThreads=%d, spinBudget=%d) counter=%d expected=%d\n", nThreads, spinBudget, state.counter.load(), expected);
+        exit(EXIT_FAILURE);
+    }
+    printf("✅ taskLoop (nThreads=%d, spinBudget=%d)\n", nThreads, spinBudget);
+}
+
+void testTaskLoopFlags(unsigned int nThreads) {
+    TaskLoopTask tasks[] = {
+        { testTaskLoopSerialReset, 0, TASK_LOOP_SERIAL },
+        { testTaskLoopStep0, 0, TASK_LOOP_NO_BARRIER },
+        { testTaskLoopStep1Own, 0 },
+        { testTaskLoopSerialSum, 0, TASK_LOOP_SERIAL },
+        { testTaskLoopSerialSum, 0, TASK_LOOP_SERIAL },
+        { testTaskLoopCheckSum, 0 },
+        { testTaskLoopStep2, 0 },
+    };
+    const unsigned int nTasks = sizeof(tasks) / sizeof(TaskLoopTask);
+    const unsigned int nRuns = 20;
+
+    TestTaskLoopState state;
+    state.counter.exchange(0);
+    state.nThreads = nThreads;
+    TaskLoop loop(nThreads, nTasks, 1, tasks, &state);
+    for (unsigned int r = 0; r < nRuns; r++) {
+        loop.run();
+    }
+
+    unsigned int expected = nRuns * (3 + 4 * nThreads);
+    if (state.counter != expected) {
+        printf("❌ taskLoop flags (nThreads=%d) counter=%d expected=%d\n", nThreads, state.counter.load(), expected);
+        exit(EXIT_FAILURE);
+    }
+    printf("✅ taskLoop flags (nThreads=%d)\n", nThreads);
+}
+
+void testTaskLoopAsync(unsigned int nThreads) {
+    TaskLoopTask tasks[] = {
+        { testTaskLoopAsyncReset, 0, TASK_LOOP_SERIAL },
+        { testTaskLoopAsyncWrite, 1, TASK_LOOP_ASYNC },
+        { testTaskLoopStep0, 0 },
+        { testTaskLoopAsyncCheck, 0, TASK_LOOP_AWAIT },
+        { testTaskLoopAsyncReset, 0, TASK_LOOP_SERIAL },
+        { testTaskLoopAsyncWrite, 1, TASK_LOOP_ASYNC },
+        { testTaskLoopAsyncCheck, 0, TASK_LOOP_SERIAL | TASK_LOOP_AWAIT },
+        { testTaskLoopAsyncWrite, 1, TASK_LOOP_ASYNC },
+        { testTaskLoopStep2, 0 },
+    };
+    const unsigned int nTasks = sizeof(tasks) / sizeof(TaskLoopTask);
+    const unsigned int nRuns = 20;
+
+    TestTaskLoopState state;
+    state.counter.exchange(0);
+    state.nThreads = nThreads;
+    TaskLoop loop(nThreads, nTasks, 2, tasks, &state);
+    for (unsigned int r = 0; r < nRuns; r++) {
+        loop.run();
+        // The last async task is awaited by run()
+        if (state.values[63] != 0xFFFF) {
+            printf("❌ taskLoop async (nThreads=%d) run ended before async tasks\n", nThreads);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    unsigned int expected = nRuns * (6 + 3 * nThreads);
+    if (state.counter != expected) {
+        printf("❌ taskLoop async (nThreads=%d) counter=%d expected=%d\n", nThreads, state.counter.load(), expected);
+        exit(EXIT_FAILURE);
+    }
+    printf("✅ taskLoop async (nThreads=%d)\n", nThreads);
+}
+
+void testTaskLoopPartialRun(unsigned int nThreads) {
+    TaskLoopTask tasks[] = {
+        { testTaskLoopAsyncReset, 0, TASK_LOOP_SERIAL },
+        { testTaskLoopAsyncWrite, 1, TASK_LOOP_ASYNC },
+        { testTaskLoopStep0, 0 },
+        { testTaskLoopAsyncCheck, 0, TASK_LOOP_AWAIT },
+        { testTaskLoopAsyncReset, 0, TASK_LOOP_SERIAL },
+        { testTaskLoopAsyncWrite, 1, TASK_LOOP_ASYNC },
+        { testTaskLoopAsyncCheck, 0, TASK_LOOP_SERIAL | TASK_LOOP_AWAIT },
+        { testTaskLoopAsyncReset, 0, TASK_LOOP_SERIAL },
+        { testTaskLoopAsyncWrite, 1, TASK_LOOP_ASYNC },
+        { testTaskLoopStep2, 0 },
+    };
+    const unsigned int nTasks = sizeof(tasks) / sizeof(TaskLoopTask);
+    const unsigned int nRunTasks = 7;
+    const unsigned int nRuns = 20;
+
+    TestTaskLoopState state;
+    state.counter.exchange(0);
+    state.nThreads = nThreads;
+    TaskLoop loop(nThreads, nTasks, 2, tasks, &state);
+    // Partial runs execute fewer async tasks, next runs must still pick the right ones
+    for (unsigned int r = 0; r < nRuns; r++) {
+        if (r % 3 == 2) {
+            loop.run();
+        } else {
+            loop.run(nRunTasks);
+        }
+    }
+
+    unsigned int nFullRuns = nRuns / 3;
+    unsigned int expected = nFullRuns * (7 + 3 * nThreads) + (nRuns - nFullRuns) * (5 + 2 * nThreads);
+    if (state.counter != expected) {
+        printf("❌ taskLoop partial run (nThreads=%d) counter=%d expected=%d\n", nThreads, state.counter.load(), expected);
+        exit(EXIT_FAILURE);
+    }
+    printf("✅ taskLoop partial run (nThreads=%d)\n", nThreads);
+}
+
+void testTaskLoopProfiler(unsigned int nThreads) {
+    TaskLoopTask tasks[] = {
+        { testTaskLoopSerialReset, 0, TASK_LOOP_SERIAL },
+        { testTaskLoopStep0, 0, TASK_LOOP_NO_BARRIER },
+        { testTaskLoopStep1Own, 0 },
+        { testTaskLoopSerialSum, 0, TASK_LOOP_SERIAL },
+        { testTaskLoopStep2, 0 },
+    };
+    const unsigned int nTasks = sizeof(tasks) / sizeof(TaskLoopTask);
+
+    TestTaskLoopState state;
+    state.counter.exchange(0);
+    state.nThreads = nThreads;
+    TaskLoopProfiler profiler(nThreads, nTasks);
+    TaskLoop loop(nThreads, nTasks, 1, tasks, &state);
+    loop.setProfiler(&profiler);
+    loop.run();
+
+    for (unsigned int i = 0; i < nTasks; i++) {
+        unsigned int nExecutions = 0;
+        for (unsigned int t = 0; t < profiler.nSlots; t++) {
+            unsigned int slot = i * profiler.nSlots + t;
+            if (profiler.beginTimes[slot] == 0) continue;
+            if (profiler.endTimes[slot] < profiler.beginTimes[slot]) {
+                printf("❌ taskLoop profiler: task %d ends before it begins\n", i);
+                exit(EXIT_FAILURE);
+            }
+            nExecutions++;
+        }
+        unsigned int expected = (tasks[i].flags & TASK_LOOP_SERIAL) ? 1 : nThreads;
+        if (nExecutions != expected) {
+            printf("❌ taskLoop profiler: task %d executed %d times, expected %d\n", i, nExecutions, expected);
+            exit(EXIT_FAILURE);
+        }
+    }
+    printf("✅ taskLoop profiler (nThreads=%d)\n", nThreads);
+}
+
+struct TestTaskLoopReductionState {
+    TaskLoopReduction* reduction;
+    float* x;
+    unsigned int size;
+    float sum;
+    float max;
+};
+
+void testTaskLoopReductionPartial(unsigned int nThreads, unsigned int threadIndex, void* userData) {
+    TestTaskLoopReductionState* state = (TestTaskLoopReductionState*)userData;
+    SPLIT_RANGE_TO_THREADS(start, end, 0, state->size, nThreads, threadIndex);
+    float* partial = state->reduction->get(threadIndex);
+    partial[0] = 0.0f;
+    partial[1] = -INFINITY;
+    for (unsigned int i = start; i < end; i++) {
+        partial[0] += state->x[i];
+        if (state->x[i] > partial[1]) partial[1] = state->x[i];
+    }
+}
+
+void testTaskLoopReductionCombine(unsigned int nThreads, unsigned int threadIndex, void* userData) {
+    TestTaskLoopReductionState* state = (TestTaskLoopReductionState*)userData;
+    float sum = state->reduction->sum(0);
+    float max = state->reduction->max(1);
+    if (threadIndex == 0) {
+        state->sum = sum;
+        state->max = max;
+    }
+}
+
+void testTaskLoopReduction(unsigned int nThreads) {
+    TaskLoopTask tasks[] = {
+        { testTaskLoopReductionPartial, 0 },
+        { testTaskLoopReductionCombine, 0 },
+    };
+    const unsigned int size = 1001;
+    float x[size];
+    float expectedSum = 0.0f;
+    for (unsigned int i = 0; i < size; i++) {
+        x[i] = (float)((i * 7) % 13) - 6.0f;
+        expectedSum += x[i];
+    }
+    x[size / 3] = 100.0f;
+    expectedSum += 100.0f - ((float)(((size / 3) * 7) % 13) - 6.0f);
+
+    TaskLoopReduction reduction(nThreads, 2);
+    TestTaskLoopReductionState state;
+    state.reduction = &reduction;
+    state.x = x;
+    state.size = size;
+
+    TaskLoop loop(nThreads, 2, 1, tasks, &state);
+    loop.run();
+
+    if (fabs(state.sum - expectedSum) > 0.001f || state.max != 100.0f) {
+        printf("❌ taskLoop reduction (nThreads=%d) sum=%f expected=%f max=%f\n", nThreads, state.sum, expectedSum, state.max);
+        exit(EXIT_FAILURE);
+    }
+    printf("✅ taskLoop reduction (nThreads=%d)\n", nThreads);
+}
+
+void benchmarkTaskLoop(unsigned int nThreads, unsigned int spinBudget) {
+    // Measures the fixed cost of TaskLoop::run(), it's paid once per token
+    TaskLoopTask tasks[] = {
+        { testTaskLoopNop, 0 },
+    };
+    const unsigned int nRuns = 200;
+
+    TaskLoop loop(nThreads, 1, 1, tasks, NULL);
+    loop.setSpinBudget(spinBudget);
+    unsigned long t0 = timeMs();
+    for (unsigned int r = 0; r < nRuns; r++) {
+        loop.run();
+    }
+    unsigned long t1 = timeMs();
+    printf("🕒 taskLoop (nThreads=%d, spinBudget=%d) run overhead: %.1f us\n", nThreads, spinBudget, ((t1 - t0) * 1000.0) / nRuns);
+}
+
+int main() {
+    testTaskLoop(1, TASK_LOOP_DEFAULT_SPIN_BUDGET);
+    testTaskLoop(2, TASK_LOOP_DEFAULT_SPIN_BUDGET);
+    testTaskLoop(4, TASK_LOOP_DEFAULT_SPIN_BUDGET);
+    testTaskLoop(8, 0);
+    testTaskLoop(8, 16);
+    testTaskLoopFlags(1);
+    testTaskLoopFlags(4);
+    testTaskLoopAsync(1);
+    testTaskLoopAsync(4);
+    testTaskLoopPartialRun(1);
+    testTaskLoopPartialRun(4);
+    testTaskLoopProfiler(1);
+    testTaskLoopProfiler(4);
+    testTaskLoopReduction(1);
+    testTaskLoopReduction(4);
+
+    benchmarkTaskLoop(1, TASK_LOOP_DEFAULT_SPIN_BUDGET);
+    benchmarkTaskLoop(2, TASK_LOOP_DEFAULT_SPIN_BUDGET);
+    benchmarkTaskLoop(4, TASK_LOOP_DEFAULT_SPIN_BUDGET);
+    benchmarkTaskLoop(2, 0);
+    benchmarkTaskLoop(4, 0);
+    return EXIT_SUCCESS;
+}
@@ -1,12 +1,35 @@
 #include <cstdio>
+#include <cassert>
 #include <cstdlib>
 #include <cstring>
+#include <cstdint>
+#include <climits>
 #include <iostream>
 #include <exception>
 #include <vector>
+#include <chrono>
 #include <sys/time.h>
 #include "utils.hpp"
 
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+    #include <immintrin.h>
+    #define CPU_RELAX() _mm_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+    #define CPU_RELAX() __asm__ __volatile__("yield")
+#else
+    #define CPU_RELAX()
+#endif
+
+#if defined(__linux__)
+    #include <linux/futex.h>
+    #include <linux/mempolicy.h>
+    #include <sys/syscall.h>
+    #include <sched.h>
+#else
+    #include <mutex>
+    #include <condition_variable>
+#endif
+
 #define BUFFER_ALIGNMENT 16
 
 #ifdef _WIN32
@@ -76,6 +99,10 @@ unsigned long timeMs() {
     return te.tv_sec * 1000LL + te.tv_usec / 1000;
 }
 
+unsigned long long timeNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 unsigned int randomU32(unsigned long long *state) {
     // xorshift rng: https://en.wikipedia.org/wiki/Xorshift#xorshift.2A
     *state ^= *state >> 12;
@@ -149,83 +176,504 @@ void closeMmapFile(MmapFile* file) {
 #endif
 }
 
+bool parseCpuList(const char* list, std::vector<unsigned int>* cpus) {
+    cpus->clear();
+    const char* p = list;
+    while (*p != '\0') {
+        char* end;
+        unsigned long first = strtoul(p, &end, 10);
+        if (end == p) return false;
+        unsigned long last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtoul(p, &end, 10);
+            if (end == p || last < first) return false;
+            p = end;
+        }
+        for (unsigned long cpu = first; cpu <= last; cpu++) {
+            cpus->push_back((unsigned int)cpu);
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0' && *p != '\n') {
+            return false;
+        } else {
+            break;
+        }
+    }
+    return cpus->size() > 0;
+}
+
+#if defined(__linux__)
+static bool readFirstLine(const char* path, char* line, size_t size) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return false;
+    bool ok = fgets(line, (int)size, file) != NULL;
+    fclose(file);
+    return ok;
+}
+#endif
+
+unsigned int getNumaNodeCount() {
+#if defined(__linux__)
+    unsigned int nNodes = 0;
+    char path[64];
+    for (;;) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%u", nNodes);
+        if (access(path, F_OK) != 0) break;
+        nNodes++;
+    }
+    return nNodes > 0 ? nNodes : 1;
+#else
+    return 1;
+#endif
+}
+
+bool getNumaNodeCpus(unsigned int node, std::vector<unsigned int>* cpus) {
+#if defined(__linux__)
+    char path[64];
+    char line[4096];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+    if (readFirstLine(path, line, sizeof(line))) {
+        return parseCpuList(line, cpus);
+    }
+    if (node == 0 && readFirstLine("/sys/devices/system/cpu/online", line, sizeof(line))) {
+        // The kernel is built without NUMA, all CPUs belong to one node
+        return parseCpuList(line, cpus);
+    }
+#endif
+    return false;
+}
+
+int getCpuNumaNode(unsigned int cpu) {
+#if defined(__linux__)
+    char path[96];
+    unsigned int nNodes = getNumaNodeCount();
+    for (unsigned int node = 0; node < nNodes; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/node%u", cpu, node);
+        if (access(path, F_OK) == 0) return (int)node;
+    }
+    if (nNodes == 1) return 0;
+#endif
+    return -1;
+}
+
+bool pinThreadToCpu(dl_thread* thread, unsigned int cpu) {
+#if defined(__linux__)
+    if (cpu >= CPU_SETSIZE) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_t handle = thread == NULL ? pthread_self() : *thread;
+    return pthread_setaffinity_np(handle, sizeof(cpu_set_t), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+#if defined(__linux__)
+static bool setBufferPolicy(void* buffer, size_t size, int mode, unsigned long nodeMask) {
+    // mbind works on whole pages, pages shared with neighbour buffers are left untouched
+    const uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t begin = ((uintptr_t)buffer + pageSize - 1) & ~(pageSize - 1);
+    uintptr_t end = ((uintptr_t)buffer + size) & ~(pageSize - 1);
+    if (end <= begin) return true;
+    long result = syscall(SYS_mbind, (void*)begin, (unsigned long)(end - begin), mode, &nodeMask, sizeof(nodeMask) * 8, MPOL_MF_MOVE);
+    return result == 0;
+}
+#endif
+
+bool bindBufferToNumaNode(void* buffer, size_t size, unsigned int node) {
+#if defined(__linux__)
+    if (node >= sizeof(unsigned long) * 8) return false;
+    return setBufferPolicy(buffer, size, MPOL_BIND, 1ul << node);
+#else
+    return false;
+#endif
+}
+
+bool interleaveBufferOnNumaNodes(void* buffer, size_t size, const std::vector<unsigned int>& nodes) {
+#if defined(__linux__)
+    unsigned long nodeMask = 0;
+    for (unsigned int i = 0; i < nodes.size(); i++) {
+        if (nodes[i] >= sizeof(unsigned long) * 8) return false;
+        nodeMask |= 1ul << nodes[i];
+    }
+    if (nodeMask == 0) return false;
+    return setBufferPolicy(buffer, size, MPOL_INTERLEAVE, nodeMask);
+#else
+    return false;
+#endif
+}
+
+#if defined(__linux__)
+static void parkWait(std::atomic_uint* value, unsigned int oldValue) {
+    syscall(SYS_futex, (unsigned int*)value, FUTEX_WAIT_PRIVATE, oldValue, NULL, NULL, 0);
+}
+
+static void parkWakeAll(std::atomic_uint* value) {
+    syscall(SYS_futex, (unsigned int*)value, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+#else
+static std::mutex parkMutex;
+static std::condition_variable parkCond;
+
+static void parkWait(std::atomic_uint* value, unsigned int oldValue) {
+    std::unique_lock<std::mutex> lock(parkMutex);
+    if (value->load() == oldValue) {
+        parkCond.wait(lock);
+    }
+}
+
+static void parkWakeAll(std::atomic_uint* value) {
+    std::lock_guard<std::mutex> lock(parkMutex);
+    parkCond.notify_all();
+}
+#endif
+
+TaskLoopReduction::TaskLoopReduction(unsigned int nThreads, unsigned int nValues) {
+    this->nThreads = nThreads;
+    this->nValues = nValues;
+    const unsigned int valuesPerLine = TASK_LOOP_CACHE_LINE_SIZE / sizeof(float);
+    stride = ((nValues + valuesPerLine - 1) / valuesPerLine) * valuesPerLine;
+    buffer = new char[nThreads * stride * sizeof(float) + TASK_LOOP_CACHE_LINE_SIZE];
+    values = (float*)(((uintptr_t)buffer + TASK_LOOP_CACHE_LINE_SIZE - 1) & ~(uintptr_t)(TASK_LOOP_CACHE_LINE_SIZE - 1));
+    memset(values, 0, nThreads * stride * sizeof(float));
+}
+
+TaskLoopReduction::~TaskLoopReduction() {
+    delete[] buffer;
+}
+
+float* TaskLoopReduction::get(unsigned int threadIndex) {
+    return &values[threadIndex * stride];
+}
+
+float TaskLoopReduction::sum(unsigned int valueIndex) {
+    // Threads are summed in the same order, so all threads get the same result
+    float result = 0.0f;
+    for (unsigned int t = 0; t < nThreads; t++) {
+        result += values[t * stride + valueIndex];
+    }
+    return result;
+}
+
+float TaskLoopReduction::max(unsigned int valueIndex) {
+    float result = values[valueIndex];
+    for (unsigned int t = 1; t < nThreads; t++) {
+        float value = values[t * stride + valueIndex];
+        if (value > result) result = value;
+    }
+    return result;
+}
+
+TaskLoopProfiler::TaskLoopProfiler(unsigned int nThreads, unsigned int nTasks) {
+    this->nThreads = nThreads;
+    this->nSlots = nThreads + 1;
+    this->nTasks = nTasks;
+    beginTimes = new unsigned long long[nTasks * nSlots];
+    endTimes = new unsigned long long[nTasks * nSlots];
+    reset();
+}
+
+TaskLoopProfiler::~TaskLoopProfiler() {
+    delete[] beginTimes;
+    delete[] endTimes;
+}
+
+void TaskLoopProfiler::reset() {
+    memset(beginTimes, 0, nTasks * nSlots * sizeof(unsigned long long));
+    memset(endTimes, 0, nTasks * nSlots * sizeof(unsigned long long));
+}
+
 TaskLoop::TaskLoop(unsigned int nThreads, unsigned int nTasks, unsigned int nTypes, TaskLoopTask* tasks, void* userData) {
     this->nThreads = nThreads;
     this->nTasks = nTasks;
     this->nTypes = nTypes;
     this->tasks = tasks;
     this->userData = userData;
+    this->spinBudget = TASK_LOOP_DEFAULT_SPIN_BUDGET;
+    this->profiler = NULL;
+    nRunTasks = nTasks;
+    firstTaskIndex = 0;
+    while (firstTaskIndex < nTasks && (tasks[firstTaskIndex].flags & (TASK_LOOP_SERIAL | TASK_LOOP_ASYNC))) {
+        firstTaskIndex++;
+    }
+    nAsyncTasks = 0;
+    asyncTaskIndexes = new unsigned int[nTasks];
+    asyncTaskCounts = new unsigned int[nTasks + 1];
+    for (unsigned int i = 0; i < nTasks; i++) {
+        asyncTaskCounts[i] = nAsyncTasks;
+        if (tasks[i].flags & TASK_LOOP_ASYNC) {
+            // Async tasks are queued by the thread that releases the barrier, so a barrier must precede them
+            assert(i == 0 || !(tasks[i - 1].flags & TASK_LOOP_NO_BARRIER));
+            asyncTaskIndexes[nAsyncTasks++] = i;
+        }
+    }
+    asyncTaskCounts[nTasks] = nAsyncTasks;
+    asyncRunBase = 0;
     executionTime = new unsigned int[nTypes];
+    stopped = false;
+    arrivalParkedThreadCount.value.exchange(0);
+    barrierSense.value.exchange(0);
+    barrierParkedThreadCount.value.exchange(0);
+    runIndex.value.exchange(0);
+    runParkedThreadCount.value.exchange(0);
+    asyncQueuedCount.value.exchange(0);
+    asyncQueuedParkedThreadCount.value.exchange(0);
+    asyncDoneCount.value.exchange(0);
+    asyncDoneParkedThreadCount.value.exchange(0);
 
     threads = new TaskLoopThread[nThreads];
     for (unsigned int i = 0; i < nThreads; i++) {
         threads[i].threadIndex = i;
-        threads[i].nTasks = nTasks;
+        threads[i].sense.value.exchange(0);
         threads[i].loop = this;
     }
+
+    for (unsigned int i = 1; i < nThreads; i++) {
+        int result = pthread_create(&threads[i].handler, NULL, (thread_func_t)poolThreadHandler, (void*)&threads[i]);
+        if (result != 0) {
+            printf("Cannot created thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (nAsyncTasks > 0) {
+        int result = pthread_create(&asyncThread, NULL, (thread_func_t)asyncThreadHandler, (void*)this);
+        if (result != 0) {
+            printf("Cannot created thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 }
 
 TaskLoop::~TaskLoop() {
+    stopped = true;
+    runIndex.value.fetch_add(1);
+    parkWakeAll(&runIndex.value);
+    for (unsigned int i = 1; i < nThreads; i++) {
+        pthread_join(threads[i].handler, NULL);
+    }
+    if (nAsyncTasks > 0) {
+        asyncQueuedCount.value.fetch_add(1);
+        parkWakeAll(&asyncQueuedCount.value);
+        pthread_join(asyncThread, NULL);
+    }
+
     delete[] executionTime;
     delete[] threads;
+    delete[] asyncTaskIndexes;
+    delete[] asyncTaskCounts;
 }
 
 void TaskLoop::run() {
-    currentTaskIndex.exchange(0);
-    doneThreadCount.exchange(0);
+    run(nTasks);
+}
 
+void TaskLoop::run(unsigned int nRunTasks) {
+    assert(nRunTasks > 0 && nRunTasks <= nTasks);
+    assert(!(tasks[nRunTasks - 1].flags & TASK_LOOP_NO_BARRIER));
+    this->nRunTasks = nRunTasks;
     unsigned int i;
     lastTime = timeMs();
     for (i = 0; i < nTypes; i++) {
         executionTime[i] = 0;
     }
+    if (profiler != NULL) {
+        profiler->reset();
+    }
+    // All async tasks of the previous run are finished
+    asyncRunBase = asyncDoneCount.value.load();
+    runSerialTasks(0, 0);
 
-    for (i = 1; i < nThreads; i++) {
-        int result = pthread_create(&threads[i].handler, NULL, (thread_func_t)threadHandler, (void*)&threads[i]);
-        if (result != 0) {
-            printf("Cannot created thread\n");
-            exit(EXIT_FAILURE);
-        }
+    runIndex.value.fetch_add(1);
+    if (runParkedThreadCount.value.load() > 0) {
+        parkWakeAll(&runIndex.value);
     }
 
     threadHandler((void*)&threads[0]);
+    await(nRunTasks, true);
+}
 
-    for (i = 1; i < nThreads; i++) {
-        pthread_join(threads[i].handler, NULL);
+void TaskLoop::setSpinBudget(unsigned int spinBudget) {
+    this->spinBudget = spinBudget;
+}
+
+void TaskLoop::setProfiler(TaskLoopProfiler* profiler) {
+    assert(profiler == NULL || (profiler->nThreads == nThreads && profiler->nTasks == nTasks));
+    this->profiler = profiler;
+}
+
+bool TaskLoop::setCpus(const std::vector<unsigned int>& cpus) {
+    if (cpus.size() == 0) return false;
+    bool ok = pinThreadToCpu(NULL, cpus[0]);
+    for (unsigned int i = 1; i < nThreads; i++) {
+        ok &= pinThreadToCpu(&threads[i].handler, cpus[i % cpus.size()]);
     }
+    return ok;
 }
 
-void* TaskLoop::threadHandler(void* arg) {
+void TaskLoop::execute(unsigned int taskIndex, unsigned int nThreads, unsigned int threadIndex, unsigned int profiledThreadIndex) {
+    if (profiler == NULL) {
+        tasks[taskIndex].handler(nThreads, threadIndex, userData);
+        return;
+    }
+    unsigned int slot = taskIndex * profiler->nSlots + profiledThreadIndex;
+    profiler->beginTimes[slot] = timeNs();
+    tasks[taskIndex].handler(nThreads, threadIndex, userData);
+    profiler->endTimes[slot] = timeNs();
+}
+
+void TaskLoop::runSerialTasks(unsigned int taskIndex, unsigned int threadIndex) {
+    for (; taskIndex < nRunTasks && (tasks[taskIndex].flags & (TASK_LOOP_SERIAL | TASK_LOOP_ASYNC)); taskIndex++) {
+        const TaskLoopTask* task = &tasks[taskIndex];
+        if (task->flags & TASK_LOOP_ASYNC) {
+            asyncQueuedCount.value.fetch_add(1);
+            if (asyncQueuedParkedThreadCount.value.load() > 0) {
+                parkWakeAll(&asyncQueuedCount.value);
+            }
+            continue;
+        }
+        if (task->flags & TASK_LOOP_AWAIT) {
+            await(taskIndex, true);
+        }
+        execute(taskIndex, 1, 0, threadIndex);
+
+        unsigned int currentTime = timeMs();
+        executionTime[task->taskType] += currentTime - lastTime;
+        lastTime = currentTime;
+    }
+}
+
+void TaskLoop::barrier(TaskLoopThread* context, const TaskLoopTask* task, unsigned int nextTaskIndex) {
+    const unsigned int oldSense = context->sense.value.load(std::memory_order_relaxed);
+
+    if (context->threadIndex == 0) {
+        // No shared arrival counter, so arriving threads don't contend for one cache line
+        for (unsigned int i = 1; i < nThreads; i++) {
+            wait(&threads[i].sense.value, oldSense, &arrivalParkedThreadCount.value);
+        }
+        unsigned int currentTime = timeMs();
+        executionTime[task->taskType] += currentTime - lastTime;
+        lastTime = currentTime;
+        runSerialTasks(nextTaskIndex, context->threadIndex);
+
+        context->sense.value.store(oldSense + 1, std::memory_order_relaxed);
+        barrierSense.value.store(oldSense + 1);
+        if (barrierParkedThreadCount.value.load() > 0) {
+            parkWakeAll(&barrierSense.value);
+        }
+    } else {
+        context->sense.value.store(oldSense + 1);
+        if (arrivalParkedThreadCount.value.load() > 0) {
+            parkWakeAll(&context->sense.value);
+        }
+        wait(&barrierSense.value, oldSense, &barrierParkedThreadCount.value);
+    }
+}
+
+void TaskLoop::await(unsigned int taskIndex, bool keepsTime) {
+    const unsigned int asyncCount = asyncTaskCounts[taskIndex];
+    const unsigned int target = asyncRunBase + asyncCount;
+    unsigned int doneCount = asyncDoneCount.value.load(std::memory_order_acquire);
+    if ((int)(doneCount - target) >= 0) {
+        return;
+    }
+
+    unsigned int startTime = timeMs();
+    do {
+        wait(&asyncDoneCount.value, doneCount, &asyncDoneParkedThreadCount.value);
+        doneCount = asyncDoneCount.value.load(std::memory_order_acquire);
+    } while ((int)(doneCount - target) < 0);
+
+    if (keepsTime) {
+        // The stall is charged to the awaited task, the compute time measured by the next barrier excludes it
+        unsigned int stallTime = timeMs() - startTime;
+        executionTime[tasks[asyncTaskIndexes[asyncCount - 1]].taskType] += stallTime;
+        lastTime += stallTime;
+    }
+}
+
+void TaskLoop::wait(std::atomic_uint* value, unsigned int oldValue, std::atomic_uint* parkedThreadCount) {
+    for (unsigned int i = 0; i < spinBudget; i++) {
+        if (value->load(std::memory_order_acquire) != oldValue) {
+            return;
+        }
+        CPU_RELAX();
+    }
+
+    // The waker reads `parkedThreadCount` after it changes `value`, so one of both sides always sees the other one
+    parkedThreadCount->fetch_add(1);
+    while (value->load() == oldValue) {
+        parkWait(value, oldValue);
+    }
+    parkedThreadCount->fetch_sub(1);
+}
+
+void* TaskLoop::poolThreadHandler(void* arg) {
     TaskLoopThread* context = (TaskLoopThread*)arg;
     TaskLoop* loop = context->loop;
-    unsigned int threadIndex = context->threadIndex;
+    unsigned int lastRunIndex = 0;
 
     while (true) {
-        const unsigned int currentTaskIndex = loop->currentTaskIndex.load();
-        if (currentTaskIndex == context->nTasks) {
+        loop->wait(&loop->runIndex.value, lastRunIndex, &loop->runParkedThreadCount.value);
+        if (loop->stopped) {
             break;
         }
+        lastRunIndex++;
 
-        const TaskLoopTask* task = &loop->tasks[currentTaskIndex % loop->nTasks];
+        threadHandler(arg);
+    }
+    return 0;
+}
 
-        task->handler(loop->nThreads, threadIndex, loop->userData);
+void* TaskLoop::asyncThreadHandler(void* arg) {
+    TaskLoop* loop = (TaskLoop*)arg;
+    unsigned int doneCount = 0;
 
-        int currentCount = loop->doneThreadCount.fetch_add(1);
+    while (true) {
+        loop->wait(&loop->asyncQueuedCount.value, doneCount, &loop->asyncQueuedParkedThreadCount.value);
+        if (loop->stopped) {
+            break;
+        }
 
-        if (currentCount == loop->nThreads - 1) {
-            unsigned int currentTime = timeMs();
-            loop->executionTime[task->taskType] += currentTime - loop->lastTime;
-            loop->lastTime = currentTime;
+        // A run may execute only a part of the list, so async tasks are counted from the start of the run
+        unsigned int taskIndex = loop->asyncTaskIndexes[doneCount - loop->asyncRunBase];
+        loop->execute(taskIndex, 1, 0, loop->nThreads);
+        doneCount++;
 
-            loop->doneThreadCount.store(0);
-            loop->currentTaskIndex.fetch_add(1);
-        } else {
-            while (loop->currentTaskIndex.load() == currentTaskIndex) {
-                // NOP
-            }
+        loop->asyncDoneCount.value.store(doneCount);
+        if (loop->asyncDoneParkedThreadCount.value.load() > 0) {
+            parkWakeAll(&loop->asyncDoneCount.value);
         }
     }
+    return 0;
+}
 
-    // printf("@ Thread %d stopped at step %d\n", threadIndex, unsigned(loop->currentTaskIndex));
+void* TaskLoop::threadHandler(void* arg) {
+    TaskLoopThread* context = (TaskLoopThread*)arg;
+    TaskLoop* loop = context->loop;
+
+    // The next run may change nRunTasks before this thread leaves the last barrier
+    const unsigned int nRunTasks = loop->nRunTasks;
+    unsigned int taskIndex = loop->firstTaskIndex;
+    while (taskIndex < nRunTasks) {
+        const TaskLoopTask* task = &loop->tasks[taskIndex];
+        if (task->flags & TASK_LOOP_AWAIT) {
+            loop->await(taskIndex, context->threadIndex == 0);
+        }
+        loop->execute(taskIndex, loop->nThreads, context->threadIndex, context->threadIndex);
+        taskIndex++;
+
+        if (task->flags & TASK_LOOP_NO_BARRIER) {
+            continue;
+        }
+        // Serial tasks after the barrier are executed, and async tasks are queued, by the thread 0
+        loop->barrier(context, task, taskIndex);
+        while (taskIndex < nRunTasks && (loop->tasks[taskIndex].flags & (TASK_LOOP_SERIAL | TASK_LOOP_ASYNC))) {
+            taskIndex++;
+        }
+    }
     return 0;
 }
@@ -3,6 +3,7 @@
 
 #include <atomic>
 #include <cstdio>
+#include <vector>
 #include "common/pthread.h"
 
 #define ALLOC_MEMORY true
@@ -27,6 +28,7 @@ void* newMmapFileBuffer(unsigned int appInstanceId, size_t size);
 void freeMmapFileBuffer(void* addr);
 
 unsigned long timeMs();
+unsigned long long timeNs();
 unsigned int randomU32(unsigned long long *state);
 float randomF32(unsigned long long *state);
 long seekToEnd(FILE* file);
@@ -45,38 +47,150 @@ struct MmapFile {
 void openMmapFile(MmapFile* file, const char* path, size_t size);
 void closeMmapFile(MmapFile* file);
 
+// CPU affinity and NUMA placement are supported only on Linux, elsewhere these functions do nothing and return false
+
+// Parses a list like "0-7,16-23"
+bool parseCpuList(const char* list, std::vector<unsigned int>* cpus);
+// Returns 1 if the system doesn't expose NUMA nodes
+unsigned int getNumaNodeCount();
+bool getNumaNodeCpus(unsigned int node, std::vector<unsigned int>* cpus);
+// Returns -1 if the node is unknown
+int getCpuNumaNode(unsigned int cpu);
+// Pins the thread to the CPU, NULL means the calling thread
+bool pinThreadToCpu(dl_thread* thread, unsigned int cpu);
+// Moves pages fully covered by the buffer to the node
+bool bindBufferToNumaNode(void* buffer, size_t size, unsigned int node);
+// Spreads pages fully covered by the buffer across the nodes
+bool interleaveBufferOnNumaNodes(void* buffer, size_t size, const std::vector<unsigned int>& nodes);
+
 typedef void (TaskLoopHandler)(unsigned int nThreads, unsigned int threadIndex, void* userData);
 typedef struct {
     TaskLoopHandler* handler;
     unsigned int taskType;
+    unsigned int flags;
+    const char* name;
 } TaskLoopTask;
 
+// The next task is started without waiting for other threads
+#define TASK_LOOP_NO_BARRIER 0x1
+// The task is executed by a single thread (nThreads=1, threadIndex=0) before other threads leave the previous barrier
+#define TASK_LOOP_SERIAL 0x2
+// The task is queued after the previous barrier and executed by the I/O thread (nThreads=1, threadIndex=0),
+// other threads don't wait for it. Async tasks are executed in the order of the list
+#define TASK_LOOP_ASYNC 0x4
+// The task is started after all previous async tasks are finished
+#define TASK_LOOP_AWAIT 0x8
+// Bits above this mask are not used by TaskLoop, a caller may keep own flags there
+#define TASK_LOOP_FLAGS_MASK 0xFF
+
+#define TASK_LOOP_CACHE_LINE_SIZE 64
+#define TASK_LOOP_DEFAULT_SPIN_BUDGET 100000
+
+// An atomic counter that doesn't share a cache line with other counters
+struct TaskLoopCounter {
+    std::atomic_uint value;
+    char padding[TASK_LOOP_CACHE_LINE_SIZE - sizeof(std::atomic_uint)];
+};
+
+// Partial results of a reduction, each thread writes its own cache line. A task stores partials of its share,
+// any thread may combine them after the next barrier. Partials stay valid until a next reduction writes them.
+class TaskLoopReduction {
+private:
+    unsigned int stride;
+    char* buffer;
+    float* values;
+public:
+    unsigned int nThreads;
+    unsigned int nValues;
+
+    TaskLoopReduction(unsigned int nThreads, unsigned int nValues);
+    ~TaskLoopReduction();
+    float* get(unsigned int threadIndex);
+    float sum(unsigned int valueIndex);
+    float max(unsigned int valueIndex);
+};
+
 class TaskLoop;
 
+// Keeps timestamps (ns) of the last run, one slot per task and thread. The slot is 0 if the thread didn't execute the task.
+// The last slot of each task (index nThreads) belongs to the I/O thread.
+class TaskLoopProfiler {
+public:
+    unsigned int nThreads;
+    unsigned int nSlots;
+    unsigned int nTasks;
+    unsigned long long* beginTimes;
+    unsigned long long* endTimes;
+
+    TaskLoopProfiler(unsigned int nThreads, unsigned int nTasks);
+    ~TaskLoopProfiler();
+    void reset();
+};
+
 struct TaskLoopThread {
     unsigned int threadIndex;
-    unsigned int nTasks;
+    // The number of barriers the thread arrived at, the thread 0 polls it to release the barrier
+    TaskLoopCounter sense;
     dl_thread handler;
     TaskLoop* loop;
+    char padding[TASK_LOOP_CACHE_LINE_SIZE];
 };
 
 class TaskLoop {
 public:
     unsigned int nThreads;
     unsigned int nTasks;
+    // The number of tasks executed by the current run
+    unsigned int nRunTasks;
     unsigned int nTypes;
     TaskLoopTask* tasks;
     void* userData;
-    std::atomic_uint currentTaskIndex;
-    std::atomic_uint doneThreadCount;
+    unsigned int firstTaskIndex;
+    unsigned int spinBudget;
     unsigned int lastTime;
     unsigned int* executionTime;
     TaskLoopThread* threads;
+    TaskLoopProfiler* profiler;
+    bool stopped;
+
+    // Sense-reversing barrier executed after each task. Each thread signals its arrival in its own cache line,
+    // the thread 0 collects the arrivals and releases the others by barrierSense
+    TaskLoopCounter arrivalParkedThreadCount;
+    TaskLoopCounter barrierSense;
+    TaskLoopCounter barrierParkedThreadCount;
+    // Threads 1..nThreads-1 live as long as the loop, they wait for the next run here
+    TaskLoopCounter runIndex;
+    TaskLoopCounter runParkedThreadCount;
+    // Async tasks, the I/O thread exists only if the list contains any
+    unsigned int nAsyncTasks;
+    unsigned int* asyncTaskIndexes;
+    // The number of async tasks before each task, the last item is the number of all async tasks
+    unsigned int* asyncTaskCounts;
+    unsigned int asyncRunBase;
+    dl_thread asyncThread;
+    TaskLoopCounter asyncQueuedCount;
+    TaskLoopCounter asyncQueuedParkedThreadCount;
+    TaskLoopCounter asyncDoneCount;
+    TaskLoopCounter asyncDoneParkedThreadCount;
 
     TaskLoop(unsigned int nThreads, unsigned int nTasks, unsigned int nTypes, TaskLoopTask* tasks, void* userData);
     ~TaskLoop();
     void run();
+    // Executes only the first nRunTasks tasks, the last one of them must end with a barrier
+    void run(unsigned int nRunTasks);
+    // The number of spins before a waiting thread is parked, 0 means the thread parks immediately
+    void setSpinBudget(unsigned int spinBudget);
+    void setProfiler(TaskLoopProfiler* profiler);
+    // Pins thread i to cpus[i % cpus.size()], the thread 0 is the thread that calls run()
+    bool setCpus(const std::vector<unsigned int>& cpus);
+    void execute(unsigned int taskIndex, unsigned int nThreads, unsigned int threadIndex, unsigned int profiledThreadIndex);
+    void barrier(TaskLoopThread* context, const TaskLoopTask* task, unsigned int nextTaskIndex);
+    void runSerialTasks(unsigned int taskIndex, unsigned int threadIndex);
+    void await(unsigned int taskIndex, bool keepsTime);
+    void wait(std::atomic_uint* value, unsigned int oldValue, std::atomic_uint* parkedThreadCount);
     static void* threadHandler(void* args);
+    static void* poolThreadHandler(void* args);
+    static void* asyncThreadHandler(void* args);
 };
 
 #endif